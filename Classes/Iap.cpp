@@ -1,14 +1,11 @@
 #include "Iap.hpp"
-#include "scripting/js-bindings/manual/cocos2d_specifics.hpp"
-#include "scripting/js-bindings/manual/js_manual_conversions.h"
-#include "platform/android/jni/JniHelper.h"
-#include <jni.h>
-#include <sstream>
-#include "base/CCDirector.h"
-#include "base/CCScheduler.h"
-#include "utils/PluginUtils.h"
-
-static void cpp_requestResult(int callbackId, std::string errorStr, std::string resultStr);
+#include "IapBase64.h"
+#include "IapBilling.h"
+#include "IapSkuTable.h"
+#include "IapStats.h"
+#include "IapVerifier.h"
+#include "base/ccMacros.h"
+#include "IapJni.h"
 
 static void printLog(const char* str) {
     CCLOG("%s", str);
@@ -16,469 +13,294 @@ static void printLog(const char* str) {
 
 ///////////////////////////////////////
 //
-//  JNI Utils
+//  Android backend
 //
 ///////////////////////////////////////
 
-// call: boolean javaMethod()
-static bool callMethod0(const char* method) {
-    cocos2d::JniMethodInfo methodInfo;
-
-    if (! cocos2d::JniHelper::getStaticMethodInfo(methodInfo, "com/tapclap/inappbilling/InAppBillingPlugin", method, "()Z")) {
-        return false;
+class AndroidBackend : public iap::Backend
+{
+public:
+    AndroidBackend()
+    : _init("init")
+    , _getPurchases("getPurchases")
+    , _buy("buy")
+    , _subscribe("subscribe")
+    , _consumePurchase("consumePurchase")
+    , _consumePurchases("consumePurchases")
+    , _getAvailableProducts("getAvailableProducts")
+    , _addSkus("addSkus")
+    , _getProductDetailsByHandle("getProductDetailsByHandle")
+    , _setDebug("setDebug")
+    , _setBinaryResults("setBinaryResults")
+    , _syncedSkus(0)
+    {}
+
+    virtual bool init(const std::vector<std::string> &skus, bool internalValidation, int requestId) override {
+        return _init(skus, internalValidation, requestId);
     }
-    bool res = methodInfo.env->CallStaticBooleanMethod(methodInfo.classID, methodInfo.methodID);
-    methodInfo.env->DeleteLocalRef(methodInfo.classID);
-    return res;
-}
 
-// call: boolean javaMethod(final boolean param)
-static bool callMethod1(const char* method, bool param) {
-    cocos2d::JniMethodInfo methodInfo;
-
-    if (! cocos2d::JniHelper::getStaticMethodInfo(methodInfo, "com/tapclap/inappbilling/InAppBillingPlugin", method, "(Z)Z")) {
-        return false;
+    virtual bool getPurchases(int requestId) override {
+        return _getPurchases(requestId);
     }
-    bool res = methodInfo.env->CallStaticBooleanMethod(methodInfo.classID, methodInfo.methodID, param);
-    methodInfo.env->DeleteLocalRef(methodInfo.classID);
-    return true;
-}
-
-// call: boolean javaMethod(final int param)
-static bool callMethod1(const char* method, int callbackId) {
-    cocos2d::JniMethodInfo methodInfo;
 
-    if (! cocos2d::JniHelper::getStaticMethodInfo(methodInfo, "com/tapclap/inappbilling/InAppBillingPlugin", method, "(I)Z")) {
-        return false;
+    virtual bool buy(const std::string &sku, const std::string &payload, int requestId) override {
+        return _buy(sku, payload, requestId);
     }
-    bool res = methodInfo.env->CallStaticBooleanMethod(methodInfo.classID, methodInfo.methodID, callbackId);
-    methodInfo.env->DeleteLocalRef(methodInfo.classID);
-    return true;
-}
-
-// call: boolean javaMethod(final String param))
-static bool callMethod1(const char* method, const std::string &param) {
-    cocos2d::JniMethodInfo methodInfo;
 
-    if (! cocos2d::JniHelper::getStaticMethodInfo(methodInfo, "com/tapclap/inappbilling/InAppBillingPlugin", method, "(Ljava/lang/String;)Z")) {
-        return false;
+    virtual bool subscribe(const std::string &sku, const std::string &payload, const std::vector<std::string> &oldSkus, int requestId) override {
+        return _subscribe(sku, payload, oldSkus, requestId);
     }
-    jstring s = methodInfo.env->NewStringUTF(param.c_str());
-    bool res = methodInfo.env->CallStaticBooleanMethod(methodInfo.classID, methodInfo.methodID, s);
-    methodInfo.env->DeleteLocalRef(s);
-    methodInfo.env->DeleteLocalRef(methodInfo.classID);
-    return true;
-}
 
-// call: boolean javaMethod(final String[] param)
-static bool callMethod1(const char* method, const std::vector<std::string> &param) {
-    cocos2d::JniMethodInfo methodInfo;
-
-    if (! cocos2d::JniHelper::getStaticMethodInfo(methodInfo, "com/tapclap/inappbilling/InAppBillingPlugin", method, "([Ljava/lang/String;)Z")) {
-        return false;
-    }
-    jobjectArray args = 0;
-    args = methodInfo.env->NewObjectArray(param.size(), methodInfo.env->FindClass("java/lang/String"), 0);
-    for(int i=0; i<param.size(); i++) {
-        jstring s = methodInfo.env->NewStringUTF(param[i].c_str());
-        methodInfo.env->SetObjectArrayElement(args, i, s);
+    virtual bool consume(const std::string &sku, int requestId) override {
+        return _consumePurchase(sku, requestId);
     }
-    bool res = methodInfo.env->CallStaticBooleanMethod(methodInfo.classID, methodInfo.methodID, args);
-    methodInfo.env->DeleteLocalRef(args);
-    methodInfo.env->DeleteLocalRef(methodInfo.classID);
-    return true;
-}
 
-// call: boolean javaMethod(final String param1, final int param2)
-static bool callMethod2(const char* method, const std::string &param, int callbackId) {
-    cocos2d::JniMethodInfo methodInfo;
-
-    if (! cocos2d::JniHelper::getStaticMethodInfo(methodInfo, "com/tapclap/inappbilling/InAppBillingPlugin", method, "(Ljava/lang/String;I)Z")) {
-        return false;
+    virtual bool consumeMany(const std::vector<std::string> &skus, int requestId) override {
+        return _consumePurchases(skus, requestId);
     }
-    jstring s = methodInfo.env->NewStringUTF(param.c_str());
-    bool res = methodInfo.env->CallStaticBooleanMethod(methodInfo.classID, methodInfo.methodID, s, callbackId);
-    methodInfo.env->DeleteLocalRef(s);
-    methodInfo.env->DeleteLocalRef(methodInfo.classID);
-    return true;
-}
 
-// call: boolean javaMethod(final String[] param1, final int param2)
-static bool callMethod2(const char* method, const std::vector<std::string> &param, int callbackId) {
-    cocos2d::JniMethodInfo methodInfo;
-
-    if (! cocos2d::JniHelper::getStaticMethodInfo(methodInfo, "com/tapclap/inappbilling/InAppBillingPlugin", method, "([Ljava/lang/String;I)Z")) {
-        return false;
-    }
-    jobjectArray args = 0;
-    args = methodInfo.env->NewObjectArray(param.size(), methodInfo.env->FindClass("java/lang/String"), 0);
-    for(int i=0; i<param.size(); i++) {
-        jstring s = methodInfo.env->NewStringUTF(param[i].c_str());
-        methodInfo.env->SetObjectArrayElement(args, i, s);
+    virtual bool availableProducts(int requestId) override {
+        return _getAvailableProducts(requestId);
     }
-    bool res = methodInfo.env->CallStaticBooleanMethod(methodInfo.classID, methodInfo.methodID, args, callbackId);
-    methodInfo.env->DeleteLocalRef(args);
-    methodInfo.env->DeleteLocalRef(methodInfo.classID);
-    return true;
-}
 
-// call: boolean javaMethod(final String[] param1, final boolean param2, final int param3)
-static bool callMethod3(const char* method, const std::vector<std::string> &param1, bool param2, int callbackId) {
-    cocos2d::JniMethodInfo methodInfo;
+    virtual bool productDetails(const std::vector<int> &skus, int requestId) override {
+        return syncSkus() && _getProductDetailsByHandle(skus, requestId);
+    }
 
-    if (! cocos2d::JniHelper::getStaticMethodInfo(methodInfo, "com/tapclap/inappbilling/InAppBillingPlugin", method, "([Ljava/lang/String;ZI)Z")) {
-        return false;
+    // Google Play keeps owned items in the inventory, restoring is re-reading it
+    virtual bool restore(int requestId) override {
+        return _getPurchases(requestId);
     }
-    jobjectArray args = 0;
-    args = methodInfo.env->NewObjectArray(param1.size(), methodInfo.env->FindClass("java/lang/String"), 0);
-    for(int i=0; i<param1.size(); i++) {
-        jstring s = methodInfo.env->NewStringUTF(param1[i].c_str());
-        methodInfo.env->SetObjectArrayElement(args, i, s);
+
+    virtual bool setDebug(bool debug) override {
+        return _setDebug(debug);
     }
-    bool res = methodInfo.env->CallStaticBooleanMethod(methodInfo.classID, methodInfo.methodID, args, param2, callbackId);
-    methodInfo.env->DeleteLocalRef(args);
-    methodInfo.env->DeleteLocalRef(methodInfo.classID);
-    return true;
-}
 
-// call: boolean javaMethod(final String param1, final String param2, final int param3)
-static bool callMethod3(const char* method, const std::string &param1, const std::string &param2, int callbackId) {
-    cocos2d::JniMethodInfo methodInfo;
+    virtual bool setBinaryResults(bool enabled) override {
+        return _setBinaryResults(enabled);
+    }
 
-    if (! cocos2d::JniHelper::getStaticMethodInfo(methodInfo, "com/tapclap/inappbilling/InAppBillingPlugin", method, "(Ljava/lang/String;Ljava/lang/String;I)Z")) {
-        return false;
+private:
+    // boolean init(final String[] skus, final boolean internalValidation, final int callbackId)
+    iap::jni::StaticMethod<std::vector<std::string>, bool, int> _init;
+    // boolean getPurchases(final int callbackId)
+    iap::jni::StaticMethod<int> _getPurchases;
+    // boolean buy(final String sku, final String developerPayload, final int callbackId)
+    iap::jni::StaticMethod<std::string, std::string, int> _buy;
+    // boolean subscribe(final String sku, final String developerPayload, final String[] oldPurchasedSkus, final int callbackId)
+    iap::jni::StaticMethod<std::string, std::string, std::vector<std::string>, int> _subscribe;
+    // boolean consumePurchase(final String sku, final int callbackId)
+    iap::jni::StaticMethod<std::string, int> _consumePurchase;
+    // boolean consumePurchases(final String[] skus, final int callbackId)
+    iap::jni::StaticMethod<std::vector<std::string>, int> _consumePurchases;
+    // boolean getAvailableProducts(final int callbackId)
+    iap::jni::StaticMethod<int> _getAvailableProducts;
+    // boolean addSkus(final String[] skus)
+    iap::jni::StaticMethod<std::vector<std::string>> _addSkus;
+    // boolean getProductDetailsByHandle(final int[] handles, final int callbackId)
+    iap::jni::StaticMethod<std::vector<int>, int> _getProductDetailsByHandle;
+    // boolean setDebug(final boolean debug)
+    iap::jni::StaticMethod<bool> _setDebug;
+    // boolean setBinaryResults(final boolean enabled)
+    iap::jni::StaticMethod<bool> _setBinaryResults;
+
+    // Java keeps a copy of the SkuTable names; each name crosses once, the
+    // handles are resolved on the Java side
+    bool syncSkus() {
+        std::lock_guard<std::mutex> lock(_skuMutex);
+        iap::SkuTable *table = iap::SkuTable::getInstance();
+        int size = table->size();
+        if(_syncedSkus == size) {
+            return true;
+        }
+        std::vector<std::string> names;
+        names.reserve(size - _syncedSkus);
+        for(int handle = _syncedSkus; handle < size; handle++) {
+            names.push_back(table->name(handle));
+        }
+        if(!_addSkus(names)) {
+            return false;
+        }
+        _syncedSkus = size;
+        return true;
     }
-    jstring s1 = methodInfo.env->NewStringUTF(param1.c_str());
-    jstring s2 = methodInfo.env->NewStringUTF(param2.c_str());
-    bool res = methodInfo.env->CallStaticBooleanMethod(methodInfo.classID, methodInfo.methodID, s1, s2, callbackId);
-    methodInfo.env->DeleteLocalRef(s2);
-    methodInfo.env->DeleteLocalRef(s1);
-    methodInfo.env->DeleteLocalRef(methodInfo.classID);
-    return true;
-}
 
-// call: boolean javaMethod(final String param1, final String param2, final String[] param3, final int param4)
-static bool callMethod4(const char* method, const std::string &param1, const std::string &param2, const std::vector<std::string> &param3, int callbackId) {
-    cocos2d::JniMethodInfo methodInfo;
+    int _syncedSkus;
+    std::mutex _skuMutex;
+};
 
-    if (! cocos2d::JniHelper::getStaticMethodInfo(methodInfo, "com/tapclap/inappbilling/InAppBillingPlugin", method, "(Ljava/lang/String;Ljava/lang/String;[Ljava/lang/String;I)Z")) {
-        return false;
-    }
-    jstring s1 = methodInfo.env->NewStringUTF(param1.c_str());
-    jstring s2 = methodInfo.env->NewStringUTF(param2.c_str());
-    jobjectArray arr = 0;
-    arr = methodInfo.env->NewObjectArray(param3.size(), methodInfo.env->FindClass("java/lang/String"), 0);
-    for(int i=0; i<param3.size(); i++) {
-        jstring s = methodInfo.env->NewStringUTF(param3[i].c_str());
-        methodInfo.env->SetObjectArrayElement(arr, i, s);
-    }
-    bool res = methodInfo.env->CallStaticBooleanMethod(methodInfo.classID, methodInfo.methodID, s1, s2, arr, callbackId);
-    methodInfo.env->DeleteLocalRef(arr);
-    methodInfo.env->DeleteLocalRef(s2);
-    methodInfo.env->DeleteLocalRef(s1);
-    methodInfo.env->DeleteLocalRef(methodInfo.classID);
-    return true;
+iap::Backend* iap::createPlatformBackend()
+{
+    return new AndroidBackend();
 }
 
-
 ///////////////////////////////////////
 //
-//  JS API
+//  JNI to CPP tools
 //
 ///////////////////////////////////////
 
-static bool js_iap_init(JSContext *cx, uint32_t argc, jsval *vp)
+void Java_com_tapclap_inappbilling_InAppBillingPlugin_requestResult(JNIEnv* env, jobject thiz, jint callbackId, jstring err, jstring result)
 {
-    printLog("js_iap_init");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 4) {
-        // skus, internalValidation, callback, this
-        CallbackFrame *cb = new CallbackFrame(cx, obj, args.get(3), args.get(2));
-        std::vector<std::string> arg0;
-        JS::RootedValue arg0Val(cx, args.get(0));
-        bool ok = jsval_to_std_vector_string(cx, arg0Val, &arg0);
-        bool arg1 = JS::ToBoolean(JS::RootedValue(cx, args.get(1)));
-        if(callMethod3("init", arg0, arg1, cb->callbackId)) {
-            rec.rval().set(JSVAL_TRUE);
-        } else {
-            rec.rval().set(JSVAL_FALSE);
-        }
-        return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
+    iap::Stats::getInstance()->arrived(callbackId);
+    printLog("Get requestResult");
+    std::string s_err;
+    std::u16string s_res;
+    if(result != NULL) {
+        // single copy of the UTF-16 payload out of the Java heap, no UTF-8 round trip
+        jsize len = env->GetStringLength(result);
+        s_res.resize(len);
+        env->GetStringRegion(result, 0, len, reinterpret_cast<jchar*>(&s_res[0]));
     }
-}
-
-static bool js_iap_get_purchases(JSContext *cx, uint32_t argc, jsval *vp)
-{
-    printLog("js_iap_get_purchases");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 2) {
-        // callback, this
-        CallbackFrame *cb = new CallbackFrame(cx, obj, args.get(1), args.get(0));
-        if(callMethod1("getPurchases", cb->callbackId)) {
-            rec.rval().set(JSVAL_TRUE);
-        } else {
-            rec.rval().set(JSVAL_FALSE);
-        }
-        return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
+    if(err != NULL) {
+        const char* ch = env->GetStringUTFChars(err, NULL);
+        s_err = ch;
+        env->ReleaseStringUTFChars(err, ch);
     }
+
+    iap::Billing::getInstance()->requestResult(callbackId, std::move(s_err), std::move(s_res));
 }
 
-static bool js_iap_buy(JSContext *cx, uint32_t argc, jsval *vp)
+void Java_com_tapclap_inappbilling_InAppBillingPlugin_requestResultRecords(JNIEnv* env, jobject thiz, jint callbackId, jobject records)
 {
-    printLog("js_iap_buy");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 4) {
-        // sku, payload, callback, this
-        CallbackFrame *cb = new CallbackFrame(cx, obj, args.get(3), args.get(2));
-        std::string arg0;
-        JS::RootedValue arg0Val(cx, args.get(0));
-        bool ok = jsval_to_std_string(cx, arg0Val, &arg0);
-        std::string arg1;
-        JS::RootedValue arg1Val(cx, args.get(1));
-        ok &= jsval_to_std_string(cx, arg1Val, &arg1);
-        if(callMethod3("buy", arg0, arg1, cb->callbackId)) {
-            rec.rval().set(JSVAL_TRUE);
-        } else {
-            rec.rval().set(JSVAL_FALSE);
-        }
-        return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
+    iap::Stats::getInstance()->arrived(callbackId);
+    printLog("Get requestResultRecords");
+    // direct buffer written by RecordEncoder, copied once out of the Java heap
+    const uint8_t *data = static_cast<const uint8_t*>(env->GetDirectBufferAddress(records));
+    jlong size = env->GetDirectBufferCapacity(records);
+    if(data == NULL || size <= 0) {
+        iap::Billing::getInstance()->requestResult(callbackId, "Invalid result buffer", std::u16string());
+        return;
     }
+    iap::Billing::getInstance()->requestRecords(callbackId, std::vector<uint8_t>(data, data + size));
 }
 
-static bool js_iap_subscribe(JSContext *cx, uint32_t argc, jsval *vp)
+void Java_com_tapclap_inappbilling_InAppBillingPlugin_purchasesUpdated(JNIEnv* env, jobject thiz, jstring purchases)
 {
-    printLog("js_iap_subscribe");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 5) {
-        // sku, payload, oldPurchasedSkus, callback, this
-        CallbackFrame *cb = new CallbackFrame(cx, obj, args.get(4), args.get(3));
-        std::string arg0;
-        JS::RootedValue arg0Val(cx, args.get(0));
-        bool ok = jsval_to_std_string(cx, arg0Val, &arg0);
-        std::string arg1;
-        JS::RootedValue arg1Val(cx, args.get(1));
-        ok &= jsval_to_std_string(cx, arg1Val, &arg1);
-        std::vector<std::string> arg2;
-        JS::RootedValue arg2Val(cx, args.get(2));
-        ok &= jsval_to_std_vector_string(cx, arg2Val, &arg2);
-        if(callMethod4("subscribe", arg0, arg1, arg2, cb->callbackId)) {
-            rec.rval().set(JSVAL_TRUE);
-        } else {
-            rec.rval().set(JSVAL_FALSE);
-        }
-        return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
+    printLog("Get purchasesUpdated");
+    if(purchases == NULL) {
+        return;
     }
+    std::u16string s_purchases;
+    jsize len = env->GetStringLength(purchases);
+    s_purchases.resize(len);
+    env->GetStringRegion(purchases, 0, len, reinterpret_cast<jchar*>(&s_purchases[0]));
+    // a fresh inventory query lists everything owned
+    iap::Billing::getInstance()->purchasesUpdated(std::move(s_purchases), true);
 }
 
-static bool js_iap_consume(JSContext *cx, uint32_t argc, jsval *vp)
+void Java_com_tapclap_inappbilling_InAppBillingPlugin_productsUpdated(JNIEnv* env, jobject thiz, jstring products)
 {
-    printLog("js_iap_consume");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 3) {
-        // sku, callback, this
-        CallbackFrame *cb = new CallbackFrame(cx, obj, args.get(2), args.get(1));
-        std::string arg0;
-        JS::RootedValue arg0Val(cx, args.get(0));
-        bool ok = jsval_to_std_string(cx, arg0Val, &arg0);
-        if(callMethod2("consumePurchase", arg0, cb->callbackId)) {
-            rec.rval().set(JSVAL_TRUE);
-        } else {
-            rec.rval().set(JSVAL_FALSE);
-        }
-        return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
+    printLog("Get productsUpdated");
+    if(products == NULL) {
+        return;
     }
+    std::u16string s_products;
+    jsize len = env->GetStringLength(products);
+    s_products.resize(len);
+    env->GetStringRegion(products, 0, len, reinterpret_cast<jchar*>(&s_products[0]));
+    iap::Billing::getInstance()->productsUpdated(std::move(s_products));
 }
 
-static bool js_iap_available_products(JSContext *cx, uint32_t argc, jsval *vp)
+jbooleanArray Java_com_tapclap_util_NativeSecurity_nativeVerifyPurchases(JNIEnv* env, jclass clazz, jstring key, jobjectArray signedData, jobjectArray signatures)
 {
-    printLog("js_iap_available_products");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 2) {
-        // callback, this
-        CallbackFrame *cb = new CallbackFrame(cx, obj, args.get(1), args.get(0));
-        if(callMethod1("getAvailableProducts", cb->callbackId)) {
-            rec.rval().set(JSVAL_TRUE);
-        } else {
-            rec.rval().set(JSVAL_FALSE);
-        }
-        return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
+    iap::PurchaseVerifier *verifier = iap::PurchaseVerifier::getInstance();
+    const char *keyChars = env->GetStringUTFChars(key, NULL);
+    // parsed only when the key differs from the cached one
+    bool keyOk = verifier->setPublicKey(keyChars);
+    env->ReleaseStringUTFChars(key, keyChars);
+    if(!keyOk) {
+        return NULL;
     }
-}
 
-static bool js_iap_product_details(JSContext *cx, uint32_t argc, jsval *vp)
-{
-    printLog("js_iap_product_details");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 3) {
-        // skus, callback, this
-        CallbackFrame *cb = new CallbackFrame(cx, obj, args.get(2), args.get(1));
-        std::vector<std::string> arg0;
-        JS::RootedValue arg0Val(cx, args.get(0));
-        bool ok = jsval_to_std_vector_string(cx, arg0Val, &arg0);
-        if(callMethod2("getProductDetails", arg0, cb->callbackId)) {
-            rec.rval().set(JSVAL_TRUE);
-        } else {
-            rec.rval().set(JSVAL_FALSE);
+    jsize count = env->GetArrayLength(signedData);
+    std::vector<iap::SignedPurchase> purchases(count);
+    for(jsize i = 0; i < count; i++) {
+        jbyteArray data = (jbyteArray)env->GetObjectArrayElement(signedData, i);
+        jstring signature = (jstring)env->GetObjectArrayElement(signatures, i);
+        if(data != NULL) {
+            jsize size = env->GetArrayLength(data);
+            purchases[i].data.resize(size);
+            env->GetByteArrayRegion(data, 0, size, reinterpret_cast<jbyte*>(&purchases[i].data[0]));
+            env->DeleteLocalRef(data);
+        }
+        if(signature != NULL) {
+            const char *chars = env->GetStringUTFChars(signature, NULL);
+            purchases[i].signature = chars;
+            env->ReleaseStringUTFChars(signature, chars);
+            env->DeleteLocalRef(signature);
         }
-        return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
     }
-}
 
-static bool js_iap_restore(JSContext *cx, uint32_t argc, jsval *vp)
-{
-    printLog("js_iap_restore");
-    return true;
+    std::vector<uint8_t> results;
+    verifier->verifyBatch(purchases, results);
+
+    jbooleanArray out = env->NewBooleanArray(count);
+    if(out != NULL && count > 0) {
+        env->SetBooleanArrayRegion(out, 0, count, reinterpret_cast<const jboolean*>(results.data()));
+    }
+    return out;
 }
 
-static bool js_iap_debug(JSContext *cx, uint32_t argc, jsval *vp)
+// off and len come from Java: check them against the array before any
+// native access, throwing IllegalArgumentException like Arrays does
+static bool checkArrayRange(JNIEnv* env, jbyteArray source, jint off, jint len)
 {
-    printLog("js_iap_debug");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 1) {
-        bool debug = JS::ToBoolean(JS::RootedValue(cx, args.get(0)));
-        if(callMethod1("setDebug", debug)) {
-            rec.rval().set(JSVAL_TRUE);
-        } else {
-            rec.rval().set(JSVAL_FALSE);
-        }
+    if(source != NULL && off >= 0 && len >= 0 && (jlong)off + len <= env->GetArrayLength(source)) {
         return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
     }
+    jclass exception = env->FindClass("java/lang/IllegalArgumentException");
+    if(exception != NULL) {
+        env->ThrowNew(exception, "Invalid array range");
+        env->DeleteLocalRef(exception);
+    }
+    return false;
 }
 
-///////////////////////////////////////
-//
-//  Register JS API
-//
-///////////////////////////////////////
-
-void register_all_iap_framework(JSContext* cx, JS::HandleObject obj) {
-    printLog("[Iap] register js interface");
-    JS::RootedObject ns(cx);
-    get_or_create_js_obj(cx, obj, "iap", &ns);
-
-    // initialize plugin, args: array of skus, internal validation flag (bool), callback func, this pointer
-    JS_DefineFunction(cx, ns, "init", js_iap_init, 4, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-    
-    // get purchased items, args: callback func, this pointer
-    JS_DefineFunction(cx, ns, "get_purchases", js_iap_get_purchases, 2, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-    
-    // purchase an item, args: sku, payload, callback func, this pointer
-    JS_DefineFunction(cx, ns, "buy", js_iap_buy, 4, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-    
-    // subscribe, args: sku, payload, oldPurchasedSkus (array of strings), callback func, this pointer
-    JS_DefineFunction(cx, ns, "subscribe", js_iap_subscribe, 5, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-
-    // consume purchased item, args: sku, callback func, this pointer
-    JS_DefineFunction(cx, ns, "consume", js_iap_consume, 3, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-    
-    // return available products for purchasing, args: callback func, this pointer
-    JS_DefineFunction(cx, ns, "available_products", js_iap_available_products, 2, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-    
-    // return product details, args: sku, callback func, this pointer
-    JS_DefineFunction(cx, ns, "product_details", js_iap_product_details, 3, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-
-    // stub for restore purchasings (will be implemented for iOS)
-    JS_DefineFunction(cx, ns, "restore", js_iap_restore, 0, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-
-    // enable/disable debugging logs
-    JS_DefineFunction(cx, ns, "set_debug", js_iap_debug, 1, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-}
-
-///////////////////////////////////////
-//
-//  JNI to CPP tools
-//
-///////////////////////////////////////
-
-static void cpp_requestResult(int callbackId, std::string errorStr, std::string resultStr)
+jbyteArray Java_com_tapclap_util_Base64_nativeEncode(JNIEnv* env, jclass clazz, jbyteArray source, jint off, jint len)
 {
-    cocos2d::Director::getInstance()->getScheduler()->performFunctionInCocosThread([callbackId, errorStr, resultStr] {
-            CallbackFrame *cb = CallbackFrame::getById(callbackId);
-            if(!cb) {
-                printLog("requestResult: callbackId not found!");
-                return;
-            }
-
-            JSAutoRequest rq(cb->cx);
-            JSAutoCompartment ac(cb->cx, cb->_ctxObject.ref());
-
-            JS::AutoValueVector valArr(cb->cx);
-            if(resultStr.size() > 0) {
-                valArr.append(JSVAL_NULL);
-                Status err;
-                JS::RootedValue rval(cb->cx);
-                std::wstring attrsW = wstring_from_utf8(std::string(resultStr), &err);
-                utf16string string(attrsW.begin(), attrsW.end());
-                if(!JS_ParseJSON(cb->cx, reinterpret_cast<const char16_t*>(string.c_str()), (uint32_t)string.size(), &rval))
-                    printLog("JSON Error");
-                valArr.append(rval);
-            } else {
-                valArr.append(std_string_to_jsval(cb->cx, errorStr));
-                valArr.append(JSVAL_NULL);
-            };
-            JS::HandleValueArray funcArgs = JS::HandleValueArray::fromMarkedLocation(2, valArr.begin());
-            cb->call(funcArgs);
-            printLog("requestResult finished");
-            delete cb;
-        });
+    if(!checkArrayRange(env, source, off, len)) {
+        return NULL;
+    }
+    jbyteArray out = env->NewByteArray((jsize)iap::base64EncodedSize(len));
+    if(out == NULL) {
+        return NULL;
+    }
+    // pinned, not copied; no JNI calls until both are released
+    uint8_t *data = (uint8_t*)env->GetPrimitiveArrayCritical(source, NULL);
+    char *text = (char*)env->GetPrimitiveArrayCritical(out, NULL);
+    if(data && text) {
+        iap::base64Encode(data + off, len, text);
+    }
+    if(text) env->ReleasePrimitiveArrayCritical(out, text, 0);
+    if(data) env->ReleasePrimitiveArrayCritical(source, data, JNI_ABORT);
+    if(!data || !text) {
+        // pinning failed with an OutOfMemoryError pending
+        env->DeleteLocalRef(out);
+        return NULL;
+    }
+    return out;
 }
 
-void Java_com_tapclap_inappbilling_InAppBillingPlugin_requestResult(JNIEnv* env, jobject thiz, jint callbackId, jstring err, jstring result)
+jbyteArray Java_com_tapclap_util_Base64_nativeDecode(JNIEnv* env, jclass clazz, jbyteArray source, jint off, jint len)
 {
-    printLog("Get requestResult");
-    std::string s_err;
-    std::string s_res;
-    if(result != NULL) {
-        const char* ch = env->GetStringUTFChars(result, NULL);
-        s_res = ch;
-        env->ReleaseStringUTFChars(result, ch);
+    if(!checkArrayRange(env, source, off, len)) {
+        return NULL;
     }
-    if(err != NULL) {
-        const char* ch = env->GetStringUTFChars(err, NULL);
-        s_err = ch;
-        env->ReleaseStringUTFChars(err, ch);
+    std::vector<uint8_t> buffer(iap::base64DecodedMaxSize(len));
+    size_t size = 0;
+    char *text = (char*)env->GetPrimitiveArrayCritical(source, NULL);
+    if(!text) {
+        return NULL;
     }
-
-    cpp_requestResult(callbackId, s_err, s_res);
+    bool ok = iap::base64Decode(text + off, len, buffer.data(), size);
+    env->ReleasePrimitiveArrayCritical(source, text, JNI_ABORT);
+    if(!ok) {
+        return NULL;
+    }
+    jbyteArray out = env->NewByteArray((jsize)size);
+    if(out != NULL) {
+        env->SetByteArrayRegion(out, 0, (jsize)size, reinterpret_cast<const jbyte*>(buffer.data()));
+    }
+    return out;
 }
-
@@ -13,6 +13,12 @@ void register_all_iap_framework(JSContext* cx, JS::HandleObject obj);
 extern "C"
 {
     void Java_com_tapclap_inappbilling_InAppBillingPlugin_requestResult(JNIEnv* env, jobject thiz, jint callbackId, jstring err, jstring result);
+    void Java_com_tapclap_inappbilling_InAppBillingPlugin_requestResultRecords(JNIEnv* env, jobject thiz, jint callbackId, jobject records);
+    void Java_com_tapclap_inappbilling_InAppBillingPlugin_purchasesUpdated(JNIEnv* env, jobject thiz, jstring purchases);
+    void Java_com_tapclap_inappbilling_InAppBillingPlugin_productsUpdated(JNIEnv* env, jobject thiz, jstring products);
+    jbooleanArray Java_com_tapclap_util_NativeSecurity_nativeVerifyPurchases(JNIEnv* env, jclass clazz, jstring key, jobjectArray signedData, jobjectArray signatures);
+    jbyteArray Java_com_tapclap_util_Base64_nativeEncode(JNIEnv* env, jclass clazz, jbyteArray source, jint off, jint len);
+    jbyteArray Java_com_tapclap_util_Base64_nativeDecode(JNIEnv* env, jclass clazz, jbyteArray source, jint off, jint len);
 };
 
 #endif /* Iap_h */
@@ -1,467 +1,424 @@
 #import "Iap.h"
-#include "scripting/js-bindings/manual/cocos2d_specifics.hpp"
-#include "scripting/js-bindings/manual/js_manual_conversions.h"
-#include <sstream>
-#include "base/CCDirector.h"
-#include "base/CCScheduler.h"
-#include "utils/PluginUtils.h"
+#include "IapBilling.h"
+#include "IapBlobCache.h"
+#include "IapContentInstaller.h"
+#include "IapModel.h"
+#include "IapRecords.h"
+#include "IapSkuTable.h"
+#include "IapStats.h"
+#include "base/ccMacros.h"
 #import "../proj.ios_mac/ios/InAppPurchase.h"
-#include "jsapi.h"
+#import <objc/runtime.h>
+#include <mutex>
 
 
 static InAppPurchase *inAppPurchase = nil;
-static void cpp_requestResult(int callbackId, std::string errorStr, std::string resultStr);
+static bool binaryResults = false;
 
 static void printLog(const char* str) {
     CCLOG("%s", str);
 }
 
-// FROM JS VAL
+// FROM STD TYPES
 
-static NSArray<NSString*>* jsval_to_array(JSContext* cx, JS::HandleValue v) {
-    JS::RootedObject jsobj(cx);
-    bool ok = JS_ValueToObject( cx, v, &jsobj );
-    JSB_PRECONDITION2( ok, cx, nil, "Error converting value to object");
-    JSB_PRECONDITION2( jsobj && JS_IsArrayObject( cx, jsobj),  cx, nil, "Object must be an array");
+static NSArray<NSString*>* vector_to_array(const std::vector<std::string> &v)
+{
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity:v.size()];
+    for(const std::string &str : v) {
+        [result addObject:[NSString stringWithUTF8String:str.c_str()]];
+    }
+    return result;
+}
 
-    uint32_t len = 0;
-    JS_GetArrayLength(cx, jsobj, &len);
+static NSString* std_string_to_string(const std::string &str)
+{
+    return [NSString stringWithUTF8String:str.c_str()];
+}
 
-    NSMutableArray *result = [NSMutableArray new];
-    for (uint32_t i=0; i < len; i++) {
-        JS::RootedValue elt(cx);
-        if (JS_GetElement(cx, jsobj, i, &elt)) {
+// one NSString per SkuTable handle, converted the first time it is needed
+static NSMutableArray<NSString*> *skuNames = nil;
+static std::mutex skuNamesMutex;
 
-            if (elt.isString()) {
-                JSStringWrapper str(elt.toString(), cx);
-                [result addObject:[NSString stringWithUTF8String:str.get()]];
-            }
-        }
+static NSArray<NSString*>* handles_to_array(const std::vector<int> &handles)
+{
+    std::lock_guard<std::mutex> lock(skuNamesMutex);
+    iap::SkuTable *table = iap::SkuTable::getInstance();
+    if(skuNames == nil) {
+        skuNames = [NSMutableArray new];
+    }
+    for(int handle = (int)skuNames.count; handle < table->size(); handle++) {
+        [skuNames addObject:std_string_to_string(table->name(handle))];
+    }
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity:handles.size()];
+    for(int handle : handles) {
+        // a handle the table never issued would raise NSRangeException
+        if(handle >= 0 && handle < (int)skuNames.count)
+            [result addObject:skuNames[handle]];
     }
-
     return result;
 }
 
-static NSString* jsval_to_string(JSContext* cx, JS::HandleValue v)
+// TO JSON
+
+static std::string object_to_json(id object)
 {
-    if (v.isNullOrUndefined())
-    {
-        return nil;
-    }
-    if (v.isString()) {
-        JSStringWrapper valueWrapper(v.toString(), cx);
-        return [NSString stringWithUTF8String:valueWrapper.get()];
-    } else {
-        return nil;
+    if(object == nil || ![NSJSONSerialization isValidJSONObject:object]) {
+        if(object != nil) NSLog(@"Error: can't serialize %@", object);
+        return "null";
     }
+    NSData *data = [NSJSONSerialization dataWithJSONObject:object options:0 error:nil];
+    return std::string((const char*)data.bytes, data.length);
 }
 
-static NSDictionary* jsval_to_dictionary(JSContext* cx, JS::HandleValue v)
+// TO RECORDS
+
+static bool dictionary_to_record(NSDictionary *dict, iap::RecordWriter &writer)
 {
-    if (v.isNullOrUndefined())
-    {
-        return nil;
-    }
-    
-    JS::RootedObject tmp(cx, v.toObjectOrNull());
-    if (!tmp)
-    {
-        CCLOG("%s", "jsval_to_dictionary: the jsval is not an object.");
-        return nil;
-    }
-    NSMutableDictionary *result = [NSMutableDictionary new];
-    
-    JS::RootedObject it(cx, JS_NewPropertyIterator(cx, tmp));
-    
-    while (true)
-    {
-        JS::RootedId idp(cx);
-        JS::RootedValue key(cx);
-        if (! JS_NextProperty(cx, it, idp.address()) || ! JS_IdToValue(cx, idp, &key))
-        {
-            return nil; // error
-        }
-        
-        if (key.isNullOrUndefined())
-        {
-            break; // end of iteration
+    std::u16string chars;
+    writer.beginRecord();
+    for(id key in dict) {
+        if(![key isKindOfClass:[NSString class]]) {
+            return false;
         }
-        
-        if (!key.isString())
-        {
-            continue; // only take account of string key
-        }
-        
-        JSStringWrapper keyWrapper(key.toString(), cx);
-        
-        JS::RootedValue value(cx);
-        JS_GetPropertyById(cx, tmp, idp, &value);
-        NSString *keyString = [NSString stringWithUTF8String:keyWrapper.get()];
-        if (value.isString()) {
-            JSStringWrapper valueWrapper(value.toString(), cx);
-            result[keyString] = [NSString stringWithUTF8String:valueWrapper.get()];
-        } else if(value.isBoolean()) {
-            result[keyString] = [NSNumber numberWithBool:value.get().toBoolean()];
-        } else if(value.isDouble()) {
-            result[keyString] = [NSNumber numberWithDouble:value.get().toDouble()];
-        } else if(value.isInt32()) {
-            result[keyString] = [NSNumber numberWithInteger:value.get().toInt32()];
+        std::string name = [key UTF8String];
+        id value = dict[key];
+        if([value isKindOfClass:[NSString class]]) {
+            NSString *str = value;
+            chars.resize(str.length);
+            [str getCharacters:(unichar*)&chars[0] range:NSMakeRange(0, str.length)];
+            writer.addString(name, chars.data(), chars.size());
+        } else if([value isKindOfClass:[NSNumber class]]) {
+            NSNumber *number = value;
+            const char *type = number.objCType;
+            if(CFGetTypeID((__bridge CFTypeRef)number) == CFBooleanGetTypeID()) {
+                writer.addBool(name, number.boolValue);
+            } else if(type[0] == 'd' || type[0] == 'f') {
+                writer.addNumber(name, number.doubleValue);
+            } else {
+                writer.addInteger(name, number.longLongValue);
+            }
+        } else if(value == [NSNull null]) {
+            writer.addNull(name);
         } else {
-            CCASSERT(false, "jsval_to_dictionary: not supported map type");
+            // nested objects stay JSON
+            return false;
         }
     }
-    
-    return result;
+    writer.endRecord();
+    return true;
 }
 
-// TO JS VAL
-
-static jsval object_to_jsval(JSContext *cx, id object);
+// flat dictionary or array of flat dictionaries
+static bool object_to_records(id object, std::vector<uint8_t> &records)
+{
+    if([object isKindOfClass:[NSDictionary class]]) {
+        iap::RecordWriter writer(false);
+        if(!dictionary_to_record(object, writer))
+            return false;
+        records = writer.finish();
+        return true;
+    }
+    if([object isKindOfClass:[NSArray class]]) {
+        iap::RecordWriter writer(true);
+        for(id item in (NSArray*)object) {
+            if(![item isKindOfClass:[NSDictionary class]] || !dictionary_to_record(item, writer))
+                return false;
+        }
+        records = writer.finish();
+        return true;
+    }
+    return false;
+}
 
-static jsval string_to_jsval(JSContext *cx, NSString* string)
+static void callback(int callbackId, id result, NSString* errorStr)
 {
-    return std_string_to_jsval(cx, std::string([string UTF8String]));
+    // conversion below counts as crossing time
+    iap::Stats::getInstance()->arrived(callbackId);
+    std::vector<uint8_t> records;
+    if(errorStr != nil && errorStr.length > 0) {
+        iap::Billing::getInstance()->requestResult(callbackId, [errorStr UTF8String], "");
+    } else if(binaryResults && object_to_records(result, records)) {
+        iap::Billing::getInstance()->requestRecords(callbackId, std::move(records));
+    } else {
+        iap::Billing::getInstance()->requestResult(callbackId, "", object_to_json(result));
+    }
 }
 
-static jsval number_to_jsval(JSContext *cx, NSNumber* number)
+// RECEIPT
+
+// keeps a Blob alive for as long as the NSString that wraps its bytes
+@interface IapBlobHolder : NSObject {
+@public
+    iap::Blob blob;
+}
+@end
+
+@implementation IapBlobHolder
+@end
+
+static NSString* app_store_receipt_path()
 {
-    return DOUBLE_TO_JSVAL(number.doubleValue);
+    NSURL *url = [NSBundle mainBundle].appStoreReceiptURL;
+    return url != nil ? url.path : nil;
 }
 
-static jsval array_to_jsval(JSContext *cx, NSArray* array)
+// Base64 receipt from the blob cache: encoded again only when the file
+// changes, and every result until then shares one NSString over the
+// cached bytes instead of a fresh read and encode per callback.
+static NSString* app_store_receipt()
 {
-    JS::RootedObject jsretArr(cx, JS_NewArrayObject(cx, array.count));
-    
-    int i = 0;
-    for(id val in array) {
-        JS::RootedValue arrElement(cx);
-        arrElement = object_to_jsval(cx, val);
-        if (!JS_SetElement(cx, jsretArr, i, arrElement)) {
-            break;
-        }
-        ++i;
+    static iap::Blob current;
+    static NSString *receipt = @"";
+    NSString *path = app_store_receipt_path();
+    if(path == nil) {
+        return @"";
     }
-    return OBJECT_TO_JSVAL(jsretArr);
+    iap::Blob blob = iap::BlobCache::getInstance()->encodedFile(path.UTF8String);
+    if(blob != current) {
+        current = blob;
+        IapBlobHolder *holder = [IapBlobHolder new];
+        holder->blob = blob;
+        receipt = [[NSString alloc] initWithBytesNoCopy:(void*)blob->data() length:blob->size() encoding:NSASCIIStringEncoding freeWhenDone:NO];
+        objc_setAssociatedObject(receipt, (__bridge const void*)[IapBlobHolder class], holder, OBJC_ASSOCIATION_RETAIN);
+    }
+    return receipt;
 }
 
-static jsval dictionary_to_jsval(JSContext* cx, NSDictionary *dict)
+static NSDictionary* transaction_to_dictionary(SKPaymentTransaction* transaction)
 {
-    JS::RootedObject proto(cx);
-    JS::RootedObject parent(cx);
-    JS::RootedObject jsRet(cx, JS_NewObject(cx, NULL, proto, parent));
-
-    for(NSString* key in dict.allKeys) {
-        JS::RootedValue element(cx);
-        
-        id obj = dict[key];
-        element = object_to_jsval(cx, obj);
-        JS_SetProperty(cx, jsRet, [key UTF8String], element);
+    // the id InAppPurchase keeps unfinished transactions under, so the
+    // journal, get_purchases and consume agree on it
+    NSString* transactionId = transaction.transactionIdentifier ?: transaction.originalTransaction.transactionIdentifier;
+    NSMutableDictionary *purchase = [@{
+             @(iap::KEY_PRODUCT_ID): transaction.payment.productIdentifier,
+             @(iap::KEY_TRANSACTION_ID): transactionId ?: @"",
+             @"receipt": app_store_receipt(),
+             @"signature": @""
+             } mutableCopy];
+    // restored and renewed purchases: the purchase they continue
+    NSString* originalId = transaction.originalTransaction.transactionIdentifier;
+    if(originalId) {
+        purchase[@(iap::KEY_ORIGINAL_TRANSACTION_ID)] = originalId;
     }
-    return OBJECT_TO_JSVAL(jsRet);
+    return purchase;
 }
 
-static jsval object_to_jsval(JSContext *cx, id object)
+// the product shape of IapModel.h, prices in micros like Google Play's
+static NSDictionary* product_to_dictionary(SKProduct* product)
 {
-    if([object isKindOfClass:NSString.class]) {
-        return string_to_jsval(cx, object);
-    } else if([object isKindOfClass:NSDictionary.class]) {
-        return dictionary_to_jsval(cx, object);
-    } else if([object isKindOfClass:NSArray.class]) {
-        return array_to_jsval(cx, object);
-    } else if([object isKindOfClass:NSNumber.class]) {
-        return number_to_jsval(cx, object);
-    } else if([object isKindOfClass:NSNull.class]) {
-        return JSVAL_NULL;
-    } else {
-        NSLog(@"Error: unknown value class %@", object);
-        return JSVAL_NULL;
-    }
+    NSDecimalNumber *micros = [product.price decimalNumberByMultiplyingByPowerOf10:6];
+    NSString *currency = [product.priceLocale objectForKey:NSLocaleCurrencyCode];
+    return @{
+             @(iap::KEY_PRODUCT_ID): product.productIdentifier,
+             @(iap::KEY_TYPE): @"",
+             @(iap::KEY_PRICE): [NSString stringWithFormat:@"%@", product.price],
+             @(iap::KEY_PRICE_MICROS): @(micros.longLongValue),
+             @(iap::KEY_TITLE): product.localizedTitle,
+             @"name": product.localizedTitle,
+             @(iap::KEY_DESCRIPTION): product.localizedDescription,
+             @(iap::KEY_CURRENCY): product.priceLocale.currencySymbol ?: @"",
+             @(iap::KEY_CURRENCY_ISO): currency ?: @""
+             };
 }
 
-static void callback(int callbackId, id result, NSString* errorStr)
+// hosted content the way copyDownloadToDocuments lays it out: Contents/
+// into Documents, or the ContentInfo.plist "Folder", only its "Files" if set
+static iap::ContentPackage download_to_package(SKDownload* download)
 {
-    CallbackFrame *cb = CallbackFrame::getById(callbackId);
-    if(!cb) {
-        printLog("requestResult: callbackId not found!");
-        return;
+    NSString *source = [download.contentURL relativePath];
+    NSDictionary *info = [NSDictionary dictionaryWithContentsOfFile:[source stringByAppendingPathComponent:@"ContentInfo.plist"]];
+    NSString *target = [FileUtility getDocumentPath];
+    if([info objectForKey:@"Folder"]) {
+        target = [target stringByAppendingPathComponent:[info objectForKey:@"Folder"]];
     }
+    iap::ContentPackage package;
+    package.id = [download.transaction.payment.productIdentifier UTF8String];
+    package.source = [[source stringByAppendingPathComponent:@"Contents"] UTF8String];
+    package.target = [target UTF8String];
+    for(NSString *file in [info objectForKey:@"Files"]) {
+        iap::ContentFile entry;
+        entry.path = [file UTF8String];
+        entry.targetPath = [[file lastPathComponent] UTF8String];
+        package.files.push_back(entry);
+    }
+    return package;
+}
 
-    JSAutoRequest rq(cb->cx);
-    JSAutoCompartment ac(cb->cx, cb->_ctxObject.ref());
-
-    JS::AutoValueVector valArr(cb->cx);
-    if(errorStr != nil && errorStr.length > 0) {
-        valArr.append(string_to_jsval(cb->cx, errorStr));
-        valArr.append(JSVAL_NULL);
-    } else {
-        valArr.append(JSVAL_NULL);
-        jsval js_result = object_to_jsval(cb->cx, result);
-        valArr.append(js_result);
-    };
-
-    JS::HandleValueArray funcArgs = JS::HandleValueArray::fromMarkedLocation(2, valArr.begin());
-    cb->call(funcArgs);
-    printLog("requestResult finished");
-    delete cb;
+static void download_progress(SKDownload* download)
+{
+    iap::ContentProgress progress;
+    progress.id = [download.transaction.payment.productIdentifier UTF8String];
+    switch(download.downloadState) {
+        case SKDownloadStateFailed:
+        case SKDownloadStateCancelled:
+            progress.state = iap::ContentProgress::STATE_FAILED;
+            progress.error = download.error ? [download.error.localizedDescription UTF8String] : "Download cancelled";
+            break;
+        case SKDownloadStateFinished:
+            // the installer reports from here on
+            return;
+        default:
+            progress.state = iap::ContentProgress::STATE_DOWNLOADING;
+            break;
+    }
+    progress.totalBytes = download.expectedContentLength > 0 ? download.expectedContentLength : 0;
+    progress.bytes = (uint64_t)(progress.totalBytes * download.progress);
+    iap::Billing::getInstance()->contentUpdated(progress.toJson());
 }
 
 ///////////////////////////////////////
 //
-//  JS API
+//  iOS backend
 //
 ///////////////////////////////////////
 
-static bool js_iap_init(JSContext *cx, uint32_t argc, jsval *vp)
+class IosBackend : public iap::Backend
 {
-    printLog("js_iap_init");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 4) {
-        // skus, internalValidation, callback, this
+public:
+    virtual bool init(const std::vector<std::string> &skus, bool internalValidation, int requestId) override {
         inAppPurchase = [InAppPurchase new];
-
-        CallbackFrame *cb = new CallbackFrame(cx, obj, args.get(3), args.get(2));
-        JS::RootedValue arg0Val(cx, args.get(0));
-        NSArray *skus = jsval_to_array(cx, arg0Val);
-        //bool arg1 = JS::ToBoolean(JS::RootedValue(cx, args.get(1)));
-        if([inAppPurchase setup]) {
-            rec.rval().set(JSVAL_TRUE);
-            [inAppPurchase load:skus withCallback:^(NSArray* result, NSError* err) {
-                    callback(cb->callbackId, result, err.localizedDescription);
-                }];
-        } else {
-            rec.rval().set(JSVAL_FALSE);
+        if(![inAppPurchase setup]) {
+            return false;
         }
+        // updatedTransactions pushes straight into the native inventory
+        inAppPurchase.updatedTransactionCallback = ^(SKPaymentTransaction* transaction) {
+            iap::Billing::getInstance()->purchasesUpdated(iap::utf8ToUtf16(object_to_json(transaction_to_dictionary(transaction))), false);
+        };
+        inAppPurchase.updatedDownloadsCallback = ^(SKDownload* download) {
+            download_progress(download);
+        };
+        // hosted content is moved into place on the installer thread, not
+        // copied on the main thread; the transaction finishes only once it is
+        // installed. A failed install has already sent a "failed" content
+        // progress event and leaves the transaction unfinished, so StoreKit
+        // delivers it again and the download can be retried.
+        inAppPurchase.installDownloadCallback = ^(SKDownload* download, void(^finish)(void)) {
+            iap::ContentInstaller::getInstance()->installAsync(download_to_package(download),
+                [finish](const iap::ContentPackage &, const iap::ContentInstaller::Report &report) {
+                    if(!report.ok) {
+                        return;
+                    }
+                    for(const std::string &path : report.installed) {
+                        NSURL *url = [NSURL fileURLWithPath:std_string_to_string(path)];
+                        [url setResourceValue:@YES forKey:NSURLIsExcludedFromBackupKey error:nil];
+                    }
+                    dispatch_async(dispatch_get_main_queue(), finish);
+                });
+        };
+        [inAppPurchase load:vector_to_array(skus) withCallback:^(NSArray* result, NSError* err) {
+                callback(requestId, result, err.localizedDescription);
+            }];
         return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
     }
-}
 
-static bool js_iap_get_purchases(JSContext *cx, uint32_t argc, jsval *vp)
-{
-    printLog("js_iap_get_purchases");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 2) {
-        // callback, this
-        CallbackFrame *cb = new CallbackFrame(cx, obj, args.get(1), args.get(0));
+    virtual bool getPurchases(int requestId) override {
         NSArray<NSString*>* ids = [inAppPurchase getUnfinishedTransactions];
-        callback(cb->callbackId, ids, nil);
-        rec.rval().set(JSVAL_TRUE);
+        callback(requestId, ids, nil);
         return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
     }
-}
 
-static bool js_iap_buy(JSContext *cx, uint32_t argc, jsval *vp)
-{
-    printLog("js_iap_buy");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 4) {
-        // sku, payload, callback, this
-        CallbackFrame *cb = new CallbackFrame(cx, obj, args.get(3), args.get(2));
-        NSString *sku = jsval_to_string(cx, args.get(0));
-        [inAppPurchase purchase:sku withCallback:^(SKPaymentTransaction* transaction, NSError* err) {
-            NSDictionary *result = @{
-                                     @"productId": transaction.payment.productIdentifier,
-                                     @"receipt": inAppPurchase.appStoreReceipt,
-                                     @"signature": @""
-                                     };
-            callback(cb->callbackId, result, err.localizedDescription);
-        }];
-        rec.rval().set(JSVAL_TRUE);
+    virtual bool buy(const std::string &sku, const std::string &payload, int requestId) override {
+        [inAppPurchase purchase:std_string_to_string(sku) withCallback:^(SKPaymentTransaction* transaction, NSError* err) {
+                callback(requestId, transaction ? transaction_to_dictionary(transaction) : nil, err.localizedDescription);
+            }];
         return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
     }
-}
 
-static bool js_iap_subscribe(JSContext *cx, uint32_t argc, jsval *vp)
-{
-    printLog("js_iap_subscribe");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 5) {
-        // sku, payload, oldPurchasedSkus, callback, this
-        CallbackFrame *cb = new CallbackFrame(cx, obj, args.get(4), args.get(3));
-        NSString *sku = jsval_to_string(cx, args.get(0));
-        [inAppPurchase purchase:sku withCallback:^(SKPaymentTransaction* transaction, NSError* err) {
-            NSDictionary *result = @{
-                                     @"productId": transaction.payment.productIdentifier,
-                                     @"receipt": inAppPurchase.appStoreReceipt,
-                                     @"signature": @""
-                                     };
-            callback(cb->callbackId, result, err.localizedDescription);
-        }];
-        rec.rval().set(JSVAL_TRUE);
-        return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
+    virtual bool subscribe(const std::string &sku, const std::string &payload, const std::vector<std::string> &oldSkus, int requestId) override {
+        return buy(sku, payload, requestId);
     }
-}
 
-static bool js_iap_consume(JSContext *cx, uint32_t argc, jsval *vp)
-{
-    printLog("js_iap_consume");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 3) {
-        // sku, callback, this
-        CallbackFrame *cb = new CallbackFrame(cx, obj, args.get(2), args.get(1));
-        NSString *sku = jsval_to_string(cx, args.get(0));
+    virtual bool consume(const std::string &sku, int requestId) override {
         inAppPurchase.transactionCallback = ^(SKPaymentTransaction* transaction, NSError* err) {
-            NSDictionary *result = @{
-                                     @"productId": transaction.payment.productIdentifier,
-                                     @"receipt": inAppPurchase.appStoreReceipt,
-                                     @"signature": @""
-                                     };
-            callback(cb->callbackId, result, err.localizedDescription);
+            callback(requestId, transaction ? transaction_to_dictionary(transaction) : nil, err.localizedDescription);
         };
-        [inAppPurchase finishTransaction:sku];
-        rec.rval().set(JSVAL_TRUE);
+        // an unknown or already finished transaction never calls back, the
+        // request would hold the store queue for good
+        if(![inAppPurchase finishTransaction:std_string_to_string(sku)]) {
+            inAppPurchase.transactionCallback = nil;
+            callback(requestId, nil, @"unknown transaction");
+        }
         return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
     }
-}
 
-static bool js_iap_available_products(JSContext *cx, uint32_t argc, jsval *vp)
-{
-    printLog("js_iap_available_products");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 2) {
-        // callback, this
-        CallbackFrame *cb = new CallbackFrame(cx, obj, args.get(1), args.get(0));
-        NSMutableArray *result = [NSMutableArray new];
-        for(NSString *productId in [inAppPurchase.products allKeys]) {
-            SKProduct *product = inAppPurchase.products[productId];
+    // finishTransaction reports synchronously, so the whole batch finishes
+    // inside this call and crosses back once
+    virtual bool consumeMany(const std::vector<std::string> &skus, int requestId) override {
+        NSMutableArray *result = [NSMutableArray arrayWithCapacity:skus.size()];
+        for(const std::string &sku : skus) {
+            NSString *identifier = std_string_to_string(sku);
+            __block NSDictionary *purchase = nil;
+            __block NSString *error = nil;
+            inAppPurchase.transactionCallback = ^(SKPaymentTransaction* transaction, NSError* err) {
+                purchase = transaction ? transaction_to_dictionary(transaction) : nil;
+                error = err.localizedDescription;
+            };
+            if(![inAppPurchase finishTransaction:identifier]) {
+                error = @"unknown transaction";
+            }
             [result addObject:@{
-                    @"productId": product.productIdentifier,
-                    @"type": @"",
-                    @"price": [NSString stringWithFormat:@"%@", product.price],
-                    @"title": product.localizedTitle,
-                    @"name": product.localizedTitle,
-                    @"description": product.localizedDescription,
-                    @"price_currency_code": product.priceLocale.currencySymbol
+                    @"productId": purchase ? purchase[@"productId"] : identifier,
+                    @"error": error ?: (purchase ? [NSNull null] : @"unknown transaction"),
+                    @"purchase": purchase && !error ? purchase : [NSNull null]
             }];
         }
-        callback(cb->callbackId, result, nil);
-        rec.rval().set(JSVAL_TRUE);
+        inAppPurchase.transactionCallback = nil;
+        callback(requestId, result, nil);
         return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
     }
-}
 
-static bool js_iap_product_details(JSContext *cx, uint32_t argc, jsval *vp)
-{
-    printLog("js_iap_product_details");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 3) {
-        // skus, callback, this
-        CallbackFrame *cb = new CallbackFrame(cx, obj, args.get(2), args.get(1));
-        NSArray *skus = jsval_to_array(cx, args.get(0));
-        [inAppPurchase load:skus withCallback:^(NSArray* result, NSError* err) {
-                callback(cb->callbackId, result, err.localizedDescription);
+    virtual bool availableProducts(int requestId) override {
+        NSMutableArray *result = [NSMutableArray new];
+        for(NSString *productId in [inAppPurchase.products allKeys]) {
+            [result addObject:product_to_dictionary(inAppPurchase.products[productId])];
+        }
+        callback(requestId, result, nil);
+        return true;
+    }
+
+    virtual bool productDetails(const std::vector<int> &skus, int requestId) override {
+        [inAppPurchase load:handles_to_array(skus) withCallback:^(NSArray* result, NSError* err) {
+                callback(requestId, result, err.localizedDescription);
             }];
-        rec.rval().set(JSVAL_TRUE);
         return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
     }
-}
 
-static bool js_iap_restore(JSContext *cx, uint32_t argc, jsval *vp)
-{
-    printLog("js_iap_restore");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 2) {
-        // callback, this
-        CallbackFrame *cb = new CallbackFrame(cx, obj, args.get(1), args.get(0));
+    virtual bool restore(int requestId) override {
         [inAppPurchase appStoreRefreshReceipt:^(NSArray* result, NSError* err){
-                callback(cb->callbackId, result, err.localizedDescription);
+                // the refresh may rewrite the receipt within the same mtime tick
+                NSString *path = app_store_receipt_path();
+                if(path != nil) {
+                    iap::BlobCache::getInstance()->invalidate(path.UTF8String);
+                }
+                callback(requestId, result, err.localizedDescription);
             }];
-        rec.rval().set(JSVAL_TRUE);
         return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
-        return false;
     }
-}
 
-static bool js_iap_debug(JSContext *cx, uint32_t argc, jsval *vp)
-{
-    printLog("js_iap_debug");
-    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
-    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
-    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
-    if(argc == 1) {
-        bool debug = JS::ToBoolean(JS::RootedValue(cx, args.get(0)));
+    virtual bool setDebug(bool debug) override {
         [InAppPurchase debug:debug];
-        rec.rval().set(JSVAL_TRUE);
         return true;
-    } else {
-        JS_ReportError(cx, "Invalid number of arguments");
+    }
+
+    virtual bool setBinaryResults(bool enabled) override {
+        binaryResults = enabled;
+        return true;
+    }
+
+    // load: answers with [[valid products], [invalid ids]]
+    virtual bool hasFlatProductDetails() const override {
         return false;
     }
-}
 
-///////////////////////////////////////
-//
-//  Register JS API
-//
-///////////////////////////////////////
+    // restore refreshes the receipt; restored transactions arrive through
+    // updatedTransactionCallback
+    virtual bool restoreListsPurchases() const override {
+        return false;
+    }
+};
 
-void register_all_iap_framework(JSContext* cx, JS::HandleObject obj) {
-    printLog("[Iap] register js interface");
-    JS::RootedObject ns(cx);
-    get_or_create_js_obj(cx, obj, "iap", &ns);
-
-    // initialize plugin, args: array of skus, internal validation flag (bool), callback func, this pointer
-    JS_DefineFunction(cx, ns, "init", js_iap_init, 4, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-    
-    // get purchased items, args: callback func, this pointer
-    JS_DefineFunction(cx, ns, "get_purchases", js_iap_get_purchases, 2, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-    
-    // purchase an item, args: sku, payload, callback func, this pointer
-    JS_DefineFunction(cx, ns, "buy", js_iap_buy, 4, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-    
-    // subscribe, args: sku, payload, oldPurchasedSkus (array of strings), callback func, this pointer
-    JS_DefineFunction(cx, ns, "subscribe", js_iap_subscribe, 5, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-
-    // consume purchased item, args: sku, callback func, this pointer
-    JS_DefineFunction(cx, ns, "consume", js_iap_consume, 3, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-    
-    // return available products for purchasing, args: callback func, this pointer
-    JS_DefineFunction(cx, ns, "available_products", js_iap_available_products, 2, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-    
-    // return product details, args: sku, callback func, this pointer
-    JS_DefineFunction(cx, ns, "product_details", js_iap_product_details, 3, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-
-    // stub for restore purchasings (will be implemented for iOS)
-    JS_DefineFunction(cx, ns, "restore", js_iap_restore, 0, JSPROP_PERMANENT | JSPROP_ENUMERATE);
-
-    // enable/disable debugging logs
-    JS_DefineFunction(cx, ns, "set_debug", js_iap_debug, 1, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+iap::Backend* iap::createPlatformBackend()
+{
+    printLog("[Iap] using StoreKit backend");
+    return new IosBackend();
 }
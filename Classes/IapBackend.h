@@ -0,0 +1,58 @@
+#ifndef IapBackend_h
+#define IapBackend_h
+
+#include <string>
+#include <vector>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Store backend interface
+//
+///////////////////////////////////////
+
+// A store backend performs billing operations on behalf of the JS layer.
+// Every asynchronous method receives a request id and answers it through
+// iap::Billing::requestResult(), from any thread. Returning false means the
+// request was rejected; the backend may still have reported an error result
+// for it.
+class Backend
+{
+public:
+    virtual ~Backend() {}
+
+    virtual bool init(const std::vector<std::string> &skus, bool internalValidation, int requestId) = 0;
+    virtual bool getPurchases(int requestId) = 0;
+    virtual bool buy(const std::string &sku, const std::string &payload, int requestId) = 0;
+    virtual bool subscribe(const std::string &sku, const std::string &payload, const std::vector<std::string> &oldSkus, int requestId) = 0;
+    virtual bool consume(const std::string &sku, int requestId) = 0;
+    // Consumes every sku in one operation and answers once with an array in
+    // sku order: {"productId", "error" (null on success), "purchase"}.
+    // Always JSON, even with binary results on.
+    virtual bool consumeMany(const std::vector<std::string> &skus, int requestId) = 0;
+    virtual bool availableProducts(int requestId) = 0;
+    // skus are SkuTable handles, all valid
+    virtual bool productDetails(const std::vector<int> &skus, int requestId) = 0;
+    virtual bool restore(int requestId) = 0;
+    virtual bool setDebug(bool debug) = 0;
+
+    // true when product_details answers with a flat array of product objects
+    // keyed by productId, the same shape as available_products
+    virtual bool hasFlatProductDetails() const { return true; }
+
+    // true when restore answers with the owned purchases, the same shape as
+    // get_purchases
+    virtual bool restoreListsPurchases() const { return true; }
+
+    // switches product and purchase results to compact binary records
+    // (IapRecords.h); false when the backend only produces JSON
+    virtual bool setBinaryResults(bool enabled) { return !enabled; }
+};
+
+// Implemented by the platform glue (Iap.cpp on Android, Iap.mm on iOS).
+Backend* createPlatformBackend();
+
+} // namespace iap
+
+#endif /* IapBackend_h */
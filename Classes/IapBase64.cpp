@@ -0,0 +1,450 @@
+#include "IapBase64.h"
+#include <atomic>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define IAP_BASE64_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define IAP_BASE64_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace iap {
+
+static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// 0..63 for alphabet characters, 64 for whitespace, 65 for '=', 255 otherwise
+struct DecodeTable
+{
+    uint8_t values[256];
+    uint8_t alphabetOnly[128]; // NEON lookup: 255 for anything but the alphabet
+
+    DecodeTable() {
+        for(int i = 0; i < 256; i++)
+            values[i] = 255;
+        for(int i = 0; i < 64; i++)
+            values[(uint8_t)ALPHABET[i]] = (uint8_t)i;
+        for(int i = 0; i < 128; i++)
+            alphabetOnly[i] = values[i];
+        values[(uint8_t)' '] = values[(uint8_t)'\n'] = values[(uint8_t)'\r'] = values[(uint8_t)'\t'] = 64;
+        values[(uint8_t)'='] = 65;
+    }
+};
+
+static const DecodeTable DECODE;
+
+///////////////////////////////////////
+//
+//  Kernels
+//
+///////////////////////////////////////
+
+// A kernel handles whole blocks only and stops at the first block it can't
+// take (too short, or not pure alphabet for the decoder); the caller does
+// the rest. encode returns input bytes consumed (a multiple of 3), decode
+// the characters consumed (a multiple of 4).
+struct Kernel
+{
+    Base64Kernel id;
+    size_t (*encode)(const uint8_t *data, size_t size, char *out);
+    size_t (*decode)(const char *text, size_t length, uint8_t *out);
+};
+
+static size_t scalarEncode(const uint8_t *data, size_t size, char *out)
+{
+    size_t i = 0;
+    for(; size - i >= 3; i += 3, out += 4) {
+        uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        out[0] = ALPHABET[v >> 18];
+        out[1] = ALPHABET[(v >> 12) & 63];
+        out[2] = ALPHABET[(v >> 6) & 63];
+        out[3] = ALPHABET[v & 63];
+    }
+    return i;
+}
+
+static size_t scalarDecode(const char *text, size_t length, uint8_t *out)
+{
+    const uint8_t *table = DECODE.values;
+    size_t i = 0;
+    for(; length - i >= 4; i += 4, out += 3) {
+        uint32_t a = table[(uint8_t)text[i]];
+        uint32_t b = table[(uint8_t)text[i + 1]];
+        uint32_t c = table[(uint8_t)text[i + 2]];
+        uint32_t d = table[(uint8_t)text[i + 3]];
+        if((a | b | c | d) >= 64) {
+            break;
+        }
+        uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+        out[0] = (uint8_t)(v >> 16);
+        out[1] = (uint8_t)(v >> 8);
+        out[2] = (uint8_t)v;
+    }
+    return i;
+}
+
+static const Kernel SCALAR_KERNEL = { BASE64_SCALAR, scalarEncode, scalarDecode };
+
+#if IAP_BASE64_X86
+
+// Both x86 kernels follow Muła and Lemire: multiply-shift the 6-bit fields
+// apart, map them to ASCII with a pshufb offset table, and validate input
+// with two nibble lookups. Decoding stores a full register, so it needs a
+// few characters of slack past the block; the caller's output size covers
+// that as long as the input does too.
+//
+// The 128-bit loops are force-inlined into the AVX2 kernel for its tail:
+// a call into legacy SSE code with dirty upper registers costs more than
+// the tail itself on short inputs.
+
+__attribute__((target("ssse3"), always_inline))
+static inline size_t ssse3EncodeBlocks(const uint8_t *data, size_t size, char *out)
+{
+    const __m128i spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t i = 0;
+    // the load reads 16 bytes for 12
+    for(; size - i >= 16; i += 12, out += 16) {
+        __m128i in = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + i)), spread);
+        __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        __m128i indices = _mm_or_si128(t0, t1);
+        __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+        _mm_storeu_si128((__m128i*)out, _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range)));
+    }
+    return i;
+}
+
+__attribute__((target("ssse3"), always_inline))
+static inline size_t ssse3DecodeBlocks(const char *text, size_t length, uint8_t *out)
+{
+    const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    // 16 characters make 12 bytes but the store writes 16
+    for(; length - i >= 24; i += 16, out += 12) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i hi = _mm_and_si128(_mm_srli_epi32(in, 4), nibble);
+        __m128i lo = _mm_and_si128(in, nibble);
+        __m128i invalid = _mm_and_si128(_mm_shuffle_epi8(lutLo, lo), _mm_shuffle_epi8(lutHi, hi));
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(invalid, _mm_setzero_si128())) != 0xffff) {
+            break;
+        }
+        __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(_mm_cmpeq_epi8(in, _mm_set1_epi8('/')), hi));
+        __m128i values = _mm_add_epi8(in, roll);
+        __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+        merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(merged, pack));
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t ssse3Encode(const uint8_t *data, size_t size, char *out)
+{
+    return ssse3EncodeBlocks(data, size, out);
+}
+
+__attribute__((target("ssse3")))
+static size_t ssse3Decode(const char *text, size_t length, uint8_t *out)
+{
+    return ssse3DecodeBlocks(text, length, out);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2Encode(const uint8_t *data, size_t size, char *out)
+{
+    const __m256i spread = _mm256_broadcastsi128_si256(_mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m256i offsets = _mm256_broadcastsi128_si256(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                                                      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0));
+    size_t i = 0;
+    // two 16 byte loads 12 apart, one per lane
+    for(; size - i >= 28; i += 24, out += 32) {
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(data + i))),
+                                             _mm_loadu_si128((const __m128i*)(data + i + 12)), 1);
+        in = _mm256_shuffle_epi8(in, spread);
+        __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+        __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+        __m256i indices = _mm256_or_si256(t0, t1);
+        __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+        _mm256_storeu_si256((__m256i*)out, _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, range)));
+    }
+    return i + ssse3EncodeBlocks(data + i, size - i, out);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2Decode(const char *text, size_t length, uint8_t *out)
+{
+    const __m256i lutLo = _mm256_broadcastsi128_si256(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a));
+    const __m256i lutHi = _mm256_broadcastsi128_si256(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10));
+    const __m256i lutRoll = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0));
+    const __m256i pack = _mm256_broadcastsi128_si256(_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    // 32 characters make 24 bytes but the store writes 32
+    for(; length - i >= 48; i += 32, out += 24) {
+        __m256i in = _mm256_loadu_si256((const __m256i*)(text + i));
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi32(in, 4), nibble);
+        __m256i lo = _mm256_and_si256(in, nibble);
+        __m256i invalid = _mm256_and_si256(_mm256_shuffle_epi8(lutLo, lo), _mm256_shuffle_epi8(lutHi, hi));
+        if(_mm256_movemask_epi8(_mm256_cmpeq_epi8(invalid, _mm256_setzero_si256())) != -1) {
+            break;
+        }
+        __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('/')), hi));
+        __m256i values = _mm256_add_epi8(in, roll);
+        __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        merged = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(merged, pack), lanes);
+        _mm256_storeu_si256((__m256i*)out, merged);
+    }
+    return i + ssse3DecodeBlocks(text + i, length - i, out);
+}
+
+static const Kernel SSSE3_KERNEL = { BASE64_SSSE3, ssse3Encode, ssse3Decode };
+static const Kernel AVX2_KERNEL = { BASE64_AVX2, avx2Encode, avx2Decode };
+
+#endif // IAP_BASE64_X86
+
+#if IAP_BASE64_NEON
+
+// 48 bytes <-> 64 characters per step; vld3/vld4 deinterleave so the bit
+// shuffling is plain shifts, and TBL does the 64 and 128 entry lookups.
+
+static size_t neonEncode(const uint8_t *data, size_t size, char *out)
+{
+    const uint8_t *alphabet = (const uint8_t*)ALPHABET;
+    uint8x16x4_t table = {{ vld1q_u8(alphabet), vld1q_u8(alphabet + 16), vld1q_u8(alphabet + 32), vld1q_u8(alphabet + 48) }};
+    const uint8x16_t mask = vdupq_n_u8(63);
+    size_t i = 0;
+    for(; size - i >= 48; i += 48, out += 64) {
+        uint8x16x3_t in = vld3q_u8(data + i);
+        uint8x16x4_t chars;
+        chars.val[0] = vqtbl4q_u8(table, vshrq_n_u8(in.val[0], 2));
+        chars.val[1] = vqtbl4q_u8(table, vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), mask));
+        chars.val[2] = vqtbl4q_u8(table, vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), mask));
+        chars.val[3] = vqtbl4q_u8(table, vandq_u8(in.val[2], mask));
+        vst4q_u8((uint8_t*)out, chars);
+    }
+    return i;
+}
+
+static size_t neonDecode(const char *text, size_t length, uint8_t *out)
+{
+    const uint8_t *values = DECODE.alphabetOnly;
+    uint8x16x4_t tableLo = {{ vld1q_u8(values), vld1q_u8(values + 16), vld1q_u8(values + 32), vld1q_u8(values + 48) }};
+    uint8x16x4_t tableHi = {{ vld1q_u8(values + 64), vld1q_u8(values + 80), vld1q_u8(values + 96), vld1q_u8(values + 112) }};
+    const uint8x16_t upper = vdupq_n_u8(0x40);
+    size_t i = 0;
+    for(; length - i >= 64; i += 64, out += 48) {
+        uint8x16x4_t in = vld4q_u8((const uint8_t*)text + i);
+        uint8x16_t v[4];
+        uint8x16_t bad = vdupq_n_u8(0);
+        for(int k = 0; k < 4; k++) {
+            // TBX keeps the low half result where the flipped index is out of range
+            v[k] = vqtbx4q_u8(vqtbl4q_u8(tableLo, in.val[k]), tableHi, veorq_u8(in.val[k], upper));
+            // 255 marks a non-alphabet character, the top bit of the input non-ASCII
+            bad = vorrq_u8(bad, vorrq_u8(v[k], in.val[k]));
+        }
+        if(vmaxvq_u8(bad) >= 0x80) {
+            break;
+        }
+        uint8x16x3_t bytes;
+        bytes.val[0] = vorrq_u8(vshlq_n_u8(v[0], 2), vshrq_n_u8(v[1], 4));
+        bytes.val[1] = vorrq_u8(vshlq_n_u8(v[1], 4), vshrq_n_u8(v[2], 2));
+        bytes.val[2] = vorrq_u8(vshlq_n_u8(v[2], 6), v[3]);
+        vst3q_u8(out, bytes);
+    }
+    return i;
+}
+
+static const Kernel NEON_KERNEL = { BASE64_NEON, neonEncode, neonDecode };
+
+#endif // IAP_BASE64_NEON
+
+static const Kernel* kernelFor(Base64Kernel id)
+{
+    switch(id) {
+        case BASE64_SCALAR:
+            return &SCALAR_KERNEL;
+#if IAP_BASE64_X86
+        case BASE64_SSSE3:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("ssse3") ? &SSSE3_KERNEL : nullptr;
+        case BASE64_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? &AVX2_KERNEL : nullptr;
+#endif
+#if IAP_BASE64_NEON
+        case BASE64_NEON:
+            return &NEON_KERNEL;
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+// null until first use, so callers from static constructors are fine too
+static std::atomic<const Kernel*> s_kernel(nullptr);
+
+static const Kernel* currentKernel()
+{
+    const Kernel *kernel = s_kernel.load(std::memory_order_acquire);
+    if(!kernel) {
+        const Base64Kernel preferred[] = { BASE64_AVX2, BASE64_NEON, BASE64_SSSE3, BASE64_SCALAR };
+        for(Base64Kernel id : preferred) {
+            if((kernel = kernelFor(id)))
+                break;
+        }
+        s_kernel.store(kernel, std::memory_order_release);
+    }
+    return kernel;
+}
+
+Base64Kernel base64Kernel()
+{
+    return currentKernel()->id;
+}
+
+bool base64UseKernel(Base64Kernel id)
+{
+    const Kernel *kernel = kernelFor(id);
+    if(kernel) {
+        s_kernel.store(kernel, std::memory_order_release);
+    }
+    return kernel != nullptr;
+}
+
+const char* base64KernelName(Base64Kernel id)
+{
+    switch(id) {
+        case BASE64_SCALAR: return "scalar";
+        case BASE64_SSSE3: return "ssse3";
+        case BASE64_AVX2: return "avx2";
+        case BASE64_NEON: return "neon";
+    }
+    return "unknown";
+}
+
+///////////////////////////////////////
+//
+//  Codec
+//
+///////////////////////////////////////
+
+size_t base64Encode(const uint8_t *data, size_t size, char *out)
+{
+    size_t i = currentKernel()->encode(data, size, out);
+    i += scalarEncode(data + i, size - i, out + i / 3 * 4);
+    char *tail = out + i / 3 * 4;
+    if(i < size) {
+        uint32_t v = data[i] << 16;
+        if(i + 1 < size)
+            v |= data[i + 1] << 8;
+        tail[0] = ALPHABET[v >> 18];
+        tail[1] = ALPHABET[(v >> 12) & 63];
+        tail[2] = i + 1 < size ? ALPHABET[(v >> 6) & 63] : '=';
+        tail[3] = '=';
+    }
+    return base64EncodedSize(size);
+}
+
+bool base64Decode(const char *text, size_t length, uint8_t *out, size_t &outSize)
+{
+    const Kernel *kernel = currentKernel();
+    size_t i = 0;
+    size_t o = 0;
+    uint32_t acc = 0;
+    int group = 0;
+    int padding = 0;
+    while(i < length) {
+        if(group == 0 && padding == 0) {
+            // back on a group boundary: let the kernel take the clean run
+            size_t used = kernel->decode(text + i, length - i, out + o);
+            i += used;
+            o += used / 4 * 3;
+            if(i == length)
+                break;
+        }
+        uint8_t v = DECODE.values[(uint8_t)text[i++]];
+        if(v == 64) {
+            continue;
+        }
+        if(v == 65) {
+            padding++;
+            continue;
+        }
+        if(v == 255 || padding > 0) {
+            // unknown character or data after padding
+            return false;
+        }
+        acc = (acc << 6) | v;
+        if(++group == 4) {
+            out[o++] = (uint8_t)(acc >> 16);
+            out[o++] = (uint8_t)(acc >> 8);
+            out[o++] = (uint8_t)acc;
+            acc = 0;
+            group = 0;
+        }
+    }
+    // a partial last group needs zero fill bits and no more padding than it lacks
+    switch(group) {
+        case 0:
+            if(padding)
+                return false;
+            break;
+        case 2:
+            if(padding > 2 || (acc & 15))
+                return false;
+            out[o++] = (uint8_t)(acc >> 4);
+            break;
+        case 3:
+            if(padding > 1 || (acc & 3))
+                return false;
+            out[o++] = (uint8_t)(acc >> 10);
+            out[o++] = (uint8_t)(acc >> 2);
+            break;
+        default:
+            return false;
+    }
+    outSize = o;
+    return true;
+}
+
+std::string base64Encode(const uint8_t *data, size_t size)
+{
+    std::string out(base64EncodedSize(size), '\0');
+    if(size)
+        base64Encode(data, size, &out[0]);
+    return out;
+}
+
+bool base64Decode(const char *text, size_t length, std::vector<uint8_t> &out)
+{
+    out.resize(base64DecodedMaxSize(length));
+    size_t size = 0;
+    if(length && !base64Decode(text, length, out.data(), size)) {
+        out.clear();
+        return false;
+    }
+    out.resize(size);
+    return true;
+}
+
+} // namespace iap
+
+size_t iap_base64_encode(const uint8_t *data, size_t size, char *out)
+{
+    return iap::base64Encode(data, size, out);
+}
+
+int iap_base64_decode(const char *text, size_t length, uint8_t *out, size_t *outSize)
+{
+    return iap::base64Decode(text, length, out, *outSize) ? 1 : 0;
+}
@@ -0,0 +1,79 @@
+#ifndef IapBase64_h
+#define IapBase64_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+
+#include <string>
+#include <vector>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Base64
+//
+///////////////////////////////////////
+
+// Standard alphabet with padding. The decoder skips whitespace, so keys
+// pasted into resources with line breaks decode as well. Long runs go
+// through SIMD kernels (SSSE3/AVX2 picked at runtime on x86, NEON on
+// arm64), everything else through the scalar code.
+
+// characters written by base64Encode, exact
+inline size_t base64EncodedSize(size_t size)
+{
+    return (size + 2) / 3 * 4;
+}
+
+// room base64Decode needs for `length` characters, an upper bound
+inline size_t base64DecodedMaxSize(size_t length)
+{
+    return (length + 3) / 4 * 3;
+}
+
+// Into caller buffers: out holds base64EncodedSize(size) chars (no
+// terminator) / base64DecodedMaxSize(length) bytes. Returns the count
+// written; decoding fails on characters outside the alphabet, data after
+// padding or a truncated last group.
+size_t base64Encode(const uint8_t *data, size_t size, char *out);
+bool base64Decode(const char *text, size_t length, uint8_t *out, size_t &outSize);
+
+std::string base64Encode(const uint8_t *data, size_t size);
+bool base64Decode(const char *text, size_t length, std::vector<uint8_t> &out);
+
+inline bool base64Decode(const std::string &text, std::vector<uint8_t> &out)
+{
+    return base64Decode(text.data(), text.size(), out);
+}
+
+enum Base64Kernel
+{
+    BASE64_SCALAR,
+    BASE64_SSSE3,
+    BASE64_AVX2,
+    BASE64_NEON
+};
+
+// kernel in use, the best one the cpu has unless overridden
+Base64Kernel base64Kernel();
+// for benchmarks and tests; false if the cpu or build lacks the kernel
+bool base64UseKernel(Base64Kernel kernel);
+const char* base64KernelName(Base64Kernel kernel);
+
+} // namespace iap
+
+extern "C" {
+#endif
+
+// for the Objective-C side, same contracts as above; decode returns 0 on bad input
+size_t iap_base64_encode(const uint8_t *data, size_t size, char *out);
+int iap_base64_decode(const char *text, size_t length, uint8_t *out, size_t *outSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IapBase64_h */
@@ -0,0 +1,1034 @@
+#include "IapBilling.h"
+#include "IapJsonScan.h"
+#include "IapRecords.h"
+#include "IapSkuTable.h"
+#include "IapStats.h"
+
+namespace iap {
+
+std::u16string utf8ToUtf16(const std::string &utf8)
+{
+    std::u16string out;
+    out.reserve(utf8.size());
+    const unsigned char *p = (const unsigned char*)utf8.data();
+    const unsigned char *end = p + utf8.size();
+    while(p < end) {
+        unsigned int c = *p++;
+        int extra = 0;
+        if(c >= 0xF0 && c < 0xF8) { c &= 0x07; extra = 3; }
+        else if(c >= 0xE0) { c &= 0x0F; extra = 2; }
+        else if(c >= 0xC0) { c &= 0x1F; extra = 1; }
+        else if(c >= 0x80) { out += (char16_t)0xFFFD; continue; }
+        if(end - p < extra) {
+            out += (char16_t)0xFFFD;
+            break;
+        }
+        bool valid = true;
+        for(int i = 0; i < extra; i++) {
+            if((p[i] & 0xC0) != 0x80) { valid = false; break; }
+            c = (c << 6) | (p[i] & 0x3F);
+        }
+        if(!valid) {
+            out += (char16_t)0xFFFD;
+            continue;
+        }
+        p += extra;
+        if(c >= 0x10000) {
+            c -= 0x10000;
+            out += (char16_t)(0xD800 + (c >> 10));
+            out += (char16_t)(0xDC00 + (c & 0x3FF));
+        } else {
+            out += (char16_t)c;
+        }
+    }
+    return out;
+}
+
+Billing::Billing()
+: _reconciled(false)
+, _watching(false)
+, _watchedVersion(0)
+, _productTableGeneration(0)
+, _purchaseTableVersion(0)
+, _timers(Stats::now())
+, _jitter((uint32_t)Stats::now() | 1)
+{
+    _scheduler.setDeliver([this](Result &&result) {
+        handleResult(std::move(result));
+    });
+    // buy and restore wait on the player as much as on the store: no deadline
+    _policies[Stats::OP_INIT] = RequestPolicy(60000);
+    _policies[Stats::OP_GET_PURCHASES] = RequestPolicy(20000, 2);
+    _policies[Stats::OP_CONSUME] = RequestPolicy(30000);
+    _policies[Stats::OP_AVAILABLE_PRODUCTS] = RequestPolicy(20000, 2);
+    _policies[Stats::OP_PRODUCT_DETAILS] = RequestPolicy(20000, 2);
+}
+
+Billing* Billing::getInstance()
+{
+    static Billing instance;
+    return &instance;
+}
+
+void Billing::setBackend(Backend *backend)
+{
+    // every store call goes through the timing wrapper, then the trace
+    _tracing.reset(backend ? new TracingBackend(backend, &_trace) : nullptr);
+    _timed.reset(backend ? new TimedBackend(_tracing.get()) : nullptr);
+    _scheduler.setBackend(_timed.get());
+    _backend.reset(backend);
+}
+
+void Billing::setResultHandler(const ResultHandler &handler)
+{
+    std::lock_guard<std::mutex> lock(_handlerMutex);
+    _resultHandler = handler;
+}
+
+bool Billing::startTrace(const std::string &path)
+{
+    return _trace.open(path);
+}
+
+void Billing::stopTrace()
+{
+    _trace.close();
+}
+
+bool Billing::openCatalogCache(const std::string &path)
+{
+    return _catalog.open(path);
+}
+
+bool Billing::openJournal(const std::string &path)
+{
+    return _journal.open(path);
+}
+
+bool Billing::markGranted(const std::string &token)
+{
+    PurchaseJournal::Entry entry;
+    if(!_journal.find(token, entry)) {
+        return false;
+    }
+    _journal.record(token, std::string(), PurchaseJournal::GRANTED);
+    return true;
+}
+
+std::vector<PurchaseJournal::Entry> Billing::pendingGrants() const
+{
+    return _journal.pendingGrants();
+}
+
+void Billing::watchPurchases(uint64_t since)
+{
+    std::lock_guard<std::mutex> lock(_watchMutex);
+    _watching = true;
+    std::u16string changes = _inventory.changesSince(since, &_watchedVersion);
+    deliver(EVENT_PURCHASES_CHANGED, std::string(), std::move(changes), LANE_EVENT);
+}
+
+void Billing::unwatchPurchases()
+{
+    std::lock_guard<std::mutex> lock(_watchMutex);
+    _watching = false;
+}
+
+std::shared_ptr<const ProductTable> Billing::productTable()
+{
+    std::lock_guard<std::mutex> lock(_tableMutex);
+    uint64_t generation = _catalog.generation();
+    if(!_productTable || generation != _productTableGeneration) {
+        std::shared_ptr<ProductTable> table = std::make_shared<ProductTable>();
+        std::u16string json;
+        if(_catalog.allProducts(json))
+            table->load(json);
+        _productTable = table;
+        _productTableGeneration = generation;
+    }
+    return _productTable;
+}
+
+std::shared_ptr<const PurchaseTable> Billing::purchaseTable()
+{
+    std::lock_guard<std::mutex> lock(_tableMutex);
+    if(!_purchaseTable || _inventory.version() != _purchaseTableVersion) {
+        std::shared_ptr<PurchaseTable> table = std::make_shared<PurchaseTable>();
+        table->load(_inventory.items(&_purchaseTableVersion));
+        _purchaseTable = table;
+    }
+    return _purchaseTable;
+}
+
+// under the lock so watchers see the changes in order
+void Billing::purchasesChanged()
+{
+    std::lock_guard<std::mutex> lock(_watchMutex);
+    if(!_watching || _inventory.version() == _watchedVersion) {
+        return;
+    }
+    std::u16string changes = _inventory.changesSince(_watchedVersion, &_watchedVersion);
+    deliver(EVENT_PURCHASES_CHANGED, std::string(), std::move(changes), LANE_EVENT);
+}
+
+///////////////////////////////////////
+//
+//  Requests
+//
+///////////////////////////////////////
+
+bool Billing::init(const std::vector<std::string> &skus, bool internalValidation, int requestId)
+{
+    Stats::getInstance()->begin(requestId, Stats::OP_INIT);
+    _trace.request(TraceEntry::CALL_INIT, requestId, skus, internalValidation);
+    // the catalog gets the first handles, in the order the game listed it
+    std::vector<int> handles;
+    SkuTable::getInstance()->intern(skus, handles);
+    watch(requestId, Stats::OP_INIT);
+    track(requestId, REQUEST_INIT);
+    if(!_scheduler.init(skus, internalValidation, requestId)) {
+        Tracked tracked;
+        untrack(requestId, tracked);
+        unwatch(requestId);
+        Stats::getInstance()->finish(requestId, true);
+        return false;
+    }
+    return true;
+}
+
+bool Billing::getPurchases(int requestId)
+{
+    Stats::getInstance()->begin(requestId, Stats::OP_GET_PURCHASES);
+    _trace.request(TraceEntry::CALL_GET_PURCHASES, requestId);
+    // owned purchases are reconciled into the journal on the way back
+    watch(requestId, Stats::OP_GET_PURCHASES);
+    track(requestId, REQUEST_RECONCILE);
+    if(!_timed->getPurchases(requestId)) {
+        Tracked tracked;
+        untrack(requestId, tracked);
+        unwatch(requestId);
+        Stats::getInstance()->finish(requestId, true);
+        return false;
+    }
+    return true;
+}
+
+bool Billing::buy(const std::string &sku, const std::string &payload, int requestId)
+{
+    Stats::getInstance()->begin(requestId, Stats::OP_BUY);
+    if(_trace.recording())
+        _trace.request(TraceEntry::CALL_BUY, requestId, std::vector<std::string>{ sku, payload });
+    watch(requestId, Stats::OP_BUY);
+    track(requestId, REQUEST_PURCHASE);
+    if(!_scheduler.buy(sku, payload, requestId)) {
+        Tracked tracked;
+        untrack(requestId, tracked);
+        unwatch(requestId);
+        Stats::getInstance()->finish(requestId, true);
+        return false;
+    }
+    return true;
+}
+
+bool Billing::subscribe(const std::string &sku, const std::string &payload, const std::vector<std::string> &oldSkus, int requestId)
+{
+    Stats::getInstance()->begin(requestId, Stats::OP_BUY);
+    if(_trace.recording()) {
+        std::vector<std::string> args{ sku, payload };
+        args.insert(args.end(), oldSkus.begin(), oldSkus.end());
+        _trace.request(TraceEntry::CALL_SUBSCRIBE, requestId, args);
+    }
+    watch(requestId, Stats::OP_BUY);
+    track(requestId, REQUEST_PURCHASE);
+    if(!_scheduler.subscribe(sku, payload, oldSkus, requestId)) {
+        Tracked tracked;
+        untrack(requestId, tracked);
+        unwatch(requestId);
+        Stats::getInstance()->finish(requestId, true);
+        return false;
+    }
+    return true;
+}
+
+bool Billing::consume(const std::string &sku, int requestId)
+{
+    Stats::getInstance()->begin(requestId, Stats::OP_CONSUME);
+    if(_trace.recording())
+        _trace.request(TraceEntry::CALL_CONSUME, requestId, std::vector<std::string>{ sku });
+    std::u16string consumed;
+    if(consumedLocally(sku, consumed)) {
+        // already consumed at the store, a retry must not reach it again
+        deliver(requestId, std::string(), std::move(consumed), LANE_PURCHASE);
+        return true;
+    }
+    watch(requestId, Stats::OP_CONSUME);
+    track(requestId, REQUEST_CONSUME, sku);
+    if(!_scheduler.consume(sku, requestId)) {
+        Tracked tracked;
+        untrack(requestId, tracked);
+        unwatch(requestId);
+        Stats::getInstance()->finish(requestId, true);
+        return false;
+    }
+    return true;
+}
+
+bool Billing::consumeMany(const std::vector<std::string> &skus, int requestId)
+{
+    Stats::getInstance()->begin(requestId, Stats::OP_CONSUME);
+    _trace.request(TraceEntry::CALL_CONSUME_MANY, requestId, skus);
+    Tracked tracked;
+    tracked.kind = REQUEST_CONSUME_MANY;
+    tracked.keys = skus;
+    tracked.answers.resize(skus.size());
+    std::vector<std::string> remaining;
+    for(size_t i = 0; i < skus.size(); i++) {
+        if(!consumedLocally(skus[i], tracked.answers[i]))
+            remaining.push_back(skus[i]);
+    }
+    if(remaining.empty()) {
+        Result none;
+        deliver(requestId, std::string(), mergeConsumed(none, tracked), LANE_PURCHASE);
+        return true;
+    }
+    watch(requestId, Stats::OP_CONSUME);
+    track(requestId, std::move(tracked));
+    if(!_scheduler.consumeMany(remaining, requestId)) {
+        untrack(requestId, tracked);
+        unwatch(requestId);
+        Stats::getInstance()->finish(requestId, true);
+        return false;
+    }
+    return true;
+}
+
+bool Billing::availableProducts(int requestId)
+{
+    Stats::getInstance()->begin(requestId, Stats::OP_AVAILABLE_PRODUCTS);
+    _trace.request(TraceEntry::CALL_AVAILABLE_PRODUCTS, requestId);
+    std::u16string cached;
+    if(_catalog.allProducts(cached)) {
+        // stale-while-revalidate: init refreshes the catalog in the background
+        deliver(requestId, std::string(), std::move(cached));
+        return true;
+    }
+    watch(requestId, Stats::OP_AVAILABLE_PRODUCTS);
+    track(requestId, REQUEST_AVAILABLE_PRODUCTS);
+    if(!_timed->availableProducts(requestId)) {
+        Tracked tracked;
+        untrack(requestId, tracked);
+        unwatch(requestId);
+        Stats::getInstance()->finish(requestId, true);
+        return false;
+    }
+    return true;
+}
+
+bool Billing::productDetails(const std::vector<std::string> &skus, int requestId)
+{
+    std::vector<int> handles;
+    SkuTable::getInstance()->intern(skus, handles);
+    return productDetails(handles, requestId);
+}
+
+bool Billing::productDetails(const std::vector<int> &handles, int requestId)
+{
+    Stats::getInstance()->begin(requestId, Stats::OP_PRODUCT_DETAILS);
+    // backends only ever see handles they can resolve
+    SkuTable *table = SkuTable::getInstance();
+    std::vector<int> skus;
+    skus.reserve(handles.size());
+    for(int handle : handles) {
+        if(table->valid(handle))
+            skus.push_back(handle);
+    }
+    if(_trace.recording()) {
+        std::vector<std::string> names;
+        table->names(skus, names);
+        _trace.request(TraceEntry::CALL_PRODUCT_DETAILS, requestId, names);
+    }
+    if(!_backend->hasFlatProductDetails()) {
+        watch(requestId, Stats::OP_PRODUCT_DETAILS, skus);
+        if(!_scheduler.productDetails(skus, requestId)) {
+            unwatch(requestId);
+            Stats::getInstance()->finish(requestId, true);
+            return false;
+        }
+        return true;
+    }
+    std::u16string cached;
+    if(_catalog.products(skus, cached)) {
+        deliver(requestId, std::string(), std::move(cached));
+        return true;
+    }
+    watch(requestId, Stats::OP_PRODUCT_DETAILS, skus);
+    track(requestId, REQUEST_PRODUCT_DETAILS);
+    if(!_scheduler.productDetails(skus, requestId)) {
+        Tracked tracked;
+        untrack(requestId, tracked);
+        unwatch(requestId);
+        Stats::getInstance()->finish(requestId, true);
+        return false;
+    }
+    return true;
+}
+
+bool Billing::restore(int requestId)
+{
+    Stats::getInstance()->begin(requestId, Stats::OP_RESTORE);
+    _trace.request(TraceEntry::CALL_RESTORE, requestId);
+    watch(requestId, Stats::OP_RESTORE);
+    // the restored purchases are reconciled like get_purchases'
+    if(_backend->restoreListsPurchases())
+        track(requestId, REQUEST_RECONCILE);
+    if(!_timed->restore(requestId)) {
+        Tracked tracked;
+        untrack(requestId, tracked);
+        unwatch(requestId);
+        Stats::getInstance()->finish(requestId, true);
+        return false;
+    }
+    return true;
+}
+
+bool Billing::setDebug(bool debug)
+{
+    return _backend->setDebug(debug);
+}
+
+bool Billing::setBinaryResults(bool enabled)
+{
+    return _backend->setBinaryResults(enabled);
+}
+
+void Billing::track(int requestId, RequestKind kind, const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(_trackMutex);
+    Tracked &tracked = _tracked[requestId];
+    tracked.kind = kind;
+    tracked.key = key;
+}
+
+void Billing::track(int requestId, Tracked &&tracked)
+{
+    std::lock_guard<std::mutex> lock(_trackMutex);
+    _tracked[requestId] = std::move(tracked);
+}
+
+bool Billing::untrack(int requestId, Tracked &tracked)
+{
+    std::lock_guard<std::mutex> lock(_trackMutex);
+    auto it = _tracked.find(requestId);
+    if(it == _tracked.end()) {
+        return false;
+    }
+    tracked = std::move(it->second);
+    _tracked.erase(it);
+    return true;
+}
+
+void Billing::refreshCatalog()
+{
+    int requestId = _scheduler.newInternalId();
+    track(requestId, REQUEST_CATALOG_REFRESH);
+    if(!_timed->availableProducts(requestId)) {
+        Tracked tracked;
+        untrack(requestId, tracked);
+    }
+}
+
+void Billing::reconcilePurchases()
+{
+    int requestId = _scheduler.newInternalId();
+    track(requestId, REQUEST_RECONCILE);
+    if(!_timed->getPurchases(requestId)) {
+        Tracked tracked;
+        untrack(requestId, tracked);
+    }
+}
+
+bool Billing::consumedLocally(const std::string &key, std::u16string &result) const
+{
+    // A token (StoreKit consumes by transaction id) stays consumed for good.
+    // A sku only maps to its newest purchase once this session reconciled
+    // the owned purchases, otherwise a purchase made elsewhere could hide.
+    PurchaseJournal::Entry entry;
+    if(!_journal.find(key, entry) && !(_reconciled && _journal.findLatest(key, entry))) {
+        return false;
+    }
+    if(!(entry.state & PurchaseJournal::CONSUMED)) {
+        return false;
+    }
+    if(!entry.purchase.empty()) {
+        result = entry.purchase;
+    } else {
+        result = u"{\"productId\":" + jsonQuote(entry.sku) + u",\"purchaseToken\":" + jsonQuote(entry.token) + u"}";
+    }
+    return true;
+}
+
+void Billing::journalPurchases(const Result &result, uint32_t state, const std::string &key, std::vector<PurchaseInventory::Item> &owned)
+{
+    if(!result.records.empty()) {
+        std::u16string converted;
+        if(recordsToJson(result.records, converted))
+            journalPurchases(converted, state, key, owned);
+        return;
+    }
+    journalPurchases(result.json, state, key, owned);
+}
+
+void Billing::journalPurchases(const std::u16string &json, uint32_t state, const std::string &key, std::vector<PurchaseInventory::Item> &owned)
+{
+    // an array of purchases (get_purchases) or a single one (buy, consume)
+    const char16_t *begin = json.data();
+    const char16_t *end = begin + json.size();
+    std::vector<JsonSpan> items;
+    if(!jsonArrayItems(begin, end, items)) {
+        items.clear();
+        jsonSkipSpace(begin, end);
+        JsonSpan whole = { begin, end };
+        items.push_back(whole);
+    }
+    for(const JsonSpan &item : items) {
+        PurchaseInventory::Item purchase;
+        if(journalPurchase(item, state, key, purchase))
+            owned.push_back(std::move(purchase));
+    }
+}
+
+// false when the item names no purchase token
+bool Billing::journalPurchase(const JsonSpan &item, uint32_t state, const std::string &key, PurchaseInventory::Item &owned)
+{
+    if(item.begin == item.end)
+        return false;
+    std::string token;
+    std::string sku;
+    if(*item.begin == u'"') {
+        // StoreKit lists owned transactions by id only
+        token = jsonAsciiString(item.begin, item.end);
+    } else {
+        token = jsonStringField(item.begin, item.end, u"purchaseToken");
+        if(token.empty())
+            token = jsonStringField(item.begin, item.end, u"transactionId");
+        sku = jsonStringField(item.begin, item.end, u"productId");
+    }
+    PurchaseJournal::Entry entry;
+    if(token.empty() && !key.empty() && (_journal.find(key, entry) || _journal.findLatest(key, entry))) {
+        token = entry.token;
+    }
+    if(token.empty()) {
+        return false;
+    }
+    _journal.record(token, sku, state, *item.begin == u'{' ? std::u16string(item.begin, item.end) : std::u16string());
+    owned.token = token;
+    owned.sku = sku;
+    if(*item.begin == u'{') {
+        owned.json.assign(item.begin, item.end);
+    } else if(_journal.find(token, entry) && !entry.purchase.empty()) {
+        owned.sku = entry.sku;
+        owned.json = entry.purchase;
+    } else {
+        owned.sku = entry.sku;
+        owned.json = u"{\"productId\":" + jsonQuote(entry.sku) + u",\"transactionId\":" + jsonQuote(token) + u"}";
+    }
+    return true;
+}
+
+// The store answers for the skus it was sent, in order; the local answers
+// fill the gaps. Consumed purchases are journaled on the way.
+std::u16string Billing::mergeConsumed(const Result &result, const Tracked &tracked)
+{
+    std::vector<JsonSpan> items;
+    std::u16string batchError;
+    if(!result.error.empty()) {
+        batchError = jsonQuote(result.error);
+    } else if(!result.json.empty() && !jsonArrayItems(result.json.data(), result.json.data() + result.json.size(), items)) {
+        batchError = u"\"malformed consume result\"";
+    }
+    size_t next = 0;
+    std::u16string out = u"[";
+    for(size_t i = 0; i < tracked.keys.size(); i++) {
+        if(i > 0)
+            out += u',';
+        out += u"{\"productId\":" + jsonQuote(tracked.keys[i]);
+        if(!tracked.answers[i].empty()) {
+            out += u",\"error\":null,\"purchase\":" + tracked.answers[i] + u"}";
+            continue;
+        }
+        if(!batchError.empty()) {
+            out += u",\"error\":" + batchError + u",\"purchase\":null}";
+            continue;
+        }
+        if(next >= items.size()) {
+            out += u",\"error\":\"no answer from the store\",\"purchase\":null}";
+            continue;
+        }
+        const JsonSpan &item = items[next++];
+        JsonSpan error;
+        JsonSpan purchase;
+        bool failed = jsonField(item.begin, item.end, u"error", error) && *error.begin != u'n';
+        if(failed) {
+            out += u",\"error\":" + std::u16string(error.begin, error.end) + u",\"purchase\":null}";
+        } else if(jsonField(item.begin, item.end, u"purchase", purchase) && *purchase.begin == u'{') {
+            PurchaseInventory::Item consumed;
+            if(journalPurchase(purchase, PurchaseJournal::PURCHASED | PurchaseJournal::CONSUMED, tracked.keys[i], consumed))
+                _inventory.remove(consumed.token);
+            out += u",\"error\":null,\"purchase\":" + std::u16string(purchase.begin, purchase.end) + u"}";
+        } else {
+            out += u",\"error\":\"no purchase in the store's answer\",\"purchase\":null}";
+        }
+    }
+    out += u']';
+    return out;
+}
+
+///////////////////////////////////////
+//
+//  Deadlines
+//
+///////////////////////////////////////
+
+// asking the store again has no effect beyond a fresh answer
+static bool idempotent(Stats::Operation op)
+{
+    return op == Stats::OP_GET_PURCHASES || op == Stats::OP_AVAILABLE_PRODUCTS || op == Stats::OP_PRODUCT_DETAILS;
+}
+
+static ResultLane laneOf(Stats::Operation op)
+{
+    return op == Stats::OP_BUY || op == Stats::OP_CONSUME ? LANE_PURCHASE : LANE_REQUEST;
+}
+
+void Billing::setRequestPolicy(Stats::Operation op, const RequestPolicy &policy)
+{
+    std::lock_guard<std::mutex> lock(_pendingMutex);
+    _policies[op] = policy;
+}
+
+Billing::RequestPolicy Billing::getRequestPolicy(Stats::Operation op) const
+{
+    std::lock_guard<std::mutex> lock(_pendingMutex);
+    return _policies[op];
+}
+
+size_t Billing::pendingRequests() const
+{
+    std::lock_guard<std::mutex> lock(_pendingMutex);
+    size_t count = 0;
+    for(const auto &entry : _pending) {
+        if(entry.second.phase != PHASE_ABANDONED)
+            count++;
+    }
+    return count;
+}
+
+bool Billing::cancel(int requestId)
+{
+    Stats::Operation op;
+    {
+        std::lock_guard<std::mutex> lock(_pendingMutex);
+        auto it = _pending.find(requestId);
+        if(it == _pending.end() || it->second.phase == PHASE_ABANDONED) {
+            return false;
+        }
+        it->second.phase = PHASE_ABANDONED;
+        op = it->second.op;
+        _timers.schedule(requestId, Stats::now() + ABANDONED_MS * 1000ull);
+    }
+    _scheduler.cancel(requestId);
+    deliver(requestId, "Request cancelled", std::u16string(), laneOf(op));
+    return true;
+}
+
+void Billing::expire(uint64_t now)
+{
+    std::vector<int> due;
+    {
+        std::lock_guard<std::mutex> lock(_pendingMutex);
+        _timers.advance(now, due);
+    }
+    for(int requestId : due) {
+        enum { GIVE_UP, RETRY_LATER, RETRY_NOW, FORGET } action;
+        Pending pending;
+        {
+            std::lock_guard<std::mutex> lock(_pendingMutex);
+            auto it = _pending.find(requestId);
+            if(it == _pending.end() || _timers.scheduled(requestId)) {
+                continue;   // answered or re-armed in the meantime
+            }
+            Pending &p = it->second;
+            switch(p.phase) {
+            case PHASE_WAITING:
+                if(retryable(p)) {
+                    p.phase = PHASE_BACKOFF;
+                    _timers.schedule(requestId, now + backoffMicros(p.attempt));
+                    action = RETRY_LATER;
+                } else {
+                    p.phase = PHASE_ABANDONED;
+                    _timers.schedule(requestId, now + ABANDONED_MS * 1000ull);
+                    action = GIVE_UP;
+                }
+                break;
+            case PHASE_BACKOFF:
+                p.phase = PHASE_WAITING;
+                p.attempt++;
+                armDeadline(requestId, p.op, now);
+                action = RETRY_NOW;
+                break;
+            default:
+                action = FORGET;
+                break;
+            }
+            pending = p;
+            if(action == FORGET)
+                _pending.erase(it);
+        }
+
+        Tracked tracked;
+        switch(action) {
+        case RETRY_LATER:
+            // the store still owns this attempt, it keeps its slot until it
+            // answers; the retry queues behind it
+            _scheduler.cancel(requestId);
+            break;
+        case GIVE_UP:
+            _scheduler.cancel(requestId);
+            Stats::getInstance()->timedOut(requestId);
+            deliver(requestId, "Request timed out", std::u16string(), laneOf(pending.op));
+            break;
+        case RETRY_NOW:
+            Stats::getInstance()->retried(requestId);
+            if(!reissue(requestId, pending) && unwatch(requestId)) {
+                untrack(requestId, tracked);
+                deliver(requestId, "Request rejected by the store", std::u16string(), laneOf(pending.op));
+            }
+            break;
+        case FORGET:
+            // the store never answered; an operation still holding the
+            // scheduler would keep every later one queued
+            untrack(requestId, tracked);
+            _scheduler.abandon(requestId);
+            break;
+        }
+    }
+}
+
+// before the request is sent: the answer may come back from inside the call
+void Billing::watch(int requestId, Stats::Operation op, const std::vector<int> &skus)
+{
+    std::lock_guard<std::mutex> lock(_pendingMutex);
+    Pending &pending = _pending[requestId];
+    pending.op = op;
+    pending.phase = PHASE_WAITING;
+    pending.attempt = 0;
+    pending.skus = skus;
+    armDeadline(requestId, op, Stats::now());
+}
+
+bool Billing::unwatch(int requestId)
+{
+    std::lock_guard<std::mutex> lock(_pendingMutex);
+    _timers.cancel(requestId);
+    return _pending.erase(requestId) != 0;
+}
+
+// what becomes of a result, decided once under the lock so a result racing
+// its deadline or a cancel is delivered exactly once
+Billing::Settle Billing::settle(const Result &result)
+{
+    std::lock_guard<std::mutex> lock(_pendingMutex);
+    auto it = _pending.find(result.requestId);
+    if(it == _pending.end()) {
+        return SETTLE_DELIVER;
+    }
+    Pending &pending = it->second;
+    bool failed = !result.error.empty();
+    if(failed && pending.phase == PHASE_WAITING && retryable(pending)) {
+        pending.phase = PHASE_BACKOFF;
+        _timers.schedule(result.requestId, Stats::now() + backoffMicros(pending.attempt));
+        return SETTLE_RETRY;
+    }
+    if(failed && pending.phase == PHASE_BACKOFF) {
+        // an earlier attempt failing late, the retry is still to come
+        return SETTLE_RETRY;
+    }
+    // a late answer during the backoff is as good as the retry's
+    Settle settle = pending.phase == PHASE_ABANDONED ? SETTLE_SILENT : SETTLE_DELIVER;
+    _pending.erase(it);
+    _timers.cancel(result.requestId);
+    return settle;
+}
+
+// under _pendingMutex
+bool Billing::retryable(const Pending &pending) const
+{
+    return idempotent(pending.op) && pending.attempt < _policies[pending.op].retries;
+}
+
+// under _pendingMutex
+void Billing::armDeadline(int requestId, Stats::Operation op, uint64_t now)
+{
+    uint32_t timeoutMs = _policies[op].timeoutMs;
+    if(timeoutMs) {
+        _timers.schedule(requestId, now + timeoutMs * 1000ull);
+    } else {
+        _timers.cancel(requestId);
+    }
+}
+
+// Under _pendingMutex. Half the exponential backoff plus up to as much again
+// at random, so requests that failed together do not retry together.
+uint64_t Billing::backoffMicros(int attempt)
+{
+    uint64_t ms = RETRY_BACKOFF_MS;
+    for(int i = 0; i < attempt && ms < MAX_RETRY_BACKOFF_MS; i++) {
+        ms *= 2;
+    }
+    if(ms > MAX_RETRY_BACKOFF_MS)
+        ms = MAX_RETRY_BACKOFF_MS;
+    // xorshift32
+    _jitter ^= _jitter << 13;
+    _jitter ^= _jitter >> 17;
+    _jitter ^= _jitter << 5;
+    return (ms / 2 + _jitter % (ms / 2 + 1)) * 1000;
+}
+
+// the request is still tracked from its first attempt
+bool Billing::reissue(int requestId, const Pending &pending)
+{
+    switch(pending.op) {
+    case Stats::OP_GET_PURCHASES:
+        return _timed->getPurchases(requestId);
+    case Stats::OP_AVAILABLE_PRODUCTS:
+        return _timed->availableProducts(requestId);
+    case Stats::OP_PRODUCT_DETAILS:
+        return _scheduler.productDetails(pending.skus, requestId);
+    default:
+        return false;
+    }
+}
+
+///////////////////////////////////////
+//
+//  Results
+//
+///////////////////////////////////////
+
+void Billing::requestResult(int requestId, std::string error, std::u16string result)
+{
+    if(_trace.recording())
+        _trace.result(requestId, error, result);
+    Result r;
+    r.requestId = requestId;
+    r.error = std::move(error);
+    r.json = std::move(result);
+    route(std::move(r));
+}
+
+void Billing::requestResult(int requestId, std::string error, const std::string &result)
+{
+    requestResult(requestId, std::move(error), utf8ToUtf16(result));
+}
+
+void Billing::requestRecords(int requestId, std::vector<uint8_t> records)
+{
+    if(_trace.recording())
+        _trace.records(requestId, records);
+    Result r;
+    r.requestId = requestId;
+    r.records = std::move(records);
+    route(std::move(r));
+}
+
+void Billing::purchasesUpdated(std::u16string purchases, bool complete)
+{
+    if(_trace.recording())
+        _trace.purchases(purchases, complete);
+    std::vector<PurchaseInventory::Item> owned;
+    journalPurchases(purchases, PurchaseJournal::PURCHASED, std::string(), owned);
+    if(complete) {
+        _inventory.replace(owned);
+        _reconciled = true;
+    } else {
+        for(const PurchaseInventory::Item &item : owned)
+            _inventory.put(item);
+    }
+    purchasesChanged();
+}
+
+void Billing::productsUpdated(std::u16string products)
+{
+    if(_trace.recording())
+        _trace.products(products);
+    std::vector<CatalogEntry> entries;
+    if(!CatalogCache::parseProducts(products, entries) || entries.empty()) {
+        return;
+    }
+    std::u16string catalog;
+    {
+        std::lock_guard<std::mutex> lock(_catalogMutex);
+        if(!_catalog.merge(entries) || !_catalog.allProducts(catalog)) {
+            return;
+        }
+    }
+    deliver(EVENT_CATALOG_CHANGED, std::string(), std::move(catalog), LANE_EVENT);
+}
+
+void Billing::contentUpdated(std::u16string progress)
+{
+    deliver(EVENT_CONTENT_PROGRESS, std::string(), std::move(progress), LANE_EVENT);
+}
+
+void Billing::purchasesVerified(int requestId, std::string error, std::u16string results)
+{
+    deliver(requestId, std::move(error), std::move(results));
+}
+
+void Billing::route(Result &&result)
+{
+    Stats::getInstance()->answered(result.requestId);
+    if(_scheduler.finish(result)) {
+        return;
+    }
+    handleResult(std::move(result));
+}
+
+// product objects of a successful result, whichever encoding it uses
+static bool parseProducts(const Result &result, std::vector<CatalogEntry> &entries)
+{
+    if(!result.records.empty()) {
+        std::u16string json;
+        return recordsToJson(result.records, json) && CatalogCache::parseProducts(json, entries);
+    }
+    return CatalogCache::parseProducts(result.json, entries);
+}
+
+void Billing::handleResult(Result &&result)
+{
+    Settle outcome = settle(result);
+    if(outcome == SETTLE_RETRY) {
+        return;
+    }
+    // a late answer to a drained attempt settles the request, drop a retry
+    // still queued for it
+    if(!Scheduler::isInternalId(result.requestId)) {
+        _scheduler.cancel(result.requestId);
+    }
+    // the caller of a request given up on already has its error
+    bool silent = outcome == SETTLE_SILENT;
+    auto reply = [this, silent](Result &&r) {
+        if(!silent)
+            deliver(std::move(r));
+    };
+
+    Tracked tracked;
+    if(!untrack(result.requestId, tracked)) {
+        if(Scheduler::isInternalId(result.requestId)) {
+            // internal request that was rejected, nobody is waiting for it
+            return;
+        }
+        reply(std::move(result));
+        return;
+    }
+
+    bool ok = result.error.empty();
+    std::vector<PurchaseInventory::Item> owned;
+    switch(tracked.kind) {
+    case REQUEST_INIT:
+        reply(std::move(result));
+        if(ok) {
+            refreshCatalog();
+            reconcilePurchases();
+        }
+        break;
+    case REQUEST_AVAILABLE_PRODUCTS:
+    case REQUEST_PRODUCT_DETAILS:
+        if(ok) {
+            std::vector<CatalogEntry> entries;
+            if(parseProducts(result, entries)) {
+                std::lock_guard<std::mutex> lock(_catalogMutex);
+                _catalog.merge(entries);
+            }
+        }
+        reply(std::move(result));
+        break;
+    case REQUEST_CATALOG_REFRESH:
+        if(ok) {
+            std::vector<CatalogEntry> entries;
+            bool changed = false;
+            if(parseProducts(result, entries) && !entries.empty()) {
+                std::lock_guard<std::mutex> lock(_catalogMutex);
+                changed = _catalog.update(entries);
+            }
+            if(changed) {
+                result.requestId = EVENT_CATALOG_CHANGED;
+                result.lane = LANE_EVENT;
+                deliver(std::move(result));
+            }
+        }
+        break;
+    case REQUEST_PURCHASE:
+        if(ok) {
+            journalPurchases(result, PurchaseJournal::PURCHASED, std::string(), owned);
+            for(const PurchaseInventory::Item &item : owned)
+                _inventory.put(item);
+        }
+        result.lane = LANE_PURCHASE;
+        reply(std::move(result));
+        break;
+    case REQUEST_CONSUME:
+        if(ok) {
+            journalPurchases(result, PurchaseJournal::PURCHASED | PurchaseJournal::CONSUMED, tracked.key, owned);
+            for(const PurchaseInventory::Item &item : owned)
+                _inventory.remove(item.token);
+        }
+        result.lane = LANE_PURCHASE;
+        reply(std::move(result));
+        break;
+    case REQUEST_CONSUME_MANY:
+        // failures are reported per sku, the batch itself always succeeds
+        result.json = mergeConsumed(result, tracked);
+        result.error.clear();
+        result.records.clear();
+        result.lane = LANE_PURCHASE;
+        reply(std::move(result));
+        break;
+    case REQUEST_RECONCILE:
+        if(ok) {
+            journalPurchases(result, PurchaseJournal::PURCHASED, std::string(), owned);
+            _inventory.replace(owned);
+            _reconciled = true;
+        }
+        if(!Scheduler::isInternalId(result.requestId)) {
+            reply(std::move(result));
+        }
+        break;
+    }
+    // after the result itself, so a watcher hears of a purchase second
+    purchasesChanged();
+}
+
+void Billing::deliver(Result &&result)
+{
+    ResultHandler handler;
+    {
+        std::lock_guard<std::mutex> lock(_handlerMutex);
+        handler = _resultHandler;
+    }
+    if(handler) {
+        handler(std::move(result));
+    }
+}
+
+void Billing::deliver(int requestId, std::string error, std::u16string result, ResultLane lane)
+{
+    Result r;
+    r.requestId = requestId;
+    r.error = std::move(error);
+    r.json = std::move(result);
+    r.lane = lane;
+    deliver(std::move(r));
+}
+
+} // namespace iap
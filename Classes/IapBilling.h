@@ -0,0 +1,285 @@
+#ifndef IapBilling_h
+#define IapBilling_h
+
+#include "IapBackend.h"
+#include "IapCatalogCache.h"
+#include "IapInventory.h"
+#include "IapJournal.h"
+#include "IapJsonScan.h"
+#include "IapModel.h"
+#include "IapResult.h"
+#include "IapScheduler.h"
+#include "IapStats.h"
+#include "IapTimerWheel.h"
+#include "IapTrace.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Billing core
+//
+///////////////////////////////////////
+
+// Platform-neutral entry point shared by the JS bindings, the platform
+// adapters and the simulated store. It owns the active backend and routes
+// results back to whoever installed the result handler.
+//
+// Store operations are queued by the Scheduler so concurrent requests wait
+// for each other instead of being rejected. Product queries go through the
+// catalog cache: available_products and product_details are answered from
+// it when possible, and a successful init revalidates it in the background.
+// When the refreshed catalog differs from the cached one an
+// EVENT_CATALOG_CHANGED result carrying the new product array is emitted,
+// as it is for every batch of products a backend streams in on its own.
+//
+// Purchases and consumes that succeed are written to the purchase journal.
+// After init the store's owned purchases are reconciled into it, and a
+// consume the journal already saw succeed is answered without the store;
+// consume_many sends only the rest to the store, as one batch.
+//
+// Every purchase result also updates the versioned inventory of owned
+// purchases, as do purchases the store pushes on its own. While someone
+// watches it, each change is emitted as an EVENT_PURCHASES_CHANGED result
+// carrying only what changed since the previous one.
+//
+// Every request is stamped for the latency statistics (IapStats.h); store
+// calls pass through a TimedBackend in front of the real backend.
+//
+// Requests waiting for the store carry an optional deadline, per operation.
+// When it passes, or the request is cancelled, the caller gets an error
+// result right away and the request leaves the Scheduler; the idempotent
+// queries (get_purchases, available_products, product_details) are first
+// asked again, after a jittered backoff, as they are after a store error.
+// A late answer to a request given up on still updates the journal, the
+// inventory and the catalog, it is just not delivered.
+//
+// While a trace is recording, every request, every store call and everything
+// the backend hands back is appended to the trace file (IapTrace.h), for
+// replaying the same traffic off-device.
+class Billing
+{
+public:
+    // request ids below zero never belong to a JS callback
+    static const int EVENT_CATALOG_CHANGED = -1;
+    static const int EVENT_PURCHASES_CHANGED = -2;
+    static const int EVENT_CONTENT_PROGRESS = -3;
+
+    struct RequestPolicy
+    {
+        uint32_t timeoutMs;     // 0 waits for the store forever
+        int retries;            // get_purchases, available_products and product_details only
+
+        RequestPolicy(uint32_t timeoutMs = 0, int retries = 0) : timeoutMs(timeoutMs), retries(retries) {}
+    };
+
+    // backoff before the first retry, doubled for each further one
+    static const uint32_t RETRY_BACKOFF_MS = 250;
+    static const uint32_t MAX_RETRY_BACKOFF_MS = 8000;
+    // how long a late answer to a request given up on is still expected
+    static const uint32_t ABANDONED_MS = 10 * 60 * 1000;
+
+    static Billing* getInstance();
+
+    // takes ownership of the backend
+    void setBackend(Backend *backend);
+    Backend* getBackend() const { return _backend.get(); }
+
+    void setResultHandler(const ResultHandler &handler);
+
+    // maps the cache file, if any; results are cached in memory without it
+    bool openCatalogCache(const std::string &path);
+    CatalogCache& getCatalogCache() { return _catalog; }
+
+    // replays the purchase journal; in memory only without it
+    bool openJournal(const std::string &path);
+    PurchaseJournal& getJournal() { return _journal; }
+
+    // the game applied the purchase; false for a token the journal doesn't know
+    bool markGranted(const std::string &token);
+    // purchases recorded as bought but never granted, oldest first
+    std::vector<PurchaseJournal::Entry> pendingGrants() const;
+
+    PurchaseInventory& getInventory() { return _inventory; }
+
+    // The cached catalog and the owned purchases as tables, rebuilt on
+    // first use after they change. A snapshot stays valid while held.
+    std::shared_ptr<const ProductTable> productTable();
+    std::shared_ptr<const PurchaseTable> purchaseTable();
+    // Emits the inventory changes after since right away, then again every
+    // time the inventory changes, until unwatchPurchases().
+    void watchPurchases(uint64_t since);
+    void unwatchPurchases();
+
+    // same contract as Backend
+    bool init(const std::vector<std::string> &skus, bool internalValidation, int requestId);
+    bool getPurchases(int requestId);
+    bool buy(const std::string &sku, const std::string &payload, int requestId);
+    bool subscribe(const std::string &sku, const std::string &payload, const std::vector<std::string> &oldSkus, int requestId);
+    bool consume(const std::string &sku, int requestId);
+    // one result: an array of {productId, error, purchase} in sku order
+    bool consumeMany(const std::vector<std::string> &skus, int requestId);
+    bool availableProducts(int requestId);
+    // skus as SkuTable handles; invalid handles are dropped
+    bool productDetails(const std::vector<int> &skus, int requestId);
+    // interns the skus and forwards
+    bool productDetails(const std::vector<std::string> &skus, int requestId);
+    bool restore(int requestId);
+    bool setDebug(bool debug);
+
+    void setRequestPolicy(Stats::Operation op, const RequestPolicy &policy);
+    RequestPolicy getRequestPolicy(Stats::Operation op) const;
+    // Gives up on a pending request, whose caller gets "Request cancelled".
+    // False when it is not waiting for the store (answered, or never sent).
+    bool cancel(int requestId);
+    // Fires due deadlines and retries; call regularly, e.g. every frame.
+    void expire(uint64_t now = Stats::now());
+    // requests waiting for the store or for a retry
+    size_t pendingRequests() const;
+
+    // Records the store traffic into a trace file until stopTrace(); false
+    // when the file can't be created.
+    bool startTrace(const std::string &path);
+    void stopTrace();
+
+    // Turns compact binary results (IapRecords.h) on or off. False when the
+    // backend only produces JSON.
+    bool setBinaryResults(bool enabled);
+
+    // thread safe, may be called by backends from any thread
+    void requestResult(int requestId, std::string error, std::u16string result);
+    // convenience for backends producing UTF-8, converts once
+    void requestResult(int requestId, std::string error, const std::string &result);
+    // successful result encoded as records
+    void requestRecords(int requestId, std::vector<uint8_t> records);
+    // Purchases the store reported outside any request (StoreKit
+    // transaction updates, Google Play inventory queries): one purchase
+    // object or an array; complete when that is everything the user owns.
+    void purchasesUpdated(std::u16string purchases, bool complete);
+    // Products the store reported outside any request (Google Play detail
+    // slices streamed after init): merged into the catalog cache, and an
+    // EVENT_CATALOG_CHANGED result with the whole catalog is emitted when
+    // that changed it.
+    void productsUpdated(std::u16string products);
+    // Download and install progress of purchased content
+    // (IapContentInstaller.h), one ContentProgress object: emitted as an
+    // EVENT_CONTENT_PROGRESS result.
+    void contentUpdated(std::u16string progress);
+    // Signature checks of a verify_purchases call (IapVerifier.h), made on
+    // the verifier's thread: a JSON array of booleans in purchase order, or
+    // an error when the key is invalid.
+    void purchasesVerified(int requestId, std::string error, std::u16string results);
+
+private:
+    enum RequestKind
+    {
+        REQUEST_INIT,
+        REQUEST_AVAILABLE_PRODUCTS,
+        REQUEST_PRODUCT_DETAILS,
+        REQUEST_CATALOG_REFRESH,
+        REQUEST_PURCHASE,
+        REQUEST_CONSUME,
+        REQUEST_CONSUME_MANY,
+        REQUEST_RECONCILE
+    };
+
+    struct Tracked
+    {
+        RequestKind kind;
+        std::string key; // consume: the sku or token it was called with
+        // consume_many: every sku, and the purchases answered locally (empty
+        // for the skus sent to the store)
+        std::vector<std::string> keys;
+        std::vector<std::u16string> answers;
+    };
+
+    enum Phase
+    {
+        PHASE_WAITING,      // for the store, until the deadline if any
+        PHASE_BACKOFF,      // until the retry
+        PHASE_ABANDONED     // answered with an error, a late answer is only applied
+    };
+
+    struct Pending
+    {
+        Stats::Operation op;
+        Phase phase;
+        int attempt;
+        std::vector<int> skus;  // product_details, for retries
+    };
+
+    enum Settle
+    {
+        SETTLE_DELIVER,
+        SETTLE_SILENT,      // apply without delivering
+        SETTLE_RETRY        // failed, asked again later
+    };
+
+    Billing();
+
+    void track(int requestId, RequestKind kind, const std::string &key = std::string());
+    void track(int requestId, Tracked &&tracked);
+    bool untrack(int requestId, Tracked &tracked);
+    void refreshCatalog();
+    void reconcilePurchases();
+    bool consumedLocally(const std::string &key, std::u16string &result) const;
+    void journalPurchases(const Result &result, uint32_t state, const std::string &key, std::vector<PurchaseInventory::Item> &owned);
+    void journalPurchases(const std::u16string &json, uint32_t state, const std::string &key, std::vector<PurchaseInventory::Item> &owned);
+    bool journalPurchase(const JsonSpan &item, uint32_t state, const std::string &key, PurchaseInventory::Item &owned);
+    std::u16string mergeConsumed(const Result &result, const Tracked &tracked);
+    void purchasesChanged();
+    void watch(int requestId, Stats::Operation op, const std::vector<int> &skus = std::vector<int>());
+    bool unwatch(int requestId);
+    Settle settle(const Result &result);
+    bool retryable(const Pending &pending) const;
+    void armDeadline(int requestId, Stats::Operation op, uint64_t now);
+    uint64_t backoffMicros(int attempt);
+    bool reissue(int requestId, const Pending &pending);
+    void route(Result &&result);
+    void handleResult(Result &&result);
+    void deliver(Result &&result);
+    void deliver(int requestId, std::string error, std::u16string result, ResultLane lane = LANE_REQUEST);
+
+    TraceWriter _trace;
+    std::unique_ptr<Backend> _backend;
+    std::unique_ptr<TracingBackend> _tracing;
+    std::unique_ptr<TimedBackend> _timed;
+    ResultHandler _resultHandler;
+    std::mutex _handlerMutex;
+
+    Scheduler _scheduler;
+    CatalogCache _catalog;
+    std::mutex _catalogMutex;   // merges read, modify and rewrite the cache
+    std::unordered_map<int, Tracked> _tracked;
+    std::mutex _trackMutex;
+
+    PurchaseJournal _journal;
+    std::atomic<bool> _reconciled;
+
+    PurchaseInventory _inventory;
+    bool _watching;
+    uint64_t _watchedVersion;
+    std::mutex _watchMutex;
+
+    std::shared_ptr<const ProductTable> _productTable;
+    uint64_t _productTableGeneration;
+    std::shared_ptr<const PurchaseTable> _purchaseTable;
+    uint64_t _purchaseTableVersion;
+    std::mutex _tableMutex;
+
+    std::unordered_map<int, Pending> _pending;
+    TimerWheel _timers;
+    RequestPolicy _policies[Stats::OP_COUNT];
+    uint32_t _jitter;
+    mutable std::mutex _pendingMutex;
+};
+
+} // namespace iap
+
+#endif /* IapBilling_h */
@@ -0,0 +1,145 @@
+#include "IapBlobCache.h"
+#include "IapBase64.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace iap {
+
+static long mtimeNsec(const struct stat &st)
+{
+#if defined(__APPLE__)
+    return st.st_mtimespec.tv_nsec;
+#elif defined(__ANDROID__)
+    return (long)st.st_mtime_nsec;
+#else
+    return st.st_mtim.tv_nsec;
+#endif
+}
+
+static const Blob& emptyBlob()
+{
+    static const Blob empty = std::make_shared<const std::string>();
+    return empty;
+}
+
+BlobCache* BlobCache::getInstance()
+{
+    static BlobCache instance;
+    return &instance;
+}
+
+Blob BlobCache::encodedFile(const std::string &path)
+{
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        invalidate(path);
+        return emptyBlob();
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _entries.find(path);
+        if(it != _entries.end() && it->second.size == (long long)st.st_size &&
+           it->second.mtime == (long long)st.st_mtime && it->second.mtimeNsec == mtimeNsec(st)) {
+            return it->second.encoded;
+        }
+    }
+
+    // encode outside the lock, receipts can be large
+    Entry fresh;
+    if(!encode(path, fresh)) {
+        return emptyBlob();
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries[path] = fresh;
+    return fresh.encoded;
+}
+
+void BlobCache::invalidate(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.erase(path);
+}
+
+void BlobCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.clear();
+}
+
+static bool sameFile(const struct stat &a, const struct stat &b)
+{
+    return a.st_size == b.st_size && a.st_mtime == b.st_mtime && mtimeNsec(a) == mtimeNsec(b);
+}
+
+// the slow path, safe against the file shrinking: a short read just ends
+// early instead of faulting like a mapping does
+static void readAll(int fd, std::string &data, size_t size)
+{
+    data.resize(size);
+    size_t done = 0;
+    while(done < size) {
+        ssize_t n = pread(fd, &data[done], size - done, (off_t)done);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+        done += (size_t)n;
+    }
+    data.resize(done);
+}
+
+bool BlobCache::encode(const std::string &path, Entry &entry)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+    // the size of the file this fd holds, not the one stat() saw by name
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+    entry.size = st.st_size;
+    entry.mtime = st.st_mtime;
+    entry.mtimeNsec = mtimeNsec(st);
+    if(st.st_size == 0) {
+        ::close(fd);
+        entry.encoded = emptyBlob();
+        return true;
+    }
+
+    size_t size = (size_t)st.st_size;
+    std::shared_ptr<std::string> text = std::make_shared<std::string>(base64EncodedSize(size), '\0');
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    bool mapped = addr != MAP_FAILED;
+    if(mapped) {
+        base64Encode((const uint8_t*)addr, size, &(*text)[0]);
+        munmap(addr, size);
+    }
+    // Re-validate through the same fd: the store replaces the receipt (a new
+    // inode, the mapping keeps the old one), but a file rewritten in place
+    // while mapped may have been encoded half old, half new. Read it again
+    // with read(), which a shrinking file cannot fault.
+    struct stat after = st;
+    if(mapped && (fstat(fd, &after) != 0 || !sameFile(st, after))) {
+        mapped = false;
+    }
+    if(!mapped) {
+        std::string data;
+        readAll(fd, data, (size_t)after.st_size);
+        text->assign(base64EncodedSize(data.size()), '\0');
+        base64Encode((const uint8_t*)data.data(), data.size(), &(*text)[0]);
+        entry.size = data.size();
+        entry.mtime = after.st_mtime;
+        entry.mtimeNsec = mtimeNsec(after);
+    }
+    ::close(fd);
+    entry.encoded = text;
+    return true;
+}
+
+} // namespace iap
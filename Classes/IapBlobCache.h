@@ -0,0 +1,55 @@
+#ifndef IapBlobCache_h
+#define IapBlobCache_h
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace iap {
+
+// Immutable blob shared by every result that carries it
+typedef std::shared_ptr<const std::string> Blob;
+
+///////////////////////////////////////
+//
+//  Encoded file cache
+//
+///////////////////////////////////////
+
+// Base64 of large opaque files attached to results (the App Store receipt).
+// The file is memory-mapped and encoded once; later reads cost a stat() and
+// return the same Blob until the file's size or mtime changes or the entry
+// is invalidated. A file that changes while it is being encoded is read
+// again with read().
+class BlobCache
+{
+public:
+    static BlobCache* getInstance();
+
+    // empty blob when the file is missing or unreadable
+    Blob encodedFile(const std::string &path);
+
+    // forget the entry, e.g. after the store rewrote the file
+    void invalidate(const std::string &path);
+    void clear();
+
+private:
+    struct Entry
+    {
+        long long size;
+        long long mtime;     // seconds
+        long mtimeNsec;
+        Blob encoded;
+    };
+
+    // fills entry with the size and mtime of the file actually encoded
+    static bool encode(const std::string &path, Entry &entry);
+
+    std::mutex _mutex;
+    std::unordered_map<std::string, Entry> _entries;
+};
+
+} // namespace iap
+
+#endif /* IapBlobCache_h */
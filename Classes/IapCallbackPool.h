@@ -0,0 +1,125 @@
+#ifndef IapCallbackPool_h
+#define IapCallbackPool_h
+
+#include <new>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Pending callback pool
+//
+///////////////////////////////////////
+
+// Fixed-capacity slab of pending callbacks. Ids encode the slot index in
+// the low bits and the slot generation above it, so a result for a slot
+// that was released (or reused) is detected and rejected in O(1) without a
+// map lookup. Nothing is allocated after construction. Not thread safe: all
+// calls are expected on the JS thread.
+template<typename T, int Capacity>
+class CallbackPool
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    CallbackPool() : _freeTop(Capacity), _inUse(0) {
+        for(int i = 0; i < Capacity; i++) {
+            _generation[i] = 1;
+            _used[i] = false;
+            // hand out low slots first
+            _free[i] = Capacity - 1 - i;
+        }
+    }
+
+    ~CallbackPool() {
+        for(int i = 0; i < Capacity; i++) {
+            if(_used[i])
+                slot(i)->~T();
+        }
+    }
+
+    // constructs T in a free slot, returns its id or 0 when the pool is full
+    template<typename... Args>
+    int acquire(Args&&... args) {
+        if(_freeTop == 0) {
+            return 0;
+        }
+        int index = _free[--_freeTop];
+        new (&_storage[index]) T(std::forward<Args>(args)...);
+        _used[index] = true;
+        _inUse++;
+        return makeId(index, _generation[index]);
+    }
+
+    // nullptr for unknown, released or stale ids
+    T* get(int id) {
+        int index = indexOf(id);
+        if(index < 0) {
+            return nullptr;
+        }
+        return slot(index);
+    }
+
+    // destroys the entry and returns its slot; false for unknown or stale ids
+    bool release(int id) {
+        int index = indexOf(id);
+        if(index < 0) {
+            return false;
+        }
+        slot(index)->~T();
+        _used[index] = false;
+        _generation[index] = nextGeneration(_generation[index]);
+        _free[_freeTop++] = index;
+        _inUse--;
+        return true;
+    }
+
+    int inUse() const { return _inUse; }
+    static int capacity() { return Capacity; }
+
+private:
+    static constexpr int log2(int n) { return n <= 1 ? 0 : 1 + log2(n / 2); }
+
+    static const int SLOT_BITS = log2(Capacity);
+    static const uint32_t GENERATION_MASK = 0x7fffffffu >> SLOT_BITS;
+
+    static int makeId(int index, uint32_t generation) {
+        return (int)((generation << SLOT_BITS) | (uint32_t)index);
+    }
+
+    static uint32_t nextGeneration(uint32_t generation) {
+        generation = (generation + 1) & GENERATION_MASK;
+        // generation 0 is never used so that no id equals 0
+        return generation == 0 ? 1 : generation;
+    }
+
+    int indexOf(int id) const {
+        if(id <= 0) {
+            return -1;
+        }
+        int index = id & (Capacity - 1);
+        uint32_t generation = (uint32_t)id >> SLOT_BITS;
+        if(!_used[index] || _generation[index] != generation) {
+            return -1;
+        }
+        return index;
+    }
+
+    T* slot(int index) {
+        return reinterpret_cast<T*>(&_storage[index]);
+    }
+
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type _storage[Capacity];
+    uint32_t _generation[Capacity];
+    bool _used[Capacity];
+    int _free[Capacity];
+    int _freeTop;
+    int _inUse;
+};
+
+} // namespace iap
+
+#endif /* IapCallbackPool_h */
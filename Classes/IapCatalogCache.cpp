@@ -0,0 +1,353 @@
+#include "IapCatalogCache.h"
+#include "IapJsonScan.h"
+#include "IapSkuTable.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace iap {
+
+static const char CATALOG_MAGIC[4] = { 'I', 'A', 'P', 'C' };
+static const uint32_t CATALOG_VERSION = 1;
+
+static uint64_t fnv1a(const uint8_t *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+CatalogCache::CatalogCache()
+: _data(nullptr)
+, _dataSize(0)
+, _generation(0)
+{
+}
+
+CatalogCache::~CatalogCache()
+{
+    close();
+}
+
+bool CatalogCache::open(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _path = path;
+    return map(path);
+}
+
+void CatalogCache::close()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    unmap();
+}
+
+bool CatalogCache::empty() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _order.empty();
+}
+
+size_t CatalogCache::size() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _order.size();
+}
+
+uint64_t CatalogCache::generation() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _generation;
+}
+
+bool CatalogCache::allProducts(std::u16string &out) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_order.empty()) {
+        return false;
+    }
+    std::vector<Span> spans;
+    spans.reserve(_order.size());
+    for(const std::string &sku : _order) {
+        spans.push_back(_index.find(sku)->second);
+    }
+    appendArray(spans, out);
+    return true;
+}
+
+bool CatalogCache::products(const std::vector<int> &skus, std::u16string &out) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<Span> spans;
+    spans.reserve(skus.size());
+    for(int sku : skus) {
+        const Span *span = spanOf(sku);
+        if(!span) {
+            return false;
+        }
+        spans.push_back(*span);
+    }
+    appendArray(spans, out);
+    return true;
+}
+
+bool CatalogCache::update(const std::vector<CatalogEntry> &entries)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    bool changed = entries.size() != _order.size();
+    for(size_t i = 0; !changed && i < entries.size(); i++) {
+        auto it = _index.find(entries[i].sku);
+        changed = it == _index.end()
+            || it->second.length != entries[i].json.size()
+            || memcmp(it->second.json, entries[i].json.data(), it->second.length * sizeof(char16_t)) != 0;
+    }
+    if(changed) {
+        write(entries);
+    }
+    return changed;
+}
+
+bool CatalogCache::merge(const std::vector<CatalogEntry> &entries)
+{
+    std::vector<CatalogEntry> merged;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::unordered_map<std::string, const CatalogEntry*> incoming;
+        for(const CatalogEntry &entry : entries) {
+            incoming[entry.sku] = &entry;
+        }
+        merged.reserve(_order.size() + entries.size());
+        for(const std::string &sku : _order) {
+            auto replaced = incoming.find(sku);
+            if(replaced != incoming.end()) {
+                merged.push_back(*replaced->second);
+                incoming.erase(replaced);
+            } else {
+                const Span &span = _index.find(sku)->second;
+                CatalogEntry entry;
+                entry.sku = sku;
+                entry.json.assign(span.json, span.length);
+                merged.push_back(std::move(entry));
+            }
+        }
+        for(const CatalogEntry &entry : entries) {
+            if(incoming.count(entry.sku)) {
+                merged.push_back(entry);
+                incoming.erase(entry.sku);
+            }
+        }
+    }
+    return update(merged);
+}
+
+const CatalogCache::Span* CatalogCache::spanOf(int handle) const
+{
+    SkuTable *table = SkuTable::getInstance();
+    if(!table->valid(handle)) {
+        return nullptr;
+    }
+    // handles interned since the last lookup are resolved by name once
+    while((int)_byHandle.size() <= handle) {
+        auto it = _index.find(table->name((int)_byHandle.size()));
+        _byHandle.push_back(it != _index.end() ? it->second : Span{ nullptr, 0 });
+    }
+    const Span &span = _byHandle[handle];
+    return span.json ? &span : nullptr;
+}
+
+void CatalogCache::appendArray(const std::vector<Span> &spans, std::u16string &out) const
+{
+    size_t total = 2;
+    for(const Span &span : spans) {
+        total += span.length + 1;
+    }
+    out.reserve(out.size() + total);
+    out += u'[';
+    for(size_t i = 0; i < spans.size(); i++) {
+        if(i > 0) out += u',';
+        out.append(spans[i].json, spans[i].length);
+    }
+    out += u']';
+}
+
+///////////////////////////////////////
+//
+//  File mapping
+//
+///////////////////////////////////////
+
+bool CatalogCache::map(const std::string &path)
+{
+    unmap();
+    if(path.empty()) {
+        return false;
+    }
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+        ::close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(addr == MAP_FAILED) {
+        return false;
+    }
+    const uint8_t *data = (const uint8_t*)addr;
+
+    Header header;
+    memcpy(&header, data, sizeof(header));
+    bool valid = memcmp(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) == 0
+        && header.version == CATALOG_VERSION
+        && sizeof(Header) + (uint64_t)header.count * sizeof(Entry) <= size
+        && fnv1a(data + sizeof(Header), size - sizeof(Header)) == header.checksum;
+    if(valid) {
+        const Entry *entries = (const Entry*)(data + sizeof(Header));
+        for(uint32_t i = 0; i < header.count && valid; i++) {
+            const Entry &e = entries[i];
+            valid = (uint64_t)e.skuOffset + e.skuLength <= size
+                && (e.jsonOffset & 1) == 0
+                && (uint64_t)e.jsonOffset + (uint64_t)e.jsonLength * sizeof(char16_t) <= size;
+            if(valid) {
+                std::string sku((const char*)data + e.skuOffset, e.skuLength);
+                Span span = { (const char16_t*)(data + e.jsonOffset), e.jsonLength };
+                if(_index.emplace(sku, span).second)
+                    _order.push_back(std::move(sku));
+            }
+        }
+    }
+    if(!valid) {
+        munmap(addr, size);
+        _index.clear();
+        _order.clear();
+        _byHandle.clear();
+        return false;
+    }
+    _data = data;
+    _dataSize = size;
+    return true;
+}
+
+void CatalogCache::unmap()
+{
+    if(_data) {
+        munmap((void*)_data, _dataSize);
+        _data = nullptr;
+        _dataSize = 0;
+    }
+    _index.clear();
+    _order.clear();
+    _byHandle.clear();
+    // every change of content starts here
+    _generation++;
+}
+
+bool CatalogCache::write(const std::vector<CatalogEntry> &entries)
+{
+    size_t jsonBytes = 0;
+    size_t skuBytes = 0;
+    for(const CatalogEntry &entry : entries) {
+        jsonBytes += entry.json.size() * sizeof(char16_t);
+        skuBytes += entry.sku.size();
+    }
+    size_t jsonStart = sizeof(Header) + entries.size() * sizeof(Entry);
+    size_t skuStart = jsonStart + jsonBytes;
+    std::vector<uint8_t> buffer(skuStart + skuBytes);
+
+    Entry *table = (Entry*)(buffer.data() + sizeof(Header));
+    size_t jsonPos = jsonStart;
+    size_t skuPos = skuStart;
+    for(size_t i = 0; i < entries.size(); i++) {
+        const CatalogEntry &entry = entries[i];
+        table[i].skuOffset = (uint32_t)skuPos;
+        table[i].skuLength = (uint32_t)entry.sku.size();
+        table[i].jsonOffset = (uint32_t)jsonPos;
+        table[i].jsonLength = (uint32_t)entry.json.size();
+        memcpy(buffer.data() + skuPos, entry.sku.data(), entry.sku.size());
+        memcpy(buffer.data() + jsonPos, entry.json.data(), entry.json.size() * sizeof(char16_t));
+        skuPos += entry.sku.size();
+        jsonPos += entry.json.size() * sizeof(char16_t);
+    }
+
+    Header header;
+    memcpy(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+    header.version = CATALOG_VERSION;
+    header.count = (uint32_t)entries.size();
+    header.reserved = 0;
+    header.checksum = fnv1a(buffer.data() + sizeof(Header), buffer.size() - sizeof(Header));
+    memcpy(buffer.data(), &header, sizeof(header));
+
+    // write next to the old file and rename over it, readers never see a torn file
+    bool written = false;
+    if(!_path.empty()) {
+        std::string tmp = _path + ".tmp";
+        FILE *f = fopen(tmp.c_str(), "wb");
+        if(f) {
+            written = fwrite(buffer.data(), 1, buffer.size(), f) == buffer.size();
+            written = fflush(f) == 0 && written;
+            written = fsync(fileno(f)) == 0 && written;
+            fclose(f);
+            written = written && rename(tmp.c_str(), _path.c_str()) == 0;
+            if(!written)
+                remove(tmp.c_str());
+        }
+    }
+    if(written && map(_path)) {
+        return true;
+    }
+
+    // no file (or no path): keep the catalog in memory for this session
+    unmap();
+    uint8_t *copy = (uint8_t*)mmap(nullptr, buffer.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(copy == MAP_FAILED) {
+        return false;
+    }
+    memcpy(copy, buffer.data(), buffer.size());
+    _data = copy;
+    _dataSize = buffer.size();
+    for(size_t i = 0; i < entries.size(); i++) {
+        Span span = { (const char16_t*)(copy + table[i].jsonOffset), table[i].jsonLength };
+        if(_index.emplace(entries[i].sku, span).second)
+            _order.push_back(entries[i].sku);
+    }
+    return written;
+}
+
+///////////////////////////////////////
+//
+//  Product array parsing
+//
+///////////////////////////////////////
+
+bool CatalogCache::parseProducts(const std::u16string &json, std::vector<CatalogEntry> &entries)
+{
+    std::vector<JsonSpan> items;
+    if(!jsonArrayItems(json.data(), json.data() + json.size(), items)) {
+        return false;
+    }
+    for(const JsonSpan &item : items) {
+        if(*item.begin != u'{') {
+            return false;
+        }
+        CatalogEntry entry;
+        entry.sku = jsonStringField(item.begin, item.end, u"productId");
+        if(entry.sku.empty()) {
+            return false;
+        }
+        entry.json.assign(item.begin, item.end);
+        entries.push_back(std::move(entry));
+    }
+    return true;
+}
+
+} // namespace iap
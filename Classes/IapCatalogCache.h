@@ -0,0 +1,110 @@
+#ifndef IapCatalogCache_h
+#define IapCatalogCache_h
+
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace iap {
+
+struct CatalogEntry
+{
+    std::string sku;
+    std::u16string json; // product object, as the store returned it
+};
+
+///////////////////////////////////////
+//
+//  Persistent product catalog
+//
+///////////////////////////////////////
+
+// Products from the last successful store query, persisted in a compact
+// binary file that is memory-mapped at startup so available_products and
+// product_details can be answered before the store responds.
+//
+// File layout (native endianness, the file never leaves the device):
+//   Header
+//   Entry[count]
+//   char16_t json data      (product objects, the form the result path consumes)
+//   char sku data           (UTF-8)
+// The checksum covers everything after the header; a file that fails
+// validation is ignored and rewritten on the next update.
+class CatalogCache
+{
+public:
+    CatalogCache();
+    ~CatalogCache();
+
+    // maps the file if present; returns false when there is no valid cache
+    bool open(const std::string &path);
+    void close();
+
+    bool empty() const;
+    size_t size() const;
+    // advances every time the content may have changed
+    uint64_t generation() const;
+
+    // JSON array of every cached product
+    bool allProducts(std::u16string &out) const;
+    // JSON array of the requested products (SkuTable handles); false unless
+    // all of them are cached
+    bool products(const std::vector<int> &skus, std::u16string &out) const;
+
+    // Replaces the catalog and rewrites the file atomically. Returns true
+    // when the content differs from what was cached before.
+    bool update(const std::vector<CatalogEntry> &entries);
+    // Adds or replaces the given products, keeping the others.
+    bool merge(const std::vector<CatalogEntry> &entries);
+
+    // Splits a flat JSON array of product objects (the available_products
+    // shape) into entries keyed by productId. False for any other shape.
+    static bool parseProducts(const std::u16string &json, std::vector<CatalogEntry> &entries);
+
+private:
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t count;
+        uint32_t reserved;
+        uint64_t checksum;
+    };
+
+    struct Entry
+    {
+        uint32_t skuOffset;   // bytes from the start of the file
+        uint32_t skuLength;   // bytes
+        uint32_t jsonOffset;  // bytes from the start of the file, even
+        uint32_t jsonLength;  // char16_t units
+    };
+
+    struct Span
+    {
+        const char16_t *json;
+        uint32_t length;
+    };
+
+    bool map(const std::string &path);
+    void unmap();
+    bool write(const std::vector<CatalogEntry> &entries);
+    void appendArray(const std::vector<Span> &spans, std::u16string &out) const;
+    const Span* spanOf(int handle) const;
+
+    std::string _path;
+    const uint8_t *_data;
+    size_t _dataSize;
+    std::vector<std::string> _order;
+    std::unordered_map<std::string, Span> _index;
+    // _index by SkuTable handle, filled in as handles are looked up
+    mutable std::vector<Span> _byHandle;
+    uint64_t _generation;
+    mutable std::mutex _mutex;
+};
+
+} // namespace iap
+
+#endif /* IapCatalogCache_h */
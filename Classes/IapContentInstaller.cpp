@@ -0,0 +1,533 @@
+#include "IapContentInstaller.h"
+#include "IapBilling.h"
+#include "IapJsonScan.h"
+#include "IapResult.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <sys/clonefile.h>
+#elif defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+namespace iap {
+
+const size_t ContentInstaller::COPY_CHUNK;
+const unsigned ContentInstaller::ALL_METHODS;
+
+static const char *PARTIAL_SUFFIX = ".partial";
+static std::atomic<unsigned> s_staged(0);
+
+///////////////////////////////////////
+//
+//  Progress
+//
+///////////////////////////////////////
+
+std::u16string ContentProgress::toJson() const
+{
+    static const char *STATES[] = { "downloading", "installing", "installed", "failed" };
+    char numbers[256];
+    snprintf(numbers, sizeof(numbers),
+             ",\"state\":\"%s\",\"bytes\":%llu,\"total_bytes\":%llu,\"files\":%u,\"total_files\":%u,\"progress\":%.3f",
+             STATES[state], (unsigned long long)bytes, (unsigned long long)totalBytes, files, totalFiles,
+             totalBytes ? (double)bytes / totalBytes : (state == STATE_INSTALLED ? 1.0 : 0.0));
+    std::u16string json = u"{\"sku\":" + jsonQuote(id) + utf8ToUtf16(numbers);
+    if(!error.empty()) {
+        json += u",\"error\":" + jsonQuote(error);
+    }
+    json += u'}';
+    return json;
+}
+
+class ContentInstaller::Progress
+{
+public:
+    Progress(const std::string &id, const ProgressHandler &handler) : _handler(handler), _step(0), _reported(0) {
+        _state.id = id;
+    }
+
+    void begin(uint64_t totalBytes, uint32_t totalFiles) {
+        _state.totalBytes = totalBytes;
+        _state.totalFiles = totalFiles;
+        _step = std::max<uint64_t>(totalBytes / 100, 1);
+        report();
+    }
+
+    // at most once per percent
+    void advance(uint64_t bytes) {
+        _state.bytes += bytes;
+        if(_state.bytes - _reported >= _step)
+            report();
+    }
+
+    void fileDone() {
+        _state.files++;
+        report();
+    }
+
+    void finish(const std::string &error) {
+        _state.state = error.empty() ? ContentProgress::STATE_INSTALLED : ContentProgress::STATE_FAILED;
+        _state.error = error;
+        report();
+    }
+
+private:
+    void report() {
+        _reported = _state.bytes;
+        if(_handler)
+            _handler(_state);
+    }
+
+    const ProgressHandler &_handler;
+    ContentProgress _state;
+    uint64_t _step;
+    uint64_t _reported;
+};
+
+// a file moved or copied next to its target, not yet published
+struct ContentInstaller::Staged
+{
+    std::string path;       // as listed, for errors
+    std::string source;
+    std::string target;
+    std::string staged;
+    Method method;
+    uint64_t size;
+};
+
+///////////////////////////////////////
+//
+//  Files
+//
+///////////////////////////////////////
+
+static std::string joinPath(const std::string &dir, const std::string &name)
+{
+    if(dir.empty() || dir.back() == '/') {
+        return dir + name;
+    }
+    return dir + '/' + name;
+}
+
+static std::string parentPath(const std::string &path)
+{
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? std::string() : path.substr(0, slash);
+}
+
+static bool makeDirs(const std::string &path)
+{
+    struct stat st;
+    if(path.empty() || (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))) {
+        return true;
+    }
+    if(!makeDirs(parentPath(path))) {
+        return false;
+    }
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+// hidden and unique, so it never collides with a file of the package:
+// .<name>.<pid>-<n>.partial next to target
+static std::string stagedPath(const std::string &target)
+{
+    size_t slash = target.find_last_of('/');
+    std::string name = slash == std::string::npos ? target : target.substr(slash + 1);
+    char suffix[48];
+    snprintf(suffix, sizeof(suffix), ".%d-%u", (int)getpid(), s_staged.fetch_add(1, std::memory_order_relaxed));
+    return joinPath(parentPath(target), "." + name + suffix + PARTIAL_SUFFIX);
+}
+
+// every regular file under root/relative, paths relative to root
+static bool listFiles(const std::string &root, const std::string &relative, std::vector<ContentFile> &files)
+{
+    DIR *dir = opendir(joinPath(root, relative).c_str());
+    if(!dir) {
+        return false;
+    }
+    bool ok = true;
+    while(struct dirent *entry = readdir(dir)) {
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        std::string path = relative.empty() ? std::string(entry->d_name) : joinPath(relative, entry->d_name);
+        struct stat st;
+        if(lstat(joinPath(root, path).c_str(), &st) != 0)
+            continue;
+        if(S_ISDIR(st.st_mode)) {
+            ok = listFiles(root, path, files) && ok;
+        } else if(S_ISREG(st.st_mode)) {
+            ContentFile file;
+            file.path = path;
+            files.push_back(file);
+        }
+    }
+    closedir(dir);
+    return ok;
+}
+
+static bool writeAll(int fd, const uint8_t *data, size_t size)
+{
+    while(size > 0) {
+        ssize_t n = write(fd, data, size);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Reads fd to the end in COPY_CHUNK pieces, updating crc and progress, and
+// writes every piece to out unless it is negative.
+static bool stream(int in, int out, std::vector<uint8_t> &buffer, uint32_t &crc, const std::function<void(size_t)> &advance)
+{
+    if(buffer.size() < ContentInstaller::COPY_CHUNK) {
+        buffer.resize(ContentInstaller::COPY_CHUNK);
+    }
+    for(;;) {
+        ssize_t n = read(in, buffer.data(), buffer.size());
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return false;
+        if(n == 0)
+            return true;
+        crc = ContentInstaller::crc32(crc, buffer.data(), n);
+        if(out >= 0 && !writeAll(out, buffer.data(), n))
+            return false;
+        advance(n);
+    }
+}
+
+// copy on write clone, no data written; false where unsupported
+static bool cloneFile(const std::string &source, const std::string &staged)
+{
+#if defined(__APPLE__)
+    if(__builtin_available(iOS 10.0, macOS 10.12, *)) {
+        return clonefile(source.c_str(), staged.c_str(), 0) == 0;
+    }
+    return false;
+#elif defined(__linux__) && defined(FICLONE)
+    int in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if(in < 0) {
+        return false;
+    }
+    struct stat st;
+    int out = fstat(in, &st) == 0 ? open(staged.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 0777) : -1;
+    bool ok = out >= 0 && ioctl(out, FICLONE, in) == 0;
+    if(out >= 0) {
+        close(out);
+        if(!ok)
+            unlink(staged.c_str());
+    }
+    close(in);
+    return ok;
+#else
+    return false;
+#endif
+}
+
+///////////////////////////////////////
+//
+//  Installer
+//
+///////////////////////////////////////
+
+ContentInstaller* ContentInstaller::getInstance()
+{
+    static ContentInstaller instance;
+    return &instance;
+}
+
+ContentInstaller::ContentInstaller()
+: _methods(ALL_METHODS)
+, _stopping(false)
+{
+}
+
+ContentInstaller::~ContentInstaller()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wakeup.notify_all();
+    if(_thread.joinable())
+        _thread.join();
+}
+
+const char* ContentInstaller::methodName(Method method)
+{
+    static const char *NAMES[METHOD_COUNT] = { "rename", "reflink", "hardlink", "copy" };
+    return method < METHOD_COUNT ? NAMES[method] : "unknown";
+}
+
+// slicing by 8, the table built on first use
+uint32_t ContentInstaller::crc32(uint32_t crc, const void *data, size_t size)
+{
+    static uint32_t table[8][256];
+    static std::once_flag built;
+    std::call_once(built, [] {
+            for(uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for(int k = 0; k < 8; k++)
+                    c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                table[0][i] = c;
+            }
+            for(uint32_t i = 0; i < 256; i++) {
+                for(int t = 1; t < 8; t++)
+                    table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xff];
+            }
+        });
+
+    const uint8_t *p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for(; size >= 8; size -= 8, p += 8) {
+        uint32_t low = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24]
+            ^ table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
+    }
+    for(; size > 0; size--, p++) {
+        crc = table[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+bool ContentInstaller::validPath(const std::string &path)
+{
+    if(path.empty() || path[0] == '/') {
+        return false;
+    }
+    size_t begin = 0;
+    while(begin <= path.size()) {
+        size_t end = path.find('/', begin);
+        if(end == std::string::npos)
+            end = path.size();
+        if(path.compare(begin, end - begin, "..") == 0)
+            return false;
+        begin = end + 1;
+    }
+    return true;
+}
+
+ContentInstaller::Report ContentInstaller::install(const ContentPackage &package, const ProgressHandler &handler)
+{
+    Report report;
+    Progress progress(package.id, handler);
+    std::vector<ContentFile> listed;
+    if(package.files.empty() && !listFiles(package.source, std::string(), listed)) {
+        report.error = "Cannot read content directory " + package.source;
+        progress.finish(report.error);
+        return report;
+    }
+    // readdir order is arbitrary
+    std::sort(listed.begin(), listed.end(), [](const ContentFile &a, const ContentFile &b) { return a.path < b.path; });
+    const std::vector<ContentFile> &files = package.files.empty() ? listed : package.files;
+
+    uint64_t total = 0;
+    for(const ContentFile &file : files) {
+        if(!validPath(file.path) || (!file.targetPath.empty() && !validPath(file.targetPath))) {
+            report.error = "Invalid content path " + (validPath(file.path) ? file.targetPath : file.path);
+            progress.finish(report.error);
+            return report;
+        }
+        struct stat st;
+        if(stat(joinPath(package.source, file.path).c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            report.error = "Missing content file " + file.path;
+            progress.finish(report.error);
+            return report;
+        }
+        total += st.st_size;
+    }
+    progress.begin(total, (uint32_t)files.size());
+
+    // every file is staged and checked before the first one is published, so
+    // a failure leaves the target as it was and the sources ready for a retry
+    std::vector<uint8_t> buffer;
+    std::vector<Staged> staged;
+    staged.reserve(files.size());
+    for(const ContentFile &file : files) {
+        Staged s;
+        if(!stageFile(package, file, buffer, progress, report, s)) {
+            for(const Staged &earlier : staged)
+                unstage(earlier);
+            progress.finish(report.error);
+            return report;
+        }
+        staged.push_back(std::move(s));
+    }
+    for(size_t i = 0; i < staged.size(); i++) {
+        if(rename(staged[i].staged.c_str(), staged[i].target.c_str()) == 0)
+            continue;
+        report.error = "Cannot install " + staged[i].path + ": " + strerror(errno);
+        for(size_t j = i; j < staged.size(); j++)
+            unstage(staged[j]);
+        // published ones stay, a moved source comes back for the retry
+        for(size_t j = 0; j < i; j++) {
+            if(staged[j].method == METHOD_RENAME)
+                link(staged[j].target.c_str(), staged[j].source.c_str());
+        }
+        progress.finish(report.error);
+        return report;
+    }
+    for(const Staged &s : staged) {
+        // installing consumes the source unless it is kept
+        if(!package.keepSource && s.method != METHOD_RENAME)
+            unlink(s.source.c_str());
+        report.methods[s.method]++;
+        report.bytes += s.size;
+        report.installed.push_back(s.target);
+    }
+    report.ok = true;
+    progress.finish(std::string());
+    return report;
+}
+
+// a moved source goes back where it was
+void ContentInstaller::unstage(const Staged &staged)
+{
+    if(staged.method == METHOD_RENAME)
+        rename(staged.staged.c_str(), staged.source.c_str());
+    else
+        unlink(staged.staged.c_str());
+}
+
+bool ContentInstaller::stageFile(const ContentPackage &package, const ContentFile &file, std::vector<uint8_t> &buffer,
+                                 Progress &progress, Report &report, Staged &staged)
+{
+    staged.path = file.path;
+    staged.source = joinPath(package.source, file.path);
+    staged.target = joinPath(package.target, file.targetPath.empty() ? file.path : file.targetPath);
+    const std::string &source = staged.source;
+    const std::string &target = staged.target;
+    struct stat st;
+    if(stat(source.c_str(), &st) != 0) {
+        report.error = "Missing content file " + file.path;
+        return false;
+    }
+    staged.size = st.st_size;
+    if(file.size && staged.size != file.size) {
+        report.error = "Size mismatch for " + file.path;
+        return false;
+    }
+    if(!makeDirs(parentPath(target))) {
+        report.error = "Cannot create " + parentPath(target) + ": " + strerror(errno);
+        return false;
+    }
+
+    // staged next to the target: the publishing rename never crosses devices
+    staged.staged = stagedPath(target);
+    unlink(staged.staged.c_str());
+    uint32_t crc = 0;
+    if(!stage(source, staged.staged, package.keepSource, buffer, progress, staged.method, crc)) {
+        report.error = "Cannot install " + file.path + ": " + strerror(errno);
+        return false;
+    }
+
+    if(staged.method != METHOD_COPY && file.verify) {
+        int fd = open(staged.staged.c_str(), O_RDONLY | O_CLOEXEC);
+        bool checked = fd >= 0 && stream(fd, -1, buffer, crc, [&](size_t n) { progress.advance(n); });
+        if(fd >= 0)
+            close(fd);
+        if(!checked) {
+            report.error = "Cannot read " + file.path + ": " + strerror(errno);
+            unstage(staged);
+            return false;
+        }
+    } else if(staged.method != METHOD_COPY) {
+        progress.advance(staged.size);
+    }
+    if(file.verify && crc != file.crc32) {
+        report.error = "Checksum mismatch for " + file.path;
+        unstage(staged);
+        return false;
+    }
+    progress.fileDone();
+    return true;
+}
+
+bool ContentInstaller::stage(const std::string &source, const std::string &staged, bool keepSource, std::vector<uint8_t> &buffer,
+                             Progress &progress, Method &method, uint32_t &crc)
+{
+    if(!keepSource && (_methods & (1u << METHOD_RENAME)) && rename(source.c_str(), staged.c_str()) == 0) {
+        method = METHOD_RENAME;
+        return true;
+    }
+    if((_methods & (1u << METHOD_REFLINK)) && cloneFile(source, staged)) {
+        method = METHOD_REFLINK;
+        return true;
+    }
+    if((_methods & (1u << METHOD_HARDLINK)) && link(source.c_str(), staged.c_str()) == 0) {
+        method = METHOD_HARDLINK;
+        return true;
+    }
+
+    method = METHOD_COPY;
+    int in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if(in < 0) {
+        return false;
+    }
+    struct stat st;
+    int out = fstat(in, &st) == 0 ? open(staged.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777) : -1;
+    bool ok = out >= 0 && stream(in, out, buffer, crc, [&](size_t n) { progress.advance(n); });
+    // on disk before the rename publishes it
+    ok = ok && fsync(out) == 0;
+    int error = errno;
+    if(out >= 0) {
+        close(out);
+        if(!ok)
+            unlink(staged.c_str());
+    }
+    close(in);
+    errno = error;
+    return ok;
+}
+
+void ContentInstaller::installAsync(ContentPackage package, DoneHandler done)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(!_thread.joinable()) {
+            _thread = std::thread(&ContentInstaller::worker, this);
+        }
+        Job job;
+        job.package = std::move(package);
+        job.done = std::move(done);
+        _jobs.push_back(std::move(job));
+    }
+    _wakeup.notify_one();
+}
+
+void ContentInstaller::worker()
+{
+    ProgressHandler emit = [](const ContentProgress &progress) {
+        Billing::getInstance()->contentUpdated(progress.toJson());
+    };
+    std::unique_lock<std::mutex> lock(_mutex);
+    for(;;) {
+        _wakeup.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+        if(_stopping) {
+            return;
+        }
+        Job job = std::move(_jobs.front());
+        _jobs.pop_front();
+        lock.unlock();
+        Report report = install(job.package, emit);
+        if(job.done)
+            job.done(job.package, report);
+        lock.lock();
+    }
+}
+
+} // namespace iap
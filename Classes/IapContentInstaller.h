@@ -0,0 +1,169 @@
+#ifndef IapContentInstaller_h
+#define IapContentInstaller_h
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Content packages
+//
+///////////////////////////////////////
+
+// One file of a package, relative to its source directory
+struct ContentFile
+{
+    std::string path;
+    std::string targetPath;     // relative to the target, empty for path
+    uint64_t size = 0;          // expected size, 0 when unknown
+    uint32_t crc32 = 0;         // expected CRC-32 (zip polynomial) when verify
+    bool verify = false;
+};
+
+// Purchased content to put in place: StoreKit hosted content, Google Play
+// expansion files, anything downloaded into a directory.
+struct ContentPackage
+{
+    std::string id;             // the sku, reported with the progress
+    std::string source;         // directory holding the files
+    std::string target;         // directory they are installed into
+    // empty: every regular file under source, same relative paths
+    std::vector<ContentFile> files;
+    // never move out of source; it stays usable (expansion files Google
+    // Play manages)
+    bool keepSource = false;
+};
+
+struct ContentProgress
+{
+    enum State
+    {
+        STATE_DOWNLOADING,
+        STATE_INSTALLING,
+        STATE_INSTALLED,
+        STATE_FAILED
+    };
+
+    std::string id;
+    State state = STATE_INSTALLING;
+    uint64_t bytes = 0;
+    uint64_t totalBytes = 0;
+    uint32_t files = 0;
+    uint32_t totalFiles = 0;
+    std::string error;
+
+    // the object on_content receives
+    std::u16string toJson() const;
+};
+
+///////////////////////////////////////
+//
+//  Content installer
+//
+///////////////////////////////////////
+
+// Puts downloaded content in place without copying it when it can.
+//
+// Every file of a package is staged next to its destination and checked
+// first; only then is each published with one atomic rename(), so a reader
+// sees the old file or the new one, a failure publishes nothing and a crash
+// leaves only hidden ".<name>.<pid>-<n>.partial" files behind. Staging
+// tries, in order: moving the source (rename, not with keepSource), cloning
+// it (FICLONE on Linux, clonefile() on Apple platforms: copy on write, no
+// data written), hard-linking it, and last a streaming copy in COPY_CHUNK
+// pieces; a failed package moves its sources back. A file
+// with an expected size or CRC-32 is checked before it is published: the
+// copy computes the CRC as it streams, the other methods read the staged
+// file once. A hard-linked file shares its data with the source, so with
+// keepSource neither may be written in place afterwards.
+//
+// Progress is reported per chunk and per file, at most once per percent.
+class ContentInstaller
+{
+public:
+    enum Method
+    {
+        METHOD_RENAME,
+        METHOD_REFLINK,
+        METHOD_HARDLINK,
+        METHOD_COPY,
+        METHOD_COUNT
+    };
+
+    static const size_t COPY_CHUNK = 1024 * 1024;
+    static const unsigned ALL_METHODS = (1u << METHOD_COUNT) - 1;
+
+    struct Report
+    {
+        bool ok = false;
+        std::string error;
+        uint64_t bytes = 0;
+        uint32_t methods[METHOD_COUNT] = {};    // files staged by each method
+        std::vector<std::string> installed;     // destination paths
+    };
+
+    typedef std::function<void(const ContentProgress &progress)> ProgressHandler;
+    // called on the installer thread
+    typedef std::function<void(const ContentPackage &package, const Report &report)> DoneHandler;
+
+    static ContentInstaller* getInstance();
+
+    ContentInstaller();
+    ~ContentInstaller();
+
+    // Installs on the calling thread. All or nothing up to the publishing
+    // renames: when a file is missing or fails its check, none is published
+    // and the sources are left for a retry.
+    Report install(const ContentPackage &package, const ProgressHandler &progress = nullptr);
+    // Queues the package for the installer thread, one package at a time.
+    // Progress and the outcome are emitted as EVENT_CONTENT_PROGRESS
+    // results (Billing::contentUpdated); done may be empty.
+    void installAsync(ContentPackage package, DoneHandler done = nullptr);
+
+    // Methods tried, a mask of 1 << Method; copying is always allowed.
+    // For tests and benchmarks.
+    void setMethods(unsigned methods) { _methods = methods | (1u << METHOD_COPY); }
+
+    // A file's path or targetPath: relative and without ".." components, so
+    // it stays inside the package's source or target directory.
+    static bool validPath(const std::string &path);
+
+    static const char* methodName(Method method);
+    static uint32_t crc32(uint32_t crc, const void *data, size_t size);
+
+private:
+    struct Job
+    {
+        ContentPackage package;
+        DoneHandler done;
+    };
+
+    class Progress;
+    struct Staged;
+
+    bool stageFile(const ContentPackage &package, const ContentFile &file, std::vector<uint8_t> &buffer,
+                   Progress &progress, Report &report, Staged &staged);
+    static void unstage(const Staged &staged);
+    bool stage(const std::string &source, const std::string &staged, bool keepSource, std::vector<uint8_t> &buffer,
+               Progress &progress, Method &method, uint32_t &crc);
+    void worker();
+
+    unsigned _methods;
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::deque<Job> _jobs;
+    std::thread _thread;
+    bool _stopping;
+};
+
+} // namespace iap
+
+#endif /* IapContentInstaller_h */
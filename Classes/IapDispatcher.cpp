@@ -0,0 +1,153 @@
+#include "IapDispatcher.h"
+
+namespace iap {
+
+const int DispatchQueue::POOL_SIZE;
+const int Dispatcher::PURCHASE_OVERRUN;
+
+static const uint64_t FREE_INDEX = 0xffffffffull;
+static const uint64_t FREE_COUNT = 1ull << 32;
+
+DispatchQueue::DispatchQueue()
+: _head(&_stub)
+, _tail(&_stub)
+, _size(0)
+, _free(0)
+{
+    _stub.next.store(nullptr, std::memory_order_relaxed);
+    for(int i = 0; i < POOL_SIZE; i++) {
+        _pool[i].freeNext.store(i + 1 < POOL_SIZE ? i + 2 : 0, std::memory_order_relaxed);
+    }
+    _free.store(1, std::memory_order_release);
+}
+
+DispatchQueue::~DispatchQueue()
+{
+    Result result;
+    while(pop(result)) {}
+}
+
+void DispatchQueue::push(Result &&result)
+{
+    Node *node = allocNode();
+    node->result = std::move(result);
+    _size.fetch_add(1, std::memory_order_relaxed);
+    pushNode(node);
+}
+
+bool DispatchQueue::pop(Result &result)
+{
+    Node *node = popNode();
+    if(!node) {
+        return false;
+    }
+    result = std::move(node->result);
+    freeNode(node);
+    _size.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+void DispatchQueue::pushNode(Node *node)
+{
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node *prev = _head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+}
+
+DispatchQueue::Node* DispatchQueue::popNode()
+{
+    Node *tail = _tail;
+    Node *next = tail->next.load(std::memory_order_acquire);
+    if(tail == &_stub) {
+        if(!next) {
+            return nullptr;
+        }
+        _tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if(next) {
+        _tail = next;
+        return tail;
+    }
+    if(tail != _head.load(std::memory_order_acquire)) {
+        // a producer swapped the head but has not linked its node yet
+        return nullptr;
+    }
+    pushNode(&_stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if(next) {
+        _tail = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+DispatchQueue::Node* DispatchQueue::allocNode()
+{
+    uint64_t top = _free.load(std::memory_order_acquire);
+    while(top & FREE_INDEX) {
+        Node *node = &_pool[(top & FREE_INDEX) - 1];
+        uint64_t next = ((top & ~FREE_INDEX) + FREE_COUNT) | node->freeNext.load(std::memory_order_relaxed);
+        if(_free.compare_exchange_weak(top, next, std::memory_order_acquire, std::memory_order_acquire))
+            return node;
+    }
+    // the pool is spent: more than POOL_SIZE results waiting
+    return new Node();
+}
+
+// consumer thread only
+void DispatchQueue::freeNode(Node *node)
+{
+    if(node < _pool || node >= _pool + POOL_SIZE) {
+        delete node;
+        return;
+    }
+    uint64_t index = (uint64_t)(node - _pool) + 1;
+    uint64_t top = _free.load(std::memory_order_relaxed);
+    do {
+        node->freeNext.store((uint32_t)(top & FREE_INDEX), std::memory_order_relaxed);
+    } while(!_free.compare_exchange_weak(top, ((top & ~FREE_INDEX) + FREE_COUNT) | index,
+                                         std::memory_order_release, std::memory_order_relaxed));
+}
+
+Dispatcher* Dispatcher::getInstance()
+{
+    static Dispatcher instance;
+    return &instance;
+}
+
+void Dispatcher::push(Result &&result)
+{
+    int lane = result.lane < LANE_COUNT ? (int)result.lane : (int)LANE_REQUEST;
+    _lanes[lane].push(std::move(result));
+}
+
+bool Dispatcher::empty() const
+{
+    for(const DispatchQueue &queue : _lanes) {
+        if(!queue.empty())
+            return false;
+    }
+    return true;
+}
+
+int Dispatcher::pending() const
+{
+    int count = 0;
+    for(const DispatchQueue &queue : _lanes) {
+        count += queue.size();
+    }
+    return count;
+}
+
+bool Dispatcher::pop(Result &result)
+{
+    for(DispatchQueue &queue : _lanes) {
+        if(queue.pop(result))
+            return true;
+    }
+    return false;
+}
+
+} // namespace iap
@@ -0,0 +1,120 @@
+#ifndef IapDispatcher_h
+#define IapDispatcher_h
+
+#include "IapBilling.h"
+#include <atomic>
+#include <chrono>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Lock-free result queue
+//
+///////////////////////////////////////
+
+// Intrusive multi-producer / single-consumer queue (Vyukov). Billing threads
+// push with a single atomic exchange, the cocos thread is the only consumer.
+// Nodes come from a fixed pool recycled through a lock-free free list, so
+// pushing does not allocate until more than POOL_SIZE results are queued.
+class DispatchQueue
+{
+public:
+    static const int POOL_SIZE = 128;
+
+    DispatchQueue();
+    ~DispatchQueue();
+
+    // any thread
+    void push(Result &&result);
+    // consumer thread only; false when empty or a producer is mid-push
+    bool pop(Result &result);
+
+    int size() const { return _size.load(std::memory_order_relaxed); }
+    bool empty() const { return size() == 0; }
+
+private:
+    struct Node
+    {
+        std::atomic<Node*> next;
+        std::atomic<uint32_t> freeNext;     // free list link, pool index + 1
+        Result result;
+    };
+
+    void pushNode(Node *node);
+    Node* popNode();
+    Node* allocNode();
+    void freeNode(Node *node);
+
+    std::atomic<Node*> _head;
+    Node *_tail;
+    Node _stub;
+    std::atomic<int> _size;
+    Node _pool[POOL_SIZE];
+    // free list top: pool index + 1 in the low half, a change count in the
+    // high half so a node popped and pushed back can't fool a stale CAS
+    std::atomic<uint64_t> _free;
+};
+
+///////////////////////////////////////
+//
+//  Per-frame dispatcher
+//
+///////////////////////////////////////
+
+// Collects results from any thread, straight from the one that produced
+// them, and hands them to the JS layer once per frame. Each ResultLane has
+// its own queue and a drain always takes from the most urgent non-empty one.
+// A drain stops when its time budget is spent so a burst of results is
+// spread over several frames instead of causing a hitch; purchase answers
+// may overrun it by PURCHASE_OVERRUN results, so they rarely wait for the
+// next frame but a flood of them can't stall one.
+class Dispatcher
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static const int PURCHASE_OVERRUN = 16;
+
+    static Dispatcher* getInstance();
+
+    // any thread, queued on result.lane
+    void push(Result &&result);
+    bool empty() const;
+    int pending() const;
+    int pending(ResultLane lane) const { return _lanes[lane].size(); }
+
+    // 0 disables the budget, every queued result is delivered in one drain
+    void setFrameBudget(std::chrono::microseconds budget) { _budget = budget; }
+    std::chrono::microseconds getFrameBudget() const { return _budget; }
+
+    // Consumer thread only. Calls handler(Result&) for queued results, lane
+    // by lane, at least one per call, and returns how many were delivered.
+    template<typename Handler>
+    int drain(Handler handler) {
+        Clock::time_point deadline = Clock::now() + _budget;
+        Result result;
+        int count = 0;
+        int overrun = 0;
+        while(pop(result)) {
+            handler(result);
+            count++;
+            if(_budget.count() > 0 && Clock::now() >= deadline &&
+               (_lanes[LANE_PURCHASE].empty() || ++overrun > PURCHASE_OVERRUN))
+                break;
+        }
+        return count;
+    }
+
+private:
+    Dispatcher() : _budget(std::chrono::microseconds(2000)) {}
+
+    bool pop(Result &result);
+
+    DispatchQueue _lanes[LANE_COUNT];
+    std::chrono::microseconds _budget;
+};
+
+} // namespace iap
+
+#endif /* IapDispatcher_h */
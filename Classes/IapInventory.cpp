@@ -0,0 +1,159 @@
+#include "IapInventory.h"
+#include "IapJsonScan.h"
+#include <chrono>
+
+namespace iap {
+
+const size_t PurchaseInventory::MAX_TOMBSTONES;
+
+PurchaseInventory::PurchaseInventory()
+: _tombstones(0)
+{
+    _version = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    _floor = _version;
+}
+
+uint64_t PurchaseInventory::version() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _version;
+}
+
+std::vector<PurchaseInventory::Item> PurchaseInventory::items(uint64_t *version) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<Item> items;
+    items.reserve(_entries.size() - _tombstones);
+    for(const auto &it : _entries) {
+        if(!it.second.removed)
+            items.push_back(Item{ it.first, it.second.sku, it.second.json });
+    }
+    if(version)
+        *version = _version;
+    return items;
+}
+
+bool PurchaseInventory::put(const Item &item)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return putLocked(item);
+}
+
+bool PurchaseInventory::putLocked(const Item &item)
+{
+    if(item.token.empty()) {
+        return false;
+    }
+    auto it = _entries.find(item.token);
+    if(it == _entries.end()) {
+        Entry &entry = _entries[item.token];
+        entry.sku = item.sku;
+        entry.json = item.json;
+        entry.added = entry.changed = ++_version;
+        entry.removed = false;
+        return true;
+    }
+    Entry &entry = it->second;
+    if(!entry.removed && entry.json == item.json) {
+        return false;
+    }
+    if(entry.removed) {
+        // bought again under the same token (restored), a new purchase for the watcher
+        entry.added = _version + 1;
+        entry.removed = false;
+        _tombstones--;
+    }
+    if(!item.sku.empty())
+        entry.sku = item.sku;
+    entry.json = item.json;
+    entry.changed = ++_version;
+    return true;
+}
+
+bool PurchaseInventory::remove(const std::string &token)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    bool changed = removeLocked(_entries.find(token));
+    pruneTombstones();
+    return changed;
+}
+
+bool PurchaseInventory::removeLocked(std::unordered_map<std::string, Entry>::iterator it)
+{
+    if(it == _entries.end() || it->second.removed) {
+        return false;
+    }
+    it->second.removed = true;
+    it->second.json.clear();
+    it->second.changed = ++_version;
+    _tombstones++;
+    return true;
+}
+
+bool PurchaseInventory::replace(const std::vector<Item> &items)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    bool changed = false;
+    std::unordered_map<std::string, bool> owned;
+    for(const Item &item : items) {
+        changed |= putLocked(item);
+        owned[item.token] = true;
+    }
+    for(auto it = _entries.begin(); it != _entries.end(); ++it) {
+        if(!owned.count(it->first))
+            changed |= removeLocked(it);
+    }
+    pruneTombstones();
+    return changed;
+}
+
+// drops the oldest tombstones, forgetting the versions they covered
+void PurchaseInventory::pruneTombstones()
+{
+    while(_tombstones > MAX_TOMBSTONES) {
+        auto oldest = _entries.end();
+        for(auto it = _entries.begin(); it != _entries.end(); ++it) {
+            if(it->second.removed && (oldest == _entries.end() || it->second.changed < oldest->second.changed))
+                oldest = it;
+        }
+        _floor = oldest->second.changed;
+        _entries.erase(oldest);
+        _tombstones--;
+    }
+}
+
+std::u16string PurchaseInventory::changesSince(uint64_t since, uint64_t *version) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(version)
+        *version = _version;
+    bool reset = since < _floor || since > _version;
+    std::u16string added;
+    std::u16string changed;
+    std::u16string removed;
+    for(const auto &it : _entries) {
+        const Entry &entry = it.second;
+        if(!reset && entry.changed <= since) {
+            continue;
+        }
+        if(entry.removed) {
+            // after a reset, or added and removed since, the watcher never saw it
+            if(!reset && entry.added <= since) {
+                if(!removed.empty())
+                    removed += u',';
+                removed += u"{\"purchaseToken\":" + jsonQuote(it.first) + u",\"productId\":" + jsonQuote(entry.sku) + u"}";
+            }
+            continue;
+        }
+        std::u16string &list = reset || entry.added > since ? added : changed;
+        if(!list.empty())
+            list += u',';
+        list += entry.json;
+    }
+    std::string current = std::to_string(_version);
+    return u"{\"version\":" + std::u16string(current.begin(), current.end())
+        + u",\"reset\":" + (reset ? u"true" : u"false")
+        + u",\"added\":[" + added + u"],\"changed\":[" + changed + u"],\"removed\":[" + removed + u"]}";
+}
+
+} // namespace iap
@@ -0,0 +1,80 @@
+#ifndef IapInventory_h
+#define IapInventory_h
+
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Purchase inventory
+//
+///////////////////////////////////////
+
+// What the user owns right now, as the store last reported it, with a
+// version that advances on every change. Watchers ask for the changes
+// since the version they saw last instead of the whole inventory.
+//
+// Versions start at the wall clock in microseconds, so a version kept from
+// an earlier session is older than anything this one can answer and gets a
+// full reset. Removed purchases leave a tombstone; once MAX_TOMBSTONES
+// pile up the oldest are dropped and versions before them reset too.
+class PurchaseInventory
+{
+public:
+    struct Item
+    {
+        std::string token;
+        std::string sku;
+        std::u16string json; // purchase object as delivered
+    };
+
+    static const size_t MAX_TOMBSTONES = 256;
+
+    PurchaseInventory();
+
+    uint64_t version() const;
+    // everything owned, in no particular order, and the version it is at
+    std::vector<Item> items(uint64_t *version = nullptr) const;
+
+    // added or changed; false when the purchase is already known as is
+    bool put(const Item &item);
+    bool remove(const std::string &token);
+    // Everything the user owns: purchases missing from items are removed.
+    // False when nothing changed.
+    bool replace(const std::vector<Item> &items);
+
+    // {"version":..,"reset":..,"added":[..],"changed":[..],"removed":[..]}
+    // with the changes after since; removed items are {purchaseToken,
+    // productId}. A reset lists everything owned under added. version, if
+    // given, receives the version the changes lead to.
+    std::u16string changesSince(uint64_t since, uint64_t *version = nullptr) const;
+
+private:
+    struct Entry
+    {
+        std::string sku;
+        std::u16string json;
+        uint64_t added;
+        uint64_t changed;
+        bool removed;
+    };
+
+    bool putLocked(const Item &item);
+    bool removeLocked(std::unordered_map<std::string, Entry>::iterator it);
+    void pruneTombstones();
+
+    std::unordered_map<std::string, Entry> _entries;
+    uint64_t _version;
+    uint64_t _floor;     // changes before this version are forgotten
+    size_t _tombstones;
+    mutable std::mutex _mutex;
+};
+
+} // namespace iap
+
+#endif /* IapInventory_h */
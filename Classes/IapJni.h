@@ -0,0 +1,247 @@
+#ifndef IapJni_h
+#define IapJni_h
+
+#include "platform/android/jni/JniHelper.h"
+#include <jni.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace iap {
+namespace jni {
+
+///////////////////////////////////////
+//
+//  Compile time JNI signatures
+//
+///////////////////////////////////////
+
+template<char... C>
+struct Chars
+{
+    static constexpr char value[sizeof...(C) + 1] = { C..., '\0' };
+};
+
+template<char... C>
+constexpr char Chars<C...>::value[];
+
+template<typename... S>
+struct Concat;
+
+template<>
+struct Concat<>
+{
+    typedef Chars<> type;
+};
+
+template<char... A>
+struct Concat<Chars<A...>>
+{
+    typedef Chars<A...> type;
+};
+
+template<char... A, char... B, typename... Rest>
+struct Concat<Chars<A...>, Chars<B...>, Rest...>
+{
+    typedef typename Concat<Chars<A..., B...>, Rest...>::type type;
+};
+
+// JNI type descriptor of a C++ argument type
+template<typename T>
+struct TypeSignature;
+
+template<>
+struct TypeSignature<bool>
+{
+    typedef Chars<'Z'> type;
+};
+
+template<>
+struct TypeSignature<int>
+{
+    typedef Chars<'I'> type;
+};
+
+template<>
+struct TypeSignature<std::string>
+{
+    typedef Chars<'L','j','a','v','a','/','l','a','n','g','/','S','t','r','i','n','g',';'> type;
+};
+
+template<typename T>
+struct TypeSignature<std::vector<T>>
+{
+    typedef typename Concat<Chars<'['>, typename TypeSignature<T>::type>::type type;
+};
+
+// signature of: static boolean method(Args...)
+template<typename... Args>
+struct MethodSignature
+{
+    typedef typename Concat<Chars<'('>, typename TypeSignature<Args>::type..., Chars<')','Z'>>::type type;
+    static const char* get() { return type::value; }
+};
+
+///////////////////////////////////////
+//
+//  Cached class references
+//
+///////////////////////////////////////
+
+static const char* PLUGIN_CLASS = "com/tapclap/inappbilling/InAppBillingPlugin";
+
+// global refs, resolved once and kept for the process lifetime
+inline jclass& pluginClass()
+{
+    static jclass cls = nullptr;
+    return cls;
+}
+
+inline jclass stringClass(JNIEnv *env)
+{
+    static jclass cls = nullptr;
+    if(!cls) {
+        jclass local = env->FindClass("java/lang/String");
+        cls = (jclass)env->NewGlobalRef(local);
+        env->DeleteLocalRef(local);
+    }
+    return cls;
+}
+
+inline std::mutex& resolveMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+///////////////////////////////////////
+//
+//  Argument marshalling
+//
+///////////////////////////////////////
+
+// Converts one C++ argument to its JNI value and releases any local
+// reference when the call expression ends.
+template<typename T>
+struct Arg;
+
+template<>
+struct Arg<bool>
+{
+    jboolean value;
+    Arg(JNIEnv*, bool v) : value(v ? JNI_TRUE : JNI_FALSE) {}
+};
+
+template<>
+struct Arg<int>
+{
+    jint value;
+    Arg(JNIEnv*, int v) : value(v) {}
+};
+
+template<>
+struct Arg<std::string>
+{
+    JNIEnv *env;
+    jstring value;
+    Arg(JNIEnv *e, const std::string &v) : env(e), value(e->NewStringUTF(v.c_str())) {}
+    ~Arg() { env->DeleteLocalRef(value); }
+    Arg(const Arg&) = delete;
+    Arg& operator=(const Arg&) = delete;
+};
+
+template<>
+struct Arg<std::vector<int>>
+{
+    JNIEnv *env;
+    jintArray value;
+    Arg(JNIEnv *e, const std::vector<int> &v) : env(e) {
+        value = env->NewIntArray((jsize)v.size());
+        env->SetIntArrayRegion(value, 0, (jsize)v.size(), (const jint*)v.data());
+    }
+    ~Arg() { env->DeleteLocalRef(value); }
+    Arg(const Arg&) = delete;
+    Arg& operator=(const Arg&) = delete;
+};
+
+template<>
+struct Arg<std::vector<std::string>>
+{
+    JNIEnv *env;
+    jobjectArray value;
+    Arg(JNIEnv *e, const std::vector<std::string> &v) : env(e) {
+        value = env->NewObjectArray((jsize)v.size(), stringClass(env), nullptr);
+        for(size_t i = 0; i < v.size(); i++) {
+            jstring s = env->NewStringUTF(v[i].c_str());
+            env->SetObjectArrayElement(value, (jsize)i, s);
+            env->DeleteLocalRef(s);
+        }
+    }
+    ~Arg() { env->DeleteLocalRef(value); }
+    Arg(const Arg&) = delete;
+    Arg& operator=(const Arg&) = delete;
+};
+
+///////////////////////////////////////
+//
+//  Static plugin method
+//
+///////////////////////////////////////
+
+// call: static boolean InAppBillingPlugin.name(Args...)
+// The class and method ids are looked up on the first call only; the
+// method id is published with release order after the class ref, so any
+// thread that sees it also sees the class.
+template<typename... Args>
+class StaticMethod
+{
+public:
+    explicit StaticMethod(const char *name) : _name(name), _methodID(nullptr) {}
+
+    bool operator()(const Args&... args) {
+        jmethodID methodID = _methodID.load(std::memory_order_acquire);
+        if(!methodID && !(methodID = resolve())) {
+            return false;
+        }
+        JNIEnv *env = cocos2d::JniHelper::getEnv();
+        jboolean res = env->CallStaticBooleanMethod(pluginClass(), methodID, Arg<Args>(env, args).value...);
+        if(env->ExceptionCheck()) {
+            env->ExceptionDescribe();
+            env->ExceptionClear();
+            return false;
+        }
+        return res == JNI_TRUE;
+    }
+
+    static const char* signature() { return MethodSignature<Args...>::get(); }
+
+private:
+    jmethodID resolve() {
+        std::lock_guard<std::mutex> lock(resolveMutex());
+        jmethodID methodID = _methodID.load(std::memory_order_relaxed);
+        if(methodID) {
+            return methodID;
+        }
+        cocos2d::JniMethodInfo methodInfo;
+        if(!cocos2d::JniHelper::getStaticMethodInfo(methodInfo, PLUGIN_CLASS, _name, signature())) {
+            return nullptr;
+        }
+        if(!pluginClass()) {
+            pluginClass() = (jclass)methodInfo.env->NewGlobalRef(methodInfo.classID);
+            stringClass(methodInfo.env);
+        }
+        methodInfo.env->DeleteLocalRef(methodInfo.classID);
+        _methodID.store(methodInfo.methodID, std::memory_order_release);
+        return methodInfo.methodID;
+    }
+
+    const char *_name;
+    std::atomic<jmethodID> _methodID;
+};
+
+} // namespace jni
+} // namespace iap
+
+#endif /* IapJni_h */
@@ -0,0 +1,419 @@
+#include "IapJournal.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace iap {
+
+static const char JOURNAL_MAGIC[4] = { 'I', 'A', 'P', 'J' };
+static const uint32_t JOURNAL_VERSION = 1;
+
+const size_t PurchaseJournal::MAX_PURCHASE_JSON;
+const int PurchaseJournal::SYNC_DELAY_MS;
+
+struct JournalHeader
+{
+    char magic[4];
+    uint32_t version;
+};
+
+// record: RecordHeader, RecordBody, token, sku, purchase (char16_t)
+struct RecordHeader
+{
+    uint32_t size;      // bytes after this header
+    uint32_t checksum;  // FNV-1a of those bytes
+};
+
+struct RecordBody
+{
+    uint8_t state;
+    uint8_t reserved;
+    uint16_t tokenLength;
+    uint16_t skuLength;
+    uint16_t reserved2;
+    uint32_t purchaseLength; // char16_t units
+};
+
+static uint32_t fnv1a32(const uint8_t *data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void encodeRecord(const std::string &token, const std::string &sku, uint32_t state, const std::u16string *purchase, std::vector<uint8_t> &out)
+{
+    RecordBody body;
+    body.state = (uint8_t)state;
+    body.reserved = 0;
+    body.tokenLength = (uint16_t)token.size();
+    body.skuLength = (uint16_t)sku.size();
+    body.reserved2 = 0;
+    body.purchaseLength = purchase ? (uint32_t)purchase->size() : 0;
+
+    size_t start = out.size();
+    size_t size = sizeof(body) + token.size() + sku.size() + body.purchaseLength * sizeof(char16_t);
+    out.resize(start + sizeof(RecordHeader) + size);
+    uint8_t *p = &out[start] + sizeof(RecordHeader);
+    memcpy(p, &body, sizeof(body));
+    memcpy(p + sizeof(body), token.data(), token.size());
+    memcpy(p + sizeof(body) + token.size(), sku.data(), sku.size());
+    if(body.purchaseLength)
+        memcpy(p + sizeof(body) + token.size() + sku.size(), purchase->data(), body.purchaseLength * sizeof(char16_t));
+
+    RecordHeader header;
+    header.size = (uint32_t)size;
+    header.checksum = fnv1a32(p, size);
+    memcpy(&out[start], &header, sizeof(header));
+}
+
+static bool writeAll(int fd, const uint8_t *data, size_t size)
+{
+    while(size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if(n < 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+PurchaseJournal::PurchaseJournal()
+: _fd(-1)
+, _records(0)
+, _sequence(0)
+, _written(0)
+, _synced(0)
+, _hurry(false)
+, _stopping(false)
+{
+}
+
+PurchaseJournal::~PurchaseJournal()
+{
+    close();
+}
+
+bool PurchaseJournal::open(const std::string &path)
+{
+    close();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _path = path;
+
+    std::vector<uint8_t> data;
+    FILE *f = fopen(path.c_str(), "rb");
+    if(f) {
+        struct stat st;
+        if(fstat(fileno(f), &st) == 0 && st.st_size > 0) {
+            data.resize((size_t)st.st_size);
+            data.resize(fread(data.data(), 1, data.size(), f));
+        }
+        fclose(f);
+    }
+
+    size_t validEnd = 0;
+    JournalHeader header;
+    if(data.size() >= sizeof(header)) {
+        memcpy(&header, data.data(), sizeof(header));
+        if(memcmp(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) == 0 && header.version == JOURNAL_VERSION) {
+            replay(data, validEnd);
+        }
+    }
+
+    _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if(_fd < 0) {
+        return false;
+    }
+    if(validEnd < data.size() || validEnd == 0) {
+        // torn tail from a crash, or no usable journal: cut back to what replayed
+        if(ftruncate(_fd, validEnd) != 0) {
+            ::close(_fd);
+            _fd = -1;
+            return false;
+        }
+        if(validEnd == 0) {
+            memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+            header.version = JOURNAL_VERSION;
+            writeAll(_fd, (const uint8_t*)&header, sizeof(header));
+        }
+        fsync(_fd);
+    }
+    if(_records > _entries.size() * 2 + 32) {
+        compact();
+    }
+    startSync();
+    return _fd >= 0;
+}
+
+void PurchaseJournal::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _syncCondition.notify_all();
+    if(_syncThread.joinable()) {
+        _syncThread.join();
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_fd >= 0) {
+        fsync(_fd);
+        ::close(_fd);
+        _fd = -1;
+    }
+    _entries.clear();
+    _latest.clear();
+    _records = 0;
+    _sequence = 0;
+    _written = _synced = 0;
+    _hurry = false;
+    _stopping = false;
+}
+
+///////////////////////////////////////
+//
+//  State
+//
+///////////////////////////////////////
+
+bool PurchaseJournal::record(const std::string &token, const std::string &sku, uint32_t state, const std::u16string &purchase)
+{
+    if(token.empty() || token.size() > 0xffff || sku.size() > 0xffff) {
+        return false;
+    }
+    static const std::u16string none;
+    const std::u16string &kept = purchase.size() <= MAX_PURCHASE_JSON ? purchase : none;
+    std::lock_guard<std::mutex> lock(_mutex);
+    bool hadPurchase = false;
+    auto it = _entries.find(token);
+    if(it != _entries.end()) {
+        hadPurchase = !it->second.purchase.empty();
+    }
+    if(!apply(token, sku, state, kept)) {
+        return false;
+    }
+    const Entry &entry = _entries[token];
+    // the purchase object is written once, later records only carry state
+    append(entry, !hadPurchase);
+    return true;
+}
+
+bool PurchaseJournal::apply(const std::string &token, const std::string &sku, uint32_t state, const std::u16string &purchase)
+{
+    auto it = _entries.find(token);
+    if(it == _entries.end()) {
+        Entry entry;
+        entry.token = token;
+        entry.sku = sku;
+        entry.state = state;
+        entry.sequence = _sequence++;
+        entry.purchase = purchase;
+        if(!sku.empty())
+            _latest[sku] = token;
+        _entries.emplace(token, std::move(entry));
+        return true;
+    }
+    Entry &entry = it->second;
+    bool changed = (entry.state | state) != entry.state;
+    entry.state |= state;
+    if(entry.sku.empty() && !sku.empty()) {
+        entry.sku = sku;
+        auto latest = _latest.find(sku);
+        if(latest == _latest.end() || _entries[latest->second].sequence < entry.sequence)
+            _latest[sku] = token;
+        changed = true;
+    }
+    if(entry.purchase.empty() && !purchase.empty()) {
+        entry.purchase = purchase;
+        changed = true;
+    }
+    return changed;
+}
+
+bool PurchaseJournal::append(const Entry &entry, bool withPurchase)
+{
+    _records++;
+    if(_fd < 0) {
+        return true;
+    }
+    std::vector<uint8_t> buffer;
+    encodeRecord(entry.token, entry.sku, entry.state, withPurchase ? &entry.purchase : nullptr, buffer);
+    // one write per record: a crash leaves at most this record torn
+    if(!writeAll(_fd, buffer.data(), buffer.size())) {
+        return false;
+    }
+    _written++;
+    _syncCondition.notify_all();
+    return true;
+}
+
+bool PurchaseJournal::find(const std::string &token, Entry &entry) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _entries.find(token);
+    if(it == _entries.end()) {
+        return false;
+    }
+    entry = it->second;
+    return true;
+}
+
+bool PurchaseJournal::findLatest(const std::string &sku, Entry &entry) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto latest = _latest.find(sku);
+    if(latest == _latest.end()) {
+        return false;
+    }
+    entry = _entries.at(latest->second);
+    return true;
+}
+
+std::vector<PurchaseJournal::Entry> PurchaseJournal::pendingGrants() const
+{
+    std::vector<Entry> pending;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for(const auto &it : _entries) {
+            if((it.second.state & PURCHASED) && !(it.second.state & GRANTED))
+                pending.push_back(it.second);
+        }
+    }
+    std::sort(pending.begin(), pending.end(), [](const Entry &a, const Entry &b) {
+        return a.sequence < b.sequence;
+    });
+    return pending;
+}
+
+size_t PurchaseJournal::size() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _entries.size();
+}
+
+///////////////////////////////////////
+//
+//  File
+//
+///////////////////////////////////////
+
+void PurchaseJournal::replay(const std::vector<uint8_t> &data, size_t &validEnd)
+{
+    size_t pos = sizeof(JournalHeader);
+    validEnd = pos;
+    while(data.size() - pos >= sizeof(RecordHeader)) {
+        RecordHeader header;
+        memcpy(&header, &data[pos], sizeof(header));
+        const uint8_t *p = &data[pos] + sizeof(header);
+        if(header.size < sizeof(RecordBody) || header.size > data.size() - pos - sizeof(header) ||
+           fnv1a32(p, header.size) != header.checksum) {
+            break;
+        }
+        RecordBody body;
+        memcpy(&body, p, sizeof(body));
+        if(sizeof(body) + body.tokenLength + body.skuLength + (size_t)body.purchaseLength * sizeof(char16_t) != header.size ||
+           body.tokenLength == 0) {
+            break;
+        }
+        const char *chars = (const char*)p + sizeof(body);
+        std::string token(chars, body.tokenLength);
+        std::string sku(chars + body.tokenLength, body.skuLength);
+        std::u16string purchase(body.purchaseLength, u'\0');
+        if(body.purchaseLength)
+            memcpy(&purchase[0], chars + body.tokenLength + body.skuLength, body.purchaseLength * sizeof(char16_t));
+        apply(token, sku, body.state, purchase);
+        _records++;
+        pos += sizeof(header) + header.size;
+        validEnd = pos;
+    }
+}
+
+bool PurchaseJournal::compact()
+{
+    std::vector<const Entry*> ordered;
+    for(const auto &it : _entries) {
+        ordered.push_back(&it.second);
+    }
+    std::sort(ordered.begin(), ordered.end(), [](const Entry *a, const Entry *b) {
+        return a->sequence < b->sequence;
+    });
+    JournalHeader header;
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    header.version = JOURNAL_VERSION;
+    std::vector<uint8_t> buffer((const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+    for(const Entry *entry : ordered) {
+        encodeRecord(entry->token, entry->sku, entry->state, &entry->purchase, buffer);
+    }
+
+    // same as the catalog: write aside, fsync, rename over
+    std::string tmp = _path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if(!f) {
+        return false;
+    }
+    bool written = fwrite(buffer.data(), 1, buffer.size(), f) == buffer.size();
+    written = fflush(f) == 0 && written;
+    written = fsync(fileno(f)) == 0 && written;
+    fclose(f);
+    if(!written || rename(tmp.c_str(), _path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    ::close(_fd);
+    _fd = ::open(_path.c_str(), O_WRONLY | O_APPEND);
+    _records = ordered.size();
+    return _fd >= 0;
+}
+
+void PurchaseJournal::flush()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    uint64_t target = _written;
+    if(_fd < 0 || !_syncThread.joinable()) {
+        return;
+    }
+    _hurry = true;
+    _syncCondition.notify_all();
+    _syncCondition.wait(lock, [this, target] { return _synced >= target || _stopping; });
+}
+
+void PurchaseJournal::startSync()
+{
+    if(_fd >= 0) {
+        _syncThread = std::thread(&PurchaseJournal::syncLoop, this);
+    }
+}
+
+void PurchaseJournal::syncLoop()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while(true) {
+        _syncCondition.wait(lock, [this] { return _stopping || _written > _synced; });
+        if(_written == _synced) {
+            break; // stopping, nothing left
+        }
+        // group commit: give the rest of a burst a moment to arrive
+        if(!_stopping) {
+            _syncCondition.wait_for(lock, std::chrono::milliseconds(SYNC_DELAY_MS), [this] { return _stopping || _hurry; });
+        }
+        _hurry = false;
+        uint64_t target = _written;
+        int fd = _fd;
+        lock.unlock();
+        fsync(fd);
+        lock.lock();
+        _synced = target;
+        _syncCondition.notify_all();
+    }
+}
+
+} // namespace iap
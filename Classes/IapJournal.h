@@ -0,0 +1,103 @@
+#ifndef IapJournal_h
+#define IapJournal_h
+
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Purchase journal
+//
+///////////////////////////////////////
+
+// What this device knows happened to each purchase, kept across crashes:
+// bought, granted to the player, consumed at the store. Keyed by purchase
+// token (Google Play purchaseToken, StoreKit transaction id).
+//
+// The file is append-only. Each record carries its length and an FNV-1a
+// checksum, so a torn tail from a crash mid-write is detected and cut off
+// at open. Records reach the kernel immediately (an app crash loses
+// nothing); fsync runs on a background thread that lets a burst of records
+// share one flush. open() replays the whole file into memory and rewrites
+// it compacted once superseded records dominate.
+class PurchaseJournal
+{
+public:
+    enum State
+    {
+        PURCHASED = 1,
+        GRANTED = 2,
+        CONSUMED = 4
+    };
+
+    struct Entry
+    {
+        std::string token;
+        std::string sku;
+        uint32_t state;
+        uint64_t sequence;       // order of first appearance
+        std::u16string purchase; // purchase object as delivered, unless larger than MAX_PURCHASE_JSON
+    };
+
+    // longer purchase objects (iOS ones carry the whole receipt) are not kept
+    static const size_t MAX_PURCHASE_JSON = 4096;
+    // how long the sync thread waits for more records before flushing
+    static const int SYNC_DELAY_MS = 20;
+
+    PurchaseJournal();
+    ~PurchaseJournal();
+
+    // replays the file, creating it if needed; without a file the journal
+    // lives in memory for this session
+    bool open(const std::string &path);
+    void close();
+
+    // Adds state bits to the token's entry, creating it. sku and purchase
+    // only fill in what is not known yet. False when nothing changed, in
+    // which case nothing is written either.
+    bool record(const std::string &token, const std::string &sku, uint32_t state, const std::u16string &purchase = std::u16string());
+
+    bool find(const std::string &token, Entry &entry) const;
+    // the newest entry bought for sku
+    bool findLatest(const std::string &sku, Entry &entry) const;
+    // bought but never granted, oldest first
+    std::vector<Entry> pendingGrants() const;
+    size_t size() const;
+
+    // waits until everything recorded so far is on disk
+    void flush();
+
+private:
+    bool apply(const std::string &token, const std::string &sku, uint32_t state, const std::u16string &purchase);
+    bool append(const Entry &entry, bool withPurchase);
+    void replay(const std::vector<uint8_t> &data, size_t &validEnd);
+    bool compact();
+    void startSync();
+    void syncLoop();
+
+    std::string _path;
+    int _fd;
+    size_t _records;
+    uint64_t _sequence;
+    std::unordered_map<std::string, Entry> _entries;
+    std::unordered_map<std::string, std::string> _latest; // sku -> token
+    mutable std::mutex _mutex;
+
+    std::thread _syncThread;
+    std::condition_variable _syncCondition;
+    uint64_t _written;  // records appended, counted
+    uint64_t _synced;   // ... and covered by an fsync
+    bool _hurry;        // flush() is waiting, skip the batching delay
+    bool _stopping;
+};
+
+} // namespace iap
+
+#endif /* IapJournal_h */
@@ -0,0 +1,1624 @@
+#include "Iap.h"
+#include "IapBilling.h"
+#include "IapCallbackPool.h"
+#include "IapContentInstaller.h"
+#include "IapDispatcher.h"
+#include "IapJsonDom.h"
+#include "IapModel.h"
+#include "IapProductStore.h"
+#include "IapRecords.h"
+#include "IapSkuTable.h"
+#include "IapStats.h"
+#include "IapVerifier.h"
+#include <cmath>
+#include "scripting/js-bindings/manual/cocos2d_specifics.hpp"
+#include "scripting/js-bindings/manual/js_manual_conversions.h"
+#include "base/CCDirector.h"
+#include "base/CCScheduler.h"
+#include "platform/CCFileUtils.h"
+#if IAP_USE_SIMULATED_STORE
+#include "IapSimulatedStore.h"
+#endif
+
+static void cpp_requestResult(iap::Result &&result);
+static void cpp_dispatchResults(float dt);
+
+static void printLog(const char* str) {
+    CCLOG("%s", str);
+}
+
+static iap::Billing* billing() {
+    return iap::Billing::getInstance();
+}
+
+///////////////////////////////////////
+//
+//  Pending JS callbacks
+//
+///////////////////////////////////////
+
+static const int MAX_PENDING_CALLBACKS = 1024;
+
+// JS function + this, rooted while the request is pending
+struct JsCallback
+{
+    JSContext *cx;
+    JS::PersistentRootedValue func;
+    JS::PersistentRootedValue thisVal;
+    bool lazyProducts; // answer with lazy product objects
+
+    JsCallback(JSContext *cx, JS::HandleValue func, JS::HandleValue thisVal)
+    : cx(cx)
+    , func(cx, func)
+    , thisVal(cx, thisVal)
+    , lazyProducts(false)
+    {}
+
+    void call(const JS::HandleValueArray &args) {
+        JS::RootedObject thisObj(cx, thisVal.isObject() ? &thisVal.toObject() : nullptr);
+        JS::RootedValue rval(cx);
+        if(!JS_CallFunctionValue(cx, thisObj, func, args, &rval) && JS_IsExceptionPending(cx)) {
+            JS_ReportPendingException(cx);
+        }
+    }
+};
+
+static iap::CallbackPool<JsCallback, MAX_PENDING_CALLBACKS> s_callbacks;
+
+// listeners for background catalog refreshes and purchase changes, live
+// outside the pool
+static std::unique_ptr<JsCallback> s_catalogListener;
+static std::unique_ptr<JsCallback> s_purchaseListener;
+static std::unique_ptr<JsCallback> s_contentListener;
+
+static int newCallback(JSContext *cx, JS::HandleValue func, JS::HandleValue thisVal) {
+    int callbackId = s_callbacks.acquire(cx, func, thisVal);
+    if(!callbackId) {
+        printLog("Too many pending requests");
+    }
+    return callbackId;
+}
+
+///////////////////////////////////////
+//
+//  Number arguments
+//
+///////////////////////////////////////
+
+// A number in [0, max], so the caller's cast is defined; NaN, infinities and
+// negative values are refused.
+// largest integer a JS number holds exactly
+static const double MAX_SAFE_INTEGER = 9007199254740991.0;
+
+static bool jsval_to_bounded(JSContext *cx, JS::HandleValue v, double max, double *ret)
+{
+    double d = 0;
+    if(!JS::ToNumber(cx, v, &d) || !std::isfinite(d) || d < 0 || d > max)
+        return false;
+    *ret = d;
+    return true;
+}
+
+///////////////////////////////////////
+//
+//  SKU arguments
+//
+///////////////////////////////////////
+
+// Wherever a sku is expected, JS may pass its name or the handle
+// iap.sku_handles() returned for it. Names are interned on first use.
+static bool jsval_to_sku_handle(JSContext *cx, JS::HandleValue v, int *ret)
+{
+    iap::SkuTable *table = iap::SkuTable::getInstance();
+    if(v.isNumber()) {
+        int32_t handle = 0;
+        if(!JS::ToInt32(cx, v, &handle) || !table->valid(handle))
+            return false;
+        *ret = handle;
+        return true;
+    }
+    std::string sku;
+    if(!jsval_to_std_string(cx, v, &sku))
+        return false;
+    *ret = table->intern(sku);
+    return *ret >= 0;
+}
+
+static bool jsval_to_sku_handles(JSContext *cx, JS::HandleValue v, std::vector<int> *ret)
+{
+    JS::RootedObject list(cx, v.isObject() ? v.toObjectOrNull() : nullptr);
+    uint32_t length = 0;
+    if(!list || !JS_IsArrayObject(cx, list) || !JS_GetArrayLength(cx, list, &length))
+        return false;
+    ret->reserve(length);
+    JS::RootedValue item(cx);
+    for(uint32_t i = 0; i < length; i++) {
+        int handle;
+        if(!JS_GetElement(cx, list, i, &item) || !jsval_to_sku_handle(cx, item, &handle)) {
+            // never hand back part of the list
+            ret->clear();
+            return false;
+        }
+        ret->push_back(handle);
+    }
+    return true;
+}
+
+// for the calls that still take names
+static bool jsval_to_sku_name(JSContext *cx, JS::HandleValue v, std::string *ret)
+{
+    if(!v.isNumber())
+        return jsval_to_std_string(cx, v, ret);
+    int handle;
+    if(!jsval_to_sku_handle(cx, v, &handle))
+        return false;
+    *ret = iap::SkuTable::getInstance()->name(handle);
+    return true;
+}
+
+static bool jsval_to_sku_names(JSContext *cx, JS::HandleValue v, std::vector<std::string> *ret)
+{
+    JS::RootedObject list(cx, v.isObject() ? v.toObjectOrNull() : nullptr);
+    uint32_t length = 0;
+    if(!list || !JS_IsArrayObject(cx, list) || !JS_GetArrayLength(cx, list, &length))
+        return false;
+    ret->resize(length);
+    JS::RootedValue item(cx);
+    for(uint32_t i = 0; i < length; i++) {
+        if(!JS_GetElement(cx, list, i, &item) || !jsval_to_sku_name(cx, item, &(*ret)[i])) {
+            ret->clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+///////////////////////////////////////
+//
+//  JS API
+//
+///////////////////////////////////////
+
+static bool js_iap_init(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_init");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 4) {
+        // skus, internalValidation, callback, this
+        int callbackId = newCallback(cx, args.get(2), args.get(3));
+        if(!callbackId) {
+            rec.rval().set(JSVAL_FALSE);
+            return true;
+        }
+        std::vector<std::string> arg0;
+        JS::RootedValue arg0Val(cx, args.get(0));
+        bool ok = jsval_to_std_vector_string(cx, arg0Val, &arg0);
+        bool arg1 = JS::ToBoolean(JS::RootedValue(cx, args.get(1)));
+        if(!ok) {
+            s_callbacks.release(callbackId);
+            JS_ReportError(cx, "Invalid arguments");
+            return false;
+        }
+        if(billing()->init(arg0, arg1, callbackId)) {
+            rec.rval().set(INT_TO_JSVAL(callbackId));
+        } else {
+            s_callbacks.release(callbackId);
+            rec.rval().set(JSVAL_FALSE);
+        }
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_get_purchases(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_get_purchases");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 2) {
+        // callback, this
+        int callbackId = newCallback(cx, args.get(0), args.get(1));
+        if(!callbackId) {
+            rec.rval().set(JSVAL_FALSE);
+            return true;
+        }
+        if(billing()->getPurchases(callbackId)) {
+            rec.rval().set(INT_TO_JSVAL(callbackId));
+        } else {
+            s_callbacks.release(callbackId);
+            rec.rval().set(JSVAL_FALSE);
+        }
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_buy(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_buy");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 4) {
+        // sku, payload, callback, this
+        int callbackId = newCallback(cx, args.get(2), args.get(3));
+        if(!callbackId) {
+            rec.rval().set(JSVAL_FALSE);
+            return true;
+        }
+        std::string arg0;
+        JS::RootedValue arg0Val(cx, args.get(0));
+        bool ok = jsval_to_sku_name(cx, arg0Val, &arg0);
+        std::string arg1;
+        JS::RootedValue arg1Val(cx, args.get(1));
+        ok &= jsval_to_std_string(cx, arg1Val, &arg1);
+        if(!ok) {
+            s_callbacks.release(callbackId);
+            JS_ReportError(cx, "Invalid arguments");
+            return false;
+        }
+        if(billing()->buy(arg0, arg1, callbackId)) {
+            rec.rval().set(INT_TO_JSVAL(callbackId));
+        } else {
+            s_callbacks.release(callbackId);
+            rec.rval().set(JSVAL_FALSE);
+        }
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_subscribe(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_subscribe");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 5) {
+        // sku, payload, oldPurchasedSkus, callback, this
+        int callbackId = newCallback(cx, args.get(3), args.get(4));
+        if(!callbackId) {
+            rec.rval().set(JSVAL_FALSE);
+            return true;
+        }
+        std::string arg0;
+        JS::RootedValue arg0Val(cx, args.get(0));
+        bool ok = jsval_to_sku_name(cx, arg0Val, &arg0);
+        std::string arg1;
+        JS::RootedValue arg1Val(cx, args.get(1));
+        ok &= jsval_to_std_string(cx, arg1Val, &arg1);
+        std::vector<std::string> arg2;
+        JS::RootedValue arg2Val(cx, args.get(2));
+        ok &= jsval_to_sku_names(cx, arg2Val, &arg2);
+        if(!ok) {
+            s_callbacks.release(callbackId);
+            JS_ReportError(cx, "Invalid arguments");
+            return false;
+        }
+        if(billing()->subscribe(arg0, arg1, arg2, callbackId)) {
+            rec.rval().set(INT_TO_JSVAL(callbackId));
+        } else {
+            s_callbacks.release(callbackId);
+            rec.rval().set(JSVAL_FALSE);
+        }
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_consume(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_consume");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 3) {
+        // sku, callback, this
+        int callbackId = newCallback(cx, args.get(1), args.get(2));
+        if(!callbackId) {
+            rec.rval().set(JSVAL_FALSE);
+            return true;
+        }
+        std::string arg0;
+        JS::RootedValue arg0Val(cx, args.get(0));
+        bool ok = jsval_to_sku_name(cx, arg0Val, &arg0);
+        if(!ok) {
+            s_callbacks.release(callbackId);
+            JS_ReportError(cx, "Invalid arguments");
+            return false;
+        }
+        if(billing()->consume(arg0, callbackId)) {
+            rec.rval().set(INT_TO_JSVAL(callbackId));
+        } else {
+            s_callbacks.release(callbackId);
+            rec.rval().set(JSVAL_FALSE);
+        }
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_consume_many(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_consume_many");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 3) {
+        // skus, callback, this
+        int callbackId = newCallback(cx, args.get(1), args.get(2));
+        if(!callbackId) {
+            rec.rval().set(JSVAL_FALSE);
+            return true;
+        }
+        std::vector<std::string> arg0;
+        JS::RootedValue arg0Val(cx, args.get(0));
+        if(!jsval_to_sku_names(cx, arg0Val, &arg0)) {
+            // a partial batch would consume the wrong items
+            s_callbacks.release(callbackId);
+            JS_ReportError(cx, "Invalid arguments");
+            return false;
+        }
+        if(billing()->consumeMany(arg0, callbackId)) {
+            rec.rval().set(INT_TO_JSVAL(callbackId));
+        } else {
+            s_callbacks.release(callbackId);
+            rec.rval().set(JSVAL_FALSE);
+        }
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_available_products(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_available_products");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 2) {
+        // callback, this
+        int callbackId = newCallback(cx, args.get(0), args.get(1));
+        if(!callbackId) {
+            rec.rval().set(JSVAL_FALSE);
+            return true;
+        }
+        s_callbacks.get(callbackId)->lazyProducts = true;
+        if(billing()->availableProducts(callbackId)) {
+            rec.rval().set(INT_TO_JSVAL(callbackId));
+        } else {
+            s_callbacks.release(callbackId);
+            rec.rval().set(JSVAL_FALSE);
+        }
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_product_details(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_product_details");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 3) {
+        // skus, callback, this
+        int callbackId = newCallback(cx, args.get(1), args.get(2));
+        if(!callbackId) {
+            rec.rval().set(JSVAL_FALSE);
+            return true;
+        }
+        s_callbacks.get(callbackId)->lazyProducts = true;
+        std::vector<int> arg0;
+        JS::RootedValue arg0Val(cx, args.get(0));
+        bool ok = jsval_to_sku_handles(cx, arg0Val, &arg0);
+        if(!ok) {
+            s_callbacks.release(callbackId);
+            JS_ReportError(cx, "Invalid arguments");
+            return false;
+        }
+        if(billing()->productDetails(arg0, callbackId)) {
+            rec.rval().set(INT_TO_JSVAL(callbackId));
+        } else {
+            s_callbacks.release(callbackId);
+            rec.rval().set(JSVAL_FALSE);
+        }
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_restore(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_restore");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 2) {
+        // callback, this
+        int callbackId = newCallback(cx, args.get(0), args.get(1));
+        if(!callbackId) {
+            rec.rval().set(JSVAL_FALSE);
+            return true;
+        }
+        if(billing()->restore(callbackId)) {
+            rec.rval().set(INT_TO_JSVAL(callbackId));
+        } else {
+            s_callbacks.release(callbackId);
+            rec.rval().set(JSVAL_FALSE);
+        }
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_cancel(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_cancel");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 1) {
+        // request id returned by the call; its callback gets "Request cancelled"
+        int32_t requestId = 0;
+        if(!args.get(0).isNumber() || !JS::ToInt32(cx, args.get(0), &requestId) || requestId <= 0) {
+            rec.rval().set(JSVAL_FALSE);
+            return true;
+        }
+        rec.rval().set(BOOLEAN_TO_JSVAL(billing()->cancel(requestId)));
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_set_timeout(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_set_timeout");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 2 || argc == 3) {
+        // operation name as in iap.stats(), milliseconds (0 = none), optional retries
+        std::string name;
+        JS::RootedValue nameVal(cx, args.get(0));
+        if(!jsval_to_std_string(cx, nameVal, &name)) {
+            rec.rval().set(JSVAL_FALSE);
+            return true;
+        }
+        int op = 0;
+        while(op < iap::Stats::OP_COUNT && name != iap::Stats::operationName((iap::Stats::Operation)op)) {
+            op++;
+        }
+        if(op == iap::Stats::OP_COUNT) {
+            rec.rval().set(JSVAL_FALSE);
+            return true;
+        }
+        double ms = 0;
+        JS::RootedValue msVal(cx, args.get(1));
+        if(!jsval_to_bounded(cx, msVal, UINT32_MAX, &ms)) {
+            JS_ReportError(cx, "Invalid timeout");
+            return false;
+        }
+        int32_t retries = 0;
+        if(argc == 3)
+            JS::ToInt32(cx, args.get(2), &retries);
+        iap::Billing::RequestPolicy policy((uint32_t)ms, retries > 0 ? retries : 0);
+        billing()->setRequestPolicy((iap::Stats::Operation)op, policy);
+        rec.rval().set(JSVAL_TRUE);
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_debug(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_debug");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::RootedObject obj(cx, args.thisv().toObjectOrNull());
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 1) {
+        bool debug = JS::ToBoolean(JS::RootedValue(cx, args.get(0)));
+        if(billing()->setDebug(debug)) {
+            rec.rval().set(JSVAL_TRUE);
+        } else {
+            rec.rval().set(JSVAL_FALSE);
+        }
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_set_dispatch_budget(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_set_dispatch_budget");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 1) {
+        double ms = 0;
+        JS::ToNumber(cx, args.get(0), &ms);
+        iap::Dispatcher::getInstance()->setFrameBudget(std::chrono::microseconds((long long)(ms * 1000)));
+        rec.rval().set(JSVAL_TRUE);
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_set_binary_results(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_set_binary_results");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 1) {
+        bool enabled = JS::ToBoolean(JS::RootedValue(cx, args.get(0)));
+        rec.rval().set(BOOLEAN_TO_JSVAL(billing()->setBinaryResults(enabled)));
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_on_catalog_changed(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_on_catalog_changed");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 2) {
+        // callback, this; a null callback removes the listener
+        if(args.get(0).isNullOrUndefined()) {
+            s_catalogListener.reset();
+        } else {
+            s_catalogListener.reset(new JsCallback(cx, args.get(0), args.get(1)));
+            s_catalogListener->lazyProducts = true;
+        }
+        rec.rval().set(JSVAL_TRUE);
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_watch_purchases(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_watch_purchases");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 3) {
+        // since version, callback, this; a null callback stops watching
+        if(args.get(1).isNullOrUndefined()) {
+            billing()->unwatchPurchases();
+            s_purchaseListener.reset();
+            rec.rval().set(JSVAL_TRUE);
+            return true;
+        }
+        double since = 0;
+        JS::RootedValue sinceVal(cx, args.get(0));
+        if(sinceVal.isNumber() && !jsval_to_bounded(cx, sinceVal, MAX_SAFE_INTEGER, &since)) {
+            JS_ReportError(cx, "Invalid version");
+            return false;
+        }
+        s_purchaseListener.reset(new JsCallback(cx, args.get(1), args.get(2)));
+        billing()->watchPurchases((uint64_t)since);
+        rec.rval().set(JSVAL_TRUE);
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_verify_purchases(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_verify_purchases");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 4) {
+        // public key (base64), array of purchases with receipt and signature, callback, this
+        std::string key;
+        JS::RootedValue keyVal(cx, args.get(0));
+        JS::RootedObject list(cx, args.get(1).isObject() ? args.get(1).toObjectOrNull() : nullptr);
+        uint32_t length = 0;
+        if(!jsval_to_std_string(cx, keyVal, &key) || !list || !JS_IsArrayObject(cx, list) || !JS_GetArrayLength(cx, list, &length)) {
+            JS_ReportError(cx, "Invalid arguments");
+            return false;
+        }
+        int callbackId = newCallback(cx, args.get(2), args.get(3));
+        if(!callbackId) {
+            rec.rval().set(JSVAL_FALSE);
+            return true;
+        }
+
+        std::vector<iap::SignedPurchase> purchases(length);
+        JS::RootedValue item(cx);
+        JS::RootedValue field(cx);
+        for(uint32_t i = 0; i < length; i++) {
+            if(!JS_GetElement(cx, list, i, &item) || !item.isObject())
+                continue;
+            JS::RootedObject purchase(cx, item.toObjectOrNull());
+            if(JS_GetProperty(cx, purchase, "receipt", &field) && field.isString())
+                jsval_to_std_string(cx, field, &purchases[i].data);
+            if(JS_GetProperty(cx, purchase, "signature", &field) && field.isString())
+                jsval_to_std_string(cx, field, &purchases[i].signature);
+        }
+        // the key is parsed and the signatures checked on the verifier's
+        // thread; the booleans come back through the dispatcher
+        iap::PurchaseVerifier::getInstance()->verifyAsync(std::move(key), std::move(purchases), [callbackId](bool keyOk, const std::vector<uint8_t> &results) {
+            if(!keyOk) {
+                billing()->purchasesVerified(callbackId, "Invalid public key", std::u16string());
+                return;
+            }
+            std::u16string json(u"[");
+            for(size_t i = 0; i < results.size(); i++) {
+                if(i)
+                    json += u',';
+                json += results[i] ? u"true" : u"false";
+            }
+            json += u']';
+            billing()->purchasesVerified(callbackId, std::string(), std::move(json));
+        });
+        rec.rval().set(INT_TO_JSVAL(callbackId));
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_mark_granted(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_mark_granted");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 1) {
+        std::string token;
+        JS::RootedValue arg0(cx, args.get(0));
+        if(!jsval_to_std_string(cx, arg0, &token)) {
+            JS_ReportError(cx, "Invalid arguments");
+            return false;
+        }
+        rec.rval().set(BOOLEAN_TO_JSVAL(billing()->markGranted(token)));
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_pending_grants(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_pending_grants");
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 0) {
+        std::vector<iap::PurchaseJournal::Entry> pending = billing()->pendingGrants();
+        JS::RootedObject out(cx, JS_NewArrayObject(cx, pending.size()));
+        JS::RootedValue field(cx);
+        JS::RootedValue item(cx);
+        for(size_t i = 0; i < pending.size(); i++) {
+            JS::RootedObject entry(cx, JS_NewObject(cx, nullptr, JS::NullPtr(), JS::NullPtr()));
+            field = std_string_to_jsval(cx, pending[i].token);
+            JS_SetProperty(cx, entry, "purchaseToken", field);
+            field = std_string_to_jsval(cx, pending[i].sku);
+            JS_SetProperty(cx, entry, "productId", field);
+            item = OBJECT_TO_JSVAL(entry);
+            JS_SetElement(cx, out, (uint32_t)i, item);
+        }
+        rec.rval().set(OBJECT_TO_JSVAL(out));
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool cpp_setTableString(JSContext *cx, JS::HandleObject obj, const char *name, const iap::StringArena &strings, iap::StringArena::Ref ref)
+{
+    JSString *str = JS_NewUCStringCopyN(cx, strings.chars(ref), ref.length);
+    if(!str)
+        return false;
+    JS::RootedValue val(cx, STRING_TO_JSVAL(str));
+    return JS_SetProperty(cx, obj, name, val);
+}
+
+static bool cpp_setTableNumber(JSContext *cx, JS::HandleObject obj, const char *name, double number)
+{
+    JS::RootedValue val(cx, DOUBLE_TO_JSVAL(number));
+    return JS_SetProperty(cx, obj, name, val);
+}
+
+static bool js_iap_query_products(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_query_products");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc <= 1) {
+        // optional {type, min_price_micros, max_price_micros, currency, sort, descending, limit}
+        iap::ProductTable::Query query;
+        JS::RootedObject options(cx, argc == 1 && args.get(0).isObject() ? args.get(0).toObjectOrNull() : nullptr);
+        JS::RootedValue field(cx);
+        std::string text;
+        if(options) {
+            if(JS_GetProperty(cx, options, "type", &field) && field.isString() && jsval_to_std_string(cx, field, &text))
+                query.type = text == "inapp" ? iap::ProductTable::TYPE_INAPP : text == "subs" ? iap::ProductTable::TYPE_SUBS : iap::ProductTable::TYPE_OTHER;
+            double number = 0;
+            if(JS_GetProperty(cx, options, "min_price_micros", &field) && field.isNumber()) {
+                if(!jsval_to_bounded(cx, field, MAX_SAFE_INTEGER, &number)) {
+                    JS_ReportError(cx, "Invalid min_price_micros");
+                    return false;
+                }
+                query.minPriceMicros = (int64_t)number;
+            }
+            if(JS_GetProperty(cx, options, "max_price_micros", &field) && field.isNumber()) {
+                if(!jsval_to_bounded(cx, field, MAX_SAFE_INTEGER, &number)) {
+                    JS_ReportError(cx, "Invalid max_price_micros");
+                    return false;
+                }
+                query.maxPriceMicros = (int64_t)number;
+            }
+            if(JS_GetProperty(cx, options, "currency", &field) && field.isString() && jsval_to_std_string(cx, field, &text))
+                query.currency = iap::utf8ToUtf16(text);
+            if(JS_GetProperty(cx, options, "sort", &field) && field.isString() && jsval_to_std_string(cx, field, &text))
+                query.sort = text == "price" ? iap::ProductTable::SORT_PRICE : text == "title" ? iap::ProductTable::SORT_TITLE : text == "sku" ? iap::ProductTable::SORT_SKU : iap::ProductTable::SORT_NONE;
+            if(JS_GetProperty(cx, options, "descending", &field))
+                query.descending = JS::ToBoolean(field);
+            if(JS_GetProperty(cx, options, "limit", &field) && field.isNumber()) {
+                if(!jsval_to_bounded(cx, field, UINT32_MAX, &number)) {
+                    JS_ReportError(cx, "Invalid limit");
+                    return false;
+                }
+                query.limit = (size_t)number;
+            }
+        }
+        std::shared_ptr<const iap::ProductTable> products = billing()->productTable();
+        std::vector<uint32_t> rows;
+        products->query(query, rows);
+
+        static const char* const TYPE_NAMES[] = { "inapp", "subs", "" };
+        const iap::StringArena &strings = products->strings();
+        iap::SkuTable *skus = iap::SkuTable::getInstance();
+        JS::RootedObject out(cx, JS_NewArrayObject(cx, rows.size()));
+        JS::RootedValue item(cx);
+        for(size_t i = 0; i < rows.size(); i++) {
+            uint32_t row = rows[i];
+            JS::RootedObject product(cx, JS_NewObject(cx, nullptr, JS::NullPtr(), JS::NullPtr()));
+            field = std_string_to_jsval(cx, skus->name(products->sku(row)));
+            JS_SetProperty(cx, product, iap::KEY_PRODUCT_ID, field);
+            field = c_string_to_jsval(cx, TYPE_NAMES[products->type(row)]);
+            JS_SetProperty(cx, product, iap::KEY_TYPE, field);
+            cpp_setTableString(cx, product, iap::KEY_PRICE, strings, products->price(row));
+            if(products->priceMicros(row) != iap::ProductTable::NO_PRICE)
+                cpp_setTableNumber(cx, product, iap::KEY_PRICE_MICROS, (double)products->priceMicros(row));
+            cpp_setTableString(cx, product, iap::KEY_CURRENCY, strings, products->currency(row));
+            cpp_setTableString(cx, product, iap::KEY_TITLE, strings, products->title(row));
+            cpp_setTableString(cx, product, iap::KEY_DESCRIPTION, strings, products->description(row));
+            item = OBJECT_TO_JSVAL(product);
+            JS_SetElement(cx, out, (uint32_t)i, item);
+        }
+        rec.rval().set(OBJECT_TO_JSVAL(out));
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_query_purchases(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_query_purchases");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc <= 1) {
+        // optional {sku, sort, descending, limit}
+        iap::PurchaseTable::Query query;
+        JS::RootedObject options(cx, argc == 1 && args.get(0).isObject() ? args.get(0).toObjectOrNull() : nullptr);
+        JS::RootedValue field(cx);
+        std::string text;
+        if(options) {
+            if(JS_GetProperty(cx, options, "sku", &field) && !field.isNullOrUndefined()) {
+                // an unknown sku matches nothing
+                if(!jsval_to_sku_handle(cx, field, &query.sku))
+                    query.sku = iap::SkuTable::MAX_SKUS;
+            }
+            if(JS_GetProperty(cx, options, "sort", &field) && field.isString() && jsval_to_std_string(cx, field, &text))
+                query.sort = text == "time" ? iap::PurchaseTable::SORT_TIME : iap::PurchaseTable::SORT_NONE;
+            if(JS_GetProperty(cx, options, "descending", &field))
+                query.descending = JS::ToBoolean(field);
+            double number = 0;
+            if(JS_GetProperty(cx, options, "limit", &field) && field.isNumber()) {
+                if(!jsval_to_bounded(cx, field, UINT32_MAX, &number)) {
+                    JS_ReportError(cx, "Invalid limit");
+                    return false;
+                }
+                query.limit = (size_t)number;
+            }
+        }
+        std::shared_ptr<const iap::PurchaseTable> purchases = billing()->purchaseTable();
+        std::vector<uint32_t> rows;
+        purchases->query(query, rows);
+
+        const iap::StringArena &strings = purchases->strings();
+        iap::SkuTable *skus = iap::SkuTable::getInstance();
+        JS::RootedObject out(cx, JS_NewArrayObject(cx, rows.size()));
+        JS::RootedValue item(cx);
+        for(size_t i = 0; i < rows.size(); i++) {
+            uint32_t row = rows[i];
+            JS::RootedObject purchase(cx, JS_NewObject(cx, nullptr, JS::NullPtr(), JS::NullPtr()));
+            field = std_string_to_jsval(cx, skus->name(purchases->sku(row)));
+            JS_SetProperty(cx, purchase, iap::KEY_PRODUCT_ID, field);
+            cpp_setTableString(cx, purchase, iap::KEY_PURCHASE_TOKEN, strings, purchases->token(row));
+            cpp_setTableString(cx, purchase, iap::KEY_ORDER_ID, strings, purchases->orderId(row));
+            cpp_setTableNumber(cx, purchase, iap::KEY_PURCHASE_TIME, (double)purchases->purchaseTime(row));
+            cpp_setTableNumber(cx, purchase, iap::KEY_PURCHASE_STATE, purchases->state(row));
+            item = OBJECT_TO_JSVAL(purchase);
+            JS_SetElement(cx, out, (uint32_t)i, item);
+        }
+        rec.rval().set(OBJECT_TO_JSVAL(out));
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_sku_handles(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_sku_handles");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 1) {
+        // array of skus; null in place of a sku the table has no room for
+        std::vector<std::string> skus;
+        JS::RootedValue arg0(cx, args.get(0));
+        if(!jsval_to_std_vector_string(cx, arg0, &skus)) {
+            JS_ReportError(cx, "Invalid arguments");
+            return false;
+        }
+        std::vector<int> handles;
+        iap::SkuTable::getInstance()->intern(skus, handles);
+        JS::RootedObject out(cx, JS_NewArrayObject(cx, handles.size()));
+        JS::RootedValue item(cx);
+        for(size_t i = 0; i < handles.size(); i++) {
+            item = handles[i] >= 0 ? INT_TO_JSVAL(handles[i]) : JSVAL_NULL;
+            JS_SetElement(cx, out, (uint32_t)i, item);
+        }
+        rec.rval().set(OBJECT_TO_JSVAL(out));
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_sku_name(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_sku_name");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 1) {
+        // null for a number that is not a handle
+        iap::SkuTable *table = iap::SkuTable::getInstance();
+        int32_t handle = -1;
+        if(!args.get(0).isNumber() || !JS::ToInt32(cx, args.get(0), &handle) || !table->valid(handle)) {
+            rec.rval().set(JSVAL_NULL);
+            return true;
+        }
+        rec.rval().set(std_string_to_jsval(cx, table->name(handle)));
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_stats(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_stats");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc <= 1) {
+        // optional reset flag, the snapshot is taken first
+        iap::Stats *stats = iap::Stats::getInstance();
+        std::u16string json = iap::utf8ToUtf16(stats->snapshotJson());
+        if(argc == 1 && JS::ToBoolean(JS::RootedValue(cx, args.get(0)))) {
+            stats->reset();
+        }
+        JS::RootedValue rval(cx);
+        if(!JS_ParseJSON(cx, json.data(), (uint32_t)json.size(), &rval)) {
+            return false;
+        }
+        rec.rval().set(rval);
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_start_trace(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_start_trace");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 1) {
+        std::string name;
+        JS::RootedValue nameVal(cx, args.get(0));
+        if(!jsval_to_std_string(cx, nameVal, &name) || name.empty()) {
+            JS_ReportError(cx, "Invalid arguments");
+            return false;
+        }
+        // relative to the writable path, like the catalog cache
+        std::string path = cocos2d::FileUtils::getInstance()->getWritablePath() + name;
+        rec.rval().set(BOOLEAN_TO_JSVAL(billing()->startTrace(path)));
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_stop_trace(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_stop_trace");
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 0) {
+        billing()->stopTrace();
+        rec.rval().set(JSVAL_TRUE);
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+static bool js_iap_on_content(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_on_content");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 2) {
+        // callback, this; a null callback removes the listener
+        if(args.get(0).isNullOrUndefined()) {
+            s_contentListener.reset();
+        } else {
+            s_contentListener.reset(new JsCallback(cx, args.get(0), args.get(1)));
+        }
+        rec.rval().set(JSVAL_TRUE);
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+// relative paths are in the writable path
+static std::string contentPath(const std::string &path)
+{
+    if(path.empty() || path[0] == '/')
+        return path;
+    return cocos2d::FileUtils::getInstance()->getWritablePath() + path;
+}
+
+static bool jsval_to_content_files(JSContext *cx, JS::HandleValue v, std::vector<iap::ContentFile> *ret)
+{
+    JS::RootedObject list(cx, v.isObject() ? v.toObjectOrNull() : nullptr);
+    uint32_t length = 0;
+    if(!list || !JS_IsArrayObject(cx, list) || !JS_GetArrayLength(cx, list, &length))
+        return false;
+    ret->resize(length);
+    JS::RootedValue item(cx);
+    JS::RootedValue field(cx);
+    for(uint32_t i = 0; i < length; i++) {
+        iap::ContentFile &file = (*ret)[i];
+        if(!JS_GetElement(cx, list, i, &item))
+            return false;
+        if(item.isString()) {
+            if(!jsval_to_std_string(cx, item, &file.path) || !iap::ContentInstaller::validPath(file.path))
+                return false;
+            continue;
+        }
+        if(!item.isObject())
+            return false;
+        JS::RootedObject entry(cx, item.toObjectOrNull());
+        if(!JS_GetProperty(cx, entry, "path", &field) || !jsval_to_std_string(cx, field, &file.path)
+           || !iap::ContentInstaller::validPath(file.path))
+            return false;
+        if(JS_GetProperty(cx, entry, "target", &field) && field.isString()
+           && (!jsval_to_std_string(cx, field, &file.targetPath) || !iap::ContentInstaller::validPath(file.targetPath)))
+            return false;
+        double number = 0;
+        if(JS_GetProperty(cx, entry, "size", &field) && field.isNumber()) {
+            if(!jsval_to_bounded(cx, field, MAX_SAFE_INTEGER, &number))
+                return false;
+            file.size = (uint64_t)number;
+        }
+        if(JS_GetProperty(cx, entry, "crc32", &field) && field.isNumber()) {
+            if(!jsval_to_bounded(cx, field, UINT32_MAX, &number))
+                return false;
+            file.crc32 = (uint32_t)number;
+            file.verify = true;
+        }
+    }
+    return true;
+}
+
+static bool js_iap_install_content(JSContext *cx, uint32_t argc, jsval *vp)
+{
+    printLog("js_iap_install_content");
+    JS::CallArgs args = JS::CallArgsFromVp(argc, vp);
+    JS::CallReceiver rec = JS::CallReceiverFromVp(vp);
+    if(argc == 3 || argc == 4) {
+        // sku, source directory, target directory, options
+        iap::ContentPackage package;
+        JS::RootedValue skuVal(cx, args.get(0));
+        JS::RootedValue sourceVal(cx, args.get(1));
+        JS::RootedValue targetVal(cx, args.get(2));
+        if(!jsval_to_std_string(cx, skuVal, &package.id) ||
+           !jsval_to_std_string(cx, sourceVal, &package.source) || package.source.empty() ||
+           !jsval_to_std_string(cx, targetVal, &package.target) || package.target.empty()) {
+            JS_ReportError(cx, "Invalid arguments");
+            return false;
+        }
+        if(argc == 4 && args.get(3).isObject()) {
+            JS::RootedObject options(cx, args.get(3).toObjectOrNull());
+            JS::RootedValue field(cx);
+            if(JS_GetProperty(cx, options, "keep_source", &field) && field.isBoolean())
+                package.keepSource = field.toBoolean();
+            if(JS_GetProperty(cx, options, "files", &field) && !field.isNullOrUndefined() &&
+               !jsval_to_content_files(cx, field, &package.files)) {
+                JS_ReportError(cx, "Invalid arguments");
+                return false;
+            }
+        }
+        package.source = contentPath(package.source);
+        package.target = contentPath(package.target);
+        iap::ContentInstaller::getInstance()->installAsync(std::move(package));
+        rec.rval().set(JSVAL_TRUE);
+        return true;
+    } else {
+        JS_ReportError(cx, "Invalid number of arguments");
+        return false;
+    }
+}
+
+///////////////////////////////////////
+//
+//  Register JS API
+//
+///////////////////////////////////////
+
+void register_all_iap_framework(JSContext* cx, JS::HandleObject obj) {
+    printLog("[Iap] register js interface");
+    iap::Billing *billing = iap::Billing::getInstance();
+    if(!billing->getBackend()) {
+#if IAP_USE_SIMULATED_STORE
+        billing->setBackend(new iap::SimulatedStore());
+#else
+        billing->setBackend(iap::createPlatformBackend());
+#endif
+    }
+    billing->setResultHandler(cpp_requestResult);
+    billing->openCatalogCache(cocos2d::FileUtils::getInstance()->getWritablePath() + "iap_catalog.bin");
+    billing->openJournal(cocos2d::FileUtils::getInstance()->getWritablePath() + "iap_journal.bin");
+
+    cocos2d::Scheduler *scheduler = cocos2d::Director::getInstance()->getScheduler();
+    iap::Dispatcher *dispatcher = iap::Dispatcher::getInstance();
+    if(!scheduler->isScheduled("iap_dispatch", dispatcher)) {
+        scheduler->schedule(cpp_dispatchResults, dispatcher, 0, false, "iap_dispatch");
+    }
+
+    JS::RootedObject ns(cx);
+    get_or_create_js_obj(cx, obj, "iap", &ns);
+
+    // initialize plugin, args: array of skus, internal validation flag (bool), callback func, this pointer
+    JS_DefineFunction(cx, ns, "init", js_iap_init, 4, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // get purchased items, args: callback func, this pointer
+    JS_DefineFunction(cx, ns, "get_purchases", js_iap_get_purchases, 2, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // purchase an item, args: sku, payload, callback func, this pointer
+    JS_DefineFunction(cx, ns, "buy", js_iap_buy, 4, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // subscribe, args: sku, payload, oldPurchasedSkus (array of strings), callback func, this pointer
+    JS_DefineFunction(cx, ns, "subscribe", js_iap_subscribe, 5, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // consume purchased item, args: sku, callback func, this pointer
+    JS_DefineFunction(cx, ns, "consume", js_iap_consume, 3, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // consume several purchased items with one store round trip, args: array of skus, callback func, this pointer; result is an array of {productId, error, purchase}
+    JS_DefineFunction(cx, ns, "consume_many", js_iap_consume_many, 3, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // return available products for purchasing, args: callback func, this pointer
+    JS_DefineFunction(cx, ns, "available_products", js_iap_available_products, 2, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // return product details, args: array of skus or sku handles, callback func, this pointer
+    JS_DefineFunction(cx, ns, "product_details", js_iap_product_details, 3, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // restore purchasings (receipt refresh on iOS, owned items on Android), args: callback func, this pointer
+    JS_DefineFunction(cx, ns, "restore", js_iap_restore, 2, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // give up on a pending request, its callback gets an error, args: id returned by the request call; returns false once answered
+    JS_DefineFunction(cx, ns, "cancel", js_iap_cancel, 1, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // deadline and retries per operation, args: operation name as in stats, milliseconds (0 = none), optional retries (idempotent queries only)
+    JS_DefineFunction(cx, ns, "set_timeout", js_iap_set_timeout, 3, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // enable/disable debugging logs
+    JS_DefineFunction(cx, ns, "set_debug", js_iap_debug, 1, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // time budget per frame for delivering callbacks, args: milliseconds (0 = unlimited)
+    JS_DefineFunction(cx, ns, "set_dispatch_budget", js_iap_set_dispatch_budget, 1, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // deliver products and purchases as binary records instead of JSON (same objects in JS), args: flag; returns false if unsupported
+    JS_DefineFunction(cx, ns, "set_binary_results", js_iap_set_binary_results, 1, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // called with the new product array when a background refresh changed the cached catalog, args: callback func, this pointer
+    JS_DefineFunction(cx, ns, "on_catalog_changed", js_iap_on_catalog_changed, 2, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // owned purchases that changed since a version, now and on every change, args: since version (0 for everything), callback func (null stops), this pointer; result is {version, reset, added, changed, removed}
+    JS_DefineFunction(cx, ns, "watch_purchases", js_iap_watch_purchases, 3, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // check purchase signatures with the store's public key, off the JS thread, args: base64 key, array of purchases, callback func, this pointer; result is an array of bools
+    JS_DefineFunction(cx, ns, "verify_purchases", js_iap_verify_purchases, 4, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // record that a purchase's content was handed to the player, args: purchase token (transactionId on iOS)
+    JS_DefineFunction(cx, ns, "mark_granted", js_iap_mark_granted, 1, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // purchases bought but never marked granted, survives crashes; returns array of {purchaseToken, productId}
+    JS_DefineFunction(cx, ns, "pending_grants", js_iap_pending_grants, 0, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // integer handles for skus, accepted wherever a sku is, args: array of skus; returns array of ints
+    JS_DefineFunction(cx, ns, "sku_handles", js_iap_sku_handles, 1, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // the sku behind a handle, args: handle; returns string (null for an unknown handle)
+    JS_DefineFunction(cx, ns, "sku_name", js_iap_sku_name, 1, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // the cached catalog filtered and sorted natively, args: optional {type, min_price_micros, max_price_micros, currency, sort ("price", "title", "sku"), descending, limit}; returns array of products
+    JS_DefineFunction(cx, ns, "query_products", js_iap_query_products, 1, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // owned purchases, args: optional {sku, sort ("time"), descending, limit}; returns array of {productId, purchaseToken, orderId, purchaseTime, purchaseState}
+    JS_DefineFunction(cx, ns, "query_purchases", js_iap_query_purchases, 1, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // latency statistics per operation and stage, args: optional reset flag; returns object, times in ms
+    JS_DefineFunction(cx, ns, "stats", js_iap_stats, 1, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // record store traffic to a trace file for replay_bench, args: file name (in the writable path); returns false if it can't be opened
+    JS_DefineFunction(cx, ns, "start_trace", js_iap_start_trace, 1, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // stop recording and flush the trace
+    JS_DefineFunction(cx, ns, "stop_trace", js_iap_stop_trace, 0, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // called with {sku, state, bytes, total_bytes, files, total_files, progress, error} as purchased content downloads and installs, args: callback func, this pointer
+    JS_DefineFunction(cx, ns, "on_content", js_iap_on_content, 2, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+
+    // install downloaded content, args: sku, source dir, target dir (relative to the writable path), options {keep_source, files: [{path, target, size, crc32}]}; progress goes to on_content
+    JS_DefineFunction(cx, ns, "install_content", js_iap_install_content, 4, JSPROP_PERMANENT | JSPROP_ENUMERATE);
+}
+
+///////////////////////////////////////
+//
+//  Backend to JS tools
+//
+///////////////////////////////////////
+
+static void cpp_requestResult(iap::Result &&result)
+{
+    // parsed and validated here, the cocos thread only creates the values
+    iap::preparseResult(result);
+    // lock-free, billing threads never touch the cocos scheduler
+    iap::Stats::getInstance()->queued(result.requestId);
+    iap::Dispatcher::getInstance()->push(std::move(result));
+}
+
+// property names of records, interned once: interned strings are pinned for
+// the lifetime of the runtime, so their ids can be kept without rooting
+static jsid cpp_recordKey(JSContext *cx, const char16_t *chars, uint32_t length)
+{
+    static std::unordered_map<std::u16string, jsid> s_keys;
+    std::u16string key(chars, length);
+    auto it = s_keys.find(key);
+    if(it != s_keys.end()) {
+        return it->second;
+    }
+    JSString *str = JS_InternUCStringN(cx, chars, length);
+    if(!str) {
+        return JSID_VOID;
+    }
+    jsid id = INTERNED_STRING_TO_JSID(cx, str);
+    s_keys.emplace(std::move(key), id);
+    return id;
+}
+
+///////////////////////////////////////
+//
+//  Lazy product objects
+//
+///////////////////////////////////////
+
+// Product lists are not converted up front: each product is a JS object
+// whose fields are defined from the ProductStore the first time they are
+// looked up (resolve hook), or all at once when enumerated (for-in,
+// Object.keys, JSON.stringify). A UI reading productId and price of a big
+// catalog never creates the other strings.
+//
+// Every product object of a list holds a reference to it; the last
+// finalizer frees the store. Finalizers of this class run on the JS thread.
+struct LazyProducts
+{
+    iap::ProductStore store;
+    std::vector<jsid> keys; // store key index -> interned property id
+    int refs;
+};
+
+static void cpp_releaseProducts(LazyProducts *products)
+{
+    if(products && --products->refs == 0) {
+        delete products;
+    }
+}
+
+static bool cpp_defineProductField(JSContext *cx, JS::HandleObject obj, JS::HandleId id, const iap::ProductStore &store, const iap::ProductStore::Field &field)
+{
+    JS::RootedValue val(cx);
+    switch(field.type) {
+    case iap::ProductStore::FIELD_STRING: {
+        JSString *str;
+        if(field.escaped) {
+            std::u16string text = store.string(field);
+            str = JS_NewUCStringCopyN(cx, text.data(), text.size());
+        } else {
+            str = JS_NewUCStringCopyN(cx, field.str, field.length);
+        }
+        if(!str)
+            return false;
+        val.setString(str);
+        break;
+    }
+    case iap::ProductStore::FIELD_NUMBER:
+        val.setNumber(field.number);
+        break;
+    case iap::ProductStore::FIELD_BOOL:
+        val.setBoolean(field.number != 0);
+        break;
+    case iap::ProductStore::FIELD_JSON:
+        if(!JS_ParseJSON(cx, field.str, field.length, &val))
+            return false;
+        break;
+    default:
+        val.setNull();
+    }
+    return JS_DefinePropertyById(cx, obj, id, val, JSPROP_ENUMERATE);
+}
+
+static bool cpp_productResolve(JSContext *cx, JS::HandleObject obj, JS::HandleId id)
+{
+    LazyProducts *products = static_cast<LazyProducts*>(JS_GetPrivate(obj));
+    if(!products || !JSID_IS_STRING(id)) {
+        return true;
+    }
+    uint32_t index = JS_GetReservedSlot(obj, 0).toInt32();
+    for(uint32_t key = 0; key < products->keys.size(); key++) {
+        if(JSID_BITS(products->keys[key]) != JSID_BITS(id.get()))
+            continue;
+        const iap::ProductStore::Field *field = products->store.field(index, key);
+        return !field || cpp_defineProductField(cx, obj, id, products->store, *field);
+    }
+    return true;
+}
+
+static bool cpp_productEnumerate(JSContext *cx, JS::HandleObject obj)
+{
+    LazyProducts *products = static_cast<LazyProducts*>(JS_GetPrivate(obj));
+    if(!products) {
+        return true;
+    }
+    uint32_t index = JS_GetReservedSlot(obj, 0).toInt32();
+    JS::RootedId id(cx);
+    const iap::ProductStore &store = products->store;
+    for(const iap::ProductStore::Field *field = store.fieldsBegin(index); field != store.fieldsEnd(index); field++) {
+        id = products->keys[field->key];
+        bool found;
+        if(!JS_AlreadyHasOwnPropertyById(cx, obj, id, &found))
+            return false;
+        if(!found && !cpp_defineProductField(cx, obj, id, store, *field))
+            return false;
+    }
+    return true;
+}
+
+static void cpp_productFinalize(JSFreeOp *fop, JSObject *obj)
+{
+    cpp_releaseProducts(static_cast<LazyProducts*>(JS_GetPrivate(obj)));
+}
+
+static const JSClass s_productClass = {
+    "IapProduct",
+    JSCLASS_HAS_PRIVATE | JSCLASS_HAS_RESERVED_SLOTS(1),
+    JS_PropertyStub, JS_DeletePropertyStub, JS_PropertyStub, JS_StrictPropertyStub,
+    cpp_productEnumerate, cpp_productResolve, JS_ConvertStub, cpp_productFinalize,
+    JSCLASS_NO_OPTIONAL_MEMBERS
+};
+
+// Takes the result's payload into a ProductStore and answers an array of
+// lazy product objects. False when the payload is not a product list, which
+// leaves the result untouched, or when the engine is out of memory.
+static bool cpp_productsToJsval(JSContext *cx, iap::Result &res, JS::MutableHandleValue out)
+{
+    LazyProducts *products = new LazyProducts();
+    products->refs = 1; // ours while building
+    if(!products->store.load(res)) {
+        delete products;
+        return false;
+    }
+    bool ok = true;
+    for(uint32_t key = 0; key < products->store.keyCount() && ok; key++) {
+        const std::u16string &name = products->store.key(key);
+        products->keys.push_back(cpp_recordKey(cx, name.data(), (uint32_t)name.size()));
+        ok = !JSID_IS_VOID(products->keys.back());
+    }
+    size_t count = products->store.size();
+    JS::RootedObject array(cx, ok ? JS_NewArrayObject(cx, count) : nullptr);
+    JS::RootedObject obj(cx);
+    for(size_t i = 0; i < count && array; i++) {
+        obj = JS_NewObject(cx, &s_productClass, JS::NullPtr(), JS::NullPtr());
+        if(!obj) {
+            array = nullptr;
+            break;
+        }
+        products->refs++;
+        JS_SetPrivate(obj, products);
+        JS_SetReservedSlot(obj, 0, INT_TO_JSVAL((int32_t)i));
+        if(!JS_SetElement(cx, array, (uint32_t)i, obj))
+            array = nullptr;
+    }
+    cpp_releaseProducts(products);
+    if(!array) {
+        return false;
+    }
+    out.setObject(*array);
+    return true;
+}
+
+// builds the JS objects straight from the records, no JSON text involved
+static bool cpp_recordsToJsval(JSContext *cx, const std::vector<uint8_t> &records, JS::MutableHandleValue out)
+{
+    iap::RecordReader reader(records.data(), records.size());
+    if(!reader.valid()) {
+        return false;
+    }
+    std::vector<jsid> keys(reader.keyCount());
+    for(uint32_t i = 0; i < reader.keyCount(); i++) {
+        uint32_t length;
+        const char16_t *chars = reader.key(i, length);
+        keys[i] = cpp_recordKey(cx, chars, length);
+        if(JSID_IS_VOID(keys[i]))
+            return false;
+    }
+
+    JS::RootedObject array(cx);
+    if(reader.isArray()) {
+        array = JS_NewArrayObject(cx, reader.recordCount());
+        if(!array)
+            return false;
+    }
+    JS::RootedObject obj(cx);
+    JS::RootedValue val(cx);
+    JS::RootedId id(cx);
+    uint32_t fieldCount;
+    uint32_t index = 0;
+    while(reader.nextRecord(fieldCount)) {
+        obj = JS_NewObject(cx, nullptr, JS::NullPtr(), JS::NullPtr());
+        if(!obj)
+            return false;
+        iap::RecordField field;
+        while(reader.nextField(field)) {
+            switch(field.type) {
+            case iap::RECORD_STRING: {
+                JSString *str = JS_NewUCStringCopyN(cx, field.str, field.length);
+                if(!str)
+                    return false;
+                val.setString(str);
+                break;
+            }
+            case iap::RECORD_NUMBER:
+            case iap::RECORD_INTEGER:
+                val.setNumber(field.number);
+                break;
+            case iap::RECORD_BOOL:
+                val.setBoolean(field.number != 0);
+                break;
+            default:
+                val.setNull();
+            }
+            id = keys[field.key];
+            if(!JS_DefinePropertyById(cx, obj, id, val, JSPROP_ENUMERATE))
+                return false;
+        }
+        if(!array) {
+            out.setObject(*obj);
+            return reader.valid();
+        }
+        val.setObject(*obj);
+        if(!JS_SetElement(cx, array, index++, val))
+            return false;
+    }
+    if(!reader.valid() || !array) {
+        return false;
+    }
+    out.setObject(*array);
+    return true;
+}
+
+static bool cpp_domNodeToJsval(JSContext *cx, const iap::JsonDom &dom, const char16_t *text, JS::AutoIdVector &keys, uint32_t &index, JS::MutableHandleValue out)
+{
+    const iap::JsonDom::Node &node = dom.node(index++);
+    switch(node.type) {
+    case iap::JsonDom::TYPE_STRING: {
+        JSString *str = JS_NewUCStringCopyN(cx, dom.string(node, text), node.length);
+        if(!str)
+            return false;
+        out.setString(str);
+        return true;
+    }
+    case iap::JsonDom::TYPE_NUMBER:
+        out.setNumber(dom.number(node));
+        return true;
+    case iap::JsonDom::TYPE_TRUE:
+    case iap::JsonDom::TYPE_FALSE:
+        out.setBoolean(node.type == iap::JsonDom::TYPE_TRUE);
+        return true;
+    case iap::JsonDom::TYPE_ARRAY: {
+        JS::RootedObject array(cx, JS_NewArrayObject(cx, node.length));
+        if(!array)
+            return false;
+        JS::RootedValue item(cx);
+        for(uint32_t i = 0; i < node.length; i++) {
+            if(!cpp_domNodeToJsval(cx, dom, text, keys, index, &item) || !JS_SetElement(cx, array, i, item))
+                return false;
+        }
+        out.setObject(*array);
+        return true;
+    }
+    case iap::JsonDom::TYPE_OBJECT: {
+        JS::RootedObject obj(cx, JS_NewObject(cx, nullptr, JS::NullPtr(), JS::NullPtr()));
+        if(!obj)
+            return false;
+        JS::RootedValue val(cx);
+        JS::RootedId id(cx);
+        for(uint32_t i = 0; i < node.length; i++) {
+            id = keys[dom.node(index++).offset];
+            if(!cpp_domNodeToJsval(cx, dom, text, keys, index, &val) || !JS_DefinePropertyById(cx, obj, id, val, JSPROP_ENUMERATE))
+                return false;
+        }
+        out.setObject(*obj);
+        return true;
+    }
+    default:
+        out.setNull();
+        return true;
+    }
+}
+
+// Creates the JS values of a result parsed by preparseResult; same values
+// as JS_ParseJSON on the text. Property names are converted once per
+// document and not interned, payload keys are not a fixed set.
+static bool cpp_domToJsval(JSContext *cx, const iap::JsonDom &dom, const std::u16string &json, JS::MutableHandleValue out)
+{
+    JS::AutoIdVector keys(cx);
+    if(!keys.reserve(dom.keyCount())) {
+        return false;
+    }
+    JS::RootedString name(cx);
+    JS::RootedId id(cx);
+    for(uint32_t i = 0; i < dom.keyCount(); i++) {
+        uint32_t length;
+        const char16_t *chars = dom.key(i, json.data(), length);
+        // JS_StringToId turns index-like names into integer ids
+        name = JS_NewUCStringCopyN(cx, chars, length);
+        if(!name || !JS_StringToId(cx, name, &id))
+            return false;
+        keys.infallibleAppend(id);
+    }
+    uint32_t index = 0;
+    return cpp_domNodeToJsval(cx, dom, json.data(), keys, index, out);
+}
+
+static void cpp_deliverResult(iap::Result &res)
+{
+    iap::Stats *stats = iap::Stats::getInstance();
+    stats->dequeued(res.requestId);
+    bool pooled = res.requestId > 0;
+    JsCallback *cb = pooled ? s_callbacks.get(res.requestId) : nullptr;
+    if(res.requestId == iap::Billing::EVENT_CATALOG_CHANGED) {
+        cb = s_catalogListener.get();
+        if(!cb) {
+            return;
+        }
+    } else if(res.requestId == iap::Billing::EVENT_PURCHASES_CHANGED) {
+        cb = s_purchaseListener.get();
+        if(!cb) {
+            return;
+        }
+    } else if(res.requestId == iap::Billing::EVENT_CONTENT_PROGRESS) {
+        cb = s_contentListener.get();
+        if(!cb) {
+            return;
+        }
+    }
+    if(!cb) {
+        // released after a failed dispatch, already answered or never issued
+        printLog("requestResult: stale or unknown callbackId");
+        stats->finish(res.requestId, true);
+        return;
+    }
+
+    JS::AutoValueVector valArr(cb->cx);
+    JS::RootedValue products(cb->cx);
+    if(cb->lazyProducts && res.error.empty() && cpp_productsToJsval(cb->cx, res, &products)) {
+        valArr.append(JSVAL_NULL);
+        valArr.append(products);
+    } else if(!res.records.empty()) {
+        valArr.append(JSVAL_NULL);
+        JS::RootedValue rval(cb->cx);
+        if(!cpp_recordsToJsval(cb->cx, res.records, &rval))
+            printLog("Records Error");
+        valArr.append(rval);
+    } else if(!res.dom.empty()) {
+        valArr.append(JSVAL_NULL);
+        JS::RootedValue rval(cb->cx);
+        if(!cpp_domToJsval(cb->cx, res.dom, res.json, &rval))
+            printLog("JSON Error");
+        valArr.append(rval);
+    } else {
+        valArr.append(std_string_to_jsval(cb->cx, res.error));
+        valArr.append(JSVAL_NULL);
+    };
+    stats->parsed(res.requestId);
+    JS::HandleValueArray funcArgs = JS::HandleValueArray::fromMarkedLocation(2, valArr.begin());
+    cb->call(funcArgs);
+    stats->finish(res.requestId, !res.error.empty());
+    if(pooled)
+        s_callbacks.release(res.requestId);
+}
+
+// scheduled every frame on the cocos thread
+static void cpp_dispatchResults(float dt)
+{
+    // deadlines answer on this thread, before this frame's drain
+    billing()->expire();
+    iap::Dispatcher *dispatcher = iap::Dispatcher::getInstance();
+    if(dispatcher->empty()) {
+        return;
+    }
+    ScriptingCore *sc = ScriptingCore::getInstance();
+    JSContext *cx = sc->getGlobalContext();
+    JSAutoRequest rq(cx);
+    JSAutoCompartment ac(cx, sc->getGlobalObject());
+    dispatcher->drain(cpp_deliverResult);
+}
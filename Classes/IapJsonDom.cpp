@@ -0,0 +1,371 @@
+#include "IapJsonDom.h"
+#include "IapJsonScan.h"
+#include "IapResult.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace iap {
+
+const int JsonDom::MAX_DEPTH;
+
+// integers of up to this many digits are exact in a double
+static const int FAST_DIGITS = 15;
+
+void JsonDom::clear()
+{
+    _nodes.clear();
+    _numbers.clear();
+    _strings.clear();
+    _keys.clear();
+    _keySlots.clear();
+    _errorOffset = 0;
+}
+
+bool JsonDom::parse(const char16_t *text, size_t length)
+{
+    clear();
+    _begin = text;
+    _end = text + length;
+    // about one node per 8 characters of store JSON
+    _nodes.reserve(length / 8 + 1);
+    _keySlots.assign(16, 0);
+
+    const char16_t *p = text;
+    jsonSkipSpace(p, _end);
+    bool ok = parseValue(p, 0);
+    if(ok) {
+        jsonSkipSpace(p, _end);
+        ok = p == _end || fail(p);
+    }
+    _begin = _end = nullptr;
+    if(!ok) {
+        size_t offset = _errorOffset;
+        clear();
+        _errorOffset = offset;
+        return false;
+    }
+    _keySlots.clear();
+    _keySlots.shrink_to_fit();
+    return true;
+}
+
+bool JsonDom::fail(const char16_t *p)
+{
+    _errorOffset = p - _begin;
+    return false;
+}
+
+static bool literal(const char16_t *&p, const char16_t *end, const char *word)
+{
+    for(; *word; word++, p++) {
+        if(p >= end || *p != (char16_t)*word)
+            return false;
+    }
+    return true;
+}
+
+bool JsonDom::parseValue(const char16_t *&p, int depth)
+{
+    if(p >= _end || depth > MAX_DEPTH) {
+        return fail(p);
+    }
+    Node node;
+    memset(&node, 0, sizeof(node));
+    switch(*p) {
+    case u'{': {
+        uint32_t index = (uint32_t)_nodes.size();
+        node.type = TYPE_OBJECT;
+        _nodes.push_back(node);
+        p++;
+        jsonSkipSpace(p, _end);
+        uint32_t count = 0;
+        if(p < _end && *p == u'}') {
+            p++;
+            return true;
+        }
+        for(;;) {
+            Node key;
+            if(p >= _end || *p != u'"' || !parseString(p, key))
+                return fail(p);
+            Node name;
+            memset(&name, 0, sizeof(name));
+            name.type = TYPE_KEY;
+            name.offset = internKey(key);
+            _nodes.push_back(name);
+            jsonSkipSpace(p, _end);
+            if(p >= _end || *p != u':')
+                return fail(p);
+            p++;
+            jsonSkipSpace(p, _end);
+            if(!parseValue(p, depth + 1))
+                return false;
+            count++;
+            jsonSkipSpace(p, _end);
+            if(p < _end && *p == u',') {
+                p++;
+                jsonSkipSpace(p, _end);
+            } else if(p < _end && *p == u'}') {
+                p++;
+                break;
+            } else {
+                return fail(p);
+            }
+        }
+        _nodes[index].length = count;
+        return true;
+    }
+    case u'[': {
+        uint32_t index = (uint32_t)_nodes.size();
+        node.type = TYPE_ARRAY;
+        _nodes.push_back(node);
+        p++;
+        jsonSkipSpace(p, _end);
+        uint32_t count = 0;
+        if(p < _end && *p == u']') {
+            p++;
+            return true;
+        }
+        for(;;) {
+            if(!parseValue(p, depth + 1))
+                return false;
+            count++;
+            jsonSkipSpace(p, _end);
+            if(p < _end && *p == u',') {
+                p++;
+                jsonSkipSpace(p, _end);
+            } else if(p < _end && *p == u']') {
+                p++;
+                break;
+            } else {
+                return fail(p);
+            }
+        }
+        _nodes[index].length = count;
+        return true;
+    }
+    case u'"':
+        if(!parseString(p, node))
+            return fail(p);
+        _nodes.push_back(node);
+        return true;
+    case u't':
+        node.type = TYPE_TRUE;
+        break;
+    case u'f':
+        node.type = TYPE_FALSE;
+        break;
+    case u'n':
+        node.type = TYPE_NULL;
+        break;
+    default:
+        return parseNumber(p);
+    }
+    static const char *WORDS[] = { "null", "false", "true" };
+    const char16_t *start = p;
+    if(!literal(p, _end, WORDS[node.type])) {
+        return fail(start);
+    }
+    _nodes.push_back(node);
+    return true;
+}
+
+static int hexDigit(char16_t c)
+{
+    if(c >= u'0' && c <= u'9')
+        return c - u'0';
+    if(c >= u'a' && c <= u'f')
+        return c - u'a' + 10;
+    if(c >= u'A' && c <= u'F')
+        return c - u'A' + 10;
+    return -1;
+}
+
+// p points at the opening quote; leaves p after the closing quote, or at
+// the offending character
+bool JsonDom::parseString(const char16_t *&p, Node &node)
+{
+    memset(&node, 0, sizeof(node));
+    node.type = TYPE_STRING;
+    const char16_t *start = ++p;
+    while(p < _end && *p != u'"' && *p != u'\\') {
+        if(*p < 0x20)
+            return false;
+        p++;
+    }
+    if(p >= _end) {
+        return false;
+    }
+    if(*p == u'"') {
+        node.offset = (uint32_t)(start - _begin);
+        node.length = (uint32_t)(p - start);
+        p++;
+        return true;
+    }
+
+    // escaped: decode the whole string into the shared buffer
+    node.decoded = 1;
+    node.offset = (uint32_t)_strings.size();
+    _strings.append(start, p);
+    while(p < _end && *p != u'"') {
+        char16_t c = *p;
+        if(c < 0x20) {
+            return false;
+        }
+        if(c != u'\\') {
+            _strings.push_back(c);
+            p++;
+            continue;
+        }
+        if(++p >= _end) {
+            return false;
+        }
+        switch(*p) {
+        case u'"': c = u'"'; break;
+        case u'\\': c = u'\\'; break;
+        case u'/': c = u'/'; break;
+        case u'b': c = u'\b'; break;
+        case u'f': c = u'\f'; break;
+        case u'n': c = u'\n'; break;
+        case u'r': c = u'\r'; break;
+        case u't': c = u'\t'; break;
+        case u'u': {
+            if(_end - p < 5)
+                return false;
+            int code = 0;
+            for(int i = 1; i <= 4; i++) {
+                int digit = hexDigit(p[i]);
+                if(digit < 0)
+                    return false;
+                code = code * 16 + digit;
+            }
+            // surrogates are kept as they are, JSON.parse does the same
+            c = (char16_t)code;
+            p += 4;
+            break;
+        }
+        default:
+            return false;
+        }
+        _strings.push_back(c);
+        p++;
+    }
+    if(p >= _end) {
+        return false;
+    }
+    node.length = (uint32_t)(_strings.size() - node.offset);
+    p++;
+    return true;
+}
+
+bool JsonDom::parseNumber(const char16_t *&p)
+{
+    const char16_t *start = p;
+    bool negative = p < _end && *p == u'-';
+    if(negative) {
+        p++;
+    }
+    if(p >= _end || *p < u'0' || *p > u'9') {
+        return fail(p);
+    }
+    int64_t mantissa = 0;
+    int digits = 0;
+    if(*p == u'0') {
+        p++;
+    } else {
+        for(; p < _end && *p >= u'0' && *p <= u'9'; p++, digits++) {
+            if(digits < FAST_DIGITS)
+                mantissa = mantissa * 10 + (*p - u'0');
+        }
+    }
+    bool integer = true;
+    if(p < _end && *p == u'.') {
+        integer = false;
+        p++;
+        if(p >= _end || *p < u'0' || *p > u'9')
+            return fail(p);
+        while(p < _end && *p >= u'0' && *p <= u'9')
+            p++;
+    }
+    if(p < _end && (*p == u'e' || *p == u'E')) {
+        integer = false;
+        p++;
+        if(p < _end && (*p == u'+' || *p == u'-'))
+            p++;
+        if(p >= _end || *p < u'0' || *p > u'9')
+            return fail(p);
+        while(p < _end && *p >= u'0' && *p <= u'9')
+            p++;
+    }
+
+    double value;
+    if(integer && digits <= FAST_DIGITS) {
+        value = negative ? -(double)mantissa : (double)mantissa;
+    } else {
+        // validated above, so every character is ASCII
+        std::string text(start, p);
+        value = strtod(text.c_str(), nullptr);
+    }
+    Node node;
+    memset(&node, 0, sizeof(node));
+    node.type = TYPE_NUMBER;
+    node.offset = (uint32_t)_numbers.size();
+    _numbers.push_back(value);
+    _nodes.push_back(node);
+    return true;
+}
+
+static uint32_t keyHash(const char16_t *chars, uint32_t length)
+{
+    uint32_t hash = 2166136261u;
+    for(uint32_t i = 0; i < length; i++) {
+        hash = (hash ^ chars[i]) * 16777619u;
+    }
+    return hash;
+}
+
+uint32_t JsonDom::internKey(const Node &node)
+{
+    const char16_t *chars = string(node, _begin);
+    uint32_t hash = keyHash(chars, node.length);
+    size_t mask = _keySlots.size() - 1;
+    size_t slot = hash & mask;
+    for(; _keySlots[slot]; slot = (slot + 1) & mask) {
+        const Node &key = _keys[_keySlots[slot] - 1];
+        if(key.length == node.length && memcmp(string(key, _begin), chars, node.length * sizeof(char16_t)) == 0)
+            return _keySlots[slot] - 1;
+    }
+    uint32_t index = (uint32_t)_keys.size();
+    _keys.push_back(node);
+    _keySlots[slot] = index + 1;
+
+    // keep the table at most half full
+    if(_keys.size() * 2 > _keySlots.size()) {
+        _keySlots.assign(_keySlots.size() * 2, 0);
+        mask = _keySlots.size() - 1;
+        for(uint32_t i = 0; i < _keys.size(); i++) {
+            slot = keyHash(string(_keys[i], _begin), _keys[i].length) & mask;
+            while(_keySlots[slot])
+                slot = (slot + 1) & mask;
+            _keySlots[slot] = i + 1;
+        }
+    }
+    return index;
+}
+
+bool preparseResult(Result &result)
+{
+    if(!result.records.empty() || result.json.empty()) {
+        return true;
+    }
+    if(result.dom.parse(result.json.data(), result.json.size())) {
+        return true;
+    }
+    char message[64];
+    snprintf(message, sizeof(message), "Invalid JSON at character %zu", result.dom.errorOffset());
+    result.error = message;
+    result.json.clear();
+    return false;
+}
+
+} // namespace iap
@@ -0,0 +1,100 @@
+#ifndef IapJsonDom_h
+#define IapJsonDom_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace iap {
+
+struct Result;
+
+///////////////////////////////////////
+//
+//  JSON document
+//
+///////////////////////////////////////
+
+// A JSON text validated and parsed into flat arrays, so the JS thread can
+// create the values by walking it without looking at the text again.
+//
+// Nodes are stored depth first: an array node is followed by its elements,
+// an object node by a KEY node and the value for each member. Strings
+// without escapes stay in the text and are addressed by offset, so the
+// document remains valid when the text is moved; escaped strings are
+// decoded into one shared buffer. Object keys are interned per document,
+// a product list has a handful of distinct keys however long it is.
+class JsonDom
+{
+public:
+    enum Type
+    {
+        TYPE_NULL,
+        TYPE_FALSE,
+        TYPE_TRUE,
+        TYPE_NUMBER,
+        TYPE_STRING,
+        TYPE_ARRAY,
+        TYPE_OBJECT,
+        TYPE_KEY        // object member name, offset is the key index
+    };
+
+    struct Node
+    {
+        uint8_t type;
+        uint8_t decoded;    // TYPE_STRING: in the decoded buffer, not the text
+        uint16_t reserved;
+        uint32_t length;    // characters of a string, elements or members
+        uint32_t offset;    // string start, number index or key index
+    };
+
+    // nesting deeper than this is rejected instead of recursing further
+    static const int MAX_DEPTH = 512;
+
+    // Parses the whole text, which must hold exactly one value. False when
+    // it is not valid JSON; errorOffset() then tells where.
+    bool parse(const char16_t *text, size_t length);
+    void clear();
+
+    bool empty() const { return _nodes.empty(); }
+    size_t errorOffset() const { return _errorOffset; }
+
+    const Node& node(uint32_t index) const { return _nodes[index]; }
+    uint32_t nodeCount() const { return (uint32_t)_nodes.size(); }
+    double number(const Node &node) const { return _numbers[node.offset]; }
+    // characters of a TYPE_STRING node; text is the parsed text
+    const char16_t* string(const Node &node, const char16_t *text) const {
+        return (node.decoded ? _strings.data() : text) + node.offset;
+    }
+
+    uint32_t keyCount() const { return (uint32_t)_keys.size(); }
+    const char16_t* key(uint32_t index, const char16_t *text, uint32_t &length) const {
+        length = _keys[index].length;
+        return string(_keys[index], text);
+    }
+
+private:
+    bool parseValue(const char16_t *&p, int depth);
+    bool parseString(const char16_t *&p, Node &node);
+    bool parseNumber(const char16_t *&p);
+    uint32_t internKey(const Node &node);
+    bool fail(const char16_t *p);
+
+    const char16_t *_begin = nullptr;
+    const char16_t *_end = nullptr;
+    std::vector<Node> _nodes;
+    std::vector<double> _numbers;
+    std::u16string _strings;
+    std::vector<Node> _keys;            // as TYPE_STRING nodes
+    std::vector<uint32_t> _keySlots;    // open addressing, key index + 1
+    size_t _errorOffset = 0;
+};
+
+// Parses a result's JSON payload into result.dom, on the thread that hands
+// the result over, so the JS thread does not parse it. A payload that is
+// not valid JSON turns the result into an error; false then.
+bool preparseResult(Result &result);
+
+} // namespace iap
+
+#endif /* IapJsonDom_h */
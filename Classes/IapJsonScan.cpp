@@ -0,0 +1,264 @@
+#include "IapJsonScan.h"
+#include "IapResult.h"
+
+namespace iap {
+
+void jsonSkipSpace(const char16_t *&p, const char16_t *end)
+{
+    while(p < end && (*p == u' ' || *p == u'\n' || *p == u'\r' || *p == u'\t'))
+        p++;
+}
+
+// p points at the opening quote; leaves p after the closing quote
+static bool skipString(const char16_t *&p, const char16_t *end)
+{
+    for(p++; p < end; p++) {
+        if(*p == u'\\') {
+            p++;
+        } else if(*p == u'"') {
+            p++;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool jsonSkipValue(const char16_t *&p, const char16_t *end)
+{
+    jsonSkipSpace(p, end);
+    if(p >= end) {
+        return false;
+    }
+    if(*p == u'"') {
+        return skipString(p, end);
+    }
+    if(*p == u'{' || *p == u'[') {
+        int depth = 0;
+        while(p < end) {
+            char16_t c = *p;
+            if(c == u'"') {
+                if(!skipString(p, end))
+                    return false;
+                continue;
+            }
+            if(c == u'{' || c == u'[') depth++;
+            else if(c == u'}' || c == u']') depth--;
+            p++;
+            if(depth == 0)
+                return true;
+        }
+        return false;
+    }
+    while(p < end && *p != u',' && *p != u'}' && *p != u']' && *p != u' ' && *p != u'\n' && *p != u'\r' && *p != u'\t')
+        p++;
+    return true;
+}
+
+bool jsonArrayItems(const char16_t *begin, const char16_t *end, std::vector<JsonSpan> &items)
+{
+    const char16_t *p = begin;
+    jsonSkipSpace(p, end);
+    if(p >= end || *p != u'[') {
+        return false;
+    }
+    p++;
+    jsonSkipSpace(p, end);
+    if(p < end && *p == u']') {
+        return true;
+    }
+    while(p < end) {
+        jsonSkipSpace(p, end);
+        JsonSpan item;
+        item.begin = p;
+        if(!jsonSkipValue(p, end)) {
+            return false;
+        }
+        item.end = p;
+        items.push_back(item);
+        jsonSkipSpace(p, end);
+        if(p < end && *p == u',') {
+            p++;
+        } else if(p < end && *p == u']') {
+            return true;
+        } else {
+            return false;
+        }
+    }
+    return false;
+}
+
+std::string jsonAsciiString(const char16_t *begin, const char16_t *end)
+{
+    if(end - begin < 2 || *begin != u'"') {
+        return std::string();
+    }
+    std::string out;
+    out.reserve(end - begin - 2);
+    for(const char16_t *p = begin + 1; p < end - 1; p++) {
+        if(*p >= 0x80 || *p == u'\\')
+            return std::string();
+        out += (char)*p;
+    }
+    return out;
+}
+
+bool jsonObjectMembers(const char16_t *begin, const char16_t *end, std::vector<JsonMember> &members)
+{
+    const char16_t *p = begin;
+    jsonSkipSpace(p, end);
+    if(p >= end || *p != u'{') {
+        return false;
+    }
+    p++;
+    jsonSkipSpace(p, end);
+    if(p < end && *p == u'}') {
+        return true;
+    }
+    while(p < end) {
+        jsonSkipSpace(p, end);
+        if(p >= end || *p != u'"')
+            return false;
+        JsonMember member;
+        member.name.begin = p + 1;
+        if(!skipString(p, end))
+            return false;
+        member.name.end = p - 1;
+        jsonSkipSpace(p, end);
+        if(p >= end || *p != u':')
+            return false;
+        p++;
+        jsonSkipSpace(p, end);
+        member.value.begin = p;
+        if(!jsonSkipValue(p, end))
+            return false;
+        member.value.end = p;
+        members.push_back(member);
+        jsonSkipSpace(p, end);
+        if(p < end && *p == u',') {
+            p++;
+        } else if(p < end && *p == u'}') {
+            return true;
+        } else {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool jsonField(const char16_t *begin, const char16_t *end, const char16_t *key, JsonSpan &value)
+{
+    size_t keyLength = std::char_traits<char16_t>::length(key);
+    const char16_t *p = begin;
+    jsonSkipSpace(p, end);
+    if(p >= end || *p != u'{') {
+        return false;
+    }
+    p++;
+    while(p < end) {
+        jsonSkipSpace(p, end);
+        if(p >= end || *p != u'"')
+            return false;
+        const char16_t *name = p;
+        if(!skipString(p, end))
+            return false;
+        bool found = (size_t)(p - name) == keyLength + 2 && std::char_traits<char16_t>::compare(name + 1, key, keyLength) == 0;
+        jsonSkipSpace(p, end);
+        if(p >= end || *p != u':')
+            return false;
+        p++;
+        jsonSkipSpace(p, end);
+        value.begin = p;
+        if(!jsonSkipValue(p, end))
+            return false;
+        value.end = p;
+        if(found) {
+            return true;
+        }
+        jsonSkipSpace(p, end);
+        if(p < end && *p == u',')
+            p++;
+        else
+            break;
+    }
+    return false;
+}
+
+std::string jsonStringField(const char16_t *begin, const char16_t *end, const char16_t *key)
+{
+    JsonSpan value;
+    if(!jsonField(begin, end, key, value)) {
+        return std::string();
+    }
+    return jsonAsciiString(value.begin, value.end);
+}
+
+static int hexDigit(char16_t c)
+{
+    if(c >= u'0' && c <= u'9') return c - u'0';
+    if(c >= u'a' && c <= u'f') return c - u'a' + 10;
+    if(c >= u'A' && c <= u'F') return c - u'A' + 10;
+    return -1;
+}
+
+bool jsonUnescape(const char16_t *begin, const char16_t *end, std::u16string &out)
+{
+    if(end - begin < 2 || *begin != u'"' || end[-1] != u'"') {
+        return false;
+    }
+    out.clear();
+    out.reserve(end - begin - 2);
+    for(const char16_t *p = begin + 1; p < end - 1; p++) {
+        if(*p != u'\\') {
+            out += *p;
+            continue;
+        }
+        if(++p >= end - 1)
+            return false;
+        switch(*p) {
+        case u'b': out += u'\b'; break;
+        case u'f': out += u'\f'; break;
+        case u'n': out += u'\n'; break;
+        case u'r': out += u'\r'; break;
+        case u't': out += u'\t'; break;
+        case u'u': {
+            if(end - 1 - p < 5)
+                return false;
+            int c = 0;
+            for(int i = 1; i <= 4; i++) {
+                int digit = hexDigit(p[i]);
+                if(digit < 0)
+                    return false;
+                c = c * 16 + digit;
+            }
+            out += (char16_t)c;
+            p += 4;
+            break;
+        }
+        default:
+            // \" \\ \/
+            out += *p;
+        }
+    }
+    return true;
+}
+
+std::u16string jsonQuote(const std::string &utf8)
+{
+    static const char16_t hex[] = u"0123456789abcdef";
+    std::u16string out = u"\"";
+    for(char16_t c : utf8ToUtf16(utf8)) {
+        if(c == u'"' || c == u'\\') {
+            out += u'\\';
+        } else if(c < 0x20) {
+            out += u"\\u00";
+            out += hex[c >> 4];
+            out += hex[c & 15];
+            continue;
+        }
+        out += c;
+    }
+    out += u'"';
+    return out;
+}
+
+} // namespace iap
@@ -0,0 +1,62 @@
+#ifndef IapJsonScan_h
+#define IapJsonScan_h
+
+#include <string>
+#include <vector>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  JSON scanning
+//
+///////////////////////////////////////
+
+// Just enough JSON to pick fields out of the store's product and purchase
+// objects without building a tree. Works on the UTF-16 text results carry.
+
+struct JsonSpan
+{
+    const char16_t *begin;
+    const char16_t *end;
+};
+
+void jsonSkipSpace(const char16_t *&p, const char16_t *end);
+// skips any value, leaves p after it
+bool jsonSkipValue(const char16_t *&p, const char16_t *end);
+
+// Elements of the array in [begin, end). False when it is not an array.
+bool jsonArrayItems(const char16_t *begin, const char16_t *end, std::vector<JsonSpan> &items);
+
+// A member of an object: the name without its quotes, the value as is
+struct JsonMember
+{
+    JsonSpan name;
+    JsonSpan value;
+};
+
+// Members of the object in [begin, end). False when it is not an object.
+bool jsonObjectMembers(const char16_t *begin, const char16_t *end, std::vector<JsonMember> &members);
+
+// Value of a top-level field of the object in [begin, end). False when the
+// key is missing.
+bool jsonField(const char16_t *begin, const char16_t *end, const char16_t *key, JsonSpan &value);
+
+// JSON string literal for UTF-8 text, quotes included
+std::u16string jsonQuote(const std::string &utf8);
+
+// Top-level string field of the object in [begin, end). Empty when the key
+// is missing or the value is not a plain ASCII string (ids and tokens are).
+std::string jsonStringField(const char16_t *begin, const char16_t *end, const char16_t *key);
+
+// Contents of the string value in [begin, end), quotes included; same
+// ASCII-only rule.
+std::string jsonAsciiString(const char16_t *begin, const char16_t *end);
+
+// Contents of the string value in [begin, end), quotes included, with the
+// escapes resolved. False when it is not a valid string.
+bool jsonUnescape(const char16_t *begin, const char16_t *end, std::u16string &out);
+
+} // namespace iap
+
+#endif /* IapJsonScan_h */
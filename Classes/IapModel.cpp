@@ -0,0 +1,316 @@
+#include "IapModel.h"
+#include "IapJsonScan.h"
+#include "IapSkuTable.h"
+#include <algorithm>
+
+namespace iap {
+
+const int64_t ProductTable::NO_PRICE;
+
+// a member name without escapes against an ASCII key
+static bool nameIs(const JsonSpan &name, const char *key)
+{
+    const char16_t *p = name.begin;
+    for(; p != name.end && *key; p++, key++) {
+        if(*p != (char16_t)(unsigned char)*key)
+            return false;
+    }
+    return p == name.end && !*key;
+}
+
+static bool parseInteger(const JsonSpan &value, int64_t &out)
+{
+    return ProductTable::parseMicros(value.begin, value.end, 0, out);
+}
+
+///////////////////////////////////////
+//
+//  String arena
+//
+///////////////////////////////////////
+
+StringArena::Ref StringArena::add(const char16_t *chars, size_t length)
+{
+    Ref ref = { (uint32_t)_chars.size(), (uint32_t)length };
+    _chars.append(chars, length);
+    return ref;
+}
+
+StringArena::Ref StringArena::addJson(const char16_t *begin, const char16_t *end)
+{
+    std::u16string text;
+    if(!jsonUnescape(begin, end, text)) {
+        return Ref{ (uint32_t)_chars.size(), 0 };
+    }
+    return add(text.data(), text.size());
+}
+
+int StringArena::compare(Ref a, Ref b) const
+{
+    int c = _chars.compare(a.offset, a.length, _chars, b.offset, b.length);
+    return c < 0 ? -1 : c > 0 ? 1 : 0;
+}
+
+///////////////////////////////////////
+//
+//  Product table
+//
+///////////////////////////////////////
+
+ProductTable::Query::Query()
+: type(-1)
+, minPriceMicros(INT64_MIN)
+, maxPriceMicros(INT64_MAX)
+, sort(SORT_NONE)
+, descending(false)
+, limit((size_t)-1)
+{
+}
+
+void ProductTable::clear()
+{
+    _sku.clear();
+    _type.clear();
+    _priceMicros.clear();
+    _price.clear();
+    _currency.clear();
+    _title.clear();
+    _description.clear();
+    _rowOf.clear();
+    _strings.clear();
+}
+
+bool ProductTable::load(const std::u16string &json)
+{
+    clear();
+    std::vector<JsonSpan> items;
+    if(!jsonArrayItems(json.data(), json.data() + json.size(), items)) {
+        return false;
+    }
+    _sku.reserve(items.size());
+    _type.reserve(items.size());
+    _priceMicros.reserve(items.size());
+    _price.reserve(items.size());
+    _currency.reserve(items.size());
+    _title.reserve(items.size());
+    _description.reserve(items.size());
+
+    SkuTable *table = SkuTable::getInstance();
+    std::vector<JsonMember> members;
+    for(const JsonSpan &item : items) {
+        members.clear();
+        if(!jsonObjectMembers(item.begin, item.end, members)) {
+            clear();
+            return false;
+        }
+        StringArena::Ref empty = { (uint32_t)_strings.size(), 0 };
+        int sku = -1;
+        uint8_t type = TYPE_OTHER;
+        int64_t micros = NO_PRICE;
+        int64_t fallback = NO_PRICE;
+        StringArena::Ref price = empty, currency = empty, title = empty, description = empty;
+        for(const JsonMember &m : members) {
+            if(nameIs(m.name, KEY_PRODUCT_ID)) {
+                std::string id = jsonAsciiString(m.value.begin, m.value.end);
+                if(!id.empty())
+                    sku = table->intern(id);
+            } else if(nameIs(m.name, KEY_TYPE)) {
+                std::string name = jsonAsciiString(m.value.begin, m.value.end);
+                type = name == "inapp" ? TYPE_INAPP : name == "subs" ? TYPE_SUBS : TYPE_OTHER;
+            } else if(nameIs(m.name, KEY_PRICE_MICROS)) {
+                parseInteger(m.value, micros);
+            } else if(nameIs(m.name, KEY_PRICE)) {
+                price = _strings.addJson(m.value.begin, m.value.end);
+                // formatted prices ("$0.99") only count when they are plain numbers
+                parseMicros(m.value.begin, m.value.end, 6, fallback);
+            } else if(nameIs(m.name, KEY_CURRENCY)) {
+                currency = _strings.addJson(m.value.begin, m.value.end);
+            } else if(nameIs(m.name, KEY_TITLE)) {
+                title = _strings.addJson(m.value.begin, m.value.end);
+            } else if(nameIs(m.name, KEY_DESCRIPTION)) {
+                description = _strings.addJson(m.value.begin, m.value.end);
+            }
+        }
+        if(sku < 0) {
+            // products are keyed by productId everywhere else too
+            continue;
+        }
+        if(sku >= (int)_rowOf.size())
+            _rowOf.resize(sku + 1, -1);
+        _rowOf[sku] = (int)_sku.size();
+        _sku.push_back(sku);
+        _type.push_back(type);
+        _priceMicros.push_back(micros != NO_PRICE ? micros : fallback);
+        _price.push_back(price);
+        _currency.push_back(currency);
+        _title.push_back(title);
+        _description.push_back(description);
+    }
+    return true;
+}
+
+int ProductTable::row(int sku) const
+{
+    return sku >= 0 && sku < (int)_rowOf.size() ? _rowOf[sku] : -1;
+}
+
+void ProductTable::query(const Query &query, std::vector<uint32_t> &rows) const
+{
+    rows.clear();
+    const char16_t *currency = query.currency.data();
+    uint32_t currencyLength = (uint32_t)query.currency.size();
+    for(size_t i = 0; i < _sku.size(); i++) {
+        if(query.type >= 0 && _type[i] != query.type)
+            continue;
+        int64_t micros = _priceMicros[i];
+        if((query.minPriceMicros != INT64_MIN || query.maxPriceMicros != INT64_MAX)
+           && (micros == NO_PRICE || micros < query.minPriceMicros || micros > query.maxPriceMicros))
+            continue;
+        if(currencyLength && (_currency[i].length != currencyLength
+           || std::char_traits<char16_t>::compare(_strings.chars(_currency[i]), currency, currencyLength) != 0))
+            continue;
+        rows.push_back((uint32_t)i);
+    }
+
+    bool descending = query.descending;
+    switch(query.sort) {
+    case SORT_NONE:
+        if(descending)
+            std::reverse(rows.begin(), rows.end());
+        break;
+    case SORT_SKU:
+        std::stable_sort(rows.begin(), rows.end(), [this, descending](uint32_t a, uint32_t b) {
+                return descending ? _sku[a] > _sku[b] : _sku[a] < _sku[b];
+            });
+        break;
+    case SORT_PRICE:
+        std::stable_sort(rows.begin(), rows.end(), [this, descending](uint32_t a, uint32_t b) {
+                int64_t pa = _priceMicros[a], pb = _priceMicros[b];
+                if(pa == NO_PRICE || pb == NO_PRICE)
+                    return pb == NO_PRICE && pa != NO_PRICE;
+                return descending ? pa > pb : pa < pb;
+            });
+        break;
+    case SORT_TITLE:
+        std::stable_sort(rows.begin(), rows.end(), [this, descending](uint32_t a, uint32_t b) {
+                int c = _strings.compare(_title[a], _title[b]);
+                return descending ? c > 0 : c < 0;
+            });
+        break;
+    }
+    if(rows.size() > query.limit)
+        rows.resize(query.limit);
+}
+
+bool ProductTable::parseMicros(const char16_t *begin, const char16_t *end, int scale, int64_t &micros)
+{
+    if(end - begin >= 2 && *begin == u'"' && end[-1] == u'"') {
+        begin++;
+        end--;
+    }
+    bool negative = begin != end && *begin == u'-';
+    if(negative)
+        begin++;
+    int64_t value = 0;
+    int digits = 0;
+    int fraction = -1;  // digits after the point, -1 before it
+    for(const char16_t *p = begin; p != end; p++) {
+        if(*p == u'.' && fraction < 0) {
+            fraction = 0;
+            continue;
+        }
+        if(*p < u'0' || *p > u'9' || ++digits > 18)
+            return false;
+        if(fraction >= 0 && fraction++ >= scale)
+            continue;   // below a micro, dropped
+        value = value * 10 + (*p - u'0');
+    }
+    if(digits == 0) {
+        return false;
+    }
+    for(int i = fraction < 0 ? 0 : fraction; i < scale; i++) {
+        value *= 10;
+    }
+    micros = negative ? -value : value;
+    return true;
+}
+
+///////////////////////////////////////
+//
+//  Purchase table
+//
+///////////////////////////////////////
+
+PurchaseTable::Query::Query()
+: sku(-1)
+, sort(SORT_NONE)
+, descending(false)
+, limit((size_t)-1)
+{
+}
+
+void PurchaseTable::clear()
+{
+    _sku.clear();
+    _purchaseTime.clear();
+    _state.clear();
+    _token.clear();
+    _orderId.clear();
+    _strings.clear();
+}
+
+void PurchaseTable::load(const std::vector<PurchaseInventory::Item> &items)
+{
+    clear();
+    _sku.reserve(items.size());
+    _purchaseTime.reserve(items.size());
+    _state.reserve(items.size());
+    _token.reserve(items.size());
+    _orderId.reserve(items.size());
+
+    SkuTable *table = SkuTable::getInstance();
+    std::vector<JsonMember> members;
+    for(const PurchaseInventory::Item &item : items) {
+        int64_t time = 0;
+        int64_t state = 0;
+        StringArena::Ref orderId = { (uint32_t)_strings.size(), 0 };
+        members.clear();
+        if(jsonObjectMembers(item.json.data(), item.json.data() + item.json.size(), members)) {
+            for(const JsonMember &m : members) {
+                if(nameIs(m.name, KEY_PURCHASE_TIME))
+                    parseInteger(m.value, time);
+                else if(nameIs(m.name, KEY_PURCHASE_STATE))
+                    parseInteger(m.value, state);
+                else if(nameIs(m.name, KEY_ORDER_ID))
+                    orderId = _strings.addJson(m.value.begin, m.value.end);
+            }
+        }
+        std::u16string token(item.token.begin(), item.token.end());
+        _sku.push_back(table->intern(item.sku));
+        _purchaseTime.push_back(time);
+        _state.push_back((int8_t)state);
+        _token.push_back(_strings.add(token.data(), token.size()));
+        _orderId.push_back(orderId);
+    }
+}
+
+void PurchaseTable::query(const Query &query, std::vector<uint32_t> &rows) const
+{
+    rows.clear();
+    for(size_t i = 0; i < _sku.size(); i++) {
+        if(query.sku < 0 || _sku[i] == query.sku)
+            rows.push_back((uint32_t)i);
+    }
+    bool descending = query.descending;
+    if(query.sort == SORT_TIME) {
+        std::stable_sort(rows.begin(), rows.end(), [this, descending](uint32_t a, uint32_t b) {
+                return descending ? _purchaseTime[a] > _purchaseTime[b] : _purchaseTime[a] < _purchaseTime[b];
+            });
+    } else if(descending) {
+        std::reverse(rows.begin(), rows.end());
+    }
+    if(rows.size() > query.limit)
+        rows.resize(query.limit);
+}
+
+} // namespace iap
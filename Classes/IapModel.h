@@ -0,0 +1,206 @@
+#ifndef IapModel_h
+#define IapModel_h
+
+#include "IapInventory.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Object keys
+//
+///////////////////////////////////////
+
+// Keys of the product and purchase objects every backend produces, named
+// after Google Play's JSON. The iOS backend builds its dictionaries with
+// them; the tables below read them.
+static const char* const KEY_PRODUCT_ID = "productId";
+static const char* const KEY_TYPE = "type";
+static const char* const KEY_PRICE = "price";
+static const char* const KEY_PRICE_MICROS = "price_amount_micros";
+static const char* const KEY_CURRENCY = "price_currency_code";
+// iOS only: price_currency_code there is the symbol, as it always was
+static const char* const KEY_CURRENCY_ISO = "price_currency_iso";
+static const char* const KEY_TITLE = "title";
+static const char* const KEY_DESCRIPTION = "description";
+static const char* const KEY_PURCHASE_TOKEN = "purchaseToken";
+static const char* const KEY_TRANSACTION_ID = "transactionId";
+static const char* const KEY_ORIGINAL_TRANSACTION_ID = "originalTransactionId";
+static const char* const KEY_ORDER_ID = "orderId";
+static const char* const KEY_PURCHASE_TIME = "purchaseTime";
+static const char* const KEY_PURCHASE_STATE = "purchaseState";
+
+///////////////////////////////////////
+//
+//  String arena
+//
+///////////////////////////////////////
+
+// Every string of a table in one UTF-16 buffer; a table row refers to its
+// strings by offset, so rows hold no pointers and copy as plain data.
+class StringArena
+{
+public:
+    struct Ref
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    Ref add(const char16_t *chars, size_t length);
+    // the JSON string literal in [begin, end) with its escapes resolved;
+    // an empty string for any other value
+    Ref addJson(const char16_t *begin, const char16_t *end);
+
+    const char16_t* chars(Ref ref) const { return _chars.data() + ref.offset; }
+    std::u16string string(Ref ref) const { return std::u16string(chars(ref), ref.length); }
+    int compare(Ref a, Ref b) const;
+
+    size_t size() const { return _chars.size(); }
+    void clear() { _chars.clear(); }
+
+private:
+    std::u16string _chars;
+};
+
+///////////////////////////////////////
+//
+//  Product table
+//
+///////////////////////////////////////
+
+// The product catalog in struct-of-arrays layout: one vector per field,
+// strings in a shared arena and prices as integer micros, so filtering
+// and sorting thousands of products walks a few dense columns instead of
+// per-product objects. Rows are in catalog order.
+class ProductTable
+{
+public:
+    enum Type
+    {
+        TYPE_INAPP,
+        TYPE_SUBS,
+        TYPE_OTHER
+    };
+
+    enum Sort
+    {
+        SORT_NONE,      // catalog order
+        SORT_SKU,       // SkuTable handle, the order init listed them in first
+        SORT_PRICE,
+        SORT_TITLE
+    };
+
+    // products without a price sort after every priced one
+    static const int64_t NO_PRICE = INT64_MAX;
+
+    struct Query
+    {
+        int type;                   // Type, or -1 for every type
+        int64_t minPriceMicros;
+        int64_t maxPriceMicros;     // inclusive
+        std::u16string currency;    // empty for any
+        Sort sort;
+        bool descending;
+        size_t limit;
+
+        Query();
+    };
+
+    // Replaces the table with a flat JSON array of product objects (the
+    // available_products shape). False for any other shape, the table is
+    // empty then.
+    bool load(const std::u16string &json);
+    void clear();
+
+    size_t size() const { return _sku.size(); }
+    // SkuTable handle
+    int sku(size_t row) const { return _sku[row]; }
+    Type type(size_t row) const { return (Type)_type[row]; }
+    int64_t priceMicros(size_t row) const { return _priceMicros[row]; }
+    StringArena::Ref price(size_t row) const { return _price[row]; }
+    StringArena::Ref currency(size_t row) const { return _currency[row]; }
+    StringArena::Ref title(size_t row) const { return _title[row]; }
+    StringArena::Ref description(size_t row) const { return _description[row]; }
+    const StringArena& strings() const { return _strings; }
+
+    // row of a SkuTable handle, -1 when the product is not in the table
+    int row(int sku) const;
+
+    // rows matching the query, in its order
+    void query(const Query &query, std::vector<uint32_t> &rows) const;
+
+    // a price such as "0.99" or 990000 (scale 0) in micros; false unless
+    // the value is a plain decimal number, quoted or not
+    static bool parseMicros(const char16_t *begin, const char16_t *end, int scale, int64_t &micros);
+
+private:
+    std::vector<int> _sku;
+    std::vector<uint8_t> _type;
+    std::vector<int64_t> _priceMicros;
+    std::vector<StringArena::Ref> _price;        // as the store formats it
+    std::vector<StringArena::Ref> _currency;
+    std::vector<StringArena::Ref> _title;
+    std::vector<StringArena::Ref> _description;
+    std::vector<int> _rowOf;                     // by SkuTable handle
+    StringArena _strings;
+};
+
+///////////////////////////////////////
+//
+//  Purchase table
+//
+///////////////////////////////////////
+
+// Owned purchases in the same layout.
+class PurchaseTable
+{
+public:
+    enum Sort
+    {
+        SORT_NONE,
+        SORT_TIME
+    };
+
+    struct Query
+    {
+        int sku;        // SkuTable handle, or -1 for every product
+        Sort sort;
+        bool descending;
+        size_t limit;
+
+        Query();
+    };
+
+    // replaces the table with the inventory's purchases
+    void load(const std::vector<PurchaseInventory::Item> &items);
+    void clear();
+
+    size_t size() const { return _sku.size(); }
+    int sku(size_t row) const { return _sku[row]; }
+    // milliseconds since the epoch, 0 when the store did not say
+    int64_t purchaseTime(size_t row) const { return _purchaseTime[row]; }
+    // Google Play's purchaseState, 0 (purchased) when missing
+    int state(size_t row) const { return _state[row]; }
+    StringArena::Ref token(size_t row) const { return _token[row]; }
+    StringArena::Ref orderId(size_t row) const { return _orderId[row]; }
+    const StringArena& strings() const { return _strings; }
+
+    void query(const Query &query, std::vector<uint32_t> &rows) const;
+
+private:
+    std::vector<int> _sku;
+    std::vector<int64_t> _purchaseTime;
+    std::vector<int8_t> _state;
+    std::vector<StringArena::Ref> _token;
+    std::vector<StringArena::Ref> _orderId;
+    StringArena _strings;
+};
+
+} // namespace iap
+
+#endif /* IapModel_h */
@@ -0,0 +1,186 @@
+#include "IapProductStore.h"
+#include "IapJsonScan.h"
+#include "IapRecords.h"
+#include <cstdlib>
+
+namespace iap {
+
+bool ProductStore::load(Result &result)
+{
+    _fields.clear();
+    _firstField.clear();
+    if(!result.records.empty()) {
+        _records.swap(result.records);
+        if(loadRecords())
+            return true;
+        _records.swap(result.records);
+    } else {
+        _json.swap(result.json);
+        if(loadJson())
+            return true;
+        _json.swap(result.json);
+    }
+    _fields.clear();
+    _firstField.clear();
+    return false;
+}
+
+uint32_t ProductStore::internKey(const char16_t *chars, size_t length)
+{
+    std::u16string name(chars, length);
+    auto it = _keyIndex.find(name);
+    if(it != _keyIndex.end()) {
+        return it->second;
+    }
+    uint32_t index = (uint32_t)_keys.size();
+    _keys.push_back(name);
+    _keyIndex.emplace(std::move(name), index);
+    return index;
+}
+
+static bool parseNumber(const char16_t *begin, const char16_t *end, double &value)
+{
+    char text[64];
+    size_t length = end - begin;
+    if(length == 0 || length >= sizeof(text)) {
+        return false;
+    }
+    for(size_t i = 0; i < length; i++) {
+        if(begin[i] >= 0x80)
+            return false;
+        text[i] = (char)begin[i];
+    }
+    text[length] = 0;
+    char *parsed;
+    value = strtod(text, &parsed);
+    return parsed == text + length;
+}
+
+bool ProductStore::loadJson()
+{
+    const char16_t *begin = _json.data();
+    const char16_t *end = begin + _json.size();
+    std::vector<JsonSpan> items;
+    if(!jsonArrayItems(begin, end, items)) {
+        return false;
+    }
+    _firstField.reserve(items.size() + 1);
+    std::vector<JsonMember> members;
+    for(const JsonSpan &item : items) {
+        members.clear();
+        if(!jsonObjectMembers(item.begin, item.end, members))
+            return false;
+        _firstField.push_back((uint32_t)_fields.size());
+        for(const JsonMember &member : members) {
+            Field field;
+            field.key = internKey(member.name.begin, member.name.end - member.name.begin);
+            field.escaped = false;
+            field.str = nullptr;
+            field.length = 0;
+            field.number = 0;
+            const char16_t *value = member.value.begin;
+            switch(*value) {
+            case u'"':
+                field.type = FIELD_STRING;
+                field.str = value + 1;
+                field.length = (uint32_t)(member.value.end - value - 2);
+                for(const char16_t *p = field.str; p < field.str + field.length; p++) {
+                    if(*p == u'\\') {
+                        field.escaped = true;
+                        break;
+                    }
+                }
+                break;
+            case u't':
+            case u'f':
+                field.type = FIELD_BOOL;
+                field.number = *value == u't' ? 1 : 0;
+                break;
+            case u'n':
+                field.type = FIELD_NULL;
+                break;
+            case u'{':
+            case u'[':
+                field.type = FIELD_JSON;
+                field.str = value;
+                field.length = (uint32_t)(member.value.end - value);
+                break;
+            default:
+                field.type = FIELD_NUMBER;
+                if(!parseNumber(value, member.value.end, field.number))
+                    return false;
+            }
+            _fields.push_back(field);
+        }
+    }
+    _firstField.push_back((uint32_t)_fields.size());
+    return true;
+}
+
+bool ProductStore::loadRecords()
+{
+    RecordReader reader(_records.data(), _records.size());
+    if(!reader.valid() || !reader.isArray()) {
+        return false;
+    }
+    std::vector<uint32_t> keys(reader.keyCount());
+    for(uint32_t i = 0; i < reader.keyCount(); i++) {
+        uint32_t length;
+        const char16_t *chars = reader.key(i, length);
+        keys[i] = internKey(chars, length);
+    }
+    _firstField.reserve(reader.recordCount() + 1);
+    uint32_t fieldCount;
+    while(reader.nextRecord(fieldCount)) {
+        _firstField.push_back((uint32_t)_fields.size());
+        RecordField record;
+        while(reader.nextField(record)) {
+            Field field;
+            field.key = keys[record.key];
+            field.escaped = false;
+            field.str = nullptr;
+            field.length = 0;
+            field.number = record.number;
+            switch(record.type) {
+            case RECORD_STRING:
+                field.type = FIELD_STRING;
+                field.str = record.str;
+                field.length = record.length;
+                break;
+            case RECORD_NUMBER:
+            case RECORD_INTEGER:
+                field.type = FIELD_NUMBER;
+                break;
+            case RECORD_BOOL:
+                field.type = FIELD_BOOL;
+                break;
+            default:
+                field.type = FIELD_NULL;
+            }
+            _fields.push_back(field);
+        }
+    }
+    _firstField.push_back((uint32_t)_fields.size());
+    return reader.valid();
+}
+
+const ProductStore::Field* ProductStore::field(size_t product, uint32_t key) const
+{
+    for(const Field *f = fieldsBegin(product); f != fieldsEnd(product); f++) {
+        if(f->key == key)
+            return f;
+    }
+    return nullptr;
+}
+
+std::u16string ProductStore::string(const Field &field) const
+{
+    if(!field.escaped) {
+        return std::u16string(field.str, field.length);
+    }
+    std::u16string out;
+    jsonUnescape(field.str - 1, field.str + field.length + 1, out);
+    return out;
+}
+
+} // namespace iap
@@ -0,0 +1,76 @@
+#ifndef IapProductStore_h
+#define IapProductStore_h
+
+#include "IapResult.h"
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Product store
+//
+///////////////////////////////////////
+
+// A product list result kept in native memory, for JS objects that turn
+// fields into JS values only when they are read. Loading takes over the
+// result's payload (JSON text or records) and indexes the fields of every
+// product; string values keep pointing into the payload, nothing is
+// decoded up front.
+class ProductStore
+{
+public:
+    enum FieldType
+    {
+        FIELD_STRING,
+        FIELD_NUMBER,
+        FIELD_BOOL,
+        FIELD_NULL,
+        FIELD_JSON      // nested object or array, JSON text
+    };
+
+    struct Field
+    {
+        uint32_t key;
+        uint16_t type;
+        bool escaped;           // FIELD_STRING text still has JSON escapes
+        const char16_t *str;    // FIELD_STRING, FIELD_JSON, points into the payload
+        uint32_t length;
+        double number;          // FIELD_NUMBER, FIELD_BOOL
+    };
+
+    // False when the payload is not an array of objects; the result is
+    // left as it was then.
+    bool load(Result &result);
+
+    size_t size() const { return _firstField.empty() ? 0 : _firstField.size() - 1; }
+    uint32_t keyCount() const { return (uint32_t)_keys.size(); }
+    const std::u16string& key(uint32_t index) const { return _keys[index]; }
+
+    const Field* fieldsBegin(size_t product) const { return _fields.data() + _firstField[product]; }
+    const Field* fieldsEnd(size_t product) const { return _fields.data() + _firstField[product + 1]; }
+    // nullptr when the product has no such field
+    const Field* field(size_t product, uint32_t key) const;
+
+    // text of a FIELD_STRING, escapes resolved
+    std::u16string string(const Field &field) const;
+
+private:
+    bool loadJson();
+    bool loadRecords();
+    uint32_t internKey(const char16_t *chars, size_t length);
+
+    std::u16string _json;
+    std::vector<uint8_t> _records;
+    std::vector<std::u16string> _keys;
+    std::unordered_map<std::u16string, uint32_t> _keyIndex;
+    std::vector<Field> _fields;
+    std::vector<uint32_t> _firstField;  // per product, plus one past the end
+};
+
+} // namespace iap
+
+#endif /* IapProductStore_h */
@@ -0,0 +1,351 @@
+#include "IapRecords.h"
+#include "IapBilling.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Writer
+//
+///////////////////////////////////////
+
+RecordWriter::RecordWriter(bool array)
+: _array(array)
+, _recordStart(0)
+, _fieldCount(0)
+, _recordCount(0)
+{
+}
+
+void RecordWriter::put(const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t*)data;
+    _body.insert(_body.end(), bytes, bytes + size);
+}
+
+void RecordWriter::beginRecord()
+{
+    _recordStart = _body.size();
+    _fieldCount = 0;
+    put(&_fieldCount, sizeof(_fieldCount));
+}
+
+void RecordWriter::endRecord()
+{
+    memcpy(&_body[_recordStart], &_fieldCount, sizeof(_fieldCount));
+    _recordCount++;
+}
+
+void RecordWriter::beginField(const std::string &key, RecordType type)
+{
+    uint16_t index;
+    auto it = _keyIndex.find(key);
+    if(it != _keyIndex.end()) {
+        index = it->second;
+    } else {
+        index = (uint16_t)_keys.size();
+        _keys.push_back(key);
+        _keyIndex[key] = index;
+    }
+    uint16_t t = (uint16_t)type;
+    put(&index, sizeof(index));
+    put(&t, sizeof(t));
+    _fieldCount++;
+}
+
+void RecordWriter::addString(const std::string &key, const char16_t *value, size_t length)
+{
+    beginField(key, RECORD_STRING);
+    uint32_t len = (uint32_t)length;
+    put(&len, sizeof(len));
+    put(value, length * sizeof(char16_t));
+}
+
+void RecordWriter::addString(const std::string &key, const std::string &utf8)
+{
+    std::u16string value = utf8ToUtf16(utf8);
+    addString(key, value.data(), value.size());
+}
+
+void RecordWriter::addNumber(const std::string &key, double value)
+{
+    beginField(key, RECORD_NUMBER);
+    put(&value, sizeof(value));
+}
+
+void RecordWriter::addInteger(const std::string &key, int64_t value)
+{
+    beginField(key, RECORD_INTEGER);
+    put(&value, sizeof(value));
+}
+
+void RecordWriter::addBool(const std::string &key, bool value)
+{
+    beginField(key, RECORD_BOOL);
+    uint16_t v = value ? 1 : 0;
+    put(&v, sizeof(v));
+}
+
+void RecordWriter::addNull(const std::string &key)
+{
+    beginField(key, RECORD_NULL);
+}
+
+std::vector<uint8_t> RecordWriter::finish()
+{
+    std::vector<uint8_t> out;
+    size_t keyBytes = 0;
+    std::vector<std::u16string> keys;
+    keys.reserve(_keys.size());
+    for(const std::string &key : _keys) {
+        keys.push_back(utf8ToUtf16(key));
+        keyBytes += sizeof(uint32_t) + keys.back().size() * sizeof(char16_t);
+    }
+    out.reserve(16 + keyBytes + _body.size());
+
+    auto append = [&out](const void *data, size_t size) {
+        const uint8_t *bytes = (const uint8_t*)data;
+        out.insert(out.end(), bytes, bytes + size);
+    };
+    uint32_t magic = RECORDS_MAGIC;
+    uint16_t version = RECORDS_VERSION;
+    uint16_t flags = _array ? RECORDS_ARRAY : 0;
+    uint32_t keyCount = (uint32_t)keys.size();
+    append(&magic, sizeof(magic));
+    append(&version, sizeof(version));
+    append(&flags, sizeof(flags));
+    append(&keyCount, sizeof(keyCount));
+    for(const std::u16string &key : keys) {
+        uint32_t length = (uint32_t)key.size();
+        append(&length, sizeof(length));
+        append(key.data(), key.size() * sizeof(char16_t));
+    }
+    append(&_recordCount, sizeof(_recordCount));
+    append(_body.data(), _body.size());
+    return out;
+}
+
+///////////////////////////////////////
+//
+//  Reader
+//
+///////////////////////////////////////
+
+template<typename T>
+bool RecordReader::read(T &value)
+{
+    if(_size - _pos < sizeof(T)) {
+        _valid = false;
+        return false;
+    }
+    memcpy(&value, _data + _pos, sizeof(T));
+    _pos += sizeof(T);
+    return true;
+}
+
+RecordReader::RecordReader(const uint8_t *data, size_t size)
+: _data(data)
+, _size(size)
+, _pos(0)
+, _valid(true)
+, _array(false)
+, _recordCount(0)
+, _recordsRead(0)
+, _fieldsLeft(0)
+{
+    uint32_t magic = 0;
+    uint16_t version = 0;
+    uint16_t flags = 0;
+    uint32_t keyCount = 0;
+    if(((uintptr_t)data & 1) != 0
+       || !read(magic) || magic != RECORDS_MAGIC
+       || !read(version) || version != RECORDS_VERSION
+       || !read(flags) || !read(keyCount)) {
+        _valid = false;
+        return;
+    }
+    _array = (flags & RECORDS_ARRAY) != 0;
+    for(uint32_t i = 0; i < keyCount; i++) {
+        uint32_t length;
+        if(!read(length) || (_size - _pos) / sizeof(char16_t) < length) {
+            _valid = false;
+            return;
+        }
+        _keys.push_back(Key{ (const char16_t*)(_data + _pos), length });
+        _pos += length * sizeof(char16_t);
+    }
+    if(!read(_recordCount) || (!_array && _recordCount != 1)) {
+        _valid = false;
+    }
+}
+
+const char16_t* RecordReader::key(uint32_t index, uint32_t &length) const
+{
+    length = _keys[index].length;
+    return _keys[index].chars;
+}
+
+bool RecordReader::nextRecord(uint32_t &fieldCount)
+{
+    if(!_valid || _recordsRead == _recordCount) {
+        return false;
+    }
+    // skip whatever the caller did not read of the previous record
+    RecordField field;
+    while(nextField(field)) {}
+    if(!_valid || !read(fieldCount)) {
+        return false;
+    }
+    _recordsRead++;
+    _fieldsLeft = fieldCount;
+    return true;
+}
+
+bool RecordReader::nextField(RecordField &field)
+{
+    if(!_valid || _fieldsLeft == 0) {
+        return false;
+    }
+    if(!read(field.key) || !read(field.type) || field.key >= _keys.size()) {
+        _valid = false;
+        return false;
+    }
+    _fieldsLeft--;
+    field.str = nullptr;
+    field.length = 0;
+    field.number = 0;
+    field.integer = 0;
+    switch(field.type) {
+    case RECORD_STRING:
+        if(!read(field.length) || (_size - _pos) / sizeof(char16_t) < field.length) {
+            _valid = false;
+            return false;
+        }
+        field.str = (const char16_t*)(_data + _pos);
+        _pos += field.length * sizeof(char16_t);
+        return true;
+    case RECORD_NUMBER:
+        return read(field.number);
+    case RECORD_INTEGER:
+        if(!read(field.integer))
+            return false;
+        field.number = (double)field.integer;
+        return true;
+    case RECORD_BOOL: {
+        uint16_t v;
+        if(!read(v))
+            return false;
+        field.number = v ? 1 : 0;
+        return true;
+    }
+    case RECORD_NULL:
+        return true;
+    default:
+        _valid = false;
+        return false;
+    }
+}
+
+///////////////////////////////////////
+//
+//  JSON conversion
+//
+///////////////////////////////////////
+
+static void appendJsonString(std::u16string &out, const char16_t *str, uint32_t length)
+{
+    static const char16_t HEX[] = u"0123456789abcdef";
+    out += u'"';
+    for(uint32_t i = 0; i < length; i++) {
+        char16_t c = str[i];
+        switch(c) {
+            case u'"': out += u"\\\""; break;
+            case u'\\': out += u"\\\\"; break;
+            case u'\n': out += u"\\n"; break;
+            case u'\r': out += u"\\r"; break;
+            case u'\t': out += u"\\t"; break;
+            default:
+                if(c < 0x20) {
+                    out += u"\\u00";
+                    out += HEX[c >> 4];
+                    out += HEX[c & 15];
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += u'"';
+}
+
+static void appendAscii(std::u16string &out, const char *str)
+{
+    while(*str)
+        out += (char16_t)*str++;
+}
+
+bool recordsToJson(const std::vector<uint8_t> &records, std::u16string &out)
+{
+    RecordReader reader(records.data(), records.size());
+    if(!reader.valid()) {
+        return false;
+    }
+    std::u16string json;
+    json.reserve(records.size());
+    if(reader.isArray())
+        json += u'[';
+    uint32_t fieldCount;
+    bool firstRecord = true;
+    while(reader.nextRecord(fieldCount)) {
+        if(!firstRecord)
+            json += u',';
+        firstRecord = false;
+        json += u'{';
+        RecordField field;
+        bool firstField = true;
+        while(reader.nextField(field)) {
+            if(!firstField)
+                json += u',';
+            firstField = false;
+            uint32_t keyLength;
+            const char16_t *key = reader.key(field.key, keyLength);
+            appendJsonString(json, key, keyLength);
+            json += u':';
+            char buf[32];
+            switch(field.type) {
+            case RECORD_STRING:
+                appendJsonString(json, field.str, field.length);
+                break;
+            case RECORD_NUMBER:
+                if(std::isfinite(field.number)) {
+                    snprintf(buf, sizeof(buf), "%.17g", field.number);
+                    appendAscii(json, buf);
+                } else {
+                    appendAscii(json, "null");
+                }
+                break;
+            case RECORD_INTEGER:
+                snprintf(buf, sizeof(buf), "%lld", (long long)field.integer);
+                appendAscii(json, buf);
+                break;
+            case RECORD_BOOL:
+                appendAscii(json, field.number != 0 ? "true" : "false");
+                break;
+            default:
+                appendAscii(json, "null");
+            }
+        }
+        json += u'}';
+    }
+    if(reader.isArray())
+        json += u']';
+    if(!reader.valid()) {
+        return false;
+    }
+    out = std::move(json);
+    return true;
+}
+
+} // namespace iap
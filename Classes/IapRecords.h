@@ -0,0 +1,135 @@
+#ifndef IapRecords_h
+#define IapRecords_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Compact binary records
+//
+///////////////////////////////////////
+
+// Product and purchase results are flat objects with string, number and
+// boolean values. Instead of JSON they can be sent as a list of records
+// which the JS layer turns into objects directly, skipping JSON
+// serialization on the store side and JS_ParseJSON on ours.
+//
+// Layout (native endianness, produced on the device that consumes it):
+//   u32  magic 'IAPR'
+//   u16  version
+//   u16  flags            RECORDS_ARRAY: a list of records, else a single one
+//   u32  keyCount         property names, each sent once
+//     u32 length, char16_t[length]
+//   u32  recordCount
+//     u32 fieldCount
+//       u16 key index, u16 type, payload
+//
+// Payloads: RECORD_STRING u32 length + char16_t[length], RECORD_NUMBER f64,
+// RECORD_INTEGER i64, RECORD_BOOL u16, RECORD_NULL nothing. Every item has
+// an even size, so strings stay char16_t aligned and can be handed to the
+// JS engine without copying them out first.
+
+static const uint32_t RECORDS_MAGIC = 0x52504149; // "IAPR" in memory
+static const uint16_t RECORDS_VERSION = 1;
+static const uint16_t RECORDS_ARRAY = 1;
+
+enum RecordType
+{
+    RECORD_STRING = 0,
+    RECORD_NUMBER = 1,
+    RECORD_INTEGER = 2,
+    RECORD_BOOL = 3,
+    RECORD_NULL = 4
+};
+
+class RecordWriter
+{
+public:
+    explicit RecordWriter(bool array);
+
+    void beginRecord();
+    void addString(const std::string &key, const char16_t *value, size_t length);
+    void addString(const std::string &key, const std::string &utf8);
+    void addNumber(const std::string &key, double value);
+    void addInteger(const std::string &key, int64_t value);
+    void addBool(const std::string &key, bool value);
+    void addNull(const std::string &key);
+    void endRecord();
+
+    std::vector<uint8_t> finish();
+
+private:
+    void beginField(const std::string &key, RecordType type);
+    void put(const void *data, size_t size);
+
+    bool _array;
+    std::vector<std::string> _keys;
+    std::unordered_map<std::string, uint16_t> _keyIndex;
+    std::vector<uint8_t> _body;
+    size_t _recordStart;
+    uint32_t _fieldCount;
+    uint32_t _recordCount;
+};
+
+struct RecordField
+{
+    uint16_t key;
+    uint16_t type;
+    const char16_t *str;    // RECORD_STRING, points into the buffer
+    uint32_t length;
+    double number;          // RECORD_NUMBER, RECORD_INTEGER, RECORD_BOOL
+    int64_t integer;        // RECORD_INTEGER
+};
+
+// Sequential reader, every read is bounds checked. The buffer must be
+// char16_t aligned and outlive the reader.
+class RecordReader
+{
+public:
+    RecordReader(const uint8_t *data, size_t size);
+
+    bool valid() const { return _valid; }
+    bool isArray() const { return _array; }
+
+    uint32_t keyCount() const { return (uint32_t)_keys.size(); }
+    const char16_t* key(uint32_t index, uint32_t &length) const;
+
+    uint32_t recordCount() const { return _recordCount; }
+    // false after the last record
+    bool nextRecord(uint32_t &fieldCount);
+    // false after the last field of the current record
+    bool nextField(RecordField &field);
+
+private:
+    template<typename T> bool read(T &value);
+
+    struct Key
+    {
+        const char16_t *chars;
+        uint32_t length;
+    };
+
+    const uint8_t *_data;
+    size_t _size;
+    size_t _pos;
+    bool _valid;
+    bool _array;
+    std::vector<Key> _keys;
+    uint32_t _recordCount;
+    uint32_t _recordsRead;
+    uint32_t _fieldsLeft;
+};
+
+// JSON text of the records, for the paths that keep products as JSON
+// (catalog cache, splitting merged product queries)
+bool recordsToJson(const std::vector<uint8_t> &records, std::u16string &out);
+
+} // namespace iap
+
+#endif /* IapRecords_h */
@@ -0,0 +1,47 @@
+#ifndef IapResult_h
+#define IapResult_h
+
+#include "IapJsonDom.h"
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace iap {
+
+// Delivery lanes, in the order the JS thread drains them: a purchase the
+// player is waiting on never queues behind a catalog flood.
+enum ResultLane
+{
+    LANE_PURCHASE,      // buy, subscribe and consume answers
+    LANE_REQUEST,       // answers to every other JS call
+    LANE_EVENT,         // catalog and purchase change events
+    LANE_COUNT
+};
+
+// A single backend answer. The payload is kept as UTF-16 JSON, the form JS
+// strings are made of, so it can be moved to the JS thread and its strings
+// copied out without re-encoding.
+struct Result
+{
+    int requestId;
+    std::string error;
+    std::u16string json;
+    // compact binary payload (IapRecords.h); when set, json is empty
+    std::vector<uint8_t> records;
+    // json parsed ahead of the JS thread (preparseResult), or empty
+    JsonDom dom;
+    // ResultLane, set by Billing
+    uint8_t lane = LANE_REQUEST;
+};
+
+// Receives every result produced by the backend. Called on the thread that
+// produced the result; the handler is responsible for any thread hop and may
+// steal the payload.
+typedef std::function<void(Result &&result)> ResultHandler;
+
+std::u16string utf8ToUtf16(const std::string &utf8);
+
+} // namespace iap
+
+#endif /* IapResult_h */
@@ -0,0 +1,396 @@
+#include "IapScheduler.h"
+#include "IapCatalogCache.h"
+#include "IapRecords.h"
+#include "IapSkuTable.h"
+#include <algorithm>
+#include <unordered_map>
+
+namespace iap {
+
+static bool containsAll(const std::vector<int> &set, const std::vector<int> &skus)
+{
+    for(int sku : skus) {
+        if(std::find(set.begin(), set.end(), sku) == set.end())
+            return false;
+    }
+    return true;
+}
+
+Scheduler::Scheduler()
+: _backend(nullptr)
+, _nextInternalId(FIRST_INTERNAL_ID)
+{
+}
+
+void Scheduler::setBackend(Backend *backend)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _backend = backend;
+    _active.reset();
+    _queue.clear();
+    _abandoned.clear();
+}
+
+void Scheduler::setDeliver(const Deliver &deliver)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _deliver = deliver;
+}
+
+int Scheduler::newInternalId()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    int requestId = _nextInternalId--;
+    if(_nextInternalId > FIRST_INTERNAL_ID) {
+        // wrapped around
+        _nextInternalId = FIRST_INTERNAL_ID;
+    }
+    return requestId;
+}
+
+size_t Scheduler::queued() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _queue.size();
+}
+
+///////////////////////////////////////
+//
+//  Requests
+//
+///////////////////////////////////////
+
+bool Scheduler::init(const std::vector<std::string> &skus, bool internalValidation, int requestId)
+{
+    std::unique_ptr<Op> op(new Op());
+    op->storeId = requestId;
+    op->details = false;
+    op->waiters.push_back(Waiter{ requestId, std::vector<int>() });
+    Backend *backend = _backend;
+    op->start = [backend, skus, internalValidation](int storeId) {
+        return backend->init(skus, internalValidation, storeId);
+    };
+    return submit(std::move(op));
+}
+
+bool Scheduler::buy(const std::string &sku, const std::string &payload, int requestId)
+{
+    std::unique_ptr<Op> op(new Op());
+    op->storeId = requestId;
+    op->details = false;
+    op->waiters.push_back(Waiter{ requestId, std::vector<int>() });
+    Backend *backend = _backend;
+    op->start = [backend, sku, payload](int storeId) {
+        return backend->buy(sku, payload, storeId);
+    };
+    return submit(std::move(op));
+}
+
+bool Scheduler::subscribe(const std::string &sku, const std::string &payload, const std::vector<std::string> &oldSkus, int requestId)
+{
+    std::unique_ptr<Op> op(new Op());
+    op->storeId = requestId;
+    op->details = false;
+    op->waiters.push_back(Waiter{ requestId, std::vector<int>() });
+    Backend *backend = _backend;
+    op->start = [backend, sku, payload, oldSkus](int storeId) {
+        return backend->subscribe(sku, payload, oldSkus, storeId);
+    };
+    return submit(std::move(op));
+}
+
+bool Scheduler::consume(const std::string &sku, int requestId)
+{
+    std::unique_ptr<Op> op(new Op());
+    op->storeId = requestId;
+    op->details = false;
+    op->waiters.push_back(Waiter{ requestId, std::vector<int>() });
+    Backend *backend = _backend;
+    op->start = [backend, sku](int storeId) {
+        return backend->consume(sku, storeId);
+    };
+    return submit(std::move(op));
+}
+
+bool Scheduler::consumeMany(const std::vector<std::string> &skus, int requestId)
+{
+    std::unique_ptr<Op> op(new Op());
+    op->storeId = requestId;
+    op->details = false;
+    op->waiters.push_back(Waiter{ requestId, std::vector<int>() });
+    Backend *backend = _backend;
+    op->start = [backend, skus](int storeId) {
+        return backend->consumeMany(skus, storeId);
+    };
+    return submit(std::move(op));
+}
+
+bool Scheduler::productDetails(const std::vector<int> &skus, int requestId)
+{
+    // results can only be split per request when they are keyed by productId
+    bool flat = _backend->hasFlatProductDetails();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(_active && _active->details
+           && (flat ? containsAll(_active->skus, skus) : _active->skus == skus)) {
+            // already being queried
+            _active->waiters.push_back(Waiter{ requestId, skus });
+            return true;
+        }
+        for(std::unique_ptr<Op> &queued : _queue) {
+            if(!queued->details || !(flat || queued->skus == skus))
+                continue;
+            for(int sku : skus) {
+                if(std::find(queued->skus.begin(), queued->skus.end(), sku) == queued->skus.end())
+                    queued->skus.push_back(sku);
+            }
+            queued->waiters.push_back(Waiter{ requestId, skus });
+            return true;
+        }
+    }
+
+    std::unique_ptr<Op> op(new Op());
+    // more requests may join, so the query gets its own id
+    op->storeId = newInternalId();
+    op->details = true;
+    op->skus = skus;
+    op->waiters.push_back(Waiter{ requestId, skus });
+    return submit(std::move(op));
+}
+
+bool Scheduler::submit(std::unique_ptr<Op> op)
+{
+    std::function<bool(int)> start;
+    int storeId;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(_active || !_queue.empty()) {
+            _queue.push_back(std::move(op));
+            return true;
+        }
+        _active = std::move(op);
+        start = launcher(*_active);
+        storeId = _active->storeId;
+    }
+    // the backend is called without the lock: it may answer synchronously
+    if(start(storeId)) {
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(_active && _active->storeId == storeId) {
+            // rejected right away, the caller sees false as before
+            _active.reset();
+        }
+    }
+    startNext();
+    return false;
+}
+
+std::function<bool(int)> Scheduler::launcher(Op &op)
+{
+    if(!op.details) {
+        return op.start;
+    }
+    // the sku set is final once the query leaves the queue
+    Backend *backend = _backend;
+    std::vector<int> skus = op.skus;
+    return [backend, skus](int storeId) {
+        return backend->productDetails(skus, storeId);
+    };
+}
+
+void Scheduler::startNext()
+{
+    for(;;) {
+        std::function<bool(int)> start;
+        int storeId;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(_active || _queue.empty()) {
+                return;
+            }
+            _active = std::move(_queue.front());
+            _queue.pop_front();
+            start = launcher(*_active);
+            storeId = _active->storeId;
+        }
+        if(start(storeId)) {
+            return;
+        }
+        std::unique_ptr<Op> rejected;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(_active && _active->storeId == storeId)
+                rejected = std::move(_active);
+        }
+        if(rejected) {
+            reject(*rejected);
+        }
+    }
+}
+
+bool Scheduler::cancel(int requestId)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for(auto it = _queue.begin(); it != _queue.end(); ++it) {
+        if(!removeWaiter(**it, requestId))
+            continue;
+        if((*it)->waiters.empty())
+            _queue.erase(it);
+        return true;
+    }
+    // the operation in flight keeps the slot until the store answers it,
+    // with or without waiters
+    return _active && removeWaiter(*_active, requestId, &_active->left);
+}
+
+bool Scheduler::abandon(int requestId)
+{
+    std::unique_ptr<Op> op;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(!_active || !(hasWaiter(_active->waiters, requestId) || hasWaiter(_active->left, requestId))) {
+            return false;
+        }
+        op = std::move(_active);
+        _abandoned.push_back(op->storeId);
+        if(_abandoned.size() > MAX_ABANDONED)
+            _abandoned.pop_front();
+    }
+    // requests that left while it ran settle through the rejection too
+    for(Waiter &waiter : op->left) {
+        if(!hasWaiter(op->waiters, waiter.requestId))
+            op->waiters.push_back(std::move(waiter));
+    }
+    removeWaiter(*op, requestId);
+    if(!op->waiters.empty()) {
+        reject(*op);
+    }
+    startNext();
+    return true;
+}
+
+bool Scheduler::hasWaiter(const std::vector<Waiter> &waiters, int requestId)
+{
+    for(const Waiter &waiter : waiters) {
+        if(waiter.requestId == requestId)
+            return true;
+    }
+    return false;
+}
+
+// a merged query keeps the skus of a waiter that left, the store is asked anyway
+bool Scheduler::removeWaiter(Op &op, int requestId, std::vector<Waiter> *left)
+{
+    for(auto it = op.waiters.begin(); it != op.waiters.end(); ++it) {
+        if(it->requestId == requestId) {
+            if(left)
+                left->push_back(std::move(*it));
+            op.waiters.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+///////////////////////////////////////
+//
+//  Results
+//
+///////////////////////////////////////
+
+bool Scheduler::finish(Result &result)
+{
+    std::unique_ptr<Op> op;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(!_active || _active->storeId != result.requestId) {
+            // the answer to an abandoned operation comes too late for anyone
+            auto it = std::find(_abandoned.begin(), _abandoned.end(), result.requestId);
+            if(it == _abandoned.end()) {
+                return false;
+            }
+            _abandoned.erase(it);
+            return true;
+        }
+        op = std::move(_active);
+    }
+    // a request that gave up on this attempt may still take the answer, a
+    // retry of it queued behind is then dropped before it can start
+    for(Waiter &waiter : op->left) {
+        if(!hasWaiter(op->waiters, waiter.requestId))
+            op->waiters.push_back(std::move(waiter));
+    }
+    if(!op->waiters.empty()) {
+        fanOut(*op, result);
+    }
+    startNext();
+    return true;
+}
+
+void Scheduler::reject(Op &op)
+{
+    Result result;
+    result.requestId = op.storeId;
+    result.error = "Request rejected by the store";
+    fanOut(op, result);
+}
+
+void Scheduler::fanOut(Op &op, Result &result)
+{
+    Deliver deliver;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        deliver = _deliver;
+    }
+    if(!deliver) {
+        return;
+    }
+    if(op.waiters.size() == 1 && (!op.details || op.waiters[0].skus.size() == op.skus.size())) {
+        result.requestId = op.waiters[0].requestId;
+        deliver(std::move(result));
+        return;
+    }
+
+    // merged query: split the answer per request, which needs it as JSON
+    if(!result.records.empty() && recordsToJson(result.records, result.json)) {
+        result.records.clear();
+    }
+    std::vector<CatalogEntry> entries;
+    if(!result.error.empty() || !_backend->hasFlatProductDetails() || !CatalogCache::parseProducts(result.json, entries)) {
+        for(const Waiter &waiter : op.waiters) {
+            Result copy = result;
+            copy.requestId = waiter.requestId;
+            deliver(std::move(copy));
+        }
+        return;
+    }
+
+    // by handle; products the table never saw were not asked for
+    SkuTable *table = SkuTable::getInstance();
+    std::unordered_map<int, const std::u16string*> products;
+    for(const CatalogEntry &entry : entries) {
+        int handle = table->find(entry.sku);
+        if(handle >= 0)
+            products[handle] = &entry.json;
+    }
+    for(const Waiter &waiter : op.waiters) {
+        // same shape as the store's answer: only the products it knows about
+        Result subset;
+        subset.requestId = waiter.requestId;
+        subset.json = u"[";
+        for(int sku : waiter.skus) {
+            auto it = products.find(sku);
+            if(it == products.end())
+                continue;
+            if(subset.json.size() > 1)
+                subset.json += u',';
+            subset.json += *it->second;
+        }
+        subset.json += u']';
+        deliver(std::move(subset));
+    }
+}
+
+} // namespace iap
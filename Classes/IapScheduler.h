@@ -0,0 +1,122 @@
+#ifndef IapScheduler_h
+#define IapScheduler_h
+
+#include "IapBackend.h"
+#include "IapResult.h"
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Store request scheduler
+//
+///////////////////////////////////////
+
+// Sits between Billing and the backend. The store runs one asynchronous
+// operation at a time (IabHelper rejects the rest with "Another async
+// operation in progress!", StoreKit shares one transaction callback), so
+// init, buy, subscribe, consume (single or batched) and product_details
+// are queued and started one after another instead of failing.
+//
+// product_details requests are merged: a request whose SKUs are covered by
+// the query in flight waits for it, otherwise its SKUs are added to the
+// queued query. SKUs are SkuTable handles, so merging compares ints. When
+// the store answers, every waiting request receives the products it asked
+// for.
+class Scheduler
+{
+public:
+    // receives the result of every request that went through the scheduler
+    typedef std::function<void(Result &&result)> Deliver;
+
+    // ids of requests issued by the core itself (merged queries, background
+    // refreshes) count down from here; ids above belong to callers
+    static const int FIRST_INTERNAL_ID = -1000;
+
+    Scheduler();
+
+    void setBackend(Backend *backend);
+    void setDeliver(const Deliver &deliver);
+
+    int newInternalId();
+    static bool isInternalId(int requestId) { return requestId <= FIRST_INTERNAL_ID; }
+
+    // Same contract as Backend. A request that has to wait returns true; if
+    // the store rejects it later the caller gets an error result instead.
+    bool init(const std::vector<std::string> &skus, bool internalValidation, int requestId);
+    bool buy(const std::string &sku, const std::string &payload, int requestId);
+    bool subscribe(const std::string &sku, const std::string &payload, const std::vector<std::string> &oldSkus, int requestId);
+    bool consume(const std::string &sku, int requestId);
+    bool consumeMany(const std::vector<std::string> &skus, int requestId);
+    bool productDetails(const std::vector<int> &skus, int requestId);
+
+    // Withdraws a request. A queued one leaves its operation, which is dropped
+    // once nobody waits for it. The operation in flight keeps its slot even
+    // when the request was its only waiter: the store still runs it and would
+    // reject the next one, so the queue moves on only once finish() sees its
+    // answer. Nothing is delivered for the request here. False when it is not
+    // in the scheduler.
+    bool cancel(int requestId);
+
+    // Gives up on the operation in flight that requestId waits for or left,
+    // once the store is not expected to answer it any more. Its other waiters
+    // are rejected (requestId itself was answered when it was given up on),
+    // a late answer is dropped and the next operation starts. False when
+    // requestId is not on the operation in flight.
+    bool abandon(int requestId);
+
+    // Called with every backend result. Returns true when the result
+    // belonged to a scheduled operation and was delivered through Deliver,
+    // also to the requests that left it while it ran (the caller decides
+    // whether a late answer still counts), before the next one starts.
+    bool finish(Result &result);
+
+    // operations waiting behind the one in flight
+    size_t queued() const;
+
+private:
+    // late answers remembered for dropping
+    static const size_t MAX_ABANDONED = 32;
+
+    struct Waiter
+    {
+        int requestId;
+        std::vector<int> skus;
+    };
+
+    struct Op
+    {
+        int storeId;                    // id the backend answers with
+        bool details;                   // product_details, started with skus
+        std::vector<int> skus;          // union of the waiters' skus
+        std::vector<Waiter> waiters;
+        std::vector<Waiter> left;       // cancelled while the store ran it
+        std::function<bool(int storeId)> start;
+    };
+
+    bool submit(std::unique_ptr<Op> op);
+    std::function<bool(int storeId)> launcher(Op &op);
+    void startNext();
+    void fanOut(Op &op, Result &result);
+    void reject(Op &op);
+    static bool removeWaiter(Op &op, int requestId, std::vector<Waiter> *left = nullptr);
+    static bool hasWaiter(const std::vector<Waiter> &waiters, int requestId);
+
+    Backend *_backend;
+    Deliver _deliver;
+    std::unique_ptr<Op> _active;
+    std::deque<std::unique_ptr<Op>> _queue;
+    std::deque<int> _abandoned;         // storeIds whose late answer is dropped
+    int _nextInternalId;
+    mutable std::mutex _mutex;
+};
+
+} // namespace iap
+
+#endif /* IapScheduler_h */
@@ -0,0 +1,359 @@
+#include "IapSimulatedStore.h"
+#include "IapBilling.h"
+#include "IapSkuTable.h"
+#include <cstdio>
+
+namespace iap {
+
+static const char* SIMULATED_PACKAGE = "com.tapclap.simulated";
+
+static void appendQuoted(std::string &out, const std::string &str)
+{
+    out += '"';
+    for(char c : str) {
+        switch(c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if((unsigned char)c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+                    out += buf;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+// same shape as InAppBillingPlugin.purchaseFinished(): original json + signature + receipt
+static std::string purchaseResultJson(const std::string &originalJson)
+{
+    std::string result = originalJson;
+    result.pop_back();
+    // no comma after an empty object
+    if(result.find_last_not_of(" \t\r\n") != 0)
+        result += ',';
+    result += "\"signature\":\"\",\"receipt\":";
+    appendQuoted(result, originalJson);
+    result += '}';
+    return result;
+}
+
+SimulatedStore::SimulatedStore(const SimulatedStoreConfig &config)
+: _config(config)
+, _inited(false)
+, _debug(false)
+, _orderCounter(0)
+, _random(config.seed)
+, _taskSeq(0)
+, _running(0)
+, _stop(false)
+{
+    for(int i = 0; i < _config.catalogSize; i++) {
+        std::string sku = skuName(i);
+        int micros = 990000 + (i % 100) * 1000000;
+        char price[32];
+        snprintf(price, sizeof(price), "$%d.%02d", micros / 1000000, (micros / 10000) % 100);
+
+        std::string json = "{\"productId\":";
+        appendQuoted(json, sku);
+        json += ",\"type\":\"inapp\",\"price\":";
+        appendQuoted(json, price);
+        json += ",\"price_amount_micros\":" + std::to_string(micros);
+        json += ",\"price_currency_code\":\"USD\",\"title\":\"Simulated item " + std::to_string(i) + "\"";
+        json += ",\"description\":\"Simulated in-app product number " + std::to_string(i) + "\"}";
+
+        Product &product = _catalog[sku];
+        product.type = "inapp";
+        product.json = std::move(json);
+    }
+    _thread = std::thread(&SimulatedStore::worker, this);
+}
+
+SimulatedStore::~SimulatedStore()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wakeup.notify_all();
+    if(_thread.joinable())
+        _thread.join();
+}
+
+std::string SimulatedStore::skuName(int index)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "sku_%05d", index);
+    return buf;
+}
+
+///////////////////////////////////////
+//
+//  Backend API
+//
+///////////////////////////////////////
+
+bool SimulatedStore::init(const std::vector<std::string> &, bool, int requestId)
+{
+    schedule(true, [this, requestId](bool failed) {
+            if(failed) {
+                Billing::getInstance()->requestResult(requestId, "3|Problem setting up in-app billing: simulated failure", "");
+                return;
+            }
+            _inited = true;
+            Billing::getInstance()->requestResult(requestId, "", "{}");
+        });
+    return true;
+}
+
+bool SimulatedStore::getPurchases(int requestId)
+{
+    schedule(false, [this, requestId](bool) {
+            if(!_inited) {
+                Billing::getInstance()->requestResult(requestId, "Billing plugin was not initialized", "");
+                return;
+            }
+            std::string result = "[";
+            for(auto &it : _owned) {
+                if(result.size() > 1) result += ',';
+                result += purchaseResultJson(it.second);
+            }
+            result += ']';
+            Billing::getInstance()->requestResult(requestId, "", std::move(result));
+        });
+    return true;
+}
+
+bool SimulatedStore::buy(const std::string &sku, const std::string &payload, int requestId)
+{
+    schedule(true, [this, sku, payload, requestId](bool failed) {
+            if(!_inited) {
+                Billing::getInstance()->requestResult(requestId, "Billing plugin was not initialized", "");
+                return;
+            }
+            auto product = _catalog.find(sku);
+            if(failed || product == _catalog.end()) {
+                Billing::getInstance()->requestResult(requestId, "-1008|Error purchasing: simulated failure", "");
+                return;
+            }
+            if(_owned.count(sku)) {
+                Billing::getInstance()->requestResult(requestId, "7|Error purchasing: item already owned", "");
+                return;
+            }
+            std::string json = purchaseJson(sku, product->second.type, payload);
+            _owned[sku] = json;
+            Billing::getInstance()->requestResult(requestId, "", purchaseResultJson(json));
+        });
+    return true;
+}
+
+bool SimulatedStore::subscribe(const std::string &sku, const std::string &payload, const std::vector<std::string> &oldSkus, int requestId)
+{
+    schedule(true, [this, sku, payload, oldSkus, requestId](bool failed) {
+            if(!_inited) {
+                Billing::getInstance()->requestResult(requestId, "Billing plugin was not initialized", "");
+                return;
+            }
+            if(failed) {
+                Billing::getInstance()->requestResult(requestId, "-1008|Error purchasing: simulated failure", "");
+                return;
+            }
+            for(const std::string &old : oldSkus) {
+                _owned.erase(old);
+            }
+            std::string json = purchaseJson(sku, "subs", payload);
+            _owned[sku] = json;
+            Billing::getInstance()->requestResult(requestId, "", purchaseResultJson(json));
+        });
+    return true;
+}
+
+bool SimulatedStore::consume(const std::string &sku, int requestId)
+{
+    schedule(true, [this, sku, requestId](bool failed) {
+            auto purchase = _owned.find(sku);
+            if(purchase == _owned.end()) {
+                Billing::getInstance()->requestResult(requestId, sku + " is not owned so it cannot be consumed", "");
+                return;
+            }
+            if(failed) {
+                Billing::getInstance()->requestResult(requestId, "6|Error while consuming: simulated failure", "");
+                return;
+            }
+            std::string json = std::move(purchase->second);
+            _owned.erase(purchase);
+            Billing::getInstance()->requestResult(requestId, "", std::move(json));
+        });
+    return true;
+}
+
+// one store round trip for the whole batch, like IabHelper's multi consume
+bool SimulatedStore::consumeMany(const std::vector<std::string> &skus, int requestId)
+{
+    schedule(true, [this, skus, requestId](bool failed) {
+            std::string result = "[";
+            for(const std::string &sku : skus) {
+                if(result.size() > 1) result += ',';
+                result += "{\"productId\":\"" + sku + "\",";
+                auto purchase = _owned.find(sku);
+                if(purchase == _owned.end()) {
+                    result += "\"error\":\"" + sku + " is not owned so it cannot be consumed\",\"purchase\":null}";
+                } else if(failed) {
+                    result += "\"error\":\"6|Error while consuming: simulated failure\",\"purchase\":null}";
+                } else {
+                    result += "\"error\":null,\"purchase\":" + purchase->second + "}";
+                    _owned.erase(purchase);
+                }
+            }
+            result += ']';
+            Billing::getInstance()->requestResult(requestId, "", std::move(result));
+        });
+    return true;
+}
+
+bool SimulatedStore::availableProducts(int requestId)
+{
+    schedule(false, [this, requestId](bool) {
+            if(!_inited) {
+                Billing::getInstance()->requestResult(requestId, "Billing plugin was not initialized", "");
+                return;
+            }
+            std::string result = "[";
+            for(auto &it : _catalog) {
+                if(result.size() > 1) result += ',';
+                result += it.second.json;
+            }
+            result += ']';
+            Billing::getInstance()->requestResult(requestId, "", std::move(result));
+        });
+    return true;
+}
+
+bool SimulatedStore::productDetails(const std::vector<int> &skus, int requestId)
+{
+    schedule(true, [this, skus, requestId](bool failed) {
+            if(!_inited) {
+                Billing::getInstance()->requestResult(requestId, "Billing plugin was not initialized", "");
+                return;
+            }
+            if(failed) {
+                Billing::getInstance()->requestResult(requestId, "6|Failed to query inventory: simulated failure", "");
+                return;
+            }
+            Billing::getInstance()->requestResult(requestId, "", productsJson(skus));
+        });
+    return true;
+}
+
+bool SimulatedStore::restore(int requestId)
+{
+    return getPurchases(requestId);
+}
+
+bool SimulatedStore::setDebug(bool debug)
+{
+    _debug = debug;
+    return true;
+}
+
+void SimulatedStore::flush()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this] { return _tasks.empty() && _running == 0; });
+}
+
+///////////////////////////////////////
+//
+//  Worker
+//
+///////////////////////////////////////
+
+void SimulatedStore::schedule(bool storeRoundTrip, std::function<void(bool failed)> run)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Task task;
+        task.due = Clock::now();
+        task.failed = false;
+        if(storeRoundTrip) {
+            int latency = _config.minLatencyUs;
+            if(_config.maxLatencyUs > _config.minLatencyUs) {
+                latency = std::uniform_int_distribution<int>(_config.minLatencyUs, _config.maxLatencyUs)(_random);
+            }
+            task.due += std::chrono::microseconds(latency);
+            if(_config.failureRate > 0.0) {
+                task.failed = std::uniform_real_distribution<double>(0.0, 1.0)(_random) < _config.failureRate;
+            }
+        }
+        task.seq = _taskSeq++;
+        task.run = std::move(run);
+        _tasks.push(std::move(task));
+    }
+    _wakeup.notify_one();
+}
+
+void SimulatedStore::worker()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while(!_stop) {
+        if(_tasks.empty()) {
+            _wakeup.wait(lock);
+            continue;
+        }
+        Clock::time_point due = _tasks.top().due;
+        if(Clock::now() < due) {
+            _wakeup.wait_until(lock, due);
+            continue;
+        }
+        Task task = std::move(const_cast<Task&>(_tasks.top()));
+        _tasks.pop();
+        _running++;
+        lock.unlock();
+        task.run(task.failed);
+        lock.lock();
+        _running--;
+        if(_tasks.empty() && _running == 0)
+            _idle.notify_all();
+    }
+}
+
+std::string SimulatedStore::purchaseJson(const std::string &sku, const std::string &type, const std::string &payload)
+{
+    unsigned long long order = ++_orderCounter;
+    long long now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    std::string json = "{\"orderId\":\"SIM." + std::to_string(order) + "\",\"packageName\":";
+    appendQuoted(json, SIMULATED_PACKAGE);
+    json += ",\"productId\":";
+    appendQuoted(json, sku);
+    json += ",\"type\":";
+    appendQuoted(json, type);
+    json += ",\"purchaseTime\":" + std::to_string(now);
+    json += ",\"purchaseState\":0,\"developerPayload\":";
+    appendQuoted(json, payload);
+    json += ",\"purchaseToken\":\"token." + std::to_string(order) + "\"}";
+    return json;
+}
+
+std::string SimulatedStore::productsJson(const std::vector<int> &skus)
+{
+    SkuTable *table = SkuTable::getInstance();
+    std::string result = "[";
+    for(int sku : skus) {
+        auto product = _catalog.find(table->name(sku));
+        if(product == _catalog.end())
+            continue;
+        if(result.size() > 1) result += ',';
+        result += product->second.json;
+    }
+    result += ']';
+    return result;
+}
+
+} // namespace iap
@@ -0,0 +1,109 @@
+#ifndef IapSimulatedStore_h
+#define IapSimulatedStore_h
+
+#include "IapBackend.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace iap {
+
+struct SimulatedStoreConfig
+{
+    // number of generated products, named sku_00000 .. sku_NNNNN
+    int catalogSize = 100;
+    // store round trip is uniformly distributed in [minLatencyUs, maxLatencyUs]
+    int minLatencyUs = 0;
+    int maxLatencyUs = 0;
+    // probability (0..1) that a store round trip fails
+    double failureRate = 0.0;
+    unsigned int seed = 1;
+};
+
+///////////////////////////////////////
+//
+//  In-process simulated store
+//
+///////////////////////////////////////
+
+// Backend that emulates Google Play billing in-process. Results are
+// produced on a worker thread after the configured latency, using the same
+// JSON shapes as InAppBillingPlugin.java, so the request/callback path can
+// be profiled off-device.
+class SimulatedStore : public Backend
+{
+public:
+    explicit SimulatedStore(const SimulatedStoreConfig &config = SimulatedStoreConfig());
+    virtual ~SimulatedStore();
+
+    virtual bool init(const std::vector<std::string> &skus, bool internalValidation, int requestId) override;
+    virtual bool getPurchases(int requestId) override;
+    virtual bool buy(const std::string &sku, const std::string &payload, int requestId) override;
+    virtual bool subscribe(const std::string &sku, const std::string &payload, const std::vector<std::string> &oldSkus, int requestId) override;
+    virtual bool consume(const std::string &sku, int requestId) override;
+    virtual bool consumeMany(const std::vector<std::string> &skus, int requestId) override;
+    virtual bool availableProducts(int requestId) override;
+    virtual bool productDetails(const std::vector<int> &skus, int requestId) override;
+    virtual bool restore(int requestId) override;
+    virtual bool setDebug(bool debug) override;
+
+    // blocks until every scheduled operation has produced its result
+    void flush();
+
+    static std::string skuName(int index);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Task
+    {
+        Clock::time_point due;
+        unsigned long long seq;
+        bool failed;
+        std::function<void(bool failed)> run;
+        bool operator<(const Task &other) const {
+            // std::priority_queue is a max-heap
+            return due != other.due ? due > other.due : seq > other.seq;
+        }
+    };
+
+    struct Product
+    {
+        std::string type;
+        std::string json;
+    };
+
+    void schedule(bool storeRoundTrip, std::function<void(bool failed)> run);
+    void worker();
+
+    std::string purchaseJson(const std::string &sku, const std::string &type, const std::string &payload);
+    std::string productsJson(const std::vector<int> &skus);
+
+    SimulatedStoreConfig _config;
+    std::map<std::string, Product> _catalog;
+    std::map<std::string, std::string> _owned; // sku -> purchase json
+    bool _inited;
+    bool _debug;
+    unsigned long long _orderCounter;
+
+    std::mt19937 _random;
+    std::priority_queue<Task> _tasks;
+    unsigned long long _taskSeq;
+    int _running;
+    bool _stop;
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::condition_variable _idle;
+    std::thread _thread;
+};
+
+} // namespace iap
+
+#endif /* IapSimulatedStore_h */
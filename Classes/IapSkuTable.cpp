@@ -0,0 +1,86 @@
+#include "IapSkuTable.h"
+
+namespace iap {
+
+const int SkuTable::BLOCK_SIZE;
+const int SkuTable::MAX_BLOCKS;
+const int SkuTable::MAX_SKUS;
+
+SkuTable::SkuTable()
+: _size(0)
+{
+    for(int i = 0; i < MAX_BLOCKS; i++)
+        _blocks[i].store(nullptr, std::memory_order_relaxed);
+}
+
+SkuTable::~SkuTable()
+{
+    for(int i = 0; i < MAX_BLOCKS; i++)
+        delete[] _blocks[i].load(std::memory_order_relaxed);
+}
+
+SkuTable* SkuTable::getInstance()
+{
+    static SkuTable instance;
+    return &instance;
+}
+
+int SkuTable::intern(const std::string &sku)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return internLocked(sku);
+}
+
+void SkuTable::intern(const std::vector<std::string> &skus, std::vector<int> &handles)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    handles.resize(skus.size());
+    for(size_t i = 0; i < skus.size(); i++)
+        handles[i] = internLocked(skus[i]);
+}
+
+int SkuTable::internLocked(const std::string &sku)
+{
+    auto it = _handles.find(sku);
+    if(it != _handles.end()) {
+        return it->second;
+    }
+    int handle = _size.load(std::memory_order_relaxed);
+    if(handle >= MAX_SKUS) {
+        return -1;
+    }
+    std::string *block = _blocks[handle / BLOCK_SIZE].load(std::memory_order_relaxed);
+    if(!block) {
+        block = new std::string[BLOCK_SIZE];
+        _blocks[handle / BLOCK_SIZE].store(block, std::memory_order_release);
+    }
+    block[handle % BLOCK_SIZE] = sku;
+    _handles.emplace(sku, handle);
+    // publishes the name to lock-free readers
+    _size.store(handle + 1, std::memory_order_release);
+    return handle;
+}
+
+int SkuTable::find(const std::string &sku) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _handles.find(sku);
+    return it != _handles.end() ? it->second : -1;
+}
+
+const std::string& SkuTable::name(int handle) const
+{
+    return _blocks[handle / BLOCK_SIZE].load(std::memory_order_acquire)[handle % BLOCK_SIZE];
+}
+
+void SkuTable::names(const std::vector<int> &handles, std::vector<std::string> &out) const
+{
+    out.clear();
+    out.reserve(handles.size());
+    for(int handle : handles) {
+        if(valid(handle))
+            out.push_back(name(handle));
+    }
+}
+
+} // namespace iap
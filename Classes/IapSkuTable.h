@@ -0,0 +1,60 @@
+#ifndef IapSkuTable_h
+#define IapSkuTable_h
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Interned SKUs
+//
+///////////////////////////////////////
+
+// Every SKU the plugin sees gets a dense integer handle, assigned once and
+// kept for the whole session, so lists of SKUs can cross JS, JNI and
+// Objective-C as ints and be resolved by index instead of being converted
+// and hashed again on every call. init() interns its SKUs first, in order.
+//
+// Names are stored in fixed blocks that never move: name() takes no lock
+// and may run on any thread while others intern.
+class SkuTable
+{
+public:
+    static const int BLOCK_SIZE = 256;
+    static const int MAX_BLOCKS = 256;
+    static const int MAX_SKUS = BLOCK_SIZE * MAX_BLOCKS;
+
+    static SkuTable* getInstance();
+
+    // the SKU's handle, new if needed; -1 once the table is full
+    int intern(const std::string &sku);
+    void intern(const std::vector<std::string> &skus, std::vector<int> &handles);
+    // -1 for a SKU never interned
+    int find(const std::string &sku) const;
+
+    int size() const { return _size.load(std::memory_order_acquire); }
+    bool valid(int handle) const { return handle >= 0 && handle < size(); }
+    // handle must be valid
+    const std::string& name(int handle) const;
+    void names(const std::vector<int> &handles, std::vector<std::string> &out) const;
+
+private:
+    SkuTable();
+    ~SkuTable();
+
+    int internLocked(const std::string &sku);
+
+    std::atomic<std::string*> _blocks[MAX_BLOCKS];
+    std::atomic<int> _size;
+    std::unordered_map<std::string, int> _handles;
+    mutable std::mutex _mutex;
+};
+
+} // namespace iap
+
+#endif /* IapSkuTable_h */
@@ -0,0 +1,443 @@
+#include "IapStats.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+namespace iap {
+
+const int LatencyHistogram::SUB_BUCKETS;
+const int LatencyHistogram::BUCKETS;
+const int Stats::SLOTS;
+
+static const std::memory_order relaxed = std::memory_order_relaxed;
+
+///////////////////////////////////////
+//
+//  Latency histogram
+//
+///////////////////////////////////////
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+int LatencyHistogram::bucketOf(uint64_t micros)
+{
+    if(micros < SUB_BUCKETS) {
+        return (int)micros;
+    }
+    if(micros > 0xffffffffu) {
+        return BUCKETS - 1;
+    }
+    int exponent = 31 - __builtin_clz((uint32_t)micros);
+    int sub = (int)(micros >> (exponent - 2)) & (SUB_BUCKETS - 1);
+    return (exponent - 1) * SUB_BUCKETS + sub;
+}
+
+// middle of the bucket's range
+uint64_t LatencyHistogram::bucketValue(int bucket)
+{
+    if(bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    int exponent = bucket / SUB_BUCKETS + 1;
+    int sub = bucket % SUB_BUCKETS;
+    uint64_t width = (uint64_t)1 << (exponent - 2);
+    return (uint64_t)(SUB_BUCKETS + sub) * width + width / 2;
+}
+
+void LatencyHistogram::record(uint64_t micros)
+{
+    _buckets[bucketOf(micros)].fetch_add(1, relaxed);
+    _count.fetch_add(1, relaxed);
+    _sum.fetch_add(micros, relaxed);
+    uint64_t max = _max.load(relaxed);
+    while(micros > max && !_max.compare_exchange_weak(max, micros, relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for(int i = 0; i < BUCKETS; i++)
+        _buckets[i].store(0, relaxed);
+    _count.store(0, relaxed);
+    _sum.store(0, relaxed);
+    _max.store(0, relaxed);
+}
+
+double LatencyHistogram::mean() const
+{
+    uint64_t count = _count.load(relaxed);
+    return count ? (double)_sum.load(relaxed) / count : 0.0;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    uint32_t counts[BUCKETS];
+    uint64_t total = 0;
+    for(int i = 0; i < BUCKETS; i++) {
+        counts[i] = _buckets[i].load(relaxed);
+        total += counts[i];
+    }
+    if(total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)std::ceil(p * total);
+    if(rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    for(int i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if(seen >= rank) {
+            uint64_t value = bucketValue(i);
+            uint64_t max = _max.load(relaxed);
+            return value < max ? value : max;
+        }
+    }
+    return _max.load(relaxed);
+}
+
+///////////////////////////////////////
+//
+//  Request statistics
+//
+///////////////////////////////////////
+
+Stats::Stats()
+{
+    for(Slot &slot : _slots) {
+        slot.id.store(0, relaxed);
+        slot.op.store(0, relaxed);
+        slot.counted.store(false, relaxed);
+        slot.begun.store(0, relaxed);
+        slot.sent.store(0, relaxed);
+        slot.crossed.store(0, relaxed);
+        slot.arrived.store(0, relaxed);
+        slot.mark.store(0, relaxed);
+    }
+    for(int op = 0; op < OP_COUNT; op++) {
+        _requests[op].store(0, relaxed);
+        _failed[op].store(0, relaxed);
+        _timedOut[op].store(0, relaxed);
+        _retries[op].store(0, relaxed);
+        _inFlight[op].store(0, relaxed);
+    }
+}
+
+Stats* Stats::getInstance()
+{
+    static Stats instance;
+    return &instance;
+}
+
+uint64_t Stats::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char* Stats::operationName(Operation op)
+{
+    static const char* names[OP_COUNT] = {
+        "init", "get_purchases", "buy", "consume", "available_products", "product_details", "restore"
+    };
+    return names[op];
+}
+
+const char* Stats::stageName(Stage stage)
+{
+    static const char* names[STAGE_COUNT] = {
+        "queue", "crossing", "store", "hop", "parse", "callback", "delivery", "total"
+    };
+    return names[stage];
+}
+
+// nullptr unless the slot currently belongs to requestId
+Stats::Slot* Stats::slotOf(int requestId)
+{
+    if(requestId == 0) {
+        return nullptr;
+    }
+    Slot &slot = requestId > 0 ? _slots[requestId & (SLOTS - 1)] : _slots[SLOTS + ((-requestId) & (SLOTS - 1))];
+    return slot.id.load(relaxed) == requestId ? &slot : nullptr;
+}
+
+void Stats::start(Slot &slot, int requestId, Operation op, bool counted)
+{
+    uint64_t t = now();
+    slot.op.store(op, relaxed);
+    slot.counted.store(counted, relaxed);
+    slot.begun.store(t, relaxed);
+    slot.sent.store(0, relaxed);
+    slot.crossed.store(0, relaxed);
+    slot.arrived.store(0, relaxed);
+    slot.mark.store(0, relaxed);
+    slot.id.store(requestId, std::memory_order_release);
+    if(counted) {
+        _requests[op].fetch_add(1, relaxed);
+        _inFlight[op].fetch_add(1, relaxed);
+    }
+}
+
+void Stats::record(const Slot &slot, Stage stage, uint64_t micros)
+{
+    _histograms[slot.op.load(relaxed)][stage].record(micros);
+}
+
+void Stats::begin(int requestId, Operation op)
+{
+    if(requestId <= 0) {
+        return;
+    }
+    start(_slots[requestId & (SLOTS - 1)], requestId, op, true);
+}
+
+void Stats::sent(int requestId, Operation op)
+{
+    Slot *slot = slotOf(requestId);
+    uint64_t t = now();
+    if(slot) {
+        record(*slot, STAGE_QUEUE, t - slot->begun.load(relaxed));
+    } else if(requestId < 0) {
+        slot = &_slots[SLOTS + ((-requestId) & (SLOTS - 1))];
+        start(*slot, requestId, op, false);
+    } else {
+        return;
+    }
+    slot->sent.store(t, relaxed);
+}
+
+void Stats::crossed(int requestId)
+{
+    Slot *slot = slotOf(requestId);
+    if(slot && slot->sent.load(relaxed)) {
+        slot->crossed.store(now(), relaxed);
+    }
+}
+
+void Stats::arrived(int requestId)
+{
+    Slot *slot = slotOf(requestId);
+    if(slot && !slot->arrived.load(relaxed)) {
+        slot->arrived.store(now(), relaxed);
+    }
+}
+
+void Stats::answered(int requestId)
+{
+    Slot *slot = slotOf(requestId);
+    if(!slot) {
+        return;
+    }
+    uint64_t t = now();
+    uint64_t sent = slot->sent.load(relaxed);
+    uint64_t crossed = slot->crossed.load(relaxed);
+    uint64_t arrived = slot->arrived.load(relaxed);
+    if(!arrived) {
+        arrived = t;
+        slot->arrived.store(t, relaxed);
+    }
+    // answered from inside the call (early errors) has no store time to speak of
+    if(sent && crossed && arrived >= crossed) {
+        record(*slot, STAGE_CROSSING, (crossed - sent) + (t - arrived));
+        record(*slot, STAGE_STORE, arrived - crossed);
+    }
+    if(requestId < 0) {
+        // nobody on the JS side waits for the core's own requests
+        slot->id.store(0, relaxed);
+    }
+}
+
+void Stats::queued(int requestId)
+{
+    Slot *slot = slotOf(requestId);
+    if(slot) {
+        slot->mark.store(now(), relaxed);
+    }
+}
+
+void Stats::dequeued(int requestId)
+{
+    Slot *slot = slotOf(requestId);
+    uint64_t mark = slot ? slot->mark.load(relaxed) : 0;
+    if(mark) {
+        uint64_t t = now();
+        record(*slot, STAGE_HOP, t - mark);
+        slot->mark.store(t, relaxed);
+    }
+}
+
+void Stats::parsed(int requestId)
+{
+    Slot *slot = slotOf(requestId);
+    uint64_t mark = slot ? slot->mark.load(relaxed) : 0;
+    if(mark) {
+        uint64_t t = now();
+        record(*slot, STAGE_PARSE, t - mark);
+        slot->mark.store(t, relaxed);
+    }
+}
+
+void Stats::finish(int requestId, bool failed)
+{
+    Slot *slot = slotOf(requestId);
+    if(!slot) {
+        return;
+    }
+    uint64_t t = now();
+    uint64_t mark = slot->mark.load(relaxed);
+    uint64_t arrived = slot->arrived.load(relaxed);
+    if(mark) {
+        record(*slot, STAGE_CALLBACK, t - mark);
+        if(arrived)
+            record(*slot, STAGE_DELIVERY, t - arrived);
+        record(*slot, STAGE_TOTAL, t - slot->begun.load(relaxed));
+    }
+    int op = slot->op.load(relaxed);
+    if(slot->counted.load(relaxed)) {
+        _inFlight[op].fetch_sub(1, relaxed);
+        if(failed)
+            _failed[op].fetch_add(1, relaxed);
+    }
+    slot->id.store(0, relaxed);
+}
+
+void Stats::timedOut(int requestId)
+{
+    Slot *slot = slotOf(requestId);
+    if(slot && slot->counted.load(relaxed)) {
+        _timedOut[slot->op.load(relaxed)].fetch_add(1, relaxed);
+    }
+}
+
+void Stats::retried(int requestId)
+{
+    Slot *slot = slotOf(requestId);
+    if(slot && slot->counted.load(relaxed)) {
+        _retries[slot->op.load(relaxed)].fetch_add(1, relaxed);
+    }
+}
+
+std::string Stats::snapshotJson() const
+{
+    std::string json = "{";
+    char buffer[256];
+    for(int op = 0; op < OP_COUNT; op++) {
+        snprintf(buffer, sizeof(buffer), "%s\"%s\":{\"requests\":%llu,\"failed\":%llu,\"timed_out\":%llu,\"retries\":%llu,\"in_flight\":%d",
+                 op ? "," : "", operationName((Operation)op),
+                 (unsigned long long)requests((Operation)op), (unsigned long long)failed((Operation)op),
+                 (unsigned long long)timedOut((Operation)op), (unsigned long long)retries((Operation)op), inFlight((Operation)op));
+        json += buffer;
+        for(int stage = 0; stage < STAGE_COUNT; stage++) {
+            const LatencyHistogram &h = _histograms[op][stage];
+            snprintf(buffer, sizeof(buffer), ",\"%s\":{\"count\":%llu,\"mean\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f}",
+                     stageName((Stage)stage), (unsigned long long)h.count(), h.mean() / 1000.0,
+                     h.percentile(0.5) / 1000.0, h.percentile(0.9) / 1000.0, h.percentile(0.99) / 1000.0, h.max() / 1000.0);
+            json += buffer;
+        }
+        json += "}";
+    }
+    json += "}";
+    return json;
+}
+
+void Stats::reset()
+{
+    for(int op = 0; op < OP_COUNT; op++) {
+        for(int stage = 0; stage < STAGE_COUNT; stage++)
+            _histograms[op][stage].reset();
+        _requests[op].store(0, relaxed);
+        _failed[op].store(0, relaxed);
+        _timedOut[op].store(0, relaxed);
+        _retries[op].store(0, relaxed);
+    }
+}
+
+///////////////////////////////////////
+//
+//  Timed backend
+//
+///////////////////////////////////////
+
+bool TimedBackend::init(const std::vector<std::string> &skus, bool internalValidation, int requestId)
+{
+    Stats *stats = Stats::getInstance();
+    stats->sent(requestId, Stats::OP_INIT);
+    bool ok = _backend->init(skus, internalValidation, requestId);
+    stats->crossed(requestId);
+    return ok;
+}
+
+bool TimedBackend::getPurchases(int requestId)
+{
+    Stats *stats = Stats::getInstance();
+    stats->sent(requestId, Stats::OP_GET_PURCHASES);
+    bool ok = _backend->getPurchases(requestId);
+    stats->crossed(requestId);
+    return ok;
+}
+
+bool TimedBackend::buy(const std::string &sku, const std::string &payload, int requestId)
+{
+    Stats *stats = Stats::getInstance();
+    stats->sent(requestId, Stats::OP_BUY);
+    bool ok = _backend->buy(sku, payload, requestId);
+    stats->crossed(requestId);
+    return ok;
+}
+
+bool TimedBackend::subscribe(const std::string &sku, const std::string &payload, const std::vector<std::string> &oldSkus, int requestId)
+{
+    Stats *stats = Stats::getInstance();
+    stats->sent(requestId, Stats::OP_BUY);
+    bool ok = _backend->subscribe(sku, payload, oldSkus, requestId);
+    stats->crossed(requestId);
+    return ok;
+}
+
+bool TimedBackend::consume(const std::string &sku, int requestId)
+{
+    Stats *stats = Stats::getInstance();
+    stats->sent(requestId, Stats::OP_CONSUME);
+    bool ok = _backend->consume(sku, requestId);
+    stats->crossed(requestId);
+    return ok;
+}
+
+bool TimedBackend::consumeMany(const std::vector<std::string> &skus, int requestId)
+{
+    Stats *stats = Stats::getInstance();
+    stats->sent(requestId, Stats::OP_CONSUME);
+    bool ok = _backend->consumeMany(skus, requestId);
+    stats->crossed(requestId);
+    return ok;
+}
+
+bool TimedBackend::availableProducts(int requestId)
+{
+    Stats *stats = Stats::getInstance();
+    stats->sent(requestId, Stats::OP_AVAILABLE_PRODUCTS);
+    bool ok = _backend->availableProducts(requestId);
+    stats->crossed(requestId);
+    return ok;
+}
+
+bool TimedBackend::productDetails(const std::vector<int> &skus, int requestId)
+{
+    Stats *stats = Stats::getInstance();
+    stats->sent(requestId, Stats::OP_PRODUCT_DETAILS);
+    bool ok = _backend->productDetails(skus, requestId);
+    stats->crossed(requestId);
+    return ok;
+}
+
+bool TimedBackend::restore(int requestId)
+{
+    Stats *stats = Stats::getInstance();
+    stats->sent(requestId, Stats::OP_RESTORE);
+    bool ok = _backend->restore(requestId);
+    stats->crossed(requestId);
+    return ok;
+}
+
+} // namespace iap
@@ -0,0 +1,207 @@
+#ifndef IapStats_h
+#define IapStats_h
+
+#include "IapBackend.h"
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Latency histogram
+//
+///////////////////////////////////////
+
+// Log-linear histogram of microseconds: four buckets per power of two, so
+// a reported percentile is within 12% of the true value. Recording is a few
+// relaxed atomic adds, safe from any thread; reads are a snapshot that may
+// be slightly torn while other threads record.
+class LatencyHistogram
+{
+public:
+    static const int SUB_BUCKETS = 4;
+    // up to 2^32 us, about 71 minutes; longer samples land in the last bucket
+    static const int BUCKETS = 32 * SUB_BUCKETS;
+
+    LatencyHistogram();
+
+    void record(uint64_t micros);
+    void reset();
+
+    uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+    uint64_t max() const { return _max.load(std::memory_order_relaxed); }
+    double mean() const;
+    // p in [0, 1]
+    uint64_t percentile(double p) const;
+
+private:
+    static int bucketOf(uint64_t micros);
+    static uint64_t bucketValue(int bucket);
+
+    std::atomic<uint32_t> _buckets[BUCKETS];
+    std::atomic<uint64_t> _count;
+    std::atomic<uint64_t> _sum;
+    std::atomic<uint64_t> _max;
+};
+
+///////////////////////////////////////
+//
+//  Request statistics
+//
+///////////////////////////////////////
+
+// Where the time goes between a JS call and its callback, per operation and
+// stage. Each layer stamps the request as it passes; the stamps live in a
+// fixed table indexed by request id (callback pool ids map to distinct
+// slots), so nothing is locked or allocated on the request path. Stamps for
+// ids that were never begun are ignored.
+//
+// Stages:
+//   queue     JS call until the store call starts (waiting in the Scheduler)
+//   crossing  the JNI / Objective-C call into the store and the callback out
+//   store     between the two crossings
+//   hop       result handed to the cocos thread until picked up there
+//   parse     JSON or records turned into JS values
+//   callback  the JS callback itself
+//   delivery  store completion until the callback returned: the native
+//             path out of the store, the lane wait, hop, parse and callback
+//   total     JS call until the callback returned
+//
+// Requests the core issues itself (background refreshes, merged
+// product_details queries) add to crossing and store only.
+class Stats
+{
+public:
+    enum Operation
+    {
+        OP_INIT,
+        OP_GET_PURCHASES,
+        OP_BUY,             // subscribe included
+        OP_CONSUME,         // consume_many batches count once
+        OP_AVAILABLE_PRODUCTS,
+        OP_PRODUCT_DETAILS,
+        OP_RESTORE,
+        OP_COUNT
+    };
+
+    enum Stage
+    {
+        STAGE_QUEUE,
+        STAGE_CROSSING,
+        STAGE_STORE,
+        STAGE_HOP,
+        STAGE_PARSE,
+        STAGE_CALLBACK,
+        STAGE_DELIVERY,
+        STAGE_TOTAL,
+        STAGE_COUNT
+    };
+
+    static const int SLOTS = 1024;
+
+    static Stats* getInstance();
+
+    // steady clock, microseconds
+    static uint64_t now();
+
+    static const char* operationName(Operation op);
+    static const char* stageName(Stage stage);
+
+    // a JS request starts
+    void begin(int requestId, Operation op);
+    // around the backend call; sent() begins requests the core issued itself
+    void sent(int requestId, Operation op);
+    void crossed(int requestId);
+    // platform callback entered, before its arguments are converted
+    void arrived(int requestId);
+    // the result reached Billing
+    void answered(int requestId);
+    // handed to the cocos thread, picked up there, converted to JS values
+    void queued(int requestId);
+    void dequeued(int requestId);
+    void parsed(int requestId);
+    // the callback returned, or the request was rejected before reaching it
+    void finish(int requestId, bool failed);
+    // Billing gave up waiting for the store, or asked it again
+    void timedOut(int requestId);
+    void retried(int requestId);
+
+    const LatencyHistogram& histogram(Operation op, Stage stage) const { return _histograms[op][stage]; }
+    uint64_t requests(Operation op) const { return _requests[op].load(std::memory_order_relaxed); }
+    uint64_t failed(Operation op) const { return _failed[op].load(std::memory_order_relaxed); }
+    uint64_t timedOut(Operation op) const { return _timedOut[op].load(std::memory_order_relaxed); }
+    uint64_t retries(Operation op) const { return _retries[op].load(std::memory_order_relaxed); }
+    int inFlight(Operation op) const { return _inFlight[op].load(std::memory_order_relaxed); }
+
+    // {"buy":{"requests":..,"failed":..,"timed_out":..,"retries":..,"in_flight":..,
+    // "total":{"count":..,"mean":..,"p50":..,"p90":..,"p99":..,"max":..},...},...},
+    // times in ms
+    std::string snapshotJson() const;
+    // clears histograms and counters; in-flight requests are kept
+    void reset();
+
+private:
+    struct Slot
+    {
+        std::atomic<int> id;
+        std::atomic<int> op;
+        std::atomic<bool> counted;
+        std::atomic<uint64_t> begun;
+        std::atomic<uint64_t> sent;
+        std::atomic<uint64_t> crossed;
+        std::atomic<uint64_t> arrived;
+        std::atomic<uint64_t> mark;
+    };
+
+    Stats();
+
+    Slot* slotOf(int requestId);
+    void start(Slot &slot, int requestId, Operation op, bool counted);
+    void record(const Slot &slot, Stage stage, uint64_t micros);
+
+    // positive ids first, internal (negative) ids in the upper half
+    Slot _slots[SLOTS * 2];
+    LatencyHistogram _histograms[OP_COUNT][STAGE_COUNT];
+    std::atomic<uint64_t> _requests[OP_COUNT];
+    std::atomic<uint64_t> _failed[OP_COUNT];
+    std::atomic<uint64_t> _timedOut[OP_COUNT];
+    std::atomic<uint64_t> _retries[OP_COUNT];
+    std::atomic<int> _inFlight[OP_COUNT];
+};
+
+///////////////////////////////////////
+//
+//  Timed backend
+//
+///////////////////////////////////////
+
+// Stamps every store call for Stats on its way into the backend. Billing
+// puts it in front of the real backend, which it does not own.
+class TimedBackend : public Backend
+{
+public:
+    explicit TimedBackend(Backend *backend) : _backend(backend) {}
+
+    virtual bool init(const std::vector<std::string> &skus, bool internalValidation, int requestId) override;
+    virtual bool getPurchases(int requestId) override;
+    virtual bool buy(const std::string &sku, const std::string &payload, int requestId) override;
+    virtual bool subscribe(const std::string &sku, const std::string &payload, const std::vector<std::string> &oldSkus, int requestId) override;
+    virtual bool consume(const std::string &sku, int requestId) override;
+    virtual bool consumeMany(const std::vector<std::string> &skus, int requestId) override;
+    virtual bool availableProducts(int requestId) override;
+    virtual bool productDetails(const std::vector<int> &skus, int requestId) override;
+    virtual bool restore(int requestId) override;
+    virtual bool setDebug(bool debug) override { return _backend->setDebug(debug); }
+    virtual bool hasFlatProductDetails() const override { return _backend->hasFlatProductDetails(); }
+    virtual bool restoreListsPurchases() const override { return _backend->restoreListsPurchases(); }
+    virtual bool setBinaryResults(bool enabled) override { return _backend->setBinaryResults(enabled); }
+
+private:
+    Backend *_backend;
+};
+
+} // namespace iap
+
+#endif /* IapStats_h */
@@ -0,0 +1,54 @@
+#include "IapTimerWheel.h"
+
+namespace iap {
+
+TimerWheel::TimerWheel(uint64_t nowMicros)
+: _tick(nowMicros / TICK_MICROS)
+{
+}
+
+void TimerWheel::schedule(int id, uint64_t dueMicros)
+{
+    // rounded up, and never into a tick that was already swept
+    uint64_t tick = (dueMicros + TICK_MICROS - 1) / TICK_MICROS;
+    if(tick <= _tick)
+        tick = _tick + 1;
+    _due[id] = tick;
+    _slots[tick % SLOTS].push_back(Entry{ id, tick });
+}
+
+bool TimerWheel::cancel(int id)
+{
+    return _due.erase(id) != 0;
+}
+
+void TimerWheel::advance(uint64_t nowMicros, std::vector<int> &expired)
+{
+    uint64_t target = nowMicros / TICK_MICROS;
+    if(target <= _tick) {
+        return;
+    }
+    // after a long stall every slot is swept once
+    uint64_t ticks = target - _tick < (uint64_t)SLOTS ? target - _tick : (uint64_t)SLOTS;
+    for(uint64_t t = _tick + 1; t <= _tick + ticks; t++) {
+        std::vector<Entry> &slot = _slots[t % SLOTS];
+        size_t kept = 0;
+        for(size_t i = 0; i < slot.size(); i++) {
+            Entry entry = slot[i];
+            auto it = _due.find(entry.id);
+            if(it == _due.end() || it->second != entry.tick) {
+                continue;   // cancelled or re-armed
+            }
+            if(entry.tick <= target) {
+                _due.erase(it);
+                expired.push_back(entry.id);
+                continue;
+            }
+            slot[kept++] = entry;
+        }
+        slot.resize(kept);
+    }
+    _tick = target;
+}
+
+} // namespace iap
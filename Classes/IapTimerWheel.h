@@ -0,0 +1,54 @@
+#ifndef IapTimerWheel_h
+#define IapTimerWheel_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace iap {
+
+///////////////////////////////////////
+//
+//  Timer wheel
+//
+///////////////////////////////////////
+
+// Hashed timing wheel for request deadlines: one timer per id, armed and
+// disarmed in O(1), and advancing sweeps only the slots of the ticks that
+// passed. Timers further out than one revolution stay in their slot until
+// their tick comes round. Re-arming or cancelling leaves the old entry in
+// its slot, it is dropped when the slot is swept. Not thread safe.
+class TimerWheel
+{
+public:
+    static const int SLOTS = 512;
+    static const uint64_t TICK_MICROS = 10000;
+
+    explicit TimerWheel(uint64_t nowMicros = 0);
+
+    // (re)arms the timer of id; it fires on the first advance at or after due
+    void schedule(int id, uint64_t dueMicros);
+    // false when id had no timer
+    bool cancel(int id);
+    bool scheduled(int id) const { return _due.count(id) != 0; }
+    size_t size() const { return _due.size(); }
+
+    // appends the ids whose timers fired, each disarmed, in no particular order
+    void advance(uint64_t nowMicros, std::vector<int> &expired);
+
+private:
+    struct Entry
+    {
+        int id;
+        uint64_t tick;
+    };
+
+    std::vector<Entry> _slots[SLOTS];
+    std::unordered_map<int, uint64_t> _due;     // id to the tick of its live entry
+    uint64_t _tick;                             // last tick swept
+};
+
+} // namespace iap
+
+#endif /* IapTimerWheel_h */
@@ -0,0 +1,715 @@
+#include "IapTrace.h"
+#include "IapBilling.h"
+#include "IapSkuTable.h"
+#include "IapStats.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+
+namespace iap {
+
+static const char TRACE_MAGIC[4] = { 'I', 'A', 'P', 'T' };
+static const uint32_t TRACE_VERSION = 1;
+
+const size_t TraceWriter::BUFFER_SIZE;
+const std::vector<std::string> TraceWriter::NO_ARGS;
+
+enum TraceFlags
+{
+    TRACE_FLAG = 1,         // TraceEntry::flag
+    TRACE_WIDE_JSON = 2,    // payload is UTF-16, not one byte per character
+    TRACE_RECORDS = 4       // payload is binary records
+};
+
+struct TraceFileHeader
+{
+    char magic[4];
+    uint32_t version;
+};
+
+// entry: TraceRecordHeader, args (uint16_t length + bytes each), error, payload
+struct TraceRecordHeader
+{
+    uint8_t kind;
+    uint8_t call;
+    uint8_t flags;
+    uint8_t reserved;
+    int32_t requestId;
+    uint64_t micros;
+    uint32_t argCount;
+    uint32_t errorLength;
+    uint32_t payloadLength;     // JSON characters or record bytes
+    uint32_t reserved2;
+};
+
+const char* TraceEntry::callName(Call call)
+{
+    static const char *NAMES[CALL_COUNT] = {
+        "init", "get_purchases", "buy", "subscribe", "consume", "consume_many",
+        "available_products", "product_details", "restore"
+    };
+    return call < CALL_COUNT ? NAMES[call] : "unknown";
+}
+
+///////////////////////////////////////
+//
+//  Trace writer
+//
+///////////////////////////////////////
+
+TraceWriter::TraceWriter()
+: _file(nullptr)
+, _start(0)
+, _recording(false)
+{
+}
+
+TraceWriter::~TraceWriter()
+{
+    close();
+}
+
+bool TraceWriter::open(const std::string &path)
+{
+    close();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _file = fopen(path.c_str(), "wb");
+    if(!_file) {
+        return false;
+    }
+    TraceFileHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    _buffer.clear();
+    _buffer.reserve(BUFFER_SIZE);
+    _buffer.insert(_buffer.end(), (const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+    _start = Stats::now();
+    _recording.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void TraceWriter::close()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _recording.store(false, std::memory_order_relaxed);
+    if(!_file) {
+        return;
+    }
+    fwrite(_buffer.data(), 1, _buffer.size(), _file);
+    fclose(_file);
+    _file = nullptr;
+    _buffer.clear();
+    _buffer.shrink_to_fit();
+}
+
+void TraceWriter::request(TraceEntry::Call call, int requestId, const std::vector<std::string> &args, bool flag)
+{
+    append(TraceEntry::KIND_REQUEST, call, flag, requestId, &args, nullptr, nullptr, nullptr);
+}
+
+void TraceWriter::call(TraceEntry::Call call, int requestId, const std::vector<std::string> &args, bool flag)
+{
+    append(TraceEntry::KIND_CALL, call, flag, requestId, &args, nullptr, nullptr, nullptr);
+}
+
+void TraceWriter::rejected(int requestId)
+{
+    append(TraceEntry::KIND_REJECTED, 0, false, requestId, nullptr, nullptr, nullptr, nullptr);
+}
+
+void TraceWriter::result(int requestId, const std::string &error, const std::u16string &json)
+{
+    append(TraceEntry::KIND_RESULT, 0, false, requestId, nullptr, &error, &json, nullptr);
+}
+
+void TraceWriter::records(int requestId, const std::vector<uint8_t> &records)
+{
+    append(TraceEntry::KIND_RESULT, 0, false, requestId, nullptr, nullptr, nullptr, &records);
+}
+
+void TraceWriter::purchases(const std::u16string &json, bool complete)
+{
+    append(TraceEntry::KIND_PURCHASES, 0, complete, 0, nullptr, nullptr, &json, nullptr);
+}
+
+void TraceWriter::products(const std::u16string &json)
+{
+    append(TraceEntry::KIND_PRODUCTS, 0, false, 0, nullptr, nullptr, &json, nullptr);
+}
+
+static void appendBytes(std::vector<uint8_t> &out, const void *data, size_t size)
+{
+    const uint8_t *bytes = static_cast<const uint8_t*>(data);
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+void TraceWriter::append(uint8_t kind, uint8_t call, bool flag, int requestId, const std::vector<std::string> *args,
+                         const std::string *error, const std::u16string *json, const std::vector<uint8_t> *records)
+{
+    if(!recording()) {
+        return;
+    }
+    bool wide = false;
+    if(json) {
+        for(char16_t c : *json) {
+            if(c >= 0x80) {
+                wide = true;
+                break;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(!_file) {
+        return;
+    }
+    TraceRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.kind = kind;
+    header.call = call;
+    header.flags = (flag ? TRACE_FLAG : 0) | (wide ? TRACE_WIDE_JSON : 0) | (records ? TRACE_RECORDS : 0);
+    header.requestId = requestId;
+    header.micros = Stats::now() - _start;
+    header.argCount = args ? (uint32_t)args->size() : 0;
+    header.errorLength = error ? (uint32_t)error->size() : 0;
+    header.payloadLength = records ? (uint32_t)records->size() : json ? (uint32_t)json->size() : 0;
+    appendBytes(_buffer, &header, sizeof(header));
+
+    if(args) {
+        for(const std::string &arg : *args) {
+            uint16_t length = (uint16_t)std::min<size_t>(arg.size(), 0xffff);
+            appendBytes(_buffer, &length, sizeof(length));
+            appendBytes(_buffer, arg.data(), length);
+        }
+    }
+    if(error) {
+        appendBytes(_buffer, error->data(), error->size());
+    }
+    if(records) {
+        appendBytes(_buffer, records->data(), records->size());
+    } else if(json && wide) {
+        appendBytes(_buffer, json->data(), json->size() * sizeof(char16_t));
+    } else if(json) {
+        size_t at = _buffer.size();
+        _buffer.resize(at + json->size());
+        for(size_t i = 0; i < json->size(); i++) {
+            _buffer[at + i] = (uint8_t)(*json)[i];
+        }
+    }
+
+    if(_buffer.size() >= BUFFER_SIZE) {
+        fwrite(_buffer.data(), 1, _buffer.size(), _file);
+        _buffer.clear();
+    }
+}
+
+bool readTrace(const std::string &path, std::vector<TraceEntry> &entries)
+{
+    entries.clear();
+    FILE *f = fopen(path.c_str(), "rb");
+    if(!f) {
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[64 * 1024];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    fclose(f);
+
+    TraceFileHeader fileHeader;
+    if(data.size() < sizeof(fileHeader)) {
+        return false;
+    }
+    memcpy(&fileHeader, data.data(), sizeof(fileHeader));
+    if(memcmp(fileHeader.magic, TRACE_MAGIC, sizeof(fileHeader.magic)) != 0 || fileHeader.version != TRACE_VERSION) {
+        return false;
+    }
+
+    const uint8_t *p = data.data() + sizeof(fileHeader);
+    const uint8_t *end = data.data() + data.size();
+    while((size_t)(end - p) >= sizeof(TraceRecordHeader)) {
+        TraceRecordHeader header;
+        memcpy(&header, p, sizeof(header));
+        const uint8_t *q = p + sizeof(header);
+        TraceEntry entry;
+        entry.kind = header.kind;
+        entry.call = header.call;
+        entry.flag = (header.flags & TRACE_FLAG) != 0;
+        entry.requestId = header.requestId;
+        entry.micros = header.micros;
+
+        // each argument takes at least its length: a count the rest of the
+        // file can't hold is a torn or corrupt record, not an allocation size
+        if(header.argCount > (size_t)(end - q) / sizeof(uint16_t)) {
+            break;
+        }
+        bool torn = false;
+        entry.args.reserve(header.argCount);
+        for(uint32_t i = 0; i < header.argCount && !torn; i++) {
+            uint16_t length;
+            if((size_t)(end - q) < sizeof(length)) {
+                torn = true;
+                break;
+            }
+            memcpy(&length, q, sizeof(length));
+            q += sizeof(length);
+            if((size_t)(end - q) < length) {
+                torn = true;
+                break;
+            }
+            entry.args.emplace_back((const char*)q, length);
+            q += length;
+        }
+        uint64_t payloadBytes = header.payloadLength;
+        if(!(header.flags & TRACE_RECORDS) && (header.flags & TRACE_WIDE_JSON))
+            payloadBytes *= sizeof(char16_t);
+        if(torn || (uint64_t)(end - q) < (uint64_t)header.errorLength + payloadBytes) {
+            break;
+        }
+        entry.error.assign((const char*)q, header.errorLength);
+        q += header.errorLength;
+        if(header.flags & TRACE_RECORDS) {
+            entry.records.assign(q, q + payloadBytes);
+        } else if(header.flags & TRACE_WIDE_JSON) {
+            entry.json.resize(header.payloadLength);
+            memcpy(&entry.json[0], q, payloadBytes);
+        } else {
+            entry.json.assign(q, q + payloadBytes);
+        }
+        q += payloadBytes;
+        entries.push_back(std::move(entry));
+        p = q;
+    }
+    return true;
+}
+
+///////////////////////////////////////
+//
+//  Tracing backend
+//
+///////////////////////////////////////
+
+bool TracingBackend::traced(bool accepted, int requestId)
+{
+    if(!accepted)
+        _trace->rejected(requestId);
+    return accepted;
+}
+
+bool TracingBackend::init(const std::vector<std::string> &skus, bool internalValidation, int requestId)
+{
+    _trace->call(TraceEntry::CALL_INIT, requestId, skus, internalValidation);
+    return traced(_backend->init(skus, internalValidation, requestId), requestId);
+}
+
+bool TracingBackend::getPurchases(int requestId)
+{
+    _trace->call(TraceEntry::CALL_GET_PURCHASES, requestId);
+    return traced(_backend->getPurchases(requestId), requestId);
+}
+
+bool TracingBackend::buy(const std::string &sku, const std::string &payload, int requestId)
+{
+    if(_trace->recording())
+        _trace->call(TraceEntry::CALL_BUY, requestId, std::vector<std::string>{ sku, payload });
+    return traced(_backend->buy(sku, payload, requestId), requestId);
+}
+
+bool TracingBackend::subscribe(const std::string &sku, const std::string &payload, const std::vector<std::string> &oldSkus, int requestId)
+{
+    if(_trace->recording()) {
+        std::vector<std::string> args{ sku, payload };
+        args.insert(args.end(), oldSkus.begin(), oldSkus.end());
+        _trace->call(TraceEntry::CALL_SUBSCRIBE, requestId, args);
+    }
+    return traced(_backend->subscribe(sku, payload, oldSkus, requestId), requestId);
+}
+
+bool TracingBackend::consume(const std::string &sku, int requestId)
+{
+    if(_trace->recording())
+        _trace->call(TraceEntry::CALL_CONSUME, requestId, std::vector<std::string>{ sku });
+    return traced(_backend->consume(sku, requestId), requestId);
+}
+
+bool TracingBackend::consumeMany(const std::vector<std::string> &skus, int requestId)
+{
+    _trace->call(TraceEntry::CALL_CONSUME_MANY, requestId, skus);
+    return traced(_backend->consumeMany(skus, requestId), requestId);
+}
+
+bool TracingBackend::availableProducts(int requestId)
+{
+    _trace->call(TraceEntry::CALL_AVAILABLE_PRODUCTS, requestId);
+    return traced(_backend->availableProducts(requestId), requestId);
+}
+
+bool TracingBackend::productDetails(const std::vector<int> &skus, int requestId)
+{
+    if(_trace->recording()) {
+        std::vector<std::string> names;
+        SkuTable::getInstance()->names(skus, names);
+        _trace->call(TraceEntry::CALL_PRODUCT_DETAILS, requestId, names);
+    }
+    return traced(_backend->productDetails(skus, requestId), requestId);
+}
+
+bool TracingBackend::restore(int requestId)
+{
+    _trace->call(TraceEntry::CALL_RESTORE, requestId);
+    return traced(_backend->restore(requestId), requestId);
+}
+
+///////////////////////////////////////
+//
+//  Replay store
+//
+///////////////////////////////////////
+
+// Answers store calls from the trace on a worker thread; the scheduling
+// follows SimulatedStore.
+class TraceReplay::Store : public Backend
+{
+public:
+    Store(std::shared_ptr<const std::vector<TraceEntry> > entries, double speed, Billing *billing)
+    : _entries(std::move(entries))
+    , _speed(speed)
+    , _billing(billing)
+    , _answers(_entries->size(), -1)
+    , _rejected(_entries->size(), false)
+    , _calls(0)
+    , _unmatched(0)
+    , _taskSeq(0)
+    , _running(0)
+    , _stop(false)
+    {
+        // pair every recorded call with what came back for it
+        std::unordered_map<int, size_t> waiting;
+        for(size_t i = 0; i < _entries->size(); i++) {
+            const TraceEntry &entry = (*_entries)[i];
+            switch(entry.kind) {
+            case TraceEntry::KIND_CALL:
+                if(entry.call < TraceEntry::CALL_COUNT) {
+                    _recorded[entry.call].push_back(i);
+                    waiting[entry.requestId] = i;
+                }
+                break;
+            case TraceEntry::KIND_REJECTED:
+            case TraceEntry::KIND_RESULT: {
+                auto it = waiting.find(entry.requestId);
+                if(it != waiting.end()) {
+                    if(entry.kind == TraceEntry::KIND_REJECTED)
+                        _rejected[it->second] = true;
+                    else
+                        _answers[it->second] = (int)i;
+                    waiting.erase(it);
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
+        _thread = std::thread(&Store::worker, this);
+    }
+
+    virtual ~Store()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wakeup.notify_all();
+        if(_thread.joinable())
+            _thread.join();
+    }
+
+    virtual bool init(const std::vector<std::string>&, bool, int requestId) override { return answer(TraceEntry::CALL_INIT, requestId); }
+    virtual bool getPurchases(int requestId) override { return answer(TraceEntry::CALL_GET_PURCHASES, requestId); }
+    virtual bool buy(const std::string&, const std::string&, int requestId) override { return answer(TraceEntry::CALL_BUY, requestId); }
+    virtual bool subscribe(const std::string&, const std::string&, const std::vector<std::string>&, int requestId) override { return answer(TraceEntry::CALL_SUBSCRIBE, requestId); }
+    virtual bool consume(const std::string&, int requestId) override { return answer(TraceEntry::CALL_CONSUME, requestId); }
+    virtual bool consumeMany(const std::vector<std::string>&, int requestId) override { return answer(TraceEntry::CALL_CONSUME_MANY, requestId); }
+    virtual bool availableProducts(int requestId) override { return answer(TraceEntry::CALL_AVAILABLE_PRODUCTS, requestId); }
+    virtual bool productDetails(const std::vector<int>&, int requestId) override { return answer(TraceEntry::CALL_PRODUCT_DETAILS, requestId); }
+    virtual bool restore(int requestId) override { return answer(TraceEntry::CALL_RESTORE, requestId); }
+    virtual bool setDebug(bool) override { return true; }
+    // recorded answers are replayed in whichever encoding they had
+    virtual bool setBinaryResults(bool) override { return true; }
+
+    // store pushes, at their recorded times from now
+    void schedulePushes()
+    {
+        uint64_t now = Stats::now();
+        for(size_t i = 0; i < _entries->size(); i++) {
+            const TraceEntry &entry = (*_entries)[i];
+            if(entry.kind != TraceEntry::KIND_PURCHASES && entry.kind != TraceEntry::KIND_PRODUCTS) {
+                continue;
+            }
+            schedule(now + scaled(entry.micros), [this, i] {
+                    const TraceEntry &push = (*_entries)[i];
+                    if(push.kind == TraceEntry::KIND_PURCHASES)
+                        _billing->purchasesUpdated(push.json, push.flag);
+                    else
+                        _billing->productsUpdated(push.json);
+                });
+        }
+    }
+
+    bool idle()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _tasks.empty() && _running == 0;
+    }
+
+    size_t calls()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _calls;
+    }
+
+    size_t unmatched()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _unmatched;
+    }
+
+private:
+    struct Task
+    {
+        uint64_t due;
+        unsigned long long seq;
+        std::function<void()> run;
+        bool operator<(const Task &other) const {
+            // std::priority_queue is a max-heap
+            return due != other.due ? due > other.due : seq > other.seq;
+        }
+    };
+
+    uint64_t scaled(uint64_t micros) const
+    {
+        return _speed > 0 ? (uint64_t)(micros / _speed) : 0;
+    }
+
+    bool answer(TraceEntry::Call call, int requestId)
+    {
+        std::deque<size_t> *recorded;
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _calls++;
+            recorded = &_recorded[call];
+            if(recorded->empty()) {
+                _unmatched++;
+                index = _entries->size();
+            } else {
+                index = recorded->front();
+                recorded->pop_front();
+            }
+        }
+        if(index == _entries->size()) {
+            schedule(Stats::now(), [this, requestId] {
+                    _billing->requestResult(requestId, "Not in trace", std::u16string());
+                });
+            return true;
+        }
+        if(_rejected[index]) {
+            return false;
+        }
+        int answer = _answers[index];
+        if(answer < 0) {
+            // never answered while recording
+            return true;
+        }
+        uint64_t latency = (*_entries)[answer].micros - (*_entries)[index].micros;
+        schedule(Stats::now() + scaled(latency), [this, answer, requestId] {
+                const TraceEntry &result = (*_entries)[answer];
+                if(!result.records.empty())
+                    _billing->requestRecords(requestId, result.records);
+                else
+                    _billing->requestResult(requestId, result.error, result.json);
+            });
+        return true;
+    }
+
+    void schedule(uint64_t due, std::function<void()> run)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            Task task;
+            task.due = due;
+            task.seq = _taskSeq++;
+            task.run = std::move(run);
+            _tasks.push(std::move(task));
+        }
+        _wakeup.notify_one();
+    }
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while(!_stop) {
+            if(_tasks.empty()) {
+                _wakeup.wait(lock);
+                continue;
+            }
+            uint64_t now = Stats::now();
+            uint64_t due = _tasks.top().due;
+            if(now < due) {
+                _wakeup.wait_for(lock, std::chrono::microseconds(due - now));
+                continue;
+            }
+            Task task = std::move(const_cast<Task&>(_tasks.top()));
+            _tasks.pop();
+            _running++;
+            lock.unlock();
+            task.run();
+            lock.lock();
+            _running--;
+        }
+    }
+
+    std::shared_ptr<const std::vector<TraceEntry> > _entries;
+    double _speed;
+    Billing *_billing;
+    std::deque<size_t> _recorded[TraceEntry::CALL_COUNT];  // calls not replayed yet, per kind
+    std::vector<int> _answers;      // per call entry: index of its result, -1 for none
+    std::vector<bool> _rejected;    // per call entry
+    size_t _calls;
+    size_t _unmatched;
+
+    std::priority_queue<Task> _tasks;
+    unsigned long long _taskSeq;
+    int _running;
+    bool _stop;
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::thread _thread;
+};
+
+///////////////////////////////////////
+//
+//  Trace replay
+//
+///////////////////////////////////////
+
+TraceReplay::TraceReplay(std::vector<TraceEntry> entries, double speed)
+: _entries(std::make_shared<const std::vector<TraceEntry> >(std::move(entries)))
+, _speed(speed)
+, _billing(nullptr)
+, _store(nullptr)
+, _start(0)
+, _next(0)
+, _issued(0)
+{
+}
+
+TraceReplay::~TraceReplay()
+{
+}
+
+uint64_t TraceReplay::scaled(uint64_t micros) const
+{
+    return _speed > 0 ? (uint64_t)(micros / _speed) : 0;
+}
+
+void TraceReplay::start(Billing *billing)
+{
+    _billing = billing;
+    _store = new Store(_entries, _speed, billing);
+    billing->setBackend(_store);
+    _start = Stats::now();
+    _store->schedulePushes();
+}
+
+bool TraceReplay::step()
+{
+    const std::vector<TraceEntry> &entries = *_entries;
+    uint64_t now = Stats::now();
+    while(_next < entries.size()) {
+        const TraceEntry &entry = entries[_next];
+        if(entry.kind == TraceEntry::KIND_REQUEST) {
+            if(_start + scaled(entry.micros) > now) {
+                break;
+            }
+            issue(entry);
+            _issued++;
+        }
+        _next++;
+    }
+    return _next < entries.size() || !_store->idle();
+}
+
+uint64_t TraceReplay::idleMicros() const
+{
+    const std::vector<TraceEntry> &entries = *_entries;
+    uint64_t now = Stats::now();
+    for(size_t i = _next; i < entries.size(); i++) {
+        const TraceEntry &entry = entries[i];
+        if(entry.kind == TraceEntry::KIND_REQUEST) {
+            uint64_t due = _start + scaled(entry.micros);
+            return due > now ? due - now : 0;
+        }
+    }
+    return 0;
+}
+
+size_t TraceReplay::storeCalls() const
+{
+    return _store ? _store->calls() : 0;
+}
+
+size_t TraceReplay::unmatched() const
+{
+    return _store ? _store->unmatched() : 0;
+}
+
+void TraceReplay::issue(const TraceEntry &entry)
+{
+    const std::vector<std::string> &args = entry.args;
+    static const std::string NONE;
+    const std::string &first = args.size() > 0 ? args[0] : NONE;
+    const std::string &second = args.size() > 1 ? args[1] : NONE;
+    int id = entry.requestId;
+    switch(entry.call) {
+    case TraceEntry::CALL_INIT:
+        _billing->init(args, entry.flag, id);
+        break;
+    case TraceEntry::CALL_GET_PURCHASES:
+        _billing->getPurchases(id);
+        break;
+    case TraceEntry::CALL_BUY:
+        _billing->buy(first, second, id);
+        break;
+    case TraceEntry::CALL_SUBSCRIBE:
+        _billing->subscribe(first, second, std::vector<std::string>(args.begin() + std::min<size_t>(2, args.size()), args.end()), id);
+        break;
+    case TraceEntry::CALL_CONSUME:
+        _billing->consume(first, id);
+        break;
+    case TraceEntry::CALL_CONSUME_MANY:
+        _billing->consumeMany(args, id);
+        break;
+    case TraceEntry::CALL_AVAILABLE_PRODUCTS:
+        _billing->availableProducts(id);
+        break;
+    case TraceEntry::CALL_PRODUCT_DETAILS:
+        _billing->productDetails(args, id);
+        break;
+    case TraceEntry::CALL_RESTORE:
+        _billing->restore(id);
+        break;
+    default:
+        break;
+    }
+}
+
+} // namespace iap
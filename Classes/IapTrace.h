@@ -0,0 +1,211 @@
+#ifndef IapTrace_h
+#define IapTrace_h
+
+#include "IapBackend.h"
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace iap {
+
+class Billing;
+
+///////////////////////////////////////
+//
+//  Trace entries
+//
+///////////////////////////////////////
+
+// A call the game made into Billing, or one crossing between Billing and
+// the store backend: a call going in, an answer or a push coming out.
+struct TraceEntry
+{
+    enum Kind
+    {
+        KIND_REQUEST,       // a Billing request, as the JS layer made it
+        KIND_CALL,          // a Backend call, stamped before it is made
+        KIND_REJECTED,      // that call returned false
+        KIND_RESULT,        // requestResult / requestRecords
+        KIND_PURCHASES,     // purchasesUpdated
+        KIND_PRODUCTS       // productsUpdated
+    };
+
+    // the Billing / Backend methods
+    enum Call
+    {
+        CALL_INIT,
+        CALL_GET_PURCHASES,
+        CALL_BUY,
+        CALL_SUBSCRIBE,
+        CALL_CONSUME,
+        CALL_CONSUME_MANY,
+        CALL_AVAILABLE_PRODUCTS,
+        CALL_PRODUCT_DETAILS,
+        CALL_RESTORE,
+        CALL_COUNT
+    };
+
+    uint8_t kind = KIND_REQUEST;
+    uint8_t call = CALL_INIT;
+    // init: internal validation; purchases: the list is everything owned
+    bool flag = false;
+    int requestId = 0;
+    uint64_t micros = 0;    // since the trace started
+    // init, consume_many, product_details: the skus (names, handles don't
+    // outlive the session); buy: sku, payload; subscribe: sku, payload,
+    // old skus; consume: sku
+    std::vector<std::string> args;
+    std::string error;
+    std::u16string json;
+    std::vector<uint8_t> records;
+
+    static const char* callName(Call call);
+};
+
+///////////////////////////////////////
+//
+//  Trace writer
+//
+///////////////////////////////////////
+
+// Appends entries to a trace file through a buffer that is written out when
+// full and on close(). Thread safe; while no file is open every hook costs
+// one relaxed atomic load.
+//
+// File: "IAPT", version, then per entry a fixed header (kind, call, flags,
+// argument count, request id, time, lengths), the arguments (16-bit length
+// prefixed), the error and the payload. JSON is stored one byte per
+// character when it is all ASCII, as nearly every store answer is, and as
+// UTF-16 otherwise.
+class TraceWriter
+{
+public:
+    static const size_t BUFFER_SIZE = 64 * 1024;
+    static const std::vector<std::string> NO_ARGS;
+
+    TraceWriter();
+    ~TraceWriter();
+
+    // truncates path; entries are timed from this call
+    bool open(const std::string &path);
+    void close();
+    bool recording() const { return _recording.load(std::memory_order_relaxed); }
+
+    void request(TraceEntry::Call call, int requestId, const std::vector<std::string> &args = NO_ARGS, bool flag = false);
+    void call(TraceEntry::Call call, int requestId, const std::vector<std::string> &args = NO_ARGS, bool flag = false);
+    void rejected(int requestId);
+    void result(int requestId, const std::string &error, const std::u16string &json);
+    void records(int requestId, const std::vector<uint8_t> &records);
+    void purchases(const std::u16string &json, bool complete);
+    void products(const std::u16string &json);
+
+private:
+    void append(uint8_t kind, uint8_t call, bool flag, int requestId, const std::vector<std::string> *args,
+                const std::string *error, const std::u16string *json, const std::vector<uint8_t> *records);
+
+    FILE *_file;
+    uint64_t _start;
+    std::vector<uint8_t> _buffer;
+    std::atomic<bool> _recording;
+    std::mutex _mutex;
+};
+
+// Reads a whole trace. A torn last entry (the app died mid-write) is
+// dropped; false for a missing or foreign file.
+bool readTrace(const std::string &path, std::vector<TraceEntry> &entries);
+
+///////////////////////////////////////
+//
+//  Tracing backend
+//
+///////////////////////////////////////
+
+// Records every call into the backend behind it, which it does not own.
+// Billing keeps one between the timing wrapper and the platform backend;
+// the requests and the answers are recorded where they enter Billing.
+class TracingBackend : public Backend
+{
+public:
+    TracingBackend(Backend *backend, TraceWriter *trace) : _backend(backend), _trace(trace) {}
+
+    virtual bool init(const std::vector<std::string> &skus, bool internalValidation, int requestId) override;
+    virtual bool getPurchases(int requestId) override;
+    virtual bool buy(const std::string &sku, const std::string &payload, int requestId) override;
+    virtual bool subscribe(const std::string &sku, const std::string &payload, const std::vector<std::string> &oldSkus, int requestId) override;
+    virtual bool consume(const std::string &sku, int requestId) override;
+    virtual bool consumeMany(const std::vector<std::string> &skus, int requestId) override;
+    virtual bool availableProducts(int requestId) override;
+    virtual bool productDetails(const std::vector<int> &skus, int requestId) override;
+    virtual bool restore(int requestId) override;
+    virtual bool setDebug(bool debug) override { return _backend->setDebug(debug); }
+    virtual bool hasFlatProductDetails() const override { return _backend->hasFlatProductDetails(); }
+    virtual bool restoreListsPurchases() const override { return _backend->restoreListsPurchases(); }
+    virtual bool setBinaryResults(bool enabled) override { return _backend->setBinaryResults(enabled); }
+
+private:
+    bool traced(bool accepted, int requestId);
+
+    Backend *_backend;
+    TraceWriter *_trace;
+};
+
+///////////////////////////////////////
+//
+//  Trace replay
+//
+///////////////////////////////////////
+
+// Plays a trace back through Billing, for load tests off-device.
+//
+// The requests the game made are issued to Billing again at their recorded
+// times, and the store pushes are repeated at theirs. The backend installed
+// in Billing answers each store call with the answer to the next recorded
+// store call of the same kind, after the same store latency, from a worker
+// thread as a real store does; a call recorded as rejected is rejected
+// again. Billing makes its own store calls (the refreshes after init,
+// retries, merged queries) again itself, and answers from its caches what
+// it answered from them before.
+//
+// Every recorded time is divided by speed; 0 replays as fast as possible.
+class TraceReplay
+{
+public:
+    TraceReplay(std::vector<TraceEntry> entries, double speed = 1.0);
+    ~TraceReplay();
+
+    // Installs the replay backend into billing (which owns it) and starts
+    // the clock. Call once.
+    void start(Billing *billing);
+    // Issues the requests that are due, on the calling thread. False once
+    // every request was issued and every store call and push answered.
+    bool step();
+    // microseconds until the next request is due, 0 when one is due now
+    uint64_t idleMicros() const;
+
+    size_t requestsIssued() const { return _issued; }
+    size_t storeCalls() const;
+    // store calls the trace had no answer left for; answered with an error
+    size_t unmatched() const;
+
+private:
+    class Store;
+
+    uint64_t scaled(uint64_t micros) const;
+    void issue(const TraceEntry &entry);
+
+    std::shared_ptr<const std::vector<TraceEntry> > _entries;   // shared with the store
+    double _speed;
+    Billing *_billing;
+    Store *_store;              // owned by Billing once started
+    uint64_t _start;
+    size_t _next;
+    size_t _issued;
+};
+
+} // namespace iap
+
+#endif /* IapTrace_h */
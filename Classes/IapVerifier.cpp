@@ -0,0 +1,465 @@
+#include "IapVerifier.h"
+#include "IapBase64.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+namespace iap {
+
+#if defined(__SIZEOF_INT128__)
+__extension__ typedef unsigned __int128 DoubleLimb;
+#else
+typedef uint64_t DoubleLimb;
+#endif
+
+///////////////////////////////////////
+//
+//  SHA-1
+//
+///////////////////////////////////////
+
+static inline uint32_t rotl(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+static void sha1Block(uint32_t h[5], const uint8_t *block)
+{
+    uint32_t w[80];
+    for(int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) | ((uint32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+    for(int i = 16; i < 80; i++) {
+        w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for(int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if(i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+        else if(i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+        else if(i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+        else            { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+        uint32_t t = rotl(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+static void sha1(const uint8_t *data, size_t size, uint8_t digest[20])
+{
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    size_t full = size / 64 * 64;
+    for(size_t i = 0; i < full; i += 64) {
+        sha1Block(h, data + i);
+    }
+    uint8_t tail[128] = { 0 };
+    size_t rest = size - full;
+    memcpy(tail, data + full, rest);
+    tail[rest] = 0x80;
+    size_t tailSize = rest + 9 <= 64 ? 64 : 128;
+    uint64_t bits = (uint64_t)size * 8;
+    for(int i = 0; i < 8; i++) {
+        tail[tailSize - 1 - i] = (uint8_t)(bits >> (i * 8));
+    }
+    for(size_t i = 0; i < tailSize; i += 64) {
+        sha1Block(h, tail + i);
+    }
+    for(int i = 0; i < 5; i++) {
+        digest[i * 4] = (uint8_t)(h[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(h[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(h[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)h[i];
+    }
+}
+
+// DER DigestInfo header for SHA-1, followed by the 20 byte digest
+static const uint8_t SHA1_DIGEST_INFO[] = {
+    0x30, 0x21, 0x30, 0x09, 0x06, 0x05, 0x2b, 0x0e, 0x03, 0x02, 0x1a, 0x05, 0x00, 0x04, 0x14
+};
+
+// 1.2.840.113549.1.1.1
+static const uint8_t RSA_ENCRYPTION_OID[] = { 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x01 };
+
+///////////////////////////////////////
+//
+//  Key parsing
+//
+///////////////////////////////////////
+
+// minimal DER reader, enough for SubjectPublicKeyInfo
+struct DerReader
+{
+    const uint8_t *p;
+    const uint8_t *end;
+
+    bool read(uint8_t tag, DerReader &content) {
+        if(end - p < 2 || *p != tag) {
+            return false;
+        }
+        p++;
+        size_t length = *p++;
+        if(length & 0x80) {
+            int bytes = length & 0x7f;
+            if(bytes == 0 || bytes > 4 || end - p < bytes)
+                return false;
+            length = 0;
+            for(int i = 0; i < bytes; i++)
+                length = (length << 8) | *p++;
+        }
+        if((size_t)(end - p) < length) {
+            return false;
+        }
+        content.p = p;
+        content.end = p + length;
+        p += length;
+        return true;
+    }
+};
+
+template<typename Limb>
+static void bytesToLimbs(const uint8_t *bytes, size_t size, std::vector<Limb> &limbs, size_t count)
+{
+    const size_t bits = sizeof(Limb) * 8;
+    limbs.assign(count, 0);
+    for(size_t i = 0; i < size; i++) {
+        size_t bit = (size - 1 - i) * 8;
+        limbs[bit / bits] |= (Limb)bytes[i] << (bit % bits);
+    }
+}
+
+template<typename Limb>
+static int compareLimbs(const Limb *a, const Limb *b, size_t count)
+{
+    for(size_t i = count; i-- > 0;) {
+        if(a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+template<typename Limb>
+static Limb subLimbs(Limb *a, const Limb *b, size_t count)
+{
+    Limb borrow = 0;
+    for(size_t i = 0; i < count; i++) {
+        Limb d = a[i] - b[i];
+        Limb under = a[i] < b[i];
+        under |= d < borrow;
+        a[i] = d - borrow;
+        borrow = under;
+    }
+    return borrow;
+}
+
+bool PurchaseVerifier::parseKey(const std::vector<uint8_t> &der, Key &key) const
+{
+    DerReader reader = { der.data(), der.data() + der.size() };
+    DerReader spki, algorithm, oid, bits, rsaKey, n, e;
+    if(reader.read(0x30, spki) && spki.read(0x30, algorithm)) {
+        // SubjectPublicKeyInfo: algorithm must be rsaEncryption
+        if(!algorithm.read(0x06, oid) || (size_t)(oid.end - oid.p) != sizeof(RSA_ENCRYPTION_OID)
+           || memcmp(oid.p, RSA_ENCRYPTION_OID, sizeof(RSA_ENCRYPTION_OID)) != 0
+           || !spki.read(0x03, bits) || bits.end - bits.p < 1 || *bits.p != 0) {
+            return false;
+        }
+        bits.p++;
+        if(!bits.read(0x30, rsaKey))
+            return false;
+    } else {
+        // bare PKCS#1 RSAPublicKey
+        reader.p = der.data();
+        if(!reader.read(0x30, rsaKey))
+            return false;
+    }
+    if(!rsaKey.read(0x02, n) || !rsaKey.read(0x02, e)) {
+        return false;
+    }
+    while(n.p < n.end && *n.p == 0) n.p++;
+    while(e.p < e.end && *e.p == 0) e.p++;
+    size_t modulusBytes = n.end - n.p;
+    size_t exponentBytes = e.end - e.p;
+    if(modulusBytes < 64 || modulusBytes > 1024 || exponentBytes == 0 || exponentBytes > 8 || (n.end[-1] & 1) == 0) {
+        return false;
+    }
+
+    const size_t limbBits = sizeof(Limb) * 8;
+    size_t k = (modulusBytes + sizeof(Limb) - 1) / sizeof(Limb);
+    key.modulusBytes = modulusBytes;
+    bytesToLimbs(n.p, modulusBytes, key.n, k);
+    key.exponent = 0;
+    for(size_t i = 0; i < exponentBytes; i++)
+        key.exponent = (key.exponent << 8) | e.p[i];
+
+    // -n^-1 mod 2^limbBits by Newton iteration, each step doubles the good bits
+    Limb inv = 1;
+    for(int i = 0; i < 6; i++)
+        inv *= 2 - key.n[0] * inv;
+    key.n0inv = (Limb)0 - inv;
+
+    // R^2 mod n by doubling 1, R = 2^(limbBits * k)
+    key.rr.assign(k, 0);
+    key.rr[0] = 1;
+    for(size_t i = 0; i < 2 * limbBits * k; i++) {
+        Limb carry = 0;
+        for(size_t j = 0; j < k; j++) {
+            Limb next = key.rr[j] >> (limbBits - 1);
+            key.rr[j] = (key.rr[j] << 1) | carry;
+            carry = next;
+        }
+        if(carry || compareLimbs(key.rr.data(), key.n.data(), k) >= 0)
+            subLimbs(key.rr.data(), key.n.data(), k);
+    }
+    return true;
+}
+
+///////////////////////////////////////
+//
+//  Verification
+//
+///////////////////////////////////////
+
+PurchaseVerifier* PurchaseVerifier::getInstance()
+{
+    static PurchaseVerifier instance;
+    return &instance;
+}
+
+PurchaseVerifier::PurchaseVerifier()
+: _stopping(false)
+{
+}
+
+PurchaseVerifier::~PurchaseVerifier()
+{
+    {
+        std::lock_guard<std::mutex> lock(_jobMutex);
+        _stopping = true;
+    }
+    _wakeup.notify_all();
+    if(_thread.joinable())
+        _thread.join();
+}
+
+bool PurchaseVerifier::setPublicKey(const std::string &base64Key)
+{
+    return keyFor(base64Key) != nullptr;
+}
+
+// the parsed key, which becomes the current one; null when it can't be parsed
+std::shared_ptr<const PurchaseVerifier::Key> PurchaseVerifier::keyFor(const std::string &base64Key)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(_key && base64Key == _base64Key) {
+            return _key;
+        }
+    }
+    std::vector<uint8_t> der;
+    std::shared_ptr<Key> key(new Key());
+    if(!base64Decode(base64Key, der) || !parseKey(der, *key)) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    _base64Key = base64Key;
+    _key = key;
+    return key;
+}
+
+bool PurchaseVerifier::hasPublicKey() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _key != nullptr;
+}
+
+bool PurchaseVerifier::verify(const std::string &data, const std::string &base64Signature) const
+{
+    return verify((const uint8_t*)data.data(), data.size(), base64Signature);
+}
+
+bool PurchaseVerifier::verify(const uint8_t *data, size_t size, const std::string &base64Signature) const
+{
+    std::shared_ptr<const Key> key;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        key = _key;
+    }
+    return key && verifyWith(*key, data, size, base64Signature);
+}
+
+void PurchaseVerifier::verifyBatch(const std::vector<SignedPurchase> &purchases, std::vector<uint8_t> &results, int maxThreads) const
+{
+    results.assign(purchases.size(), 0);
+    std::shared_ptr<const Key> key;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        key = _key;
+    }
+    if(key) {
+        verifyAll(*key, purchases, results, maxThreads);
+    }
+}
+
+void PurchaseVerifier::verifyAll(const Key &key, const std::vector<SignedPurchase> &purchases, std::vector<uint8_t> &results, int maxThreads) const
+{
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for(size_t i = next++; i < purchases.size(); i = next++) {
+            const SignedPurchase &purchase = purchases[i];
+            results[i] = verifyWith(key, (const uint8_t*)purchase.data.data(), purchase.data.size(), purchase.signature) ? 1 : 0;
+        }
+    };
+
+    size_t threads = maxThreads > 0 ? (size_t)maxThreads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, purchases.size() / PARALLEL_THRESHOLD);
+    std::vector<std::thread> workers;
+    for(size_t i = 1; i < threads; i++) {
+        workers.emplace_back(work);
+    }
+    work();
+    for(std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+void PurchaseVerifier::verifyAsync(std::string base64Key, std::vector<SignedPurchase> purchases, BatchHandler done)
+{
+    {
+        std::lock_guard<std::mutex> lock(_jobMutex);
+        if(!_thread.joinable()) {
+            _thread = std::thread(&PurchaseVerifier::worker, this);
+        }
+        Job job;
+        job.base64Key = std::move(base64Key);
+        job.purchases = std::move(purchases);
+        job.done = std::move(done);
+        _jobs.push_back(std::move(job));
+    }
+    _wakeup.notify_one();
+}
+
+void PurchaseVerifier::worker()
+{
+    std::unique_lock<std::mutex> lock(_jobMutex);
+    for(;;) {
+        _wakeup.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+        if(_stopping) {
+            return;
+        }
+        Job job = std::move(_jobs.front());
+        _jobs.pop_front();
+        lock.unlock();
+        // parsing a new key costs a few hundred microseconds, also off the caller
+        std::shared_ptr<const Key> key = keyFor(job.base64Key);
+        std::vector<uint8_t> results;
+        if(key) {
+            results.assign(job.purchases.size(), 0);
+            verifyAll(*key, job.purchases, results, 0);
+        }
+        if(job.done)
+            job.done(key != nullptr, results);
+        lock.lock();
+    }
+}
+
+// Montgomery product a * b * R^-1 mod n, scratch holds k + 1 limbs. The
+// product and the reduction run in one pass (FIOS): their two carry chains
+// are independent, so they overlap instead of waiting for each other.
+void PurchaseVerifier::montMul(const Key &key, const Limb *a, const Limb *b, Limb *out, Limb *t) const
+{
+    const int bits = sizeof(Limb) * 8;
+    const size_t k = key.n.size();
+    const Limb *n = key.n.data();
+    memset(t, 0, (k + 1) * sizeof(Limb));
+    for(size_t i = 0; i < k; i++) {
+        // a limb product plus two limbs never overflows a DoubleLimb
+        const Limb bi = b[i];
+        DoubleLimb product = (DoubleLimb)a[0] * bi + t[0];
+        const Limb m = (Limb)product * key.n0inv;
+        DoubleLimb reduced = (DoubleLimb)m * n[0] + (Limb)product;   // low limb is 0
+        product >>= bits;
+        reduced >>= bits;
+        for(size_t j = 1; j < k; j++) {
+            product = (DoubleLimb)a[j] * bi + t[j] + (Limb)product;
+            reduced = (DoubleLimb)m * n[j] + (Limb)product + (Limb)reduced;
+            t[j - 1] = (Limb)reduced;
+            product >>= bits;
+            reduced >>= bits;
+        }
+        // t stays below 2n, its top limb is 0 or 1
+        DoubleLimb top = (DoubleLimb)t[k] + (Limb)product + (Limb)reduced;
+        t[k - 1] = (Limb)top;
+        t[k] = (Limb)(top >> bits);
+    }
+    if(t[k] || compareLimbs(t, n, k) >= 0) {
+        subLimbs(t, n, k);
+    }
+    memcpy(out, t, k * sizeof(Limb));
+}
+
+bool PurchaseVerifier::verifyWith(const Key &key, const uint8_t *data, size_t size, const std::string &base64Signature) const
+{
+    // decoded in place, keys are at most 1024 bytes; longer text can't be a signature
+    uint8_t signature[1024 + 3];
+    size_t signatureSize = 0;
+    if(base64DecodedMaxSize(base64Signature.size()) > sizeof(signature) ||
+       !base64Decode(base64Signature.data(), base64Signature.size(), signature, signatureSize) || signatureSize != key.modulusBytes) {
+        return false;
+    }
+    const size_t bits = sizeof(Limb) * 8;
+    const size_t k = key.n.size();
+    Limbs buffer(k * 4 + 1);
+    Limb *s = &buffer[0];
+    Limb *x = s + k;
+    Limb *acc = x + k;
+    Limb *scratch = acc + k;
+
+    Limbs sig;
+    bytesToLimbs(signature, signatureSize, sig, k);
+    if(compareLimbs(sig.data(), key.n.data(), k) >= 0) {
+        return false;
+    }
+
+    // acc = s^e mod n, in Montgomery form until the end
+    montMul(key, sig.data(), key.rr.data(), x, scratch);
+    memcpy(acc, x, k * sizeof(Limb));
+    uint64_t e = key.exponent;
+    int top = 63;
+    while(top > 0 && !((e >> top) & 1))
+        top--;
+    for(int bit = top - 1; bit >= 0; bit--) {
+        montMul(key, acc, acc, acc, scratch);
+        if((e >> bit) & 1)
+            montMul(key, acc, x, acc, scratch);
+    }
+    memset(s, 0, k * sizeof(Limb));
+    s[0] = 1;
+    montMul(key, acc, s, acc, scratch);
+
+    // EMSA-PKCS1-v1_5: 00 01 FF..FF 00 DigestInfo SHA1(data)
+    std::vector<uint8_t> em(key.modulusBytes);
+    for(size_t i = 0; i < key.modulusBytes; i++) {
+        size_t bit = (key.modulusBytes - 1 - i) * 8;
+        em[i] = (uint8_t)(acc[bit / bits] >> (bit % bits));
+    }
+    const size_t tLength = sizeof(SHA1_DIGEST_INFO) + 20;
+    if(key.modulusBytes < tLength + 11) {
+        return false;
+    }
+    size_t padEnd = key.modulusBytes - tLength - 1;
+    bool ok = em[0] == 0x00 && em[1] == 0x01 && em[padEnd] == 0x00;
+    for(size_t i = 2; i < padEnd; i++) {
+        ok &= em[i] == 0xff;
+    }
+    uint8_t digest[20];
+    sha1(data, size, digest);
+    ok &= memcmp(&em[padEnd + 1], SHA1_DIGEST_INFO, sizeof(SHA1_DIGEST_INFO)) == 0;
+    ok &= memcmp(&em[padEnd + 1 + sizeof(SHA1_DIGEST_INFO)], digest, 20) == 0;
+    return ok;
+}
+
+} // namespace iap
@@ -0,0 +1,111 @@
+#ifndef IapVerifier_h
+#define IapVerifier_h
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace iap {
+
+struct SignedPurchase
+{
+    std::string data;       // signed bytes, the purchase's original JSON
+    std::string signature;  // base64
+};
+
+///////////////////////////////////////
+//
+//  Purchase signature verification
+//
+///////////////////////////////////////
+
+// SHA1withRSA (PKCS#1 v1.5) verification of store-signed purchase data,
+// what Google Play signs purchases with. The base64 X.509 public key is
+// parsed once and kept together with its Montgomery constants, so checking
+// a signature is a hash and one modular exponentiation with no setup.
+// Self-contained: no platform crypto, builds anywhere. About 1.6x the cost
+// of OpenSSL's verify on 64-bit targets (bench/verify_bench.cpp).
+class PurchaseVerifier
+{
+public:
+    // keyOk is false, with no results, when the key cannot be parsed
+    typedef std::function<void(bool keyOk, const std::vector<uint8_t> &results)> BatchHandler;
+
+    static PurchaseVerifier* getInstance();
+
+    PurchaseVerifier();
+    ~PurchaseVerifier();
+
+    // base64 SubjectPublicKeyInfo (or bare RSAPublicKey); setting the same
+    // key again is a no-op. False when the key cannot be parsed.
+    bool setPublicKey(const std::string &base64Key);
+    bool hasPublicKey() const;
+
+    bool verify(const std::string &data, const std::string &base64Signature) const;
+    bool verify(const uint8_t *data, size_t size, const std::string &base64Signature) const;
+
+    // Verifies a whole inventory. Large batches are split across cores;
+    // results[i] is 1 when purchases[i] is correctly signed.
+    void verifyBatch(const std::vector<SignedPurchase> &purchases, std::vector<uint8_t> &results, int maxThreads = 0) const;
+    // Sets the key and verifies the batch on the verifier's thread, one
+    // batch after another, off the caller's (the game's) thread; done is
+    // called there. The batch keeps the key it was queued with.
+    void verifyAsync(std::string base64Key, std::vector<SignedPurchase> purchases, BatchHandler done);
+
+    // batches smaller than this are verified on the calling thread
+    static const size_t PARALLEL_THRESHOLD = 8;
+
+private:
+    // 64-bit limbs where the compiler multiplies them into 128 bits, a
+    // quarter of the limb products of 32-bit ones
+#if defined(__SIZEOF_INT128__)
+    typedef uint64_t Limb;
+#else
+    typedef uint32_t Limb;
+#endif
+    typedef std::vector<Limb> Limbs; // little-endian
+
+    struct Key
+    {
+        Limbs n;
+        Limbs rr;           // R^2 mod n
+        Limb n0inv;         // -n^-1 mod 2^(limb bits)
+        uint64_t exponent;
+        size_t modulusBytes;
+    };
+
+    struct Job
+    {
+        std::string base64Key;
+        std::vector<SignedPurchase> purchases;
+        BatchHandler done;
+    };
+
+    std::shared_ptr<const Key> keyFor(const std::string &base64Key);
+    void verifyAll(const Key &key, const std::vector<SignedPurchase> &purchases, std::vector<uint8_t> &results, int maxThreads) const;
+    void worker();
+    bool parseKey(const std::vector<uint8_t> &der, Key &key) const;
+    bool verifyWith(const Key &key, const uint8_t *data, size_t size, const std::string &base64Signature) const;
+    void montMul(const Key &key, const Limb *a, const Limb *b, Limb *out, Limb *scratch) const;
+
+    std::string _base64Key;
+    std::shared_ptr<const Key> _key;
+    mutable std::mutex _mutex;
+
+    std::mutex _jobMutex;
+    std::condition_variable _wakeup;
+    std::deque<Job> _jobs;
+    std::thread _thread;
+    bool _stopping;
+};
+
+} // namespace iap
+
+#endif /* IapVerifier_h */
@@ -10,11 +10,13 @@ import org.json.JSONArray;
 import org.json.JSONObject;
 import org.json.JSONException;
 
+import java.nio.ByteBuffer;
 import java.util.Arrays;
 import java.util.List;
 import java.util.ArrayList;
 
 import com.tapclap.util.Purchase;
+import com.tapclap.util.IabException;
 import com.tapclap.util.IabHelper;
 import com.tapclap.util.IabResult;
 import com.tapclap.util.Inventory;
@@ -41,8 +43,21 @@ public class InAppBillingPlugin {
     // The helper object
     private static IabHelper mHelper = null;
 
-    // A quite up to date inventory of available items and purchase items
-    private static Inventory myInventory;
+    // A quite up to date inventory of available items and purchase items;
+    // replaced from billing worker threads
+    private static volatile Inventory myInventory;
+
+    // While the inventory query started by init runs, the calls that read
+    // myInventory wait here and run once it finished
+    private static boolean inventoryLoading = false;
+    private static final List<Runnable> inventoryWaiters = new ArrayList<Runnable>();
+
+    // Send results as binary records (RecordEncoder) instead of JSON strings
+    private static volatile boolean binaryResults = false;
+
+    // Names of the native SkuTable, indexed by handle; native appends new
+    // names with addSkus before passing their handles
+    private static final ArrayList<String> skuTable = new ArrayList<String>();
 
     public static boolean isGooglePlayServiceEnabled(Context context)
     {
@@ -87,22 +102,14 @@ public class InAppBillingPlugin {
         // enable debug logging (for a production application, you should set this to false).
         mHelper.enableDebugLogging(ENABLE_DEBUG_LOGGING);
 
+        // the listeners below only hand results to native, which takes them on
+        // any thread: no need to bounce through the UI thread first
+        mHelper.setListenersOnWorkerThread(true);
+
         // Start setup. This is asynchronous and the specified listener
         // will be called once setup completes.
         Log.d(TAG, "Starting setup.");
 
-        // Listener that's called when we finish querying the items and subscriptions we own
-        final IabHelper.QueryInventoryFinishedListener mGotInventoryListener = new IabHelper.QueryInventoryFinishedListener() {
-                public void onQueryInventoryFinished(IabResult result, Inventory inventory) {
-                    Log.d(TAG, "Inside mGotInventoryListener");
-                    if (hasErrorsAndUpdateInventory(result, inventory, callbackId))
-                        return;
-
-                    Log.d(TAG, "Query inventory was successful.");
-                    callRequestResult(callbackId, null, "{}");
-                }
-            };
-
         mHelper.startSetup(new IabHelper.OnIabSetupFinishedListener() {
             public void onIabSetupFinished(IabResult result) {
                 Log.d(TAG, "Setup finished.");
@@ -119,18 +126,11 @@ public class InAppBillingPlugin {
                     return;
                 }
 
-                // Hooray, IAB is fully set up. Now, let's get an inventory of stuff we own.
-                if(skus.length <= 0) {
-					Log.d(TAG, "Setup successful. Querying inventory.");
-                	mHelper.queryInventoryAsync(mGotInventoryListener);
-				} else {
-					Log.d(TAG, "Setup successful. Querying inventory w/ SKUs.");
-                    try {
-                        mHelper.queryInventoryAsync(true, Arrays.asList(skus), mGotInventoryListener);
-                    } catch(IllegalStateException ex) {
-                        Log.d("Catch IllegalStateException", ex.getMessage());
-                    }
-				}
+                // Hooray, IAB is fully set up. Ready to take calls; purchases and
+                // prices follow from the inventory query.
+                Log.d(TAG, "Setup successful. Querying inventory.");
+                callRequestResult(callbackId, null, "{}");
+                loadInventory(skus);
             }
         });
         Cocos2dxHelper.addOnActivityResultListener(new OnActivityResultListener() {
@@ -144,6 +144,12 @@ public class InAppBillingPlugin {
         return true;
     }
 
+    // Deliver sku details and purchases as binary records instead of JSON
+    public static boolean setBinaryResults(final boolean enabled) {
+        binaryResults = enabled;
+        return true;
+    }
+
     public static boolean setDebug(final boolean debug) {
         if(mHelper != null) {
             mHelper.enableDebugLogging(debug);
@@ -155,25 +161,20 @@ public class InAppBillingPlugin {
 
 	// Get the list of purchases
 	public static boolean getPurchases(final int callbackId) {
+        if (waitForInventory(new Runnable() {
+                public void run() {
+                    getPurchases(callbackId);
+                }
+            })) {
+            return true;
+        }
 		// Get the list of owned items
         try {
             if(myInventory == null) {
                 callRequestResult(callbackId, "Billing plugin was not initialized", null);
                 return false;
             }
-            List<Purchase>purchaseList = myInventory.getAllPurchases();
-
-            // Convert the java list to json
-            JSONArray jsonPurchaseList = new JSONArray();
-            for (Purchase p : purchaseList) {
-                // jsonPurchaseList.put(new JSONObject(p.getOriginalJson()));
-                JSONObject purchaseJsonObject = new JSONObject(p.getOriginalJson());
-                purchaseJsonObject.put("signature", p.getSignature());
-                purchaseJsonObject.put("receipt", p.getOriginalJson().toString());
-                jsonPurchaseList.put(purchaseJsonObject);
-            }
-
-            callRequestResult(callbackId, null, jsonPurchaseList.toString());
+            callRequestResultList(callbackId, purchasesToJson(myInventory.getAllPurchases()));
             return true;
         } catch (JSONException e) {
             return false;
@@ -182,6 +183,13 @@ public class InAppBillingPlugin {
 
 	// Buy an item
 	public static boolean buy(final String sku, final String developerPayload, final int callbackId) {
+        if (waitForInventory(new Runnable() {
+                public void run() {
+                    buy(sku, developerPayload, callbackId);
+                }
+            })) {
+            return true;
+        }
         // Buy an item
 
 		if (mHelper == null || !mHelper.IsInited()) {
@@ -206,6 +214,13 @@ public class InAppBillingPlugin {
 
 	// Buy an item
 	public static boolean subscribe(final String sku, final String developerPayload, final String[] oldPurchasedSkus, final int callbackId) {
+        if (waitForInventory(new Runnable() {
+                public void run() {
+                    subscribe(sku, developerPayload, oldPurchasedSkus, callbackId);
+                }
+            })) {
+            return true;
+        }
         // Subscribe to an item
 		if (mHelper == null || !mHelper.IsInited()) {
             callRequestResult(callbackId, "Billing plugin was not initialized", null);
@@ -231,6 +246,13 @@ public class InAppBillingPlugin {
 
 	// Consume a purchase
 	public static boolean consumePurchase(final String sku, final int callbackId) {
+        if (waitForInventory(new Runnable() {
+                public void run() {
+                    consumePurchase(sku, callbackId);
+                }
+            })) {
+            return true;
+        }
 
 		if (mHelper == null || !mHelper.IsInited()) {
             callRequestResult(callbackId, "Did you forget to initialize the plugin?", null);
@@ -265,6 +287,10 @@ public class InAppBillingPlugin {
             };
 
 		// Get the purchase from the inventory
+        if (myInventory == null) {
+            callRequestResult(callbackId, "The inventory could not be queried", null);
+            return false;
+        }
 		final Purchase purchase = myInventory.getPurchase(sku);
 		if (purchase != null) {
 			// Consume it
@@ -281,8 +307,103 @@ public class InAppBillingPlugin {
         }
 	}
 
+	// Consume several items with one IabHelper call. Answers once with an array
+	// of {productId, error, purchase} in sku order.
+	public static boolean consumePurchases(final String[] skus, final int callbackId) {
+        if (waitForInventory(new Runnable() {
+                public void run() {
+                    consumePurchases(skus, callbackId);
+                }
+            })) {
+            return true;
+        }
+
+		if (mHelper == null || !mHelper.IsInited()) {
+            callRequestResult(callbackId, "Did you forget to initialize the plugin?", null);
+			return false;
+		}
+        if(mHelper.AsyncInProgress()) {
+            callRequestResult(callbackId, "Another async operation in progress!", null);
+            return false;
+        }
+
+        if (myInventory == null) {
+            callRequestResult(callbackId, "The inventory could not be queried", null);
+            return false;
+        }
+
+        final JSONObject[] items = new JSONObject[skus.length];
+        final List<Purchase> purchases = new ArrayList<Purchase>();
+        final List<Integer> positions = new ArrayList<Integer>();
+        try {
+            for (int i = 0; i < skus.length; i++) {
+                final Purchase purchase = myInventory.getPurchase(skus[i]);
+                // a sku listed twice is consumed by its first entry
+                if (purchase == null || purchases.contains(purchase)) {
+                    items[i] = consumeItem(skus[i], "" + skus[i] + " is not owned so it cannot be consumed", null);
+                } else {
+                    purchases.add(purchase);
+                    positions.add(i);
+                }
+            }
+        } catch (JSONException e) {
+            callRequestResult(callbackId, "Could not create JSON object from purchase object", null);
+            return false;
+        }
+        if (purchases.isEmpty()) {
+            callRequestResult(callbackId, null, new JSONArray(Arrays.asList(items)).toString());
+            return true;
+        }
+
+        final IabHelper.OnConsumeMultiFinishedListener mConsumeMultiFinishedListener = new IabHelper.OnConsumeMultiFinishedListener() {
+                public void onConsumeMultiFinished(List<Purchase> consumed, List<IabResult> results) {
+                    Log.d(TAG, "Consumption of " + consumed.size() + " purchases finished.");
+                    try {
+                        for (int j = 0; j < consumed.size(); j++) {
+                            final Purchase purchase = consumed.get(j);
+                            final IabResult result = results.get(j);
+                            final int i = positions.get(j);
+                            if (result.isSuccess()) {
+                                myInventory.erasePurchase(purchase.getSku());
+                                items[i] = consumeItem(skus[i], null, new JSONObject(purchase.getOriginalJson()));
+                            } else {
+                                items[i] = consumeItem(skus[i], result.getResponse() + "|Error while consuming: " + result, null);
+                            }
+                        }
+                    } catch (JSONException e) {
+                        callRequestResult(callbackId, "Could not create JSON object from purchase object", null);
+                        return;
+                    }
+                    callRequestResult(callbackId, null, new JSONArray(Arrays.asList(items)).toString());
+                }
+            };
+
+        appActivity.runOnUiThread(new Runnable() {
+                @Override
+                public void run() {
+                    mHelper.consumeAsync(purchases, mConsumeMultiFinishedListener);
+                }
+            });
+        return true;
+	}
+
+    static private JSONObject consumeItem(final String sku, final String error, final JSONObject purchase) throws JSONException {
+        JSONObject item = new JSONObject();
+        item.put("productId", sku);
+        item.put("error", error == null ? JSONObject.NULL : error);
+        item.put("purchase", purchase == null ? JSONObject.NULL : purchase);
+        return item;
+    }
+
 	// Get the list of available products
 	public static boolean getAvailableProducts(final int callbackId) {
+        if (waitForInventory(new Runnable() {
+                public void run() {
+                    getAvailableProducts(callbackId);
+                }
+            })) {
+            return true;
+        }
 		// Get the list of owned items
 		if(myInventory == null) {
             callRequestResult(callbackId, "Billing plugin was not initialized", null);
@@ -291,13 +412,13 @@ public class InAppBillingPlugin {
         List<SkuDetails>skuList = myInventory.getAllProducts();
 
 		// Convert the java list to json
-	    JSONArray jsonSkuList = new JSONArray();
+	    List<JSONObject> jsonSkuList = new ArrayList<JSONObject>();
 		try {
 	        for (SkuDetails sku : skuList) {
 				Log.d(TAG, "SKUDetails: Title: "+sku.getTitle());
-	        	jsonSkuList.put(sku.toJson());
+	        	jsonSkuList.add(sku.toJson());
 	        }
-            callRequestResult(callbackId, null, jsonSkuList.toString());
+            callRequestResultList(callbackId, jsonSkuList);
             return true;
 		} catch (JSONException e){
             callRequestResult(callbackId, e.getMessage(), null);
@@ -330,17 +451,17 @@ public class InAppBillingPlugin {
                     List<SkuDetails>skuList = inventory.getAllProducts();
 
                     // Convert the java list to json
-                    JSONArray jsonSkuList = new JSONArray();
+                    List<JSONObject> jsonSkuList = new ArrayList<JSONObject>();
                     try {
                         for (SkuDetails sku : skuList) {
                             Log.d(TAG, "SKUDetails: Title: "+sku.getTitle());
-                            jsonSkuList.put(sku.toJson());
+                            jsonSkuList.add(sku.toJson());
                         }
                     } catch (JSONException e) {
                         callRequestResult(callbackId, e.getMessage(), null);
                         return;
                     }
-                    callRequestResult(callbackId, null, jsonSkuList.toString());
+                    callRequestResultList(callbackId, jsonSkuList);
                 }
             };
 
@@ -353,6 +474,29 @@ public class InAppBillingPlugin {
         return true;
 	}
 
+	//Names for the native sku handles that follow, appended in handle order
+	public static boolean addSkus(final String[] skus) {
+        synchronized (skuTable) {
+            skuTable.addAll(Arrays.asList(skus));
+        }
+        return true;
+	}
+
+	//Get SkuDetails for skus passed as native sku handles
+	public static boolean getProductDetailsByHandle(final int[] handles, final int callbackId) {
+        String[] skus = new String[handles.length];
+        synchronized (skuTable) {
+            for (int i = 0; i < handles.length; i++) {
+                if (handles[i] < 0 || handles[i] >= skuTable.size()) {
+                    callRequestResult(callbackId, "Unknown sku handle " + handles[i], null);
+                    return false;
+                }
+                skus[i] = skuTable.get(handles[i]);
+            }
+        }
+        return getProductDetails(skus, callbackId);
+	}
+
     /////////////////////////
     //
     // Private methods
@@ -386,10 +530,91 @@ public class InAppBillingPlugin {
         	return true;
         }
 
-        // Update the inventory
+        updateInventory(inventory);
+        return false;
+    }
+
+    private static void updateInventory(Inventory inventory) {
         myInventory = inventory;
 
-        return false;
+        // the native inventory diffs it against what it had and tells watchers
+        try {
+            purchasesUpdated(new JSONArray(purchasesToJson(inventory.getAllPurchases())).toString());
+        } catch (JSONException e) {
+            Log.d(TAG, "Could not create JSON object from purchase object");
+        }
+    }
+
+    // Queries owned items and the details of skus (and of the owned ones) on a
+    // new thread, after init has answered. Each slice of details goes to native
+    // as soon as it arrives, so prices show up after one store round trip.
+    private static void loadInventory(final String[] skus) {
+        synchronized (inventoryWaiters) {
+            inventoryLoading = true;
+        }
+        (new Thread(new Runnable() {
+            public void run() {
+                final IabHelper.SkuDetailsSliceListener sliceListener = new IabHelper.SkuDetailsSliceListener() {
+                        public void onSkuDetailsSlice(String itemType, List<SkuDetails> slice) {
+                            try {
+                                List<JSONObject> jsonSkuList = new ArrayList<JSONObject>();
+                                for (SkuDetails sku : slice) {
+                                    jsonSkuList.add(sku.toJson());
+                                }
+                                productsUpdated(new JSONArray(jsonSkuList).toString());
+                            } catch (JSONException e) {
+                                Log.d(TAG, "Could not create JSON object from sku details");
+                            }
+                        }
+                    };
+                try {
+                    Inventory inventory = mHelper.queryInventory(true, skus.length > 0 ? Arrays.asList(skus) : null,
+                                                                 null, sliceListener);
+                    if (mHelper != null && mHelper.IsInited()) {
+                        Log.d(TAG, "Query inventory was successful.");
+                        updateInventory(inventory);
+                    }
+                } catch (IabException ex) {
+                    Log.d(TAG, "Failed to query inventory: " + ex.getResult());
+                } catch (IllegalStateException ex) {
+                    Log.d(TAG, "Failed to query inventory: " + ex.getMessage());
+                }
+
+                List<Runnable> waiters;
+                synchronized (inventoryWaiters) {
+                    inventoryLoading = false;
+                    waiters = new ArrayList<Runnable>(inventoryWaiters);
+                    inventoryWaiters.clear();
+                }
+                for (Runnable waiter : waiters) {
+                    waiter.run();
+                }
+            }
+        })).start();
+    }
+
+    // Queues call while the inventory query started by init runs; false
+    // when the inventory is there (or never will be) and it can go ahead
+    private static boolean waitForInventory(Runnable call) {
+        synchronized (inventoryWaiters) {
+            if (!inventoryLoading) {
+                return false;
+            }
+            inventoryWaiters.add(call);
+            return true;
+        }
+    }
+
+    // Convert the java list to json, with the signature & receipt appended
+    private static List<JSONObject> purchasesToJson(List<Purchase> purchaseList) throws JSONException {
+        List<JSONObject> jsonPurchaseList = new ArrayList<JSONObject>();
+        for (Purchase p : purchaseList) {
+            JSONObject purchaseJsonObject = new JSONObject(p.getOriginalJson());
+            purchaseJsonObject.put("signature", p.getSignature());
+            purchaseJsonObject.put("receipt", p.getOriginalJson().toString());
+            jsonPurchaseList.add(purchaseJsonObject);
+        }
+        return jsonPurchaseList;
     }
     
     private static boolean purchaseFinished(IabResult result, Purchase purchase, int callbackId) {
@@ -414,14 +639,14 @@ public class InAppBillingPlugin {
         Log.d(TAG, "Purchase successful.");
 
         // add the purchase to the inventory
-        myInventory.addPurchase(purchase);
+        if (myInventory != null) myInventory.addPurchase(purchase);
 
         // append the purchase signature & receipt to the json
         try {
             JSONObject purchaseJsonObject = new JSONObject(purchase.getOriginalJson());
             purchaseJsonObject.put("signature", purchase.getSignature());
             purchaseJsonObject.put("receipt", purchase.getOriginalJson().toString());
-            callRequestResult(callbackId, null, purchaseJsonObject.toString());
+            callRequestResultObject(callbackId, purchaseJsonObject);
             return true;
         } catch (JSONException e) {
             callRequestResult(callbackId, "Could not create JSON object from purchase object", null);
@@ -491,14 +716,41 @@ public class InAppBillingPlugin {
 
     // JNI methods
 
+    // Results go to native straight from the thread that produced them (UI,
+    // billing worker or the caller's); native queues them for the cocos thread
     static private void callRequestResult(final int callbackId, final String error, final String result) {
-        appActivity.runOnUiThread(new Runnable() {
-                @Override
-                public void run() {
-                    requestResult(callbackId, error, result);
-                }
-            });
+        requestResult(callbackId, error, result);
+    }
+
+    // Sends a list of products or purchases, as binary records when enabled
+    static private void callRequestResultList(final int callbackId, final List<JSONObject> list) {
+        if (binaryResults) {
+            final ByteBuffer records = RecordEncoder.encodeList(list);
+            if (records != null) {
+                callRequestResultRecords(callbackId, records);
+                return;
+            }
+        }
+        callRequestResult(callbackId, null, new JSONArray(list).toString());
+    }
+
+    static private void callRequestResultObject(final int callbackId, final JSONObject object) {
+        if (binaryResults) {
+            final ByteBuffer records = RecordEncoder.encodeObject(object);
+            if (records != null) {
+                callRequestResultRecords(callbackId, records);
+                return;
+            }
+        }
+        callRequestResult(callbackId, null, object.toString());
+    }
+
+    static private void callRequestResultRecords(final int callbackId, final ByteBuffer records) {
+        requestResultRecords(callbackId, records);
     }
 
     public static native void requestResult(int callbackId, String err, String result);
+    public static native void requestResultRecords(int callbackId, ByteBuffer records);
+    public static native void purchasesUpdated(String purchases);
+    public static native void productsUpdated(String products);
 }
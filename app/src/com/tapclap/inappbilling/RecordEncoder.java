@@ -0,0 +1,114 @@
+/**
+ * Compact binary encoding of store results
+ *
+ */
+package com.tapclap.inappbilling;
+
+import org.json.JSONObject;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.Collections;
+import java.util.Iterator;
+import java.util.LinkedHashMap;
+import java.util.List;
+import java.util.Map;
+
+/**
+ * Encodes flat JSON objects (sku details, purchases) in the record format
+ * read by Classes/IapRecords.h, so the native side can build the JS objects
+ * without JSON text in between. Returns null for anything the format cannot
+ * hold (nested objects or arrays); the caller then falls back to JSON.
+ */
+class RecordEncoder {
+    private static final int MAGIC = 0x52504149; // "IAPR" in native order
+    private static final short VERSION = 1;
+    private static final short FLAG_ARRAY = 1;
+
+    private static final short TYPE_STRING = 0;
+    private static final short TYPE_NUMBER = 1;
+    private static final short TYPE_INTEGER = 2;
+    private static final short TYPE_BOOL = 3;
+    private static final short TYPE_NULL = 4;
+
+    static ByteBuffer encodeList(List<JSONObject> records) {
+        return encode(records, true);
+    }
+
+    static ByteBuffer encodeObject(JSONObject record) {
+        return encode(Collections.singletonList(record), false);
+    }
+
+    private static ByteBuffer encode(List<JSONObject> records, boolean array) {
+        // first pass: key table and exact size, the native side takes the
+        // buffer capacity as the payload length
+        Map<String, Integer> keys = new LinkedHashMap<String, Integer>();
+        int size = 4 + 2 + 2 + 4 + 4;
+        for (JSONObject record : records) {
+            size += 4;
+            Iterator<String> it = record.keys();
+            while (it.hasNext()) {
+                String key = it.next();
+                if (!keys.containsKey(key)) {
+                    keys.put(key, keys.size());
+                    size += 4 + 2 * key.length();
+                }
+                Object value = record.opt(key);
+                size += 4;
+                if (value instanceof String) {
+                    size += 4 + 2 * ((String)value).length();
+                } else if (value instanceof Number) {
+                    size += 8;
+                } else if (value instanceof Boolean) {
+                    size += 2;
+                } else if (value != JSONObject.NULL) {
+                    return null;
+                }
+            }
+        }
+        if (keys.size() > 0xffff) {
+            return null;
+        }
+
+        ByteBuffer buffer = ByteBuffer.allocateDirect(size).order(ByteOrder.nativeOrder());
+        buffer.putInt(MAGIC);
+        buffer.putShort(VERSION);
+        buffer.putShort(array ? FLAG_ARRAY : 0);
+        buffer.putInt(keys.size());
+        for (String key : keys.keySet()) {
+            putString(buffer, key);
+        }
+        buffer.putInt(records.size());
+        for (JSONObject record : records) {
+            buffer.putInt(record.length());
+            Iterator<String> it = record.keys();
+            while (it.hasNext()) {
+                String key = it.next();
+                Object value = record.opt(key);
+                buffer.putShort((short)(int)keys.get(key));
+                if (value instanceof String) {
+                    buffer.putShort(TYPE_STRING);
+                    putString(buffer, (String)value);
+                } else if (value instanceof Integer || value instanceof Long) {
+                    buffer.putShort(TYPE_INTEGER);
+                    buffer.putLong(((Number)value).longValue());
+                } else if (value instanceof Number) {
+                    buffer.putShort(TYPE_NUMBER);
+                    buffer.putDouble(((Number)value).doubleValue());
+                } else if (value instanceof Boolean) {
+                    buffer.putShort(TYPE_BOOL);
+                    buffer.putShort((short)(((Boolean)value) ? 1 : 0));
+                } else {
+                    buffer.putShort(TYPE_NULL);
+                }
+            }
+        }
+        return buffer;
+    }
+
+    private static void putString(ByteBuffer buffer, String str) {
+        buffer.putInt(str.length());
+        buffer.asCharBuffer().put(str);
+        buffer.position(buffer.position() + 2 * str.length());
+    }
+}
@@ -137,6 +137,15 @@ public class Base64 {
     // Indicates equals sign in encoding
     private final static byte EQUALS_SIGN_ENC = -1;
 
+    /**
+     * Standard-alphabet input from this length on goes through the native
+     * codec (Classes/IapBase64.h), below it the JNI call costs more than
+     * the conversion.
+     */
+    private final static int NATIVE_MIN_LENGTH = 256;
+
+    private static boolean sNativeAvailable = true;
+
     /** Defeats instantiation. */
     private Base64() {
     }
@@ -270,6 +279,13 @@ public class Base64 {
      */
     public static byte[] encode(byte[] source, int off, int len, byte[] alphabet,
             int maxLineLength) {
+        if (alphabet == ALPHABET && maxLineLength == Integer.MAX_VALUE && len >= NATIVE_MIN_LENGTH && sNativeAvailable) {
+            try {
+                return nativeEncode(source, off, len);
+            } catch (UnsatisfiedLinkError e) {
+                sNativeAvailable = false;
+            }
+        }
         int lenDiv3 = (len + 2) / 3; // ceil(len / 3)
         int len43 = lenDiv3 * 4;
         byte[] outBuff = new byte[len43 // Main 4:3
@@ -473,6 +489,17 @@ public class Base64 {
      */
     public static byte[] decode(byte[] source, int off, int len, byte[] decodabet)
             throws Base64DecoderException {
+        if (decodabet == DECODABET && len >= NATIVE_MIN_LENGTH && sNativeAvailable) {
+            try {
+                byte[] decoded = nativeDecode(source, off, len);
+                if (decoded != null) {
+                    return decoded;
+                }
+                // malformed: decode below for the detailed exception
+            } catch (UnsatisfiedLinkError e) {
+                sNativeAvailable = false;
+            }
+        }
         int len34 = len * 3 / 4;
         byte[] outBuff = new byte[2 + len34]; // Upper limit on size of output
         int outBuffPosn = 0;
@@ -539,4 +566,10 @@ public class Base64 {
         System.arraycopy(outBuff, 0, out, 0, outBuffPosn);
         return out;
     }
+
+    private static native byte[] nativeEncode(byte[] source, int off, int len);
+
+    // null when the input is not valid base64
+    private static native byte[] nativeDecode(byte[] source, int off, int len);
 }
+
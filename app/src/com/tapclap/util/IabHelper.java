@@ -35,7 +35,15 @@ import com.android.vending.billing.IInAppBillingService;
 import org.json.JSONException;
 
 import java.util.ArrayList;
+import java.util.HashSet;
+import java.util.LinkedHashSet;
 import java.util.List;
+import java.util.Set;
+import java.util.concurrent.Callable;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.Future;
 
 
 /**
@@ -95,6 +103,16 @@ public class IabHelper {
     // if mAsyncInProgress == true, what asynchronous operation is in progress?
     String mAsyncOperation = "";
 
+    // Call async listeners on the worker thread that finished the operation
+    // instead of posting them back to the thread that started it
+    boolean mListenersOnWorker = false;
+
+    // Store calls of inventory queries run on at most this many threads
+    static final int QUERY_PARALLELISM = 4;
+    // getSkuDetails accepts at most this many skus per call
+    static final int SKU_DETAILS_SLICE = 20;
+    ExecutorService mQueryExecutor;
+
     // Context we were passed during initialization
     Context mContext;
 
@@ -201,6 +219,16 @@ public class IabHelper {
         mDebugLog = enable;
     }
 
+    /**
+     * Calls the listeners of the async operations (inventory query, consume) on
+     * their worker thread instead of the thread that started them. The listeners
+     * must then be thread-safe; it saves the hop when they only hand the result
+     * on to another thread anyway.
+     */
+    public void setListenersOnWorkerThread(boolean enable) {
+        mListenersOnWorker = enable;
+    }
+
     /**
      * Callback for setup process. This listener's {@link #onIabSetupFinished} method is called
      * when the setup process is complete.
@@ -346,6 +374,10 @@ public class IabHelper {
         mServiceConn = null;
         mService = null;
         mPurchaseListener = null;
+        synchronized (this) {
+            if (mQueryExecutor != null) mQueryExecutor.shutdownNow();
+            mQueryExecutor = null;
+        }
     }
 
     private void checkNotDisposed() {
@@ -549,7 +581,7 @@ public class IabHelper {
                 String sku = purchase.getSku();
 
                 // Verify signature
-                if (mSignatureBase64 != null && !Security.verifyPurchase(mSignatureBase64, purchaseData, dataSignature)) {
+                if (mSignatureBase64 != null && !NativeSecurity.verifyPurchase(mSignatureBase64, purchaseData, dataSignature)) {
                     logError("Purchase signature verification FAILED for sku " + sku);
                     result = new IabResult(ERR_VERIFICATION_FAILED, "Signature verification failed for sku " + sku);
                     if (mPurchaseListener != null) mPurchaseListener.onIabPurchaseFinished(result, purchase);
@@ -611,47 +643,138 @@ public class IabHelper {
      */
     public Inventory queryInventory(boolean querySkuDetails, List<String> moreItemSkus,
                                         List<String> moreSubsSkus) throws IabException {
+        return queryInventory(querySkuDetails, moreItemSkus, moreSubsSkus, null);
+    }
+
+    /**
+     * Receives sku details while an inventory query is still running, one
+     * getSkuDetails answer at a time. Called on a query thread.
+     */
+    public interface SkuDetailsSliceListener {
+        public void onSkuDetailsSlice(String itemType, List<SkuDetails> slice);
+    }
+
+    /**
+     * As {@link #queryInventory(boolean, List, List)}, with each slice of sku details
+     * also passed to sliceListener (may be null) as soon as it arrives.
+     *
+     * The owned purchases of both item types and the details of the listed skus are
+     * queried concurrently, and the details in slices of {@link #SKU_DETAILS_SLICE}
+     * skus, at most {@link #QUERY_PARALLELISM} store calls at a time. Owned skus that
+     * were not listed are asked for once the purchases are known.
+     */
+    public Inventory queryInventory(boolean querySkuDetails, List<String> moreItemSkus,
+                                    List<String> moreSubsSkus, SkuDetailsSliceListener sliceListener)
+            throws IabException {
         checkNotDisposed();
         checkSetupDone("queryInventory");
+        Inventory inv = new Inventory();
+        List<Future<Integer>> purchases = new ArrayList<Future<Integer>>();
+        List<Future<Integer>> itemDetails = new ArrayList<Future<Integer>>();
+        List<Future<Integer>> subsDetails = new ArrayList<Future<Integer>>();
         try {
-            Inventory inv = new Inventory();
-            int r = queryPurchases(inv, ITEM_TYPE_INAPP);
-            if (r != BILLING_RESPONSE_RESULT_OK) {
-                throw new IabException(r, "Error refreshing inventory (querying owned items).");
+            purchases.add(queryExecutor().submit(purchasesQuery(inv, ITEM_TYPE_INAPP)));
+            if (mSubscriptionsSupported) {
+                purchases.add(queryExecutor().submit(purchasesQuery(inv, ITEM_TYPE_SUBS)));
             }
-
             if (querySkuDetails) {
-                r = querySkuDetails(ITEM_TYPE_INAPP, inv, moreItemSkus);
-                if (r != BILLING_RESPONSE_RESULT_OK) {
-                    throw new IabException(r, "Error refreshing inventory (querying prices of items).");
+                submitSkuDetails(ITEM_TYPE_INAPP, inv, moreItemSkus, sliceListener, itemDetails);
+                if (mSubscriptionsSupported) {
+                    submitSkuDetails(ITEM_TYPE_SUBS, inv, moreItemSkus, sliceListener, subsDetails);
                 }
             }
 
-            // if subscriptions are supported, then also query for subscriptions
+            awaitQuery(purchases.get(0), "Error refreshing inventory (querying owned items).");
             if (mSubscriptionsSupported) {
-                r = queryPurchases(inv, ITEM_TYPE_SUBS);
-                if (r != BILLING_RESPONSE_RESULT_OK) {
-                    throw new IabException(r, "Error refreshing inventory (querying owned subscriptions).");
+                awaitQuery(purchases.get(1), "Error refreshing inventory (querying owned subscriptions).");
+            }
+            if (querySkuDetails) {
+                // details of owned skus the caller did not list
+                submitSkuDetails(ITEM_TYPE_INAPP, inv, unlisted(inv.getAllOwnedSkus(ITEM_TYPE_INAPP), moreItemSkus),
+                        sliceListener, itemDetails);
+                if (mSubscriptionsSupported) {
+                    submitSkuDetails(ITEM_TYPE_SUBS, inv, unlisted(inv.getAllOwnedSkus(ITEM_TYPE_SUBS), moreItemSkus),
+                            sliceListener, subsDetails);
                 }
-
-                if (querySkuDetails) {
-                    r = querySkuDetails(ITEM_TYPE_SUBS, inv, moreItemSkus);
-                    if (r != BILLING_RESPONSE_RESULT_OK) {
-                        throw new IabException(r, "Error refreshing inventory (querying prices of subscriptions).");
-                    }
+                for (Future<Integer> slice : itemDetails) {
+                    awaitQuery(slice, "Error refreshing inventory (querying prices of items).");
+                }
+                for (Future<Integer> slice : subsDetails) {
+                    awaitQuery(slice, "Error refreshing inventory (querying prices of subscriptions).");
                 }
             }
-
             return inv;
         }
-        catch (RemoteException e) {
-            throw new IabException(ERR_COMMUNICATION, "Remote exception while refreshing inventory.", e);
+        finally {
+            // after an error the queries not started yet are dropped
+            for (Future<Integer> query : purchases) query.cancel(false);
+            for (Future<Integer> query : itemDetails) query.cancel(false);
+            for (Future<Integer> query : subsDetails) query.cancel(false);
+        }
+    }
+
+    synchronized ExecutorService queryExecutor() {
+        checkNotDisposed();
+        if (mQueryExecutor == null) mQueryExecutor = Executors.newFixedThreadPool(QUERY_PARALLELISM);
+        return mQueryExecutor;
+    }
+
+    Callable<Integer> purchasesQuery(final Inventory inv, final String itemType) {
+        return new Callable<Integer>() {
+            public Integer call() throws Exception {
+                return queryPurchases(inv, itemType);
+            }
+        };
+    }
+
+    // Queues one getSkuDetails call per slice of skus
+    void submitSkuDetails(final String itemType, final Inventory inv, List<String> skus,
+                          final SkuDetailsSliceListener sliceListener, List<Future<Integer>> out) {
+        if (skus == null) return;
+        ArrayList<String> unique = new ArrayList<String>(new LinkedHashSet<String>(skus));
+        for (int start = 0; start < unique.size(); start += SKU_DETAILS_SLICE) {
+            final ArrayList<String> slice = new ArrayList<String>(
+                    unique.subList(start, Math.min(start + SKU_DETAILS_SLICE, unique.size())));
+            out.add(queryExecutor().submit(new Callable<Integer>() {
+                public Integer call() throws Exception {
+                    return querySkuDetails(itemType, inv, slice, sliceListener);
+                }
+            }));
         }
-        catch (JSONException e) {
-            throw new IabException(ERR_BAD_RESPONSE, "Error parsing JSON response while refreshing inventory.", e);
+    }
+
+    static List<String> unlisted(List<String> skus, List<String> listed) {
+        if (listed == null) return skus;
+        Set<String> known = new HashSet<String>(listed);
+        List<String> result = new ArrayList<String>();
+        for (String sku : skus) {
+            if (!known.contains(sku)) result.add(sku);
         }
-        catch (NullPointerException e) {
-            throw new IabException(ERR_UNKNOWN, "NullPointer while refreshing inventory.", e);
+        return result;
+    }
+
+    // Waits for one query of queryInventory; throws its error
+    void awaitQuery(Future<Integer> query, String errorMessage) throws IabException {
+        int r;
+        try {
+            r = query.get();
+        }
+        catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+            throw new IabException(ERR_UNKNOWN, "Interrupted while refreshing inventory.", e);
+        }
+        catch (ExecutionException e) {
+            Throwable cause = e.getCause();
+            if (cause instanceof RemoteException) {
+                throw new IabException(ERR_COMMUNICATION, "Remote exception while refreshing inventory.", (Exception) cause);
+            }
+            if (cause instanceof JSONException) {
+                throw new IabException(ERR_BAD_RESPONSE, "Error parsing JSON response while refreshing inventory.", (Exception) cause);
+            }
+            throw new IabException(ERR_UNKNOWN, "Exception while refreshing inventory.", e);
+        }
+        if (r != BILLING_RESPONSE_RESULT_OK) {
+            throw new IabException(r, errorMessage);
         }
     }
 
@@ -702,7 +825,7 @@ public class IabHelper {
                 final IabResult result_f = result;
                 final Inventory inv_f = inv;
                 if (!mDisposed && listener != null) {
-                    handler.post(new Runnable() {
+                    notifyListener(handler, new Runnable() {
                         public void run() {
                             listener.onQueryInventoryFinished(result_f, inv_f);
                         }
@@ -913,11 +1036,15 @@ public class IabHelper {
             ArrayList<String> purchaseDataList = ownedItems.getStringArrayList(RESPONSE_INAPP_PURCHASE_DATA_LIST);
             ArrayList<String> signatureList = ownedItems.getStringArrayList(RESPONSE_INAPP_SIGNATURE_LIST);
 
+            // verify the whole page in one native batch
+            boolean[] verified = mSignatureBase64 == null ? null
+                : NativeSecurity.verifyPurchases(mSignatureBase64, purchaseDataList, signatureList);
+
             for (int i = 0; i < purchaseDataList.size(); ++i) {
                 String purchaseData = purchaseDataList.get(i);
                 String signature = signatureList.get(i);
                 String sku = ownedSkus.get(i);
-                if (mSignatureBase64 == null || Security.verifyPurchase(mSignatureBase64, purchaseData, signature)) {
+                if (verified == null || verified[i]) {
                     logDebug("Sku is owned: " + sku);
                     Purchase purchase = new Purchase(itemType, purchaseData, signature);
 
@@ -944,58 +1071,39 @@ public class IabHelper {
         return verificationFailed ? ERR_VERIFICATION_FAILED : BILLING_RESPONSE_RESULT_OK;
     }
 
-    int querySkuDetails(String itemType, Inventory inv, List<String> moreSkus)
-            throws RemoteException, JSONException {
-        logDebug("Querying SKU details.");
-        ArrayList<String> skuList = new ArrayList<String>();
-        skuList.addAll(inv.getAllOwnedSkus(itemType));
-        if (moreSkus != null) {
-            logDebug("moreSkus: Building SKUs List");
-            for (String sku : moreSkus) {
-                logDebug("moreSkus: " + sku);
-                if (!skuList.contains(sku)) {
-                    skuList.add(sku);
-                }
+    // One getSkuDetails call, for at most SKU_DETAILS_SLICE skus
+    int querySkuDetails(String itemType, Inventory inv, ArrayList<String> skuList,
+                        SkuDetailsSliceListener sliceListener) throws RemoteException, JSONException {
+        logDebug("Querying SKU details: " + skuList);
+        Bundle querySkus = new Bundle();
+        querySkus.putStringArrayList(GET_SKU_DETAILS_ITEM_LIST, skuList);
+        Bundle skuDetails = mService.getSkuDetails(3,
+                mContext.getPackageName(), itemType, querySkus);
+
+        if (!skuDetails.containsKey(RESPONSE_GET_SKU_DETAILS_LIST)) {
+            int response = getResponseCodeFromBundle(skuDetails);
+            if (response != BILLING_RESPONSE_RESULT_OK) {
+                logDebug("getSkuDetails() failed: "
+                        + getResponseDesc(response));
+                return response;
+            } else {
+                logError("getSkuDetails() returned a bundle with neither an error nor a detail list.");
+                return ERR_BAD_RESPONSE;
             }
         }
 
-        if (skuList.size() == 0) {
-            logDebug("queryPrices: nothing to do because there are no SKUs.");
-            return BILLING_RESPONSE_RESULT_OK;
-        }
-
-        // Split the SKUs into slices of maximum 20 entries before querying them to prevent 
-        // "Input Error: skusBundle array associated with key ITEM_ID_LIST cannot contain more than 20 items."
-        while (skuList.size() > 0) {
-            ArrayList<String> skuSubList = new ArrayList<String>(
-                    skuList.subList(0, Math.min(19, skuList.size())));
-            skuList.removeAll(skuSubList);
-
-            Bundle querySkus = new Bundle();
-            querySkus.putStringArrayList(GET_SKU_DETAILS_ITEM_LIST, skuSubList);
-            Bundle skuDetails = mService.getSkuDetails(3,
-                    mContext.getPackageName(), itemType, querySkus);
-
-            if (!skuDetails.containsKey(RESPONSE_GET_SKU_DETAILS_LIST)) {
-                int response = getResponseCodeFromBundle(skuDetails);
-                if (response != BILLING_RESPONSE_RESULT_OK) {
-                    logDebug("getSkuDetails() failed: "
-                            + getResponseDesc(response));
-                    return response;
-                } else {
-                    logError("getSkuDetails() returned a bundle with neither an error nor a detail list.");
-                    return ERR_BAD_RESPONSE;
-                }
-            }
-
-            ArrayList<String> responseList = skuDetails
-                    .getStringArrayList(RESPONSE_GET_SKU_DETAILS_LIST);
+        ArrayList<String> responseList = skuDetails
+                .getStringArrayList(RESPONSE_GET_SKU_DETAILS_LIST);
 
-            for (String thisResponse : responseList) {
-                SkuDetails d = new SkuDetails(itemType, thisResponse);
-                logDebug("Got sku details: " + d);
-                inv.addSkuDetails(d);
-            }
+        List<SkuDetails> slice = new ArrayList<SkuDetails>(responseList.size());
+        for (String thisResponse : responseList) {
+            SkuDetails d = new SkuDetails(itemType, thisResponse);
+            logDebug("Got sku details: " + d);
+            inv.addSkuDetails(d);
+            slice.add(d);
+        }
+        if (sliceListener != null && !slice.isEmpty()) {
+            sliceListener.onSkuDetailsSlice(itemType, slice);
         }
         return BILLING_RESPONSE_RESULT_OK;
     }
@@ -1020,14 +1128,14 @@ public class IabHelper {
 
                 flagEndAsync();
                 if (!mDisposed && singleListener != null) {
-                    handler.post(new Runnable() {
+                    notifyListener(handler, new Runnable() {
                         public void run() {
                             singleListener.onConsumeFinished(purchases.get(0), results.get(0));
                         }
                     });
                 }
                 if (!mDisposed && multiListener != null) {
-                    handler.post(new Runnable() {
+                    notifyListener(handler, new Runnable() {
                         public void run() {
                             multiListener.onConsumeMultiFinished(purchases, results);
                         }
@@ -1037,6 +1145,12 @@ public class IabHelper {
         })).start();
     }
 
+    // Runs an async listener where setListenersOnWorkerThread asked for
+    void notifyListener(Handler handler, Runnable listener) {
+        if (mListenersOnWorker) listener.run();
+        else handler.post(listener);
+    }
+
     void logDebug(String msg) {
         if (mDebugLog) Log.d(mDebugTag, msg);
     }
@@ -3,17 +3,18 @@
 package com.tapclap.util;
 
 import java.util.ArrayList;
-import java.util.HashMap;
 import java.util.List;
 import java.util.Map;
+import java.util.concurrent.ConcurrentHashMap;
 
 /**
  * Represents a block of information about in-app items.
  * An Inventory is returned by such methods as {@link IabHelper#queryInventory}.
+ * The queries of one inventory fill it from several threads at once.
  */
 public class Inventory {
-    Map<String,SkuDetails> mSkuMap = new HashMap<String,SkuDetails>();
-    Map<String,Purchase> mPurchaseMap = new HashMap<String,Purchase>();
+    Map<String,SkuDetails> mSkuMap = new ConcurrentHashMap<String,SkuDetails>();
+    Map<String,Purchase> mPurchaseMap = new ConcurrentHashMap<String,Purchase>();
 
     public Inventory() { }
 
@@ -0,0 +1,71 @@
+package com.tapclap.util;
+
+import android.text.TextUtils;
+import android.util.Log;
+
+import java.io.UnsupportedEncodingException;
+import java.util.List;
+
+/**
+ * Purchase signature verification backed by the native verifier
+ * (Classes/IapVerifier.h). The public key is parsed once on the native side
+ * and a whole inventory is checked in one call, spread across cores when it
+ * is large. Falls back to {@link Security} when the native library is not
+ * loaded.
+ */
+public class NativeSecurity {
+    private static final String TAG = "IABUtil/NativeSecurity";
+
+    private static boolean sNativeAvailable = true;
+
+    /**
+     * Verifies one purchase, same contract as {@link Security#verifyPurchase}.
+     */
+    public static boolean verifyPurchase(String base64PublicKey, String signedData, String signature) {
+        boolean[] results = verifyPurchases(base64PublicKey, new String[] { signedData }, new String[] { signature });
+        return results[0];
+    }
+
+    /**
+     * Verifies a batch of purchases; result[i] tells whether signedData[i]
+     * matches signatures[i].
+     */
+    public static boolean[] verifyPurchases(String base64PublicKey, List<String> signedData, List<String> signatures) {
+        return verifyPurchases(base64PublicKey, signedData.toArray(new String[signedData.size()]), signatures.toArray(new String[signatures.size()]));
+    }
+
+    public static boolean[] verifyPurchases(String base64PublicKey, String[] signedData, String[] signatures) {
+        boolean[] results = new boolean[signedData.length];
+        if (TextUtils.isEmpty(base64PublicKey)) {
+            Log.e(TAG, "Purchase verification failed: missing key.");
+            return results;
+        }
+        if (sNativeAvailable) {
+            try {
+                // signed bytes exactly as Security.verify hashes them
+                byte[][] data = new byte[signedData.length][];
+                for (int i = 0; i < signedData.length; i++) {
+                    data[i] = signedData[i] == null ? new byte[0] : signedData[i].getBytes("UTF-8");
+                }
+                boolean[] verified = nativeVerifyPurchases(base64PublicKey, data, signatures);
+                if (verified != null) {
+                    return verified;
+                }
+                Log.e(TAG, "Invalid public key.");
+                return results;
+            } catch (UnsatisfiedLinkError e) {
+                Log.w(TAG, "Native verifier not available, using java.security");
+                sNativeAvailable = false;
+            } catch (UnsupportedEncodingException e) {
+                throw new RuntimeException(e);
+            }
+        }
+        for (int i = 0; i < signedData.length; i++) {
+            results[i] = Security.verifyPurchase(base64PublicKey, signedData[i], signatures[i]);
+        }
+        return results;
+    }
+
+    // null when the key cannot be parsed
+    private static native boolean[] nativeVerifyPurchases(String base64PublicKey, byte[][] signedData, String[] signatures);
+}
@@ -0,0 +1,151 @@
+// Base64 codec: round trips and malformed input against a plain reference
+// codec for every kernel this cpu has, random sizes and whitespace, then
+// encode/decode throughput per kernel on receipt-sized buffers.
+//
+// build: g++ -std=c++11 -O2 -I../Classes base64_bench.cpp ../Classes/IapBase64.cpp -o base64_bench
+
+#include "IapBase64.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+static const size_t SIZES[] = { 256, 4096, 65536, 1 << 20 };
+
+// reference: textbook bit accumulator, strict on padding like the codec
+static std::string referenceEncode(const std::vector<uint8_t> &data)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    uint32_t acc = 0;
+    int bits = 0;
+    for(uint8_t byte : data) {
+        acc = (acc << 8) | byte;
+        bits += 8;
+        while(bits >= 6) {
+            bits -= 6;
+            out += alphabet[(acc >> bits) & 63];
+        }
+    }
+    if(bits > 0)
+        out += alphabet[(acc << (6 - bits)) & 63];
+    while(out.size() % 4)
+        out += '=';
+    return out;
+}
+
+static int check(bool condition, const char *what, size_t size)
+{
+    if(!condition)
+        printf("FAILED: %s (size %zu)\n", what, size);
+    return condition ? 0 : 1;
+}
+
+static int fuzz(std::mt19937 &rng)
+{
+    int failures = 0;
+    for(int round = 0; round < 3000; round++) {
+        size_t size = round < 300 ? round : rng() % 5000;
+        std::vector<uint8_t> data(size);
+        for(uint8_t &b : data)
+            b = (uint8_t)rng();
+
+        // caller buffer with guard bytes: nothing may be written past the contract
+        std::string expected = referenceEncode(data);
+        std::vector<char> text(iap::base64EncodedSize(size) + 8, '#');
+        size_t written = iap::base64Encode(data.data(), size, text.data());
+        failures += check(written == expected.size() && memcmp(text.data(), expected.data(), written) == 0, "encode matches reference", size);
+        failures += check(memcmp(text.data() + written, "########", 8) == 0, "encode stays in bounds", size);
+
+        std::vector<uint8_t> decoded(iap::base64DecodedMaxSize(written) + 8, 0xa5);
+        size_t decodedSize = 0;
+        bool ok = iap::base64Decode(text.data(), written, decoded.data(), decodedSize);
+        failures += check(ok && decodedSize == size && (size == 0 || memcmp(decoded.data(), data.data(), size) == 0), "round trip", size);
+        for(size_t i = iap::base64DecodedMaxSize(written); i < decoded.size(); i++)
+            failures += check(decoded[i] == 0xa5, "decode stays in bounds", size);
+
+        // line breaks and stray spaces anywhere decode the same
+        std::string spaced;
+        for(char c : expected) {
+            spaced += c;
+            if(rng() % 40 == 0)
+                spaced += " \n\r\t"[rng() % 4];
+        }
+        std::vector<uint8_t> out;
+        failures += check(iap::base64Decode(spaced, out) && out == data, "whitespace skipped", size);
+
+        // one bad character anywhere fails
+        if(!expected.empty()) {
+            std::string broken = expected;
+            const char bad[] = { '*', '-', '_', '\0', (char)0xc3, '.', '"' };
+            broken[rng() % broken.size()] = bad[rng() % sizeof(bad)];
+            failures += check(!iap::base64Decode(broken, out), "bad character rejected", size);
+        }
+        // data after padding, truncated group
+        if(size % 3) {
+            failures += check(!iap::base64Decode(expected + "AAAA", out), "data after padding rejected", size);
+        }
+        if(size) {
+            std::string truncated = expected.substr(0, expected.size() - 3);
+            failures += check(!iap::base64Decode(truncated, out), "single trailing character rejected", size);
+        }
+        // unpadded input decodes too
+        std::string unpadded = expected;
+        while(!unpadded.empty() && unpadded.back() == '=')
+            unpadded.pop_back();
+        failures += check(iap::base64Decode(unpadded, out) && out == data, "unpadded accepted", size);
+    }
+    return failures;
+}
+
+template<typename F>
+static double megabytesPerSecond(size_t bytes, F f)
+{
+    int iterations = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    do {
+        f();
+        iterations++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while(elapsed < 0.2);
+    return bytes * (double)iterations / elapsed / 1e6;
+}
+
+int main()
+{
+    int failures = 0;
+    const iap::Base64Kernel kernels[] = { iap::BASE64_SCALAR, iap::BASE64_SSSE3, iap::BASE64_AVX2, iap::BASE64_NEON };
+    iap::Base64Kernel best = iap::base64Kernel();
+    printf("default kernel: %s\n", iap::base64KernelName(best));
+
+    for(iap::Base64Kernel kernel : kernels) {
+        if(!iap::base64UseKernel(kernel)) {
+            printf("%-6s  not available\n", iap::base64KernelName(kernel));
+            continue;
+        }
+        std::mt19937 rng(1234);
+        int kernelFailures = fuzz(rng);
+        failures += kernelFailures;
+
+        for(size_t size : SIZES) {
+            std::vector<uint8_t> data(size);
+            for(uint8_t &b : data)
+                b = (uint8_t)rng();
+            std::vector<char> text(iap::base64EncodedSize(size));
+            std::vector<uint8_t> decoded(iap::base64DecodedMaxSize(text.size()));
+            size_t decodedSize = 0;
+            double encode = megabytesPerSecond(size, [&] {
+                iap::base64Encode(data.data(), size, text.data());
+            });
+            double decode = megabytesPerSecond(size, [&] {
+                iap::base64Decode(text.data(), text.size(), decoded.data(), decodedSize);
+            });
+            printf("%-6s %8zu bytes: encode %7.0f MB/s, decode %7.0f MB/s%s\n", iap::base64KernelName(kernel), size, encode, decode,
+                   kernelFailures ? " (FAILED checks)" : "");
+        }
+    }
+    iap::base64UseKernel(best);
+    printf(failures ? "%d checks failed\n" : "all checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,728 @@
+// Native binding benchmark: the real Android request and result code from
+// Iap.cpp (AndroidBackend, the JNI result entry points) driven through the
+// fake JNIEnv, with Billing, Dispatcher, CallbackPool and Stats as shipped.
+//
+// SpiderMonkey is not available off-device, so the JS value layer is a
+// stub: jsval_to_std_vector_string copies each element through a UTF-8
+// buffer like the cocos conversion does, and results are parsed into a
+// small value tree with interned property names, from the text as
+// JS_ParseJSON would or from the document the delivering thread parsed
+// (IapJsonDom.h). The delivery step mirrors
+// cpp_requestResult / cpp_deliverResult in IapJs.cpp.
+//
+// Every measurement is printed as one JSON object per line so runs can be
+// stored and compared per commit; an optional argument is copied into each
+// line as "label" (e.g. the commit hash).
+//
+// build: g++ -std=c++11 -O2 -Ifake -I../Classes binding_bench.cpp ../Classes/Iap.cpp ../Classes/IapBilling.cpp ../Classes/IapScheduler.cpp ../Classes/IapCatalogCache.cpp ../Classes/IapRecords.cpp ../Classes/IapJsonScan.cpp ../Classes/IapJsonDom.cpp ../Classes/IapJournal.cpp ../Classes/IapStats.cpp ../Classes/IapInventory.cpp ../Classes/IapSkuTable.cpp ../Classes/IapModel.cpp ../Classes/IapTimerWheel.cpp ../Classes/IapTrace.cpp ../Classes/IapDispatcher.cpp ../Classes/IapVerifier.cpp ../Classes/IapBase64.cpp -pthread -o binding_bench
+
+#include "Iap.hpp"
+#include "IapBilling.h"
+#include "IapCallbackPool.h"
+#include "IapDispatcher.h"
+#include "IapJsonDom.h"
+#include "IapRecords.h"
+#include "IapSkuTable.h"
+#include "IapStats.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <unordered_map>
+
+///////////////////////////////////////
+//
+//  Allocation counting
+//
+///////////////////////////////////////
+
+static std::atomic<long> s_allocs(0);
+static std::atomic<long> s_allocBytes(0);
+
+void* operator new(size_t size)
+{
+    s_allocs.fetch_add(1, std::memory_order_relaxed);
+    s_allocBytes.fetch_add((long)size, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+// out of line: inlined into a delete expression, free() would be paired
+// with the new expression's operator new (-Wmismatched-new-delete)
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    operator delete(p);
+}
+
+///////////////////////////////////////
+//
+//  Measurement
+//
+///////////////////////////////////////
+
+static const double MIN_SECONDS = 0.25;
+static const char *s_label = nullptr;
+static int s_failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if(!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        s_failures++;
+    }
+}
+
+// runs f(i) until MIN_SECONDS passed, prints one JSON line
+template<typename F>
+static void measure(const char *bench, int size, F f)
+{
+    f(0);
+    long allocs = s_allocs.load();
+    long bytes = s_allocBytes.load();
+    auto start = std::chrono::steady_clock::now();
+    double seconds = 0;
+    long ops = 0;
+    do {
+        for(int i = 0; i < 16; i++)
+            f((int)ops++);
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while(seconds < MIN_SECONDS);
+    allocs = s_allocs.load() - allocs;
+    bytes = s_allocBytes.load() - bytes;
+    printf("{\"bench\":\"%s\",\"size\":%d,\"ops\":%ld,\"ops_per_sec\":%.1f,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,\"bytes_per_op\":%.1f%s%s%s}\n",
+           bench, size, ops, ops / seconds, seconds * 1e9 / ops, (double)allocs / ops, (double)bytes / ops,
+           s_label ? ",\"label\":\"" : "", s_label ? s_label : "", s_label ? "\"" : "");
+    fflush(stdout);
+}
+
+///////////////////////////////////////
+//
+//  Stub JS value layer
+//
+///////////////////////////////////////
+
+struct StubValue
+{
+    enum Type { NUL, BOOL, NUMBER, STRING, OBJECT, ARRAY };
+    Type type;
+    double number;
+    std::u16string string;
+    std::vector<const std::u16string*> keys; // interned, OBJECT only
+    std::vector<StubValue> items;            // OBJECT values or ARRAY elements
+};
+
+// property names, atomized once per occurrence like the engine does
+static const std::u16string* intern(const char16_t *chars, size_t length)
+{
+    static std::unordered_map<std::u16string, std::unique_ptr<std::u16string>> s_atoms;
+    std::u16string key(chars, length);
+    auto it = s_atoms.find(key);
+    if(it != s_atoms.end()) {
+        return it->second.get();
+    }
+    std::u16string *atom = new std::u16string(key);
+    s_atoms.emplace(std::move(key), std::unique_ptr<std::u16string>(atom));
+    return atom;
+}
+
+// stands in for JS_ParseJSON
+class StubParser
+{
+public:
+    StubParser(const char16_t *p, const char16_t *end) : _p(p), _end(end) {}
+
+    bool parse(StubValue &out) {
+        return value(out) && (space(), _p == _end);
+    }
+
+private:
+    void space() {
+        while(_p < _end && (*_p == u' ' || *_p == u'\n' || *_p == u'\r' || *_p == u'\t'))
+            _p++;
+    }
+
+    bool string(std::u16string &out) {
+        _p++;
+        out.clear();
+        while(_p < _end && *_p != u'"') {
+            char16_t c = *_p++;
+            if(c == u'\\') {
+                if(_p >= _end)
+                    return false;
+                c = *_p++;
+                switch(c) {
+                case u'n': c = u'\n'; break;
+                case u't': c = u'\t'; break;
+                case u'r': c = u'\r'; break;
+                case u'b': c = u'\b'; break;
+                case u'f': c = u'\f'; break;
+                case u'u': {
+                    if(_end - _p < 4)
+                        return false;
+                    c = (char16_t)strtol(std::string(_p, _p + 4).c_str(), nullptr, 16);
+                    _p += 4;
+                    break;
+                }
+                default: break;
+                }
+            }
+            out += c;
+        }
+        if(_p >= _end)
+            return false;
+        _p++;
+        return true;
+    }
+
+    bool value(StubValue &out) {
+        space();
+        if(_p >= _end)
+            return false;
+        switch(*_p) {
+        case u'"':
+            out.type = StubValue::STRING;
+            return string(out.string);
+        case u'{': {
+            out.type = StubValue::OBJECT;
+            _p++;
+            space();
+            if(_p < _end && *_p == u'}') {
+                _p++;
+                return true;
+            }
+            std::u16string name;
+            while(_p < _end && *_p == u'"') {
+                if(!string(name))
+                    return false;
+                space();
+                if(_p >= _end || *_p++ != u':')
+                    return false;
+                out.keys.push_back(intern(name.data(), name.size()));
+                out.items.push_back(StubValue());
+                if(!value(out.items.back()))
+                    return false;
+                space();
+                if(_p < _end && *_p == u',') {
+                    _p++;
+                    space();
+                } else {
+                    break;
+                }
+            }
+            if(_p >= _end || *_p++ != u'}')
+                return false;
+            return true;
+        }
+        case u'[':
+            out.type = StubValue::ARRAY;
+            _p++;
+            space();
+            if(_p < _end && *_p == u']') {
+                _p++;
+                return true;
+            }
+            for(;;) {
+                out.items.push_back(StubValue());
+                if(!value(out.items.back()))
+                    return false;
+                space();
+                if(_p < _end && *_p == u',') {
+                    _p++;
+                } else {
+                    break;
+                }
+            }
+            if(_p >= _end || *_p++ != u']')
+                return false;
+            return true;
+        case u't':
+        case u'f':
+            out.type = StubValue::BOOL;
+            out.number = *_p == u't';
+            _p += *_p == u't' ? 4 : 5;
+            return _p <= _end;
+        case u'n':
+            out.type = StubValue::NUL;
+            _p += 4;
+            return _p <= _end;
+        default: {
+            const char16_t *start = _p;
+            while(_p < _end && *_p != u',' && *_p != u'}' && *_p != u']' && *_p != u' ')
+                _p++;
+            out.type = StubValue::NUMBER;
+            out.number = strtod(std::string(start, _p).c_str(), nullptr);
+            return _p > start;
+        }
+        }
+    }
+
+    const char16_t *_p;
+    const char16_t *_end;
+};
+
+// stands in for cpp_recordsToJsval
+static bool stubRecordsToValue(const std::vector<uint8_t> &records, StubValue &out)
+{
+    iap::RecordReader reader(records.data(), records.size());
+    if(!reader.valid()) {
+        return false;
+    }
+    std::vector<const std::u16string*> keys(reader.keyCount());
+    for(uint32_t i = 0; i < reader.keyCount(); i++) {
+        uint32_t length;
+        const char16_t *chars = reader.key(i, length);
+        keys[i] = intern(chars, length);
+    }
+    out.type = StubValue::ARRAY;
+    out.items.reserve(reader.recordCount());
+    uint32_t fieldCount;
+    while(reader.nextRecord(fieldCount)) {
+        out.items.push_back(StubValue());
+        StubValue &obj = out.items.back();
+        obj.type = StubValue::OBJECT;
+        iap::RecordField field;
+        while(reader.nextField(field)) {
+            obj.keys.push_back(keys[field.key]);
+            obj.items.push_back(StubValue());
+            StubValue &v = obj.items.back();
+            switch(field.type) {
+            case iap::RECORD_STRING:
+                v.type = StubValue::STRING;
+                v.string.assign(field.str, field.length);
+                break;
+            case iap::RECORD_NUMBER:
+            case iap::RECORD_INTEGER:
+                v.type = StubValue::NUMBER;
+                v.number = field.number;
+                break;
+            case iap::RECORD_BOOL:
+                v.type = StubValue::BOOL;
+                v.number = field.number;
+                break;
+            default:
+                v.type = StubValue::NUL;
+            }
+        }
+    }
+    return reader.valid();
+}
+
+// stands in for cpp_domToJsval: names resolved once per document
+static void stubDomNodeToValue(const iap::JsonDom &dom, const char16_t *text, const std::vector<const std::u16string*> &keys,
+                               uint32_t &index, StubValue &out)
+{
+    const iap::JsonDom::Node &node = dom.node(index++);
+    switch(node.type) {
+    case iap::JsonDom::TYPE_STRING:
+        out.type = StubValue::STRING;
+        out.string.assign(dom.string(node, text), node.length);
+        break;
+    case iap::JsonDom::TYPE_NUMBER:
+        out.type = StubValue::NUMBER;
+        out.number = dom.number(node);
+        break;
+    case iap::JsonDom::TYPE_TRUE:
+    case iap::JsonDom::TYPE_FALSE:
+        out.type = StubValue::BOOL;
+        out.number = node.type == iap::JsonDom::TYPE_TRUE;
+        break;
+    case iap::JsonDom::TYPE_ARRAY:
+        out.type = StubValue::ARRAY;
+        out.items.resize(node.length);
+        for(uint32_t i = 0; i < node.length; i++)
+            stubDomNodeToValue(dom, text, keys, index, out.items[i]);
+        break;
+    case iap::JsonDom::TYPE_OBJECT:
+        out.type = StubValue::OBJECT;
+        out.keys.resize(node.length);
+        out.items.resize(node.length);
+        for(uint32_t i = 0; i < node.length; i++) {
+            out.keys[i] = keys[dom.node(index++).offset];
+            stubDomNodeToValue(dom, text, keys, index, out.items[i]);
+        }
+        break;
+    default:
+        out.type = StubValue::NUL;
+    }
+}
+
+static void stubDomToValue(const iap::JsonDom &dom, const std::u16string &json, StubValue &out)
+{
+    std::vector<const std::u16string*> keys(dom.keyCount());
+    for(uint32_t i = 0; i < dom.keyCount(); i++) {
+        uint32_t length;
+        const char16_t *chars = dom.key(i, json.data(), length);
+        keys[i] = intern(chars, length);
+    }
+    uint32_t index = 0;
+    stubDomNodeToValue(dom, json.data(), keys, index, out);
+}
+
+// cocos' jsval_to_std_string: encoded to a fresh UTF-8 buffer
+// (JSStringWrapper) and copied into the std::string
+static bool jsval_to_std_string(const StubValue &value, std::string *ret)
+{
+    if(value.type != StubValue::STRING) {
+        return false;
+    }
+    const std::u16string &s = value.string;
+    char *utf8 = new char[s.size() * 3 + 1];
+    size_t n = 0;
+    for(char16_t c : s) {
+        if(c < 0x80) {
+            utf8[n++] = (char)c;
+        } else if(c < 0x800) {
+            utf8[n++] = (char)(0xC0 | (c >> 6));
+            utf8[n++] = (char)(0x80 | (c & 0x3F));
+        } else {
+            utf8[n++] = (char)(0xE0 | (c >> 12));
+            utf8[n++] = (char)(0x80 | ((c >> 6) & 0x3F));
+            utf8[n++] = (char)(0x80 | (c & 0x3F));
+        }
+    }
+    utf8[n] = '\0';
+    ret->assign(utf8, n);
+    delete[] utf8;
+    return true;
+}
+
+// jsval_to_sku_handles in IapJs.cpp: numbers are handles, strings are
+// interned
+static bool jsval_to_sku_handles(const StubValue &array, std::vector<int> *ret)
+{
+    if(array.type != StubValue::ARRAY) {
+        return false;
+    }
+    iap::SkuTable *table = iap::SkuTable::getInstance();
+    ret->reserve(array.items.size());
+    for(const StubValue &item : array.items) {
+        int handle;
+        if(item.type == StubValue::NUMBER) {
+            handle = (int)item.number;
+            if(!table->valid(handle))
+                return false;
+        } else {
+            std::string s;
+            if(!jsval_to_std_string(item, &s) || (handle = table->intern(s)) < 0)
+                return false;
+        }
+        ret->push_back(handle);
+    }
+    return true;
+}
+
+///////////////////////////////////////
+//
+//  Result delivery (IapJs.cpp)
+//
+///////////////////////////////////////
+
+struct BenchCallback
+{
+    size_t items;
+    bool error;
+
+    void call(const std::string &err, const StubValue &value) {
+        error = !err.empty();
+        items = value.type == StubValue::ARRAY ? value.items.size() : 0;
+    }
+};
+
+static iap::CallbackPool<BenchCallback, 1024> s_callbacks;
+static size_t s_lastItems = 0;
+
+static void benchRequestResult(iap::Result &&result)
+{
+    iap::preparseResult(result);
+    iap::Stats::getInstance()->queued(result.requestId);
+    iap::Dispatcher::getInstance()->push(std::move(result));
+}
+
+static void benchDeliverResult(iap::Result &res)
+{
+    iap::Stats *stats = iap::Stats::getInstance();
+    stats->dequeued(res.requestId);
+    BenchCallback *cb = s_callbacks.get(res.requestId);
+    if(!cb) {
+        stats->finish(res.requestId, true);
+        return;
+    }
+    StubValue value;
+    value.type = StubValue::NUL;
+    if(!res.records.empty()) {
+        check(stubRecordsToValue(res.records, value), "records decode");
+    } else if(!res.dom.empty()) {
+        stubDomToValue(res.dom, res.json, value);
+    }
+    stats->parsed(res.requestId);
+    cb->call(res.error, value);
+    s_lastItems = cb->items;
+    stats->finish(res.requestId, !res.error.empty());
+    s_callbacks.release(res.requestId);
+}
+
+///////////////////////////////////////
+//
+//  Catalog
+//
+///////////////////////////////////////
+
+static std::string skuName(int i)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "com.tapclap.gems.%05d", i);
+    return name;
+}
+
+static std::string productJson(int i)
+{
+    char json[512];
+    snprintf(json, sizeof(json),
+             "{\"productId\":\"%s\",\"type\":\"inapp\",\"price\":\"$%d.99\",\"price_amount_micros\":%d,"
+             "\"price_currency_code\":\"USD\",\"title\":\"Gems %d (Tap Clap)\",\"description\":\"A pile of %d gems\"}",
+             skuName(i).c_str(), i % 100, (i % 100) * 1000000 + 990000, i, (i + 1) * 10);
+    return json;
+}
+
+static std::u16string catalogJson(int count)
+{
+    std::string json = "[";
+    for(int i = 0; i < count; i++) {
+        if(i) json += ',';
+        json += productJson(i);
+    }
+    json += ']';
+    return iap::utf8ToUtf16(json);
+}
+
+static std::vector<uint8_t> catalogRecords(int count)
+{
+    iap::RecordWriter writer(true);
+    for(int i = 0; i < count; i++) {
+        char text[64];
+        writer.beginRecord();
+        writer.addString("productId", skuName(i));
+        writer.addString("type", "inapp");
+        snprintf(text, sizeof(text), "$%d.99", i % 100);
+        writer.addString("price", text);
+        writer.addInteger("price_amount_micros", (int64_t)(i % 100) * 1000000 + 990000);
+        writer.addString("price_currency_code", "USD");
+        snprintf(text, sizeof(text), "Gems %d (Tap Clap)", i);
+        writer.addString("title", text);
+        snprintf(text, sizeof(text), "A pile of %d gems", (i + 1) * 10);
+        writer.addString("description", text);
+        writer.endRecord();
+    }
+    return writer.finish();
+}
+
+///////////////////////////////////////
+//
+//  Benchmarks
+//
+///////////////////////////////////////
+
+static const int CATALOG_SIZES[] = { 10, 100, 1000, 10000 };
+
+// the Java side of the bridge: records what arrived
+static jsize s_javaArrayLength = -1;
+
+static void javaSide(JNIEnv *env, jmethodID method, va_list args)
+{
+    if(method->sig[1] == '[') {
+        jarray skus = va_arg(args, jarray);
+        s_javaArrayLength = env->GetArrayLength(skus);
+    }
+}
+
+static void benchMarshalling(iap::Backend *backend)
+{
+    JNIEnv *env = cocos2d::JniHelper::getEnv();
+    for(int size : CATALOG_SIZES) {
+        StubValue array;
+        array.type = StubValue::ARRAY;
+        for(int i = 0; i < size; i++) {
+            StubValue item;
+            item.type = StubValue::STRING;
+            item.string = iap::utf8ToUtf16(skuName(i));
+            array.items.push_back(item);
+        }
+        long refs = env->localRefs;
+        measure("marshal_product_details", size, [&](int i) {
+            std::vector<int> skus;
+            jsval_to_sku_handles(array, &skus);
+            backend->productDetails(skus, i + 1);
+        });
+        check(env->localRefs == refs, "product_details leaks no local refs");
+        check(s_javaArrayLength == size, "product_details passes every sku");
+
+        // the same skus as handles from iap.sku_handles()
+        StubValue handles;
+        handles.type = StubValue::ARRAY;
+        for(int i = 0; i < size; i++) {
+            StubValue item;
+            item.type = StubValue::NUMBER;
+            item.number = iap::SkuTable::getInstance()->find(skuName(i));
+            handles.items.push_back(item);
+        }
+        measure("marshal_product_details_handles", size, [&](int i) {
+            std::vector<int> skus;
+            jsval_to_sku_handles(handles, &skus);
+            backend->productDetails(skus, i + 1);
+        });
+        check(env->localRefs == refs, "product_details by handle leaks no local refs");
+        check(s_javaArrayLength == size, "product_details by handle passes every sku");
+    }
+
+    StubValue sku;
+    sku.type = StubValue::STRING;
+    sku.string = iap::utf8ToUtf16(skuName(7));
+    long refs = env->localRefs;
+    measure("marshal_buy", 1, [&](int i) {
+        std::string s;
+        jsval_to_std_string(sku, &s);
+        backend->buy(s, "payload", i + 1);
+    });
+    check(env->localRefs == refs, "buy leaks no local refs");
+}
+
+static void benchResults()
+{
+    JNIEnv *env = cocos2d::JniHelper::getEnv();
+    iap::Dispatcher *dispatcher = iap::Dispatcher::getInstance();
+    dispatcher->setFrameBudget(std::chrono::microseconds(0));
+
+    for(int size : CATALOG_SIZES) {
+        std::u16string text = catalogJson(size);
+        jstring json = env->NewString((const jchar*)text.data(), (jsize)text.size());
+        measure("result_json", size, [&](int) {
+            int id = s_callbacks.acquire();
+            Java_com_tapclap_inappbilling_InAppBillingPlugin_requestResult(env, nullptr, id, nullptr, json);
+            dispatcher->drain(benchDeliverResult);
+        });
+        check(s_lastItems == (size_t)size, "result_json delivers every product");
+        env->DeleteLocalRef(json);
+
+        // the JS thread's share of a JSON result: parsing the text there
+        // as before, against walking the document parsed off-thread
+        measure("js_thread_parse_json", size, [&](int) {
+            StubValue value;
+            StubParser parser(text.data(), text.data() + text.size());
+            check(parser.parse(value), "json parse");
+        });
+        iap::JsonDom dom;
+        measure("preparse_json", size, [&](int) {
+            check(dom.parse(text.data(), text.size()), "json preparse");
+        });
+        measure("js_thread_walk_dom", size, [&](int) {
+            StubValue value;
+            stubDomToValue(dom, text, value);
+            s_lastItems = value.items.size();
+        });
+        check(s_lastItems == (size_t)size, "the document holds every product");
+
+        std::vector<uint8_t> records = catalogRecords(size);
+        jobject buffer = env->NewDirectByteBuffer(records.data(), (jlong)records.size());
+        measure("result_records", size, [&](int) {
+            int id = s_callbacks.acquire();
+            Java_com_tapclap_inappbilling_InAppBillingPlugin_requestResultRecords(env, nullptr, id, buffer);
+            dispatcher->drain(benchDeliverResult);
+        });
+        check(s_lastItems == (size_t)size, "result_records delivers every product");
+        env->DeleteLocalRef(buffer);
+    }
+
+    // a purchase answer queued behind a flood of catalog events is delivered first
+    for(int size : CATALOG_SIZES) {
+        for(int i = 0; i < size; i++) {
+            iap::Result event;
+            event.requestId = iap::Billing::EVENT_CATALOG_CHANGED;
+            event.lane = iap::LANE_EVENT;
+            dispatcher->push(std::move(event));
+        }
+        iap::Result purchase;
+        purchase.requestId = 1;
+        purchase.lane = iap::LANE_PURCHASE;
+        dispatcher->push(std::move(purchase));
+        int first = 0;
+        dispatcher->drain([&](iap::Result &res) {
+                if(!first)
+                    first = res.requestId;
+            });
+        check(first == 1 && dispatcher->empty(), "purchase lane drains ahead of events");
+    }
+    // a malformed payload becomes an error before it is queued
+    std::u16string torn = catalogJson(10);
+    torn.resize(torn.size() / 2);
+    jstring tornJson = env->NewString((const jchar*)torn.data(), (jsize)torn.size());
+    int id = s_callbacks.acquire();
+    BenchCallback *cb = s_callbacks.get(id);
+    cb->error = false;
+    Java_com_tapclap_inappbilling_InAppBillingPlugin_requestResult(env, nullptr, id, nullptr, tornJson);
+    bool answered = false;
+    dispatcher->drain([&](iap::Result &res) {
+            answered = res.requestId == id && !res.error.empty() && res.dom.empty();
+            benchDeliverResult(res);
+        });
+    check(answered, "malformed json is answered with an error");
+    env->DeleteLocalRef(tornJson);
+    check(s_callbacks.inUse() == 0, "every callback released");
+}
+
+static void benchRegistry()
+{
+    static const int PENDING[] = { 10, 100, 1000 };
+    for(int pending : PENDING) {
+        std::vector<int> ids;
+        for(int i = 0; i < pending; i++)
+            ids.push_back(s_callbacks.acquire());
+        size_t found = 0;
+        measure("registry_get", pending, [&](int i) {
+            found += s_callbacks.get(ids[(i * 7919) % pending]) != nullptr;
+        });
+        check(found > 0, "registry finds pending callbacks");
+        measure("registry_acquire_release", pending, [&](int) {
+            s_callbacks.release(s_callbacks.acquire());
+        });
+        for(int id : ids)
+            s_callbacks.release(id);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1) {
+        s_label = argv[1];
+    }
+    JNIEnv *env = cocos2d::JniHelper::getEnv();
+    env->onCall = javaSide;
+
+    iap::Billing *billing = iap::Billing::getInstance();
+    billing->setBackend(iap::createPlatformBackend());
+    billing->setResultHandler(benchRequestResult);
+
+    benchMarshalling(billing->getBackend());
+    benchResults();
+    benchRegistry();
+
+    if(s_failures) {
+        fprintf(stderr, "%d checks failed\n", s_failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef fake_ccConfig_h
+#define fake_ccConfig_h
+
+// Stand-in for cocos2d-x base/ccConfig.h, nothing the benchmarks need.
+
+#endif /* fake_ccConfig_h */
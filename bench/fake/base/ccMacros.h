@@ -0,0 +1,8 @@
+#ifndef fake_ccMacros_h
+#define fake_ccMacros_h
+
+// Stand-in for cocos2d-x base/ccMacros.h: logging compiled out like a release build.
+
+#define CCLOG(format, ...) do {} while(0)
+
+#endif /* fake_ccMacros_h */
@@ -0,0 +1,6 @@
+#ifndef fake_firebase_admob_types_h
+#define fake_firebase_admob_types_h
+
+// Stand-in for the Firebase AdMob types header pulled in by Iap.hpp.
+
+#endif /* fake_firebase_admob_types_h */
@@ -0,0 +1,231 @@
+#ifndef fake_jni_h
+#define fake_jni_h
+
+// Minimal stand-in for <jni.h> used by the off-device benchmarks. The
+// environment keeps real bookkeeping (local/global refs, string copies,
+// class and method lookups through hash maps) so reflection and marshalling
+// costs stay visible, but no JVM is involved.
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+typedef uint8_t jboolean;
+typedef int8_t jbyte;
+typedef int32_t jint;
+typedef int64_t jlong;
+typedef uint16_t jchar;
+typedef jint jsize;
+
+struct _jobject { virtual ~_jobject() {} };
+struct _jclass : _jobject { std::string name; };
+struct _jstring : _jobject { std::string utf8; std::u16string utf16; };
+struct _jarray : _jobject { virtual jsize length() const = 0; };
+struct _jobjectArray : _jarray { std::vector<_jobject*> items; jsize length() const override { return (jsize)items.size(); } };
+struct _jbyteArray : _jarray { std::vector<jbyte> items; jsize length() const override { return (jsize)items.size(); } };
+struct _jbooleanArray : _jarray { std::vector<jboolean> items; jsize length() const override { return (jsize)items.size(); } };
+struct _jintArray : _jarray { std::vector<jint> items; jsize length() const override { return (jsize)items.size(); } };
+// java.nio direct buffer over native memory, not owned
+struct _jdirectBuffer : _jobject { void *address; jlong capacity; };
+struct _jmethodID { std::string name; std::string sig; };
+
+typedef _jobject* jobject;
+typedef _jclass* jclass;
+typedef _jstring* jstring;
+typedef _jarray* jarray;
+typedef _jobjectArray* jobjectArray;
+typedef _jbyteArray* jbyteArray;
+typedef _jbooleanArray* jbooleanArray;
+typedef _jintArray* jintArray;
+typedef _jmethodID* jmethodID;
+
+#define JNI_FALSE 0
+#define JNI_TRUE 1
+#define JNI_ABORT 2
+
+struct JNIEnv
+{
+    // bookkeeping exposed to benchmarks
+    long localRefs = 0;
+    long globalRefs = 0;
+    long classLookups = 0;
+    long methodLookups = 0;
+    long calls = 0;
+    // what the Java side returns from static boolean methods
+    jboolean callResult = JNI_TRUE;
+    // invoked for every static call, lets a benchmark play the Java side
+    void (*onCall)(JNIEnv *env, jmethodID method, va_list args) = nullptr;
+
+    std::unordered_map<std::string, _jclass*> classes;
+    std::unordered_map<std::string, _jmethodID*> methods;
+
+    ~JNIEnv() {
+        for(auto &it : classes) delete it.second;
+        for(auto &it : methods) delete it.second;
+    }
+
+    jclass FindClass(const char *name) {
+        classLookups++;
+        localRefs++;
+        _jclass *&cls = classes[name];
+        if(!cls) {
+            cls = new _jclass();
+            cls->name = name;
+        }
+        return cls;
+    }
+
+    jmethodID GetStaticMethodID(jclass cls, const char *name, const char *sig) {
+        methodLookups++;
+        std::string key = cls->name + "." + name + sig;
+        _jmethodID *&method = methods[key];
+        if(!method) {
+            method = new _jmethodID();
+            method->name = name;
+            method->sig = sig;
+        }
+        return method;
+    }
+
+    jobject NewGlobalRef(jobject obj) { globalRefs++; return obj; }
+    void DeleteGlobalRef(jobject) { globalRefs--; }
+
+    void DeleteLocalRef(jobject obj) {
+        if(!obj) return;
+        localRefs--;
+        if(dynamic_cast<_jclass*>(obj) == nullptr)
+            delete obj;
+    }
+
+    jstring NewStringUTF(const char *utf) {
+        localRefs++;
+        _jstring *s = new _jstring();
+        s->utf8 = utf;
+        return s;
+    }
+
+    jstring NewString(const jchar *chars, jsize len) {
+        localRefs++;
+        _jstring *s = new _jstring();
+        s->utf16.assign((const char16_t*)chars, len);
+        return s;
+    }
+
+    jsize GetStringLength(jstring s) { return (jsize)s->utf16.size(); }
+    const jchar* GetStringChars(jstring s, jboolean *isCopy) {
+        if(isCopy) *isCopy = JNI_FALSE;
+        return (const jchar*)s->utf16.data();
+    }
+    void ReleaseStringChars(jstring, const jchar *) {}
+    void GetStringRegion(jstring s, jsize start, jsize len, jchar *buf) {
+        memcpy(buf, s->utf16.data() + start, len * sizeof(jchar));
+    }
+    const char* GetStringUTFChars(jstring s, jboolean *isCopy) {
+        if(isCopy) *isCopy = JNI_TRUE;
+        char *copy = new char[s->utf8.size() + 1];
+        memcpy(copy, s->utf8.c_str(), s->utf8.size() + 1);
+        return copy;
+    }
+    void ReleaseStringUTFChars(jstring, const char *chars) { delete[] chars; }
+
+    jobjectArray NewObjectArray(jsize len, jclass, jobject init) {
+        localRefs++;
+        _jobjectArray *arr = new _jobjectArray();
+        arr->items.resize(len, init);
+        return arr;
+    }
+
+    void SetObjectArrayElement(jobjectArray arr, jsize index, jobject obj) {
+        arr->items[index] = obj;
+    }
+
+    jobject GetObjectArrayElement(jobjectArray arr, jsize index) {
+        if(arr->items[index]) localRefs++;
+        return arr->items[index];
+    }
+
+    jsize GetArrayLength(jarray arr) { return arr->length(); }
+
+    jbyteArray NewByteArray(jsize len) {
+        localRefs++;
+        _jbyteArray *arr = new _jbyteArray();
+        arr->items.resize(len);
+        return arr;
+    }
+    void GetByteArrayRegion(jbyteArray arr, jsize start, jsize len, jbyte *buf) {
+        memcpy(buf, arr->items.data() + start, len);
+    }
+    void SetByteArrayRegion(jbyteArray arr, jsize start, jsize len, const jbyte *buf) {
+        memcpy(arr->items.data() + start, buf, len);
+    }
+
+    jbooleanArray NewBooleanArray(jsize len) {
+        localRefs++;
+        _jbooleanArray *arr = new _jbooleanArray();
+        arr->items.resize(len);
+        return arr;
+    }
+    void SetBooleanArrayRegion(jbooleanArray arr, jsize start, jsize len, const jboolean *buf) {
+        memcpy(arr->items.data() + start, buf, len);
+    }
+
+    jintArray NewIntArray(jsize len) {
+        localRefs++;
+        _jintArray *arr = new _jintArray();
+        arr->items.resize(len);
+        return arr;
+    }
+    void GetIntArrayRegion(jintArray arr, jsize start, jsize len, jint *buf) {
+        memcpy(buf, arr->items.data() + start, len * sizeof(jint));
+    }
+    void SetIntArrayRegion(jintArray arr, jsize start, jsize len, const jint *buf) {
+        memcpy(arr->items.data() + start, buf, len * sizeof(jint));
+    }
+
+    void* GetPrimitiveArrayCritical(jarray arr, jboolean *isCopy) {
+        if(isCopy) *isCopy = JNI_FALSE;
+        if(_jbyteArray *bytes = dynamic_cast<_jbyteArray*>(arr)) return bytes->items.data();
+        if(_jbooleanArray *bools = dynamic_cast<_jbooleanArray*>(arr)) return bools->items.data();
+        if(_jintArray *ints = dynamic_cast<_jintArray*>(arr)) return ints->items.data();
+        return nullptr;
+    }
+    void ReleasePrimitiveArrayCritical(jarray, void *, jint) {}
+
+    jobject NewDirectByteBuffer(void *address, jlong capacity) {
+        localRefs++;
+        _jdirectBuffer *buffer = new _jdirectBuffer();
+        buffer->address = address;
+        buffer->capacity = capacity;
+        return buffer;
+    }
+    void* GetDirectBufferAddress(jobject buf) {
+        _jdirectBuffer *buffer = dynamic_cast<_jdirectBuffer*>(buf);
+        return buffer ? buffer->address : nullptr;
+    }
+    jlong GetDirectBufferCapacity(jobject buf) {
+        _jdirectBuffer *buffer = dynamic_cast<_jdirectBuffer*>(buf);
+        return buffer ? buffer->capacity : -1;
+    }
+
+    jboolean CallStaticBooleanMethod(jclass, jmethodID method, ...) {
+        calls++;
+        if(onCall) {
+            va_list args;
+            va_start(args, method);
+            onCall(this, method, args);
+            va_end(args);
+        }
+        return callResult;
+    }
+
+    bool exceptionPending = false;
+    jint ThrowNew(jclass, const char *) { exceptionPending = true; return 0; }
+    jboolean ExceptionCheck() { return exceptionPending ? JNI_TRUE : JNI_FALSE; }
+    void ExceptionDescribe() {}
+    void ExceptionClear() { exceptionPending = false; }
+};
+
+#endif /* fake_jni_h */
@@ -0,0 +1,13 @@
+#ifndef fake_jsapi_h
+#define fake_jsapi_h
+
+// Stand-in for SpiderMonkey's jsapi.h: only the names Iap.hpp declares with.
+
+struct JSContext;
+class JSObject;
+
+namespace JS {
+typedef JSObject* const& HandleObject;
+}
+
+#endif /* fake_jsapi_h */
@@ -0,0 +1,6 @@
+#ifndef fake_jsfriendapi_h
+#define fake_jsfriendapi_h
+
+// Stand-in for SpiderMonkey's jsfriendapi.h, nothing the benchmarks need.
+
+#endif /* fake_jsfriendapi_h */
@@ -0,0 +1,42 @@
+#ifndef fake_JniHelper_h
+#define fake_JniHelper_h
+
+// Stand-in for cocos2d::JniHelper backed by the fake JNIEnv from bench/fake/jni.h.
+
+#include <jni.h>
+
+namespace cocos2d {
+
+struct JniMethodInfo
+{
+    JNIEnv *env;
+    jclass classID;
+    jmethodID methodID;
+};
+
+class JniHelper
+{
+public:
+    static JNIEnv* getEnv() {
+        static JNIEnv env;
+        return &env;
+    }
+
+    static bool getStaticMethodInfo(JniMethodInfo &methodinfo, const char *className, const char *methodName, const char *paramCode) {
+        JNIEnv *env = getEnv();
+        jclass classID = env->FindClass(className);
+        jmethodID methodID = env->GetStaticMethodID(classID, methodName, paramCode);
+        if(!methodID) {
+            env->DeleteLocalRef(classID);
+            return false;
+        }
+        methodinfo.env = env;
+        methodinfo.classID = classID;
+        methodinfo.methodID = methodID;
+        return true;
+    }
+};
+
+} // namespace cocos2d
+
+#endif /* fake_JniHelper_h */
@@ -0,0 +1,89 @@
+// JNI bridge benchmark: per-call JniHelper lookups (the old callMethodN
+// helpers) against the cached iap::jni::StaticMethod bridge.
+//
+// build: g++ -std=c++11 -O2 -Ifake -I../Classes jni_bridge_bench.cpp -o jni_bridge_bench
+
+#include "IapJni.h"
+#include <chrono>
+#include <cstdio>
+
+static const int ITERATIONS = 200000;
+
+// the pre-bridge helper, kept as it was (warnings aside) for comparison
+static bool legacyCallMethod2(const char* method, const std::vector<std::string> &param, int callbackId) {
+    cocos2d::JniMethodInfo methodInfo;
+
+    if (! cocos2d::JniHelper::getStaticMethodInfo(methodInfo, "com/tapclap/inappbilling/InAppBillingPlugin", method, "([Ljava/lang/String;I)Z")) {
+        return false;
+    }
+    jobjectArray args = 0;
+    args = methodInfo.env->NewObjectArray(param.size(), methodInfo.env->FindClass("java/lang/String"), 0);
+    for(size_t i=0; i<param.size(); i++) {
+        jstring s = methodInfo.env->NewStringUTF(param[i].c_str());
+        methodInfo.env->SetObjectArrayElement(args, i, s);
+    }
+    methodInfo.env->CallStaticBooleanMethod(methodInfo.classID, methodInfo.methodID, args, callbackId);
+    methodInfo.env->DeleteLocalRef(args);
+    methodInfo.env->DeleteLocalRef(methodInfo.classID);
+    return true;
+}
+
+static bool legacyCallMethod3(const char* method, const std::string &param1, const std::string &param2, int callbackId) {
+    cocos2d::JniMethodInfo methodInfo;
+
+    if (! cocos2d::JniHelper::getStaticMethodInfo(methodInfo, "com/tapclap/inappbilling/InAppBillingPlugin", method, "(Ljava/lang/String;Ljava/lang/String;I)Z")) {
+        return false;
+    }
+    jstring s1 = methodInfo.env->NewStringUTF(param1.c_str());
+    jstring s2 = methodInfo.env->NewStringUTF(param2.c_str());
+    methodInfo.env->CallStaticBooleanMethod(methodInfo.classID, methodInfo.methodID, s1, s2, callbackId);
+    methodInfo.env->DeleteLocalRef(s2);
+    methodInfo.env->DeleteLocalRef(s1);
+    methodInfo.env->DeleteLocalRef(methodInfo.classID);
+    return true;
+}
+
+template<typename F>
+static void run(const char *name, F f)
+{
+    JNIEnv *env = cocos2d::JniHelper::getEnv();
+    long refs = env->localRefs;
+    long classLookups = env->classLookups;
+    long methodLookups = env->methodLookups;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < ITERATIONS; i++) {
+        f(i);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-34s %12.0f ops/s  leaked local refs %8ld  class lookups %8ld  method lookups %8ld\n",
+           name, ITERATIONS / seconds, env->localRefs - refs,
+           env->classLookups - classLookups, env->methodLookups - methodLookups);
+}
+
+int main()
+{
+    static_assert(sizeof(iap::jni::MethodSignature<std::vector<std::string>, bool, int>::type::value) == sizeof("([Ljava/lang/String;ZI)Z"), "signature length");
+    printf("init signature: %s\n", iap::jni::StaticMethod<std::vector<std::string>, bool, int>::signature());
+
+    std::vector<std::string> skus;
+    for(int i = 0; i < 10; i++) {
+        skus.push_back("com.tapclap.sku." + std::to_string(i));
+    }
+    const std::string sku = "com.tapclap.gems.100";
+    const std::string payload = "payload";
+
+    iap::jni::StaticMethod<std::vector<std::string>, int> productDetails("getProductDetails");
+    iap::jni::StaticMethod<std::vector<int>, int> productDetailsByHandle("getProductDetailsByHandle");
+    std::vector<int> handles;
+    for(int i = 0; i < 10; i++) {
+        handles.push_back(i);
+    }
+    iap::jni::StaticMethod<std::string, std::string, int> buy("buy");
+
+    run("legacy product_details(10)", [&](int i) { legacyCallMethod2("getProductDetails", skus, i); });
+    run("bridge product_details(10)", [&](int i) { productDetails(skus, i); });
+    run("bridge product_details handles(10)", [&](int i) { productDetailsByHandle(handles, i); });
+    run("legacy buy", [&](int i) { legacyCallMethod3("buy", sku, payload, i); });
+    run("bridge buy", [&](int i) { buy(sku, payload, i); });
+    return 0;
+}
@@ -0,0 +1,122 @@
+// Data model benchmark: sorting and filtering a product catalog held as
+// per-product objects (what each platform builds per call today: one
+// dictionary of strings per product, prices parsed on every comparison)
+// against the struct-of-arrays ProductTable (IapModel.h).
+//
+// build: g++ -std=c++11 -O2 -I../Classes model_bench.cpp ../Classes/IapModel.cpp ../Classes/IapTimerWheel.cpp ../Classes/IapTrace.cpp ../Classes/IapJsonScan.cpp ../Classes/IapSkuTable.cpp ../Classes/IapInventory.cpp ../Classes/IapBilling.cpp ../Classes/IapCatalogCache.cpp ../Classes/IapScheduler.cpp ../Classes/IapRecords.cpp ../Classes/IapJournal.cpp ../Classes/IapStats.cpp -pthread -o model_bench
+
+#include "IapModel.h"
+#include "IapJsonScan.h"
+#include "IapResult.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+static const int ITERATIONS = 200;
+
+typedef std::map<std::string, std::string> Dictionary;
+
+static std::u16string makeCatalog(int count)
+{
+    std::string json = "[";
+    srand(7);
+    for(int i = 0; i < count; i++) {
+        int micros = (rand() % 10000) * 10000;
+        char item[512];
+        snprintf(item, sizeof(item),
+                 "%s{\"productId\":\"sku_%05d\",\"type\":\"%s\",\"price\":\"$%d.%02d\",\"price_amount_micros\":%d,"
+                 "\"price_currency_code\":\"USD\",\"title\":\"Item %d\",\"description\":\"Product number %d\"}",
+                 i ? "," : "", i, i % 5 ? "inapp" : "subs", micros / 1000000, (micros / 10000) % 100, micros, i, i);
+        json += item;
+    }
+    json += "]";
+    return iap::utf8ToUtf16(json);
+}
+
+// one dictionary of UTF-8 strings per product
+static std::vector<Dictionary> toDictionaries(const std::u16string &json)
+{
+    std::vector<Dictionary> out;
+    std::vector<iap::JsonSpan> items;
+    std::vector<iap::JsonMember> members;
+    iap::jsonArrayItems(json.data(), json.data() + json.size(), items);
+    for(const iap::JsonSpan &item : items) {
+        members.clear();
+        iap::jsonObjectMembers(item.begin, item.end, members);
+        Dictionary dict;
+        for(const iap::JsonMember &m : members) {
+            std::string name(m.name.begin, m.name.end);
+            std::u16string value;
+            if(iap::jsonUnescape(m.value.begin, m.value.end, value))
+                dict[name] = std::string(value.begin(), value.end());
+            else
+                dict[name] = std::string(m.value.begin, m.value.end);
+        }
+        out.push_back(std::move(dict));
+    }
+    return out;
+}
+
+template<typename F>
+static double measure(F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < ITERATIONS; i++) {
+        f();
+    }
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / ITERATIONS;
+}
+
+int main()
+{
+    static const int SIZES[] = { 100, 1000, 10000 };
+    printf("%8s %12s %14s %14s %14s %14s\n", "products", "load us", "dict sort us", "table sort us", "dict filter us", "table filter us");
+    for(int size : SIZES) {
+        std::u16string json = makeCatalog(size);
+        std::vector<Dictionary> dicts = toDictionaries(json);
+        iap::ProductTable table;
+        double loadUs = measure([&] { table.load(json); });
+
+        std::vector<const Dictionary*> sorted;
+        double dictSortUs = measure([&] {
+            sorted.clear();
+            for(const Dictionary &d : dicts)
+                sorted.push_back(&d);
+            std::stable_sort(sorted.begin(), sorted.end(), [](const Dictionary *a, const Dictionary *b) {
+                    return atoll(a->find("price_amount_micros")->second.c_str()) < atoll(b->find("price_amount_micros")->second.c_str());
+                });
+        });
+        std::vector<uint32_t> rows;
+        iap::ProductTable::Query byPrice;
+        byPrice.sort = iap::ProductTable::SORT_PRICE;
+        double tableSortUs = measure([&] { table.query(byPrice, rows); });
+        if(rows.size() != sorted.size()
+           || table.priceMicros(rows.front()) != atoll(sorted.front()->find("price_amount_micros")->second.c_str())) {
+            printf("sort results differ for %d products\n", size);
+            return 1;
+        }
+
+        std::vector<const Dictionary*> matched;
+        double dictFilterUs = measure([&] {
+            matched.clear();
+            for(const Dictionary &d : dicts) {
+                long long micros = atoll(d.find("price_amount_micros")->second.c_str());
+                if(d.find("type")->second == "inapp" && micros >= 10000000 && micros <= 50000000)
+                    matched.push_back(&d);
+            }
+        });
+        iap::ProductTable::Query range;
+        range.type = iap::ProductTable::TYPE_INAPP;
+        range.minPriceMicros = 10000000;
+        range.maxPriceMicros = 50000000;
+        double tableFilterUs = measure([&] { table.query(range, rows); });
+        if(rows.size() != matched.size()) {
+            printf("filter results differ for %d products\n", size);
+            return 1;
+        }
+        printf("%8d %12.1f %14.1f %14.1f %14.1f %14.1f\n", size, loadUs, dictSortUs, tableSortUs, dictFilterUs, tableFilterUs);
+    }
+    return 0;
+}
@@ -0,0 +1,168 @@
+// Trace replay benchmark: plays recorded store traffic (IapTrace.h) back
+// through Billing, the dispatcher and Stats at recorded and accelerated
+// speed, and reports throughput and callback latency per operation.
+//
+// replay_bench <trace>     replays a trace recorded with iap.start_trace
+// replay_bench             first records one against the simulated store:
+//                          init with a large catalog, a restore storm, a
+//                          purchase burst, bulk consumes and product queries
+//
+// The delivery step mirrors cpp_requestResult / cpp_deliverResult in
+// IapJs.cpp without the JS values. Each speed is printed as one JSON line.
+//
+// build: g++ -std=c++11 -O2 -I../Classes replay_bench.cpp ../Classes/IapTrace.cpp ../Classes/IapSimulatedStore.cpp ../Classes/IapBilling.cpp ../Classes/IapScheduler.cpp ../Classes/IapCatalogCache.cpp ../Classes/IapRecords.cpp ../Classes/IapJsonScan.cpp ../Classes/IapJsonDom.cpp ../Classes/IapJournal.cpp ../Classes/IapStats.cpp ../Classes/IapInventory.cpp ../Classes/IapSkuTable.cpp ../Classes/IapProductStore.cpp ../Classes/IapModel.cpp ../Classes/IapTimerWheel.cpp ../Classes/IapDispatcher.cpp -pthread -o replay_bench
+
+#include "IapBilling.h"
+#include "IapDispatcher.h"
+#include "IapJsonDom.h"
+#include "IapSimulatedStore.h"
+#include "IapStats.h"
+#include "IapTrace.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+static const int CATALOG_SIZE = 2000;
+static const int INIT_SKUS = 300;
+static const int PURCHASES = 60;
+static const int RESTORES = 40;
+static const int DETAIL_QUERIES = 20;
+
+static int s_delivered = 0;
+
+static void deliver(iap::Result &res)
+{
+    iap::Stats *stats = iap::Stats::getInstance();
+    stats->dequeued(res.requestId);
+    stats->parsed(res.requestId);
+    stats->finish(res.requestId, !res.error.empty());
+    if(res.requestId > 0)
+        s_delivered++;
+}
+
+// one frame of the cocos thread
+static void frame()
+{
+    iap::Billing::getInstance()->expire();
+    iap::Dispatcher::getInstance()->drain(deliver);
+}
+
+static void waitFor(int delivered)
+{
+    while(s_delivered < delivered) {
+        frame();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static bool record(const std::string &path)
+{
+    iap::SimulatedStoreConfig config;
+    config.catalogSize = CATALOG_SIZE;
+    config.minLatencyUs = 20000;
+    config.maxLatencyUs = 120000;
+    config.failureRate = 0.02;
+    iap::Billing *billing = iap::Billing::getInstance();
+    billing->setBackend(new iap::SimulatedStore(config));
+    if(!billing->startTrace(path)) {
+        return false;
+    }
+
+    int id = 1;
+    std::vector<std::string> skus;
+    for(int i = 0; i < INIT_SKUS; i++)
+        skus.push_back(iap::SimulatedStore::skuName(i));
+    billing->init(skus, false, id++);
+    waitFor(id - 1);
+
+    // restore storm: every screen asks at once
+    for(int i = 0; i < RESTORES; i++) {
+        billing->restore(id++);
+        billing->getPurchases(id++);
+    }
+    // purchase burst, then one bulk consume
+    std::vector<std::string> bought;
+    for(int i = 0; i < PURCHASES; i++) {
+        bought.push_back(iap::SimulatedStore::skuName(INIT_SKUS + i));
+        billing->buy(bought.back(), "", id++);
+    }
+    waitFor(id - 1);
+    billing->consumeMany(bought, id++);
+    // product pages beyond the init catalog
+    for(int i = 0; i < DETAIL_QUERIES; i++) {
+        std::vector<std::string> page;
+        for(int j = 0; j < 50; j++)
+            page.push_back(iap::SimulatedStore::skuName(INIT_SKUS + PURCHASES + (i * 50 + j) % (CATALOG_SIZE - INIT_SKUS - PURCHASES)));
+        billing->productDetails(page, id++);
+    }
+    billing->availableProducts(id++);
+    waitFor(id - 1);
+    billing->stopTrace();
+    return true;
+}
+
+static void replay(const std::vector<iap::TraceEntry> &entries, double speed)
+{
+    iap::Stats *stats = iap::Stats::getInstance();
+    stats->reset();
+    s_delivered = 0;
+    iap::TraceReplay replay(entries, speed);
+    auto start = std::chrono::steady_clock::now();
+    replay.start(iap::Billing::getInstance());
+    while(replay.step() || !iap::Dispatcher::getInstance()->empty()) {
+        frame();
+        uint64_t idle = replay.idleMicros();
+        std::this_thread::sleep_for(std::chrono::microseconds(idle > 0 && idle < 1000 ? idle : 1000));
+    }
+    frame();
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    printf("{\"speed\":%g,\"requests\":%zu,\"callbacks\":%d,\"store_calls\":%zu,\"unmatched\":%zu,\"wall_ms\":%.1f,\"callbacks_per_s\":%.0f,\"ops\":{",
+           speed, replay.requestsIssued(), s_delivered, replay.storeCalls(), replay.unmatched(), wallMs,
+           wallMs > 0 ? s_delivered * 1000.0 / wallMs : 0.0);
+    bool first = true;
+    for(int op = 0; op < iap::Stats::OP_COUNT; op++) {
+        const iap::LatencyHistogram &total = stats->histogram((iap::Stats::Operation)op, iap::Stats::STAGE_TOTAL);
+        const iap::LatencyHistogram &delivery = stats->histogram((iap::Stats::Operation)op, iap::Stats::STAGE_DELIVERY);
+        if(total.count() == 0) {
+            continue;
+        }
+        printf("%s\"%s\":{\"count\":%llu,\"total_p50_ms\":%.2f,\"total_p99_ms\":%.2f,\"delivery_p50_ms\":%.3f,\"delivery_p99_ms\":%.3f}",
+               first ? "" : ",", iap::Stats::operationName((iap::Stats::Operation)op), (unsigned long long)total.count(),
+               total.percentile(0.5) / 1000.0, total.percentile(0.99) / 1000.0,
+               delivery.percentile(0.5) / 1000.0, delivery.percentile(0.99) / 1000.0);
+        first = false;
+    }
+    printf("}}\n");
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    iap::Billing *billing = iap::Billing::getInstance();
+    billing->setResultHandler([](iap::Result &&result) {
+            iap::preparseResult(result);
+            iap::Stats::getInstance()->queued(result.requestId);
+            iap::Dispatcher::getInstance()->push(std::move(result));
+        });
+
+    std::string path = argc > 1 ? argv[1] : "replay_bench_trace.bin";
+    if(argc <= 1 && !record(path)) {
+        fprintf(stderr, "could not record %s\n", path.c_str());
+        return 1;
+    }
+    std::vector<iap::TraceEntry> entries;
+    if(!iap::readTrace(path, entries)) {
+        fprintf(stderr, "could not read %s\n", path.c_str());
+        return 1;
+    }
+    fprintf(stderr, "%s: %zu entries over %.1f s\n", path.c_str(), entries.size(),
+            entries.empty() ? 0.0 : entries.back().micros / 1e6);
+
+    static const double SPEEDS[] = { 1, 10, 0 };
+    for(double speed : SPEEDS) {
+        replay(entries, speed);
+    }
+    return 0;
+}
@@ -0,0 +1,327 @@
+// Result encoding benchmark: JSON text (serialize on the store side, parse
+// on ours) against binary records (IapRecords.h) for product lists.
+//
+// JS object construction cannot run off-device, so both paths decode into
+// the same small object model instead. Property names are looked up in an
+// intern table like the engine atomizes them: once per key occurrence for
+// JSON, once per result for records.
+//
+// build: g++ -std=c++11 -O2 -I../Classes result_encoding_bench.cpp ../Classes/IapRecords.cpp ../Classes/IapBilling.cpp ../Classes/IapCatalogCache.cpp ../Classes/IapScheduler.cpp ../Classes/IapJsonScan.cpp ../Classes/IapJournal.cpp ../Classes/IapStats.cpp ../Classes/IapInventory.cpp ../Classes/IapSkuTable.cpp ../Classes/IapModel.cpp ../Classes/IapTimerWheel.cpp ../Classes/IapTrace.cpp -pthread -o result_encoding_bench
+
+#include "IapRecords.h"
+#include "IapResult.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <unordered_map>
+
+static const int ITERATIONS = 2000;
+
+struct Product
+{
+    std::string productId;
+    std::string type;
+    std::string price;
+    long long priceMicros;
+    std::string currency;
+    std::string title;
+    std::string description;
+};
+
+///////////////////////////////////////
+//
+//  Decoded object model
+//
+///////////////////////////////////////
+
+struct Value
+{
+    int type; // iap::RecordType
+    std::u16string str;
+    double number;
+};
+
+struct Object
+{
+    std::vector<std::pair<const std::u16string*, Value>> props;
+};
+
+class Atoms
+{
+public:
+    const std::u16string* intern(const char16_t *chars, size_t length) {
+        std::unique_ptr<std::u16string> &atom = _atoms[std::u16string(chars, length)];
+        if(!atom)
+            atom.reset(new std::u16string(chars, length));
+        return atom.get();
+    }
+
+private:
+    std::unordered_map<std::u16string, std::unique_ptr<std::u16string>> _atoms;
+};
+
+///////////////////////////////////////
+//
+//  JSON path
+//
+///////////////////////////////////////
+
+static void appendQuoted(std::u16string &out, const std::string &str)
+{
+    out += u'"';
+    for(char c : str) {
+        if(c == '"' || c == '\\')
+            out += u'\\';
+        out += (char16_t)c;
+    }
+    out += u'"';
+}
+
+// what JSONArray.toString() hands over, already UTF-16
+static std::u16string toJson(const std::vector<Product> &products)
+{
+    std::u16string out = u"[";
+    for(const Product &p : products) {
+        if(out.size() > 1)
+            out += u',';
+        out += u"{\"productId\":"; appendQuoted(out, p.productId);
+        out += u",\"type\":"; appendQuoted(out, p.type);
+        out += u",\"price\":"; appendQuoted(out, p.price);
+        out += u",\"price_amount_micros\":";
+        for(char c : std::to_string(p.priceMicros))
+            out += (char16_t)c;
+        out += u",\"price_currency_code\":"; appendQuoted(out, p.currency);
+        out += u",\"title\":"; appendQuoted(out, p.title);
+        out += u",\"description\":"; appendQuoted(out, p.description);
+        out += u'}';
+    }
+    out += u']';
+    return out;
+}
+
+static void skipSpace(const char16_t *&p)
+{
+    while(*p == u' ' || *p == u'\n' || *p == u'\t' || *p == u'\r')
+        p++;
+}
+
+static bool parseString(const char16_t *&p, std::u16string &out)
+{
+    out.clear();
+    p++;
+    while(*p && *p != u'"') {
+        if(*p == u'\\') {
+            p++;
+            switch(*p) {
+                case u'n': out += u'\n'; break;
+                case u't': out += u'\t'; break;
+                case u'r': out += u'\r'; break;
+                default: out += *p;
+            }
+            p++;
+        } else {
+            out += *p++;
+        }
+    }
+    if(*p != u'"')
+        return false;
+    p++;
+    return true;
+}
+
+// flat objects only, enough for the product shape
+static bool parseJson(const std::u16string &json, Atoms &atoms, std::vector<Object> &out)
+{
+    const char16_t *p = json.c_str();
+    std::u16string key;
+    skipSpace(p);
+    if(*p++ != u'[')
+        return false;
+    skipSpace(p);
+    while(*p == u'{') {
+        p++;
+        Object obj;
+        skipSpace(p);
+        while(*p == u'"') {
+            if(!parseString(p, key))
+                return false;
+            const std::u16string *atom = atoms.intern(key.data(), key.size());
+            skipSpace(p);
+            if(*p++ != u':')
+                return false;
+            skipSpace(p);
+            Value value;
+            value.number = 0;
+            if(*p == u'"') {
+                value.type = iap::RECORD_STRING;
+                if(!parseString(p, value.str))
+                    return false;
+            } else {
+                value.type = iap::RECORD_NUMBER;
+                char buf[64];
+                size_t n = 0;
+                while(n < sizeof(buf) - 1 && ((*p >= u'0' && *p <= u'9') || *p == u'-' || *p == u'.' || *p == u'e' || *p == u'E' || *p == u'+'))
+                    buf[n++] = (char)*p++;
+                buf[n] = 0;
+                value.number = strtod(buf, nullptr);
+            }
+            obj.props.emplace_back(atom, std::move(value));
+            skipSpace(p);
+            if(*p == u',') {
+                p++;
+                skipSpace(p);
+            }
+        }
+        if(*p++ != u'}')
+            return false;
+        out.push_back(std::move(obj));
+        skipSpace(p);
+        if(*p == u',') {
+            p++;
+            skipSpace(p);
+        }
+    }
+    return *p == u']';
+}
+
+///////////////////////////////////////
+//
+//  Records path
+//
+///////////////////////////////////////
+
+static std::vector<uint8_t> toRecords(const std::vector<Product> &products)
+{
+    iap::RecordWriter writer(true);
+    for(const Product &p : products) {
+        writer.beginRecord();
+        writer.addString("productId", p.productId);
+        writer.addString("type", p.type);
+        writer.addString("price", p.price);
+        writer.addInteger("price_amount_micros", p.priceMicros);
+        writer.addString("price_currency_code", p.currency);
+        writer.addString("title", p.title);
+        writer.addString("description", p.description);
+        writer.endRecord();
+    }
+    return writer.finish();
+}
+
+static bool decodeRecords(const std::vector<uint8_t> &records, Atoms &atoms, std::vector<Object> &out)
+{
+    iap::RecordReader reader(records.data(), records.size());
+    if(!reader.valid())
+        return false;
+    std::vector<const std::u16string*> keys(reader.keyCount());
+    for(uint32_t i = 0; i < reader.keyCount(); i++) {
+        uint32_t length;
+        const char16_t *chars = reader.key(i, length);
+        keys[i] = atoms.intern(chars, length);
+    }
+    uint32_t fieldCount;
+    iap::RecordField field;
+    while(reader.nextRecord(fieldCount)) {
+        Object obj;
+        obj.props.reserve(fieldCount);
+        while(reader.nextField(field)) {
+            Value value;
+            value.type = field.type;
+            value.number = field.number;
+            if(field.type == iap::RECORD_STRING)
+                value.str.assign(field.str, field.length);
+            obj.props.emplace_back(keys[field.key], std::move(value));
+        }
+        out.push_back(std::move(obj));
+    }
+    return reader.valid();
+}
+
+///////////////////////////////////////
+//
+//  Benchmark
+//
+///////////////////////////////////////
+
+static std::vector<Product> makeProducts(int count)
+{
+    std::vector<Product> products;
+    for(int i = 0; i < count; i++) {
+        char sku[16];
+        snprintf(sku, sizeof(sku), "sku_%05d", i);
+        Product p;
+        p.productId = sku;
+        p.type = "inapp";
+        p.price = "$" + std::to_string(i % 100) + ".99";
+        p.priceMicros = 990000 + (i % 100) * 1000000LL;
+        p.currency = "USD";
+        p.title = "Simulated item " + std::to_string(i) + " (Game \"Title\")";
+        p.description = "Simulated in-app product number " + std::to_string(i);
+        products.push_back(p);
+    }
+    return products;
+}
+
+template<typename F>
+static double measure(F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < ITERATIONS; i++)
+        f();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / ITERATIONS;
+}
+
+static bool sameObjects(const std::vector<Object> &a, const std::vector<Object> &b)
+{
+    if(a.size() != b.size())
+        return false;
+    for(size_t i = 0; i < a.size(); i++) {
+        if(a[i].props.size() != b[i].props.size())
+            return false;
+        for(size_t j = 0; j < a[i].props.size(); j++) {
+            const Value &x = a[i].props[j].second;
+            const Value &y = b[i].props[j].second;
+            // the records keep integers apart from doubles, JSON does not
+            bool sameType = x.type == y.type || (x.type != iap::RECORD_STRING && y.type != iap::RECORD_STRING);
+            if(a[i].props[j].first != b[i].props[j].first || !sameType || x.str != y.str || x.number != y.number)
+                return false;
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    const int sizes[] = { 10, 100, 1000 };
+    printf("%8s %14s %14s %10s %12s %12s\n", "products", "json us", "records us", "speedup", "json bytes", "rec bytes");
+    for(int size : sizes) {
+        std::vector<Product> products = makeProducts(size);
+        Atoms atoms;
+
+        // both paths must produce the same objects
+        std::vector<Object> fromJson, fromRecords;
+        std::u16string json = toJson(products);
+        std::vector<uint8_t> records = toRecords(products);
+        if(!parseJson(json, atoms, fromJson) || !decodeRecords(records, atoms, fromRecords) || !sameObjects(fromJson, fromRecords)) {
+            printf("decoded objects differ for %d products\n", size);
+            return 1;
+        }
+        std::u16string roundTrip;
+        if(!iap::recordsToJson(records, roundTrip)) {
+            printf("recordsToJson failed\n");
+            return 1;
+        }
+
+        double jsonUs = measure([&] {
+            std::vector<Object> out;
+            parseJson(toJson(products), atoms, out);
+        });
+        double recordsUs = measure([&] {
+            std::vector<Object> out;
+            decodeRecords(toRecords(products), atoms, out);
+        });
+        printf("%8d %14.2f %14.2f %9.2fx %12zu %12zu\n", size, jsonUs, recordsUs, jsonUs / recordsUs,
+               json.size() * sizeof(char16_t), records.size());
+    }
+    return 0;
+}
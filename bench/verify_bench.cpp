@@ -0,0 +1,177 @@
+// Purchase signature verification: correctness against OpenSSL-generated
+// keys and signatures, then throughput of iap::PurchaseVerifier (single
+// call, batch) next to OpenSSL's own verify. OpenSSL is only used here to
+// make test keys, the verifier itself has no dependencies.
+//
+// build: g++ -std=c++11 -O2 -I../Classes verify_bench.cpp ../Classes/IapVerifier.cpp ../Classes/IapBase64.cpp -lcrypto -pthread -o verify_bench
+
+#include "IapBase64.h"
+#include "IapVerifier.h"
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <thread>
+
+static const int PURCHASES = 256;
+
+static EVP_PKEY* generateKey(int bits)
+{
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr);
+    EVP_PKEY *key = nullptr;
+    if(ctx && EVP_PKEY_keygen_init(ctx) > 0 && EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, bits) > 0)
+        EVP_PKEY_keygen(ctx, &key);
+    EVP_PKEY_CTX_free(ctx);
+    return key;
+}
+
+static std::string publicKeyBase64(EVP_PKEY *key)
+{
+    unsigned char *der = nullptr;
+    int size = i2d_PUBKEY(key, &der);
+    std::string out = iap::base64Encode(der, size);
+    OPENSSL_free(der);
+    return out;
+}
+
+static std::vector<uint8_t> sign(EVP_PKEY *key, const std::string &data)
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    size_t size = 0;
+    std::vector<uint8_t> sig;
+    EVP_DigestSignInit(ctx, nullptr, EVP_sha1(), nullptr, key);
+    EVP_DigestSign(ctx, nullptr, &size, (const unsigned char*)data.data(), data.size());
+    sig.resize(size);
+    EVP_DigestSign(ctx, sig.data(), &size, (const unsigned char*)data.data(), data.size());
+    sig.resize(size);
+    EVP_MD_CTX_free(ctx);
+    return sig;
+}
+
+static bool opensslVerify(EVP_PKEY *key, const std::string &data, const std::vector<uint8_t> &sig)
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    EVP_DigestVerifyInit(ctx, nullptr, EVP_sha1(), nullptr, key);
+    bool ok = EVP_DigestVerify(ctx, sig.data(), sig.size(), (const unsigned char*)data.data(), data.size()) == 1;
+    EVP_MD_CTX_free(ctx);
+    return ok;
+}
+
+static std::string purchaseJson(int i)
+{
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "{\"orderId\":\"GPA.0000-0000-0000-%05d\",\"packageName\":\"com.tapclap.simulated\",\"productId\":\"sku_%05d\","
+             "\"purchaseTime\":%lld,\"purchaseState\":0,\"developerPayload\":\"payload %d \\u00e9\",\"purchaseToken\":\"token-%d\"}",
+             i, i % 100, 1500000000000LL + i, i, i);
+    return buf;
+}
+
+template<typename F>
+static double perCallUs(int count, F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+static int check(bool condition, const char *what)
+{
+    if(!condition)
+        printf("FAILED: %s\n", what);
+    return condition ? 0 : 1;
+}
+
+int main()
+{
+    int failures = 0;
+    const int keySizes[] = { 1024, 2048, 3072 };
+    for(int bits : keySizes) {
+        EVP_PKEY *key = generateKey(bits);
+        EVP_PKEY *otherKey = generateKey(bits);
+        if(!key || !otherKey) {
+            printf("key generation failed\n");
+            return 1;
+        }
+
+        iap::PurchaseVerifier verifier;
+        failures += check(verifier.setPublicKey(publicKeyBase64(key)), "parse public key");
+        failures += check(!verifier.setPublicKey("not a key"), "reject garbage key");
+
+        std::vector<iap::SignedPurchase> purchases(PURCHASES);
+        std::vector<std::vector<uint8_t>> raw(PURCHASES);
+        for(int i = 0; i < PURCHASES; i++) {
+            purchases[i].data = purchaseJson(i);
+            raw[i] = sign(i % 16 == 15 ? otherKey : key, purchases[i].data);
+            purchases[i].signature = iap::base64Encode(raw[i].data(), raw[i].size());
+        }
+        // tamper with a few: data, signature bits, truncated signature
+        purchases[3].data[10] ^= 1;
+        purchases[5].signature[20] = purchases[5].signature[20] == 'A' ? 'B' : 'A';
+        purchases[7].signature.resize(purchases[7].signature.size() - 4);
+
+        std::vector<uint8_t> results;
+        verifier.verifyBatch(purchases, results);
+        std::vector<uint8_t> parallel;
+        verifier.verifyBatch(purchases, parallel, 4);
+        // the async form answers on the verifier's thread, a bad key with no results
+        std::promise<std::vector<uint8_t>> answered;
+        std::promise<bool> rejected;
+        verifier.verifyAsync(publicKeyBase64(key), purchases, [&answered](bool keyOk, const std::vector<uint8_t> &r) {
+            answered.set_value(keyOk ? r : std::vector<uint8_t>());
+        });
+        verifier.verifyAsync("not a key", purchases, [&rejected](bool keyOk, const std::vector<uint8_t> &r) {
+            rejected.set_value(!keyOk && r.empty());
+        });
+        failures += check(answered.get_future().get() == results, "async batch matches");
+        failures += check(rejected.get_future().get(), "async rejects garbage key");
+
+        for(int i = 0; i < PURCHASES; i++) {
+            bool expected = i != 3 && i != 5 && i != 7 && i % 16 != 15;
+            char what[64];
+            snprintf(what, sizeof(what), "purchase %d with %d bit key", i, bits);
+            failures += check((results[i] != 0) == expected, what);
+            failures += check(results[i] == parallel[i], "parallel batch matches");
+            failures += check(verifier.verify(purchases[i].data, purchases[i].signature) == expected, "single verify");
+        }
+
+        // throughput on the valid signatures only
+        std::vector<iap::SignedPurchase> valid;
+        std::vector<std::vector<uint8_t>> validRaw;
+        for(int i = 0; i < PURCHASES; i++) {
+            if(results[i]) {
+                valid.push_back(purchases[i]);
+                validRaw.push_back(raw[i]);
+            }
+        }
+        double single = perCallUs((int)valid.size(), [&] {
+            for(const iap::SignedPurchase &p : valid)
+                verifier.verify(p.data, p.signature);
+        });
+        double batch = perCallUs((int)valid.size(), [&] {
+            std::vector<uint8_t> r;
+            verifier.verifyBatch(valid, r);
+        });
+        double openssl = perCallUs((int)valid.size(), [&] {
+            for(size_t i = 0; i < valid.size(); i++)
+                opensslVerify(key, valid[i].data, validRaw[i]);
+        });
+        // what Security.verifyPurchase does per call: parse the key every time
+        std::string keyText = publicKeyBase64(key);
+        double reparse = perCallUs((int)valid.size(), [&] {
+            for(const iap::SignedPurchase &p : valid) {
+                iap::PurchaseVerifier fresh;
+                fresh.setPublicKey(keyText);
+                fresh.verify(p.data, p.signature);
+            }
+        });
+        printf("%4d bit: verify %7.1f us, batch %7.1f us/purchase (%u cores), key per call %7.1f us, openssl %7.1f us\n",
+               bits, single, batch, std::thread::hardware_concurrency(), reparse, openssl);
+
+        EVP_PKEY_free(key);
+        EVP_PKEY_free(otherKey);
+    }
+    printf(failures ? "%d checks failed\n" : "all checks passed\n", failures);
+    return failures ? 1 : 0;
+}
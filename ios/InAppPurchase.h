@@ -24,8 +24,12 @@
 @property (nonatomic, strong) RefreshReceiptDelegate* refreshReceiptDelegate;
 
 @property (nonatomic, strong) void(^updatedDownloadsCallback)(SKDownload* download);
+// installs finished hosted content, calls finish (on the main thread) only if it succeeded; copyDownloadToDocuments when unset
+@property (nonatomic, strong) void(^installDownloadCallback)(SKDownload* download, void(^finish)(void));
 //@property (nonatomic, strong) void(^purchaseRestorationCallback)(NSError* err);
 @property (nonatomic, strong) void(^transactionCallback)(SKPaymentTransaction* transaction, NSError* err);
+// every purchased or restored transaction, whether or not a request waits for it
+@property (nonatomic, strong) void(^updatedTransactionCallback)(SKPaymentTransaction* transaction);
 
 - (BOOL) canMakePayments;
 
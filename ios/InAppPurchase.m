@@ -1,4 +1,5 @@
 #import "InAppPurchase.h"
+#include "../../Classes/IapBase64.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -82,35 +83,10 @@ static NSString *jsErrorCodeAsString(NSInteger code) {
 
 @implementation NSData (Base64)
 - (NSString*)convertToBase64 {
-    const uint8_t* input = (const uint8_t*)[self bytes];
-    NSInteger length = [self length];
-
-    static char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/=";
-
-    NSMutableData* data = [NSMutableData dataWithLength:((length + 2) / 3) * 4];
-    uint8_t* output = (uint8_t*)data.mutableBytes;
-
-    NSInteger i;
-    for (i=0; i < length; i += 3) {
-        NSInteger value = 0;
-        NSInteger j;
-        for (j = i; j < (i + 3); j++) {
-            value <<= 8;
-
-            if (j < length) {
-                value |= (0xFF & input[j]);
-            }
-        }
-
-        NSInteger theIndex = (i / 3) * 4;
-        output[theIndex + 0] =                    table[(value >> 18) & 0x3F];
-        output[theIndex + 1] =                    table[(value >> 12) & 0x3F];
-        output[theIndex + 2] = (i + 1) < length ? table[(value >> 6)  & 0x3F] : '=';
-        output[theIndex + 3] = (i + 2) < length ? table[(value >> 0)  & 0x3F] : '=';
-    }
-
-    NSString *ret = [[NSString alloc] initWithData:data encoding:NSASCIIStringEncoding];
-    return ret;
+    // shared native codec, SIMD on device
+    NSMutableData* data = [NSMutableData dataWithLength:((self.length + 2) / 3) * 4];
+    iap_base64_encode((const uint8_t*)self.bytes, self.length, (char*)data.mutableBytes);
+    return [[NSString alloc] initWithData:data encoding:NSASCIIStringEncoding];
 }
 @end
 
@@ -263,9 +239,8 @@ static NSString *jsErrorCodeAsString(NSInteger code) {
 {
     DLog(@"getUnfinishedTransactions");
     NSMutableArray *result = [NSMutableArray new];
-    for(SKPaymentTransaction *transaction in self.unfinishedTransactions) {
-        NSString *transactionIdentifier = transaction.transactionIdentifier;
-        if(transactionIdentifier == nil) transactionIdentifier = transaction.originalTransaction.transactionIdentifier;
+    // keyed by transaction id, enumerating the dictionary yields the ids
+    for(NSString *transactionIdentifier in self.unfinishedTransactions) {
         [result addObject:transactionIdentifier];
     }
     return result;
@@ -505,10 +480,19 @@ static NSString *jsErrorCodeAsString(NSInteger code) {
                 [self.currentDownloads removeObjectForKey:productId];
                 
                 state = @"DownloadStateFinished";
-                [[SKPaymentQueue defaultQueue] finishTransaction:download.transaction];
-                [self transactionFinished:download.transaction];
-                
-                [self copyDownloadToDocuments:download]; // Copy download content to Documnents folder
+
+                // Install before finishing: finishing the transaction deletes the downloaded content
+                void(^finish)(void) = ^{
+                    [[SKPaymentQueue defaultQueue] finishTransaction:transaction];
+                    [self transactionFinished:transaction];
+                };
+                if(_installDownloadCallback) {
+                    // moves the content in place off the main thread, then calls finish on it if that succeeded
+                    _installDownloadCallback(download, finish);
+                } else {
+                    [self copyDownloadToDocuments:download]; // Copy download content to Documnents folder
+                    finish();
+                }
                 
                 break;
             }
@@ -631,6 +615,10 @@ static NSString *jsErrorCodeAsString(NSInteger code) {
        transaction.transactionState == SKPaymentTransactionStateRestored) {
         if(self.transactionCallback) self.transactionCallback(transaction, nil);
     }
+    if(transaction.transactionState == SKPaymentTransactionStatePurchased ||
+       transaction.transactionState == SKPaymentTransactionStateRestored) {
+        if(self.updatedTransactionCallback) self.updatedTransactionCallback(transaction);
+    }
 
     NSArray *downloads = nil;
     SKPaymentTransactionState state = transaction.transactionState;